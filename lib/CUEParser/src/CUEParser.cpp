@@ -69,6 +69,15 @@ const CUETrackInfo *CUEParser::next_track()
         {
             const char *p = read_quoted(m_parse_pos + 5, m_track_info.filename, sizeof(m_track_info.filename));
             m_track_info.file_mode = parse_file_mode(skip_space(p));
+
+            // FLAC files are commonly declared as WAVE in cue sheets
+            size_t namelen = strlen(m_track_info.filename);
+            if (m_track_info.file_mode == CUEFile_WAVE && namelen > 5 &&
+                strncasecmp(m_track_info.filename + namelen - 5, ".flac", 5) == 0)
+            {
+                m_track_info.file_mode = CUEFile_FLAC;
+            }
+
             m_track_info.file_offset = 0;
             m_track_info.track_mode = CUETrack_AUDIO;
             prev_track_start = 0;
@@ -226,6 +235,8 @@ CUEFileMode CUEParser::parse_file_mode(const char *src)
         return CUEFile_WAVE;
     else if (strncasecmp(src, "AIFF", 4) == 0)
         return CUEFile_AIFF;
+    else if (strncasecmp(src, "FLAC", 4) == 0)
+        return CUEFile_FLAC;
     else
         return CUEFile_BINARY; // Default to binary mode
 }
@@ -275,6 +286,11 @@ uint32_t CUEParser::get_sector_length(CUEFileMode filemode, CUETrackMode trackmo
             default:                    return 2048;
         }
     }
+    else if (filemode == CUEFile_FLAC && trackmode == CUETrack_AUDIO)
+    {
+        // Decoded to 16-bit stereo samples, same as audio in binary files
+        return 2352;
+    }
     else
     {
         return 0;
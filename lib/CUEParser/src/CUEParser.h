@@ -32,6 +32,7 @@ enum CUEFileMode
     CUEFile_MP3,
     CUEFile_WAVE,
     CUEFile_AIFF,
+    CUEFile_FLAC,
 };
 
 enum CUETrackMode
@@ -51,6 +52,7 @@ enum CUETrackMode
 struct CUETrackInfo
 {
     // Source file name and file type, and offset to start of track data in bytes.
+    // For FLAC files the offset is in the decoded 16-bit stereo sample stream.
     char filename[CUE_MAX_FILENAME+1];
     CUEFileMode file_mode;
     uint64_t file_offset; // corresponds to track_start below
@@ -59,7 +61,7 @@ struct CUETrackInfo
     int track_number;
     CUETrackMode track_mode;
 
-    // Sector length for this track in bytes, assuming BINARY or MOTOROLA file modes.
+    // Sector length for this track in bytes, assuming BINARY, MOTOROLA or FLAC file modes.
     uint32_t sector_length;
 
     // The CD frames of PREGAP time at the start of this track, or 0 if none are present.
@@ -178,9 +178,62 @@ TRACK 03 MODE1/2352
 }
 
 
+bool test_flac()
+{
+    bool status = true;
+    const char *cue_sheet = R"(
+FILE "Some Album.flac" WAVE
+  TRACK 01 AUDIO
+    INDEX 01 00:00:00
+  TRACK 02 AUDIO
+    INDEX 00 03:10:20
+    INDEX 01 03:12:20
+FILE "Bonus.FLAC" FLAC
+  TRACK 03 AUDIO
+    INDEX 01 00:00:00
+    )";
+
+    CUEParser parser(cue_sheet);
+
+    COMMENT("test_flac()");
+    COMMENT("Test TRACK 01 (FLAC declared as WAVE)");
+    const CUETrackInfo *track = parser.next_track();
+    TEST(track != NULL);
+    if (track)
+    {
+        TEST(strcmp(track->filename, "Some Album.flac") == 0);
+        TEST(track->file_mode == CUEFile_FLAC);
+        TEST(track->file_offset == 0);
+        TEST(track->sector_length == 2352);
+    }
+
+    COMMENT("Test TRACK 02 (offset in decoded samples)");
+    track = parser.next_track();
+    TEST(track != NULL);
+    uint32_t start2 = ((3 * 60) + 10) * 75 + 20;
+    if (track)
+    {
+        TEST(track->file_mode == CUEFile_FLAC);
+        TEST(track->file_offset == 2352 * start2);
+        TEST(track->track_start == start2);
+    }
+
+    COMMENT("Test TRACK 03 (FLAC file type)");
+    track = parser.next_track();
+    TEST(track != NULL);
+    if (track)
+    {
+        TEST(track->file_mode == CUEFile_FLAC);
+        TEST(track->file_offset == 0);
+        TEST(track->sector_length == 2352);
+    }
+
+    return status;
+}
+
 int main()
 {
-    if (test_basics() && test_datatracks())
+    if (test_basics() && test_datatracks() && test_flac())
     {
         return 0;
     }
@@ -0,0 +1,998 @@
+/*
+ * Minimal FLAC decoder for CD audio images on embedded systems.
+ *
+ *  Copyright (c) 2023 Rabbit Hole Computing
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Refer to https://xiph.org/flac/format.html for the stream format.
+
+#include "FLACDecoder.h"
+#include <string.h>
+
+// Longest possible frame header: sync, 7 byte sample number,
+// 16-bit block size, 16-bit sample rate and CRC.
+#define FLAC_MAX_HEADER_LENGTH 16
+
+// CRC-16 with polynomial 0x8005, used for whole frames
+static const uint16_t g_flac_crc16_table[256] = {
+    0x0000, 0x8005, 0x800F, 0x000A, 0x801B, 0x001E, 0x0014, 0x8011,
+    0x8033, 0x0036, 0x003C, 0x8039, 0x0028, 0x802D, 0x8027, 0x0022,
+    0x8063, 0x0066, 0x006C, 0x8069, 0x0078, 0x807D, 0x8077, 0x0072,
+    0x0050, 0x8055, 0x805F, 0x005A, 0x804B, 0x004E, 0x0044, 0x8041,
+    0x80C3, 0x00C6, 0x00CC, 0x80C9, 0x00D8, 0x80DD, 0x80D7, 0x00D2,
+    0x00F0, 0x80F5, 0x80FF, 0x00FA, 0x80EB, 0x00EE, 0x00E4, 0x80E1,
+    0x00A0, 0x80A5, 0x80AF, 0x00AA, 0x80BB, 0x00BE, 0x00B4, 0x80B1,
+    0x8093, 0x0096, 0x009C, 0x8099, 0x0088, 0x808D, 0x8087, 0x0082,
+    0x8183, 0x0186, 0x018C, 0x8189, 0x0198, 0x819D, 0x8197, 0x0192,
+    0x01B0, 0x81B5, 0x81BF, 0x01BA, 0x81AB, 0x01AE, 0x01A4, 0x81A1,
+    0x01E0, 0x81E5, 0x81EF, 0x01EA, 0x81FB, 0x01FE, 0x01F4, 0x81F1,
+    0x81D3, 0x01D6, 0x01DC, 0x81D9, 0x01C8, 0x81CD, 0x81C7, 0x01C2,
+    0x0140, 0x8145, 0x814F, 0x014A, 0x815B, 0x015E, 0x0154, 0x8151,
+    0x8173, 0x0176, 0x017C, 0x8179, 0x0168, 0x816D, 0x8167, 0x0162,
+    0x8123, 0x0126, 0x012C, 0x8129, 0x0138, 0x813D, 0x8137, 0x0132,
+    0x0110, 0x8115, 0x811F, 0x011A, 0x810B, 0x010E, 0x0104, 0x8101,
+    0x8303, 0x0306, 0x030C, 0x8309, 0x0318, 0x831D, 0x8317, 0x0312,
+    0x0330, 0x8335, 0x833F, 0x033A, 0x832B, 0x032E, 0x0324, 0x8321,
+    0x0360, 0x8365, 0x836F, 0x036A, 0x837B, 0x037E, 0x0374, 0x8371,
+    0x8353, 0x0356, 0x035C, 0x8359, 0x0348, 0x834D, 0x8347, 0x0342,
+    0x03C0, 0x83C5, 0x83CF, 0x03CA, 0x83DB, 0x03DE, 0x03D4, 0x83D1,
+    0x83F3, 0x03F6, 0x03FC, 0x83F9, 0x03E8, 0x83ED, 0x83E7, 0x03E2,
+    0x83A3, 0x03A6, 0x03AC, 0x83A9, 0x03B8, 0x83BD, 0x83B7, 0x03B2,
+    0x0390, 0x8395, 0x839F, 0x039A, 0x838B, 0x038E, 0x0384, 0x8381,
+    0x0280, 0x8285, 0x828F, 0x028A, 0x829B, 0x029E, 0x0294, 0x8291,
+    0x82B3, 0x02B6, 0x02BC, 0x82B9, 0x02A8, 0x82AD, 0x82A7, 0x02A2,
+    0x82E3, 0x02E6, 0x02EC, 0x82E9, 0x02F8, 0x82FD, 0x82F7, 0x02F2,
+    0x02D0, 0x82D5, 0x82DF, 0x02DA, 0x82CB, 0x02CE, 0x02C4, 0x82C1,
+    0x8243, 0x0246, 0x024C, 0x8249, 0x0258, 0x825D, 0x8257, 0x0252,
+    0x0270, 0x8275, 0x827F, 0x027A, 0x826B, 0x026E, 0x0264, 0x8261,
+    0x0220, 0x8225, 0x822F, 0x022A, 0x823B, 0x023E, 0x0234, 0x8231,
+    0x8213, 0x0216, 0x021C, 0x8219, 0x0208, 0x820D, 0x8207, 0x0202,
+};
+
+static uint8_t flac_crc8(const uint8_t *data, uint32_t len)
+{
+    // Polynomial 0x07, only used for the short frame headers
+    uint8_t crc = 0;
+    for (uint32_t i = 0; i < len; i++)
+    {
+        crc ^= data[i];
+        for (int j = 0; j < 8; j++)
+        {
+            crc = (crc & 0x80) ? ((crc << 1) ^ 0x07) : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+static uint16_t flac_crc16(const uint8_t *data, uint32_t len)
+{
+    uint16_t crc = 0;
+    for (uint32_t i = 0; i < len; i++)
+    {
+        crc = (crc << 8) ^ g_flac_crc16_table[(crc >> 8) ^ data[i]];
+    }
+    return crc;
+}
+
+static uint32_t flac_ilog2(uint32_t v)
+{
+    uint32_t result = 0;
+    while (v >>= 1) result++;
+    return result;
+}
+
+FLACDecoder::FLACDecoder()
+{
+    m_source = nullptr;
+    m_yield = nullptr;
+    close();
+}
+
+bool FLACDecoder::open(FLACSource *source)
+{
+    close();
+    m_source = source;
+
+    if (!readMetadata())
+    {
+        m_source = nullptr;
+        return false;
+    }
+
+    restartInput(m_audio_start, 0);
+    return true;
+}
+
+void FLACDecoder::close()
+{
+    m_source = nullptr;
+    memset(&m_info, 0, sizeof(m_info));
+    memset(m_seek_index, 0, sizeof(m_seek_index));
+    m_seek_interval = 1;
+    m_audio_start = 0;
+    m_in_offset = 0;
+    m_in_len = 0;
+    m_frame_pos = 0;
+    m_frame_sample = 0;
+    m_frame_samples = 0;
+    m_out_pos = 0;
+    startBits(0);
+}
+
+bool FLACDecoder::readMetadata()
+{
+    uint8_t buf[34];
+    if (!m_source->seek(0) || m_source->read(buf, 4) != 4 || memcmp(buf, "fLaC", 4) != 0)
+    {
+        return false;
+    }
+
+    uint64_t pos = 4;
+    uint64_t seektable_pos = 0;
+    uint32_t seektable_points = 0;
+    bool got_info = false;
+    bool last = false;
+    while (!last)
+    {
+        if (m_source->read(buf, 4) != 4)
+        {
+            return false;
+        }
+
+        last = (buf[0] & 0x80);
+        uint32_t type = buf[0] & 0x7F;
+        uint32_t len = ((uint32_t)buf[1] << 16) | ((uint32_t)buf[2] << 8) | buf[3];
+        pos += 4;
+
+        if (type == 0 && len >= 34)
+        {
+            // STREAMINFO
+            if (m_source->read(buf, 34) != 34)
+            {
+                return false;
+            }
+
+            m_info.min_blocksize = ((uint32_t)buf[0] << 8) | buf[1];
+            m_info.max_blocksize = ((uint32_t)buf[2] << 8) | buf[3];
+            m_info.max_framesize = ((uint32_t)buf[7] << 16) | ((uint32_t)buf[8] << 8) | buf[9];
+            m_info.sample_rate = ((uint32_t)buf[10] << 12) | ((uint32_t)buf[11] << 4) | (buf[12] >> 4);
+            m_info.channels = ((buf[12] >> 1) & 7) + 1;
+            m_info.bits_per_sample = (((buf[12] & 1) << 4) | (buf[13] >> 4)) + 1;
+            m_info.total_samples = ((uint64_t)(buf[13] & 0x0F) << 32)
+                                 | ((uint32_t)buf[14] << 24) | ((uint32_t)buf[15] << 16)
+                                 | ((uint32_t)buf[16] << 8) | buf[17];
+            got_info = true;
+        }
+        else if (type == 3)
+        {
+            // SEEKTABLE, points are processed once start of audio data is known
+            seektable_pos = pos;
+            seektable_points = len / 18;
+        }
+        else if (type == 127)
+        {
+            return false;
+        }
+
+        pos += len;
+        if (!m_source->seek(pos))
+        {
+            return false;
+        }
+    }
+
+    if (!got_info || m_info.channels > 2 || m_info.bits_per_sample != 16 ||
+        m_info.min_blocksize < 16 || m_info.max_blocksize > FLAC_MAX_BLOCKSIZE ||
+        m_info.max_framesize > FLAC_INPUT_BUFFER_SIZE || m_info.total_samples == 0 ||
+        pos > UINT32_MAX)
+    {
+        return false;
+    }
+
+    m_audio_start = pos;
+    m_seek_interval = m_info.total_samples / FLAC_SEEK_INDEX_SIZE + 1;
+
+    if (seektable_points > 0 && m_source->seek(seektable_pos))
+    {
+        for (uint32_t i = 0; i < seektable_points; i++)
+        {
+            if (m_source->read(buf, 18) != 18)
+            {
+                break;
+            }
+
+            uint64_t sample = 0, offset = 0;
+            for (int j = 0; j < 8; j++)
+            {
+                sample = (sample << 8) | buf[j];
+                offset = (offset << 8) | buf[8 + j];
+            }
+
+            if (sample != UINT64_MAX)
+            {
+                // Placeholder points have all bits set
+                addSeekPoint(sample, m_audio_start + offset);
+            }
+        }
+    }
+
+    return true;
+}
+
+void FLACDecoder::restartInput(uint64_t offset, uint64_t sample)
+{
+    m_in_offset = offset;
+    m_in_len = 0;
+    m_frame_pos = 0;
+    m_frame_sample = sample;
+    m_frame_samples = 0;
+    m_out_pos = 0;
+    m_source->seek(offset);
+}
+
+uint32_t FLACDecoder::fill()
+{
+    if (!m_source)
+    {
+        return 0;
+    }
+
+    if (m_frame_pos > 0)
+    {
+        // Discard data that has already been decoded
+        m_in_len -= m_frame_pos;
+        memmove(m_in_buf, m_in_buf + m_frame_pos, m_in_len);
+        m_in_offset += m_frame_pos;
+        m_frame_pos = 0;
+    }
+
+    uint32_t added = 0;
+    while (m_in_len < sizeof(m_in_buf))
+    {
+        uint32_t len = m_source->read(m_in_buf + m_in_len, sizeof(m_in_buf) - m_in_len);
+        if (len == 0)
+        {
+            break;
+        }
+
+        m_in_len += len;
+        added += len;
+    }
+
+    return added;
+}
+
+FLACResult FLACDecoder::read(uint8_t *dst, uint32_t len, uint32_t *bytes_done, bool refill)
+{
+    FLACResult result = m_source ? FLAC_OK : FLAC_ERROR;
+    uint32_t done = 0;
+
+    while (result == FLAC_OK && done + 4 <= len)
+    {
+        if (m_out_pos >= m_frame_samples)
+        {
+            if (position() >= m_info.total_samples)
+            {
+                result = FLAC_END;
+                break;
+            }
+
+            result = decodeFrame();
+            if (result == FLAC_NEED_DATA && refill)
+            {
+                // Running out of data before end of stream means truncated file
+                result = (fill() > 0) ? FLAC_OK : FLAC_ERROR;
+            }
+
+            if (result != FLAC_OK)
+            {
+                break;
+            }
+            continue;
+        }
+
+        uint32_t count = m_frame_samples - m_out_pos;
+        if (count > (len - done) / 4)
+        {
+            count = (len - done) / 4;
+        }
+
+        const int32_t *left = &m_samples[0][m_out_pos];
+        const int32_t *right = &m_samples[m_info.channels - 1][m_out_pos];
+        uint8_t *out = dst + done;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            int32_t l = left[i];
+            int32_t r = right[i];
+            out[0] = (uint8_t)l;
+            out[1] = (uint8_t)(l >> 8);
+            out[2] = (uint8_t)r;
+            out[3] = (uint8_t)(r >> 8);
+            out += 4;
+        }
+
+        m_out_pos += count;
+        done += count * 4;
+    }
+
+    *bytes_done = done;
+    return result;
+}
+
+bool FLACDecoder::seek(uint64_t sample)
+{
+    if (!m_source || sample > m_info.total_samples)
+    {
+        return false;
+    }
+
+    if (sample >= m_frame_sample && sample < m_frame_sample + m_frame_samples)
+    {
+        // Already decoded
+        m_out_pos = sample - m_frame_sample;
+        return true;
+    }
+
+    if (sample == m_info.total_samples)
+    {
+        restartInput(m_source->size(), sample);
+        return true;
+    }
+
+    // Short seeks forward continue decoding from buffered data
+    uint64_t next_sample = m_frame_sample + m_frame_samples;
+    if (sample < next_sample || sample - next_sample > 2 * m_info.max_blocksize)
+    {
+        // Search the closest known frames before and after the target
+        uint64_t lo_sample = 0, lo_offset = m_audio_start;
+        uint64_t hi_sample = m_info.total_samples, hi_offset = m_source->size();
+        for (int i = 0; i < FLAC_SEEK_INDEX_SIZE; i++)
+        {
+            const SeekPoint &p = m_seek_index[i];
+            if (p.offset == 0)
+            {
+                continue;
+            }
+            else if (p.sample <= sample && p.sample > lo_sample)
+            {
+                lo_sample = p.sample;
+                lo_offset = p.offset;
+            }
+            else if (p.sample > sample && p.sample < hi_sample)
+            {
+                hi_sample = p.sample;
+                hi_offset = p.offset;
+            }
+        }
+
+        // Bisect until the target is within a few frames, using linear
+        // interpolation of the bitrate to pick the next location.
+        for (int i = 0; i < 32 && sample - lo_sample > 2 * m_info.max_blocksize; i++)
+        {
+            if (hi_offset - lo_offset < 2)
+            {
+                break;
+            }
+
+            uint64_t estimate = lo_offset + (hi_offset - lo_offset) * (sample - lo_sample) / (hi_sample - lo_sample);
+            if (estimate <= lo_offset) estimate = lo_offset + 1;
+            if (estimate >= hi_offset) estimate = hi_offset - 1;
+
+            uint64_t found_offset, found_sample;
+            if (!findFrame(estimate, hi_offset, &found_offset, &found_sample))
+            {
+                // No frame starts between estimate and hi_offset
+                hi_offset = estimate;
+            }
+            else if (found_sample <= sample)
+            {
+                lo_sample = found_sample;
+                lo_offset = found_offset;
+            }
+            else
+            {
+                hi_sample = found_sample;
+                hi_offset = found_offset;
+            }
+        }
+
+        restartInput(lo_offset, lo_sample);
+    }
+
+    // Decode until the frame that contains target sample
+    while (sample >= m_frame_sample + m_frame_samples)
+    {
+        FLACResult result = decodeFrame();
+        if (result == FLAC_NEED_DATA && fill() > 0)
+        {
+            continue;
+        }
+        else if (result != FLAC_OK)
+        {
+            return false;
+        }
+    }
+
+    if (sample < m_frame_sample)
+    {
+        return false;
+    }
+
+    m_out_pos = sample - m_frame_sample;
+    return true;
+}
+
+bool FLACDecoder::findFrame(uint64_t offset, uint64_t limit, uint64_t *frame_offset, uint64_t *frame_sample)
+{
+    restartInput(offset, 0);
+    fill();
+
+    uint32_t pos = 0;
+    while (m_in_offset + pos < limit)
+    {
+        if (pos + FLAC_MAX_HEADER_LENGTH > m_in_len)
+        {
+            // Keep the possible header start when getting more data
+            m_frame_pos = pos;
+            fill();
+            pos = 0;
+        }
+
+        if (pos + 1 >= m_in_len)
+        {
+            return false;
+        }
+
+        if (m_in_buf[pos] == 0xFF && (m_in_buf[pos + 1] & 0xFE) == 0xF8)
+        {
+            FrameHeader header;
+            if (parseFrameHeader(&m_in_buf[pos], m_in_len - pos, &header) == FLAC_OK &&
+                header.sample < m_info.total_samples)
+            {
+                *frame_offset = m_in_offset + pos;
+                *frame_sample = header.sample;
+                addSeekPoint(header.sample, *frame_offset);
+                return true;
+            }
+        }
+
+        pos++;
+    }
+
+    return false;
+}
+
+FLACResult FLACDecoder::parseFrameHeader(const uint8_t *p, uint32_t avail, FrameHeader *header)
+{
+    if (avail < 5)
+    {
+        return FLAC_NEED_DATA;
+    }
+
+    if (p[0] != 0xFF || (p[1] & 0xFE) != 0xF8 || (p[3] & 1))
+    {
+        return FLAC_ERROR;
+    }
+
+    bool variable_blocksize = (p[1] & 1);
+    uint32_t blocksize_code = p[2] >> 4;
+    uint32_t rate_code = p[2] & 0x0F;
+    uint32_t channel_code = p[3] >> 4;
+    uint32_t size_code = (p[3] >> 1) & 7;
+
+    if (blocksize_code == 0 || rate_code == 15 || channel_code > 10 ||
+        (size_code != 0 && size_code != 4))
+    {
+        // Reserved values or not 16 bits per sample
+        return FLAC_ERROR;
+    }
+
+    header->channel_mode = channel_code;
+    header->channels = (channel_code < 8) ? (channel_code + 1) : 2;
+    if (header->channels != m_info.channels)
+    {
+        return FLAC_ERROR;
+    }
+
+    // Frame or sample number in UTF-8 like coding
+    uint32_t pos = 4;
+    uint8_t first = p[pos++];
+    uint64_t number;
+    int extra;
+    if (!(first & 0x80))              { number = first; extra = 0; }
+    else if ((first & 0xE0) == 0xC0) { number = first & 0x1F; extra = 1; }
+    else if ((first & 0xF0) == 0xE0) { number = first & 0x0F; extra = 2; }
+    else if ((first & 0xF8) == 0xF0) { number = first & 0x07; extra = 3; }
+    else if ((first & 0xFC) == 0xF8) { number = first & 0x03; extra = 4; }
+    else if ((first & 0xFE) == 0xFC) { number = first & 0x01; extra = 5; }
+    else if (first == 0xFE)          { number = 0; extra = 6; }
+    else return FLAC_ERROR;
+
+    uint32_t blocksize_bytes = (blocksize_code == 6) ? 1 : (blocksize_code == 7) ? 2 : 0;
+    uint32_t rate_bytes = (rate_code == 12) ? 1 : (rate_code >= 13) ? 2 : 0;
+    if (avail < pos + extra + blocksize_bytes + rate_bytes + 1)
+    {
+        return FLAC_NEED_DATA;
+    }
+
+    for (int i = 0; i < extra; i++)
+    {
+        uint8_t c = p[pos++];
+        if ((c & 0xC0) != 0x80)
+        {
+            return FLAC_ERROR;
+        }
+        number = (number << 6) | (c & 0x3F);
+    }
+
+    uint32_t blocksize;
+    if (blocksize_code == 1)
+    {
+        blocksize = 192;
+    }
+    else if (blocksize_code <= 5)
+    {
+        blocksize = 576 << (blocksize_code - 2);
+    }
+    else if (blocksize_code == 6)
+    {
+        blocksize = p[pos] + 1;
+    }
+    else if (blocksize_code == 7)
+    {
+        blocksize = (((uint32_t)p[pos] << 8) | p[pos + 1]) + 1;
+    }
+    else
+    {
+        blocksize = 256 << (blocksize_code - 8);
+    }
+    pos += blocksize_bytes + rate_bytes;
+
+    if (flac_crc8(p, pos) != p[pos])
+    {
+        return FLAC_ERROR;
+    }
+
+    if (blocksize > m_info.max_blocksize)
+    {
+        return FLAC_ERROR;
+    }
+
+    header->blocksize = blocksize;
+    header->sample = variable_blocksize ? number : number * m_info.max_blocksize;
+    header->length = pos + 1;
+    return FLAC_OK;
+}
+
+FLACResult FLACDecoder::decodeFrame()
+{
+    // The whole frame must fit in the input buffer. If the buffer
+    // is full and frame is still incomplete, the stream is invalid.
+    FLACResult need_data = (inputFree() > 0) ? FLAC_NEED_DATA : FLAC_ERROR;
+
+    FrameHeader header;
+    FLACResult result = parseFrameHeader(&m_in_buf[m_frame_pos], m_in_len - m_frame_pos, &header);
+    if (result == FLAC_NEED_DATA)
+    {
+        return need_data;
+    }
+    else if (result != FLAC_OK)
+    {
+        return FLAC_ERROR;
+    }
+
+    startBits(m_frame_pos + header.length);
+    for (int ch = 0; ch < header.channels; ch++)
+    {
+        // Side channel has one extra bit
+        uint32_t bps = 16;
+        if ((header.channel_mode == 8 && ch == 1) ||
+            (header.channel_mode == 9 && ch == 0) ||
+            (header.channel_mode == 10 && ch == 1))
+        {
+            bps = 17;
+        }
+
+        bool status = decodeSubframe(m_samples[ch], header.blocksize, bps);
+        if (underflow())
+        {
+            return need_data;
+        }
+        else if (!status)
+        {
+            return FLAC_ERROR;
+        }
+    }
+
+    // Frame ends with byte alignment and CRC-16
+    uint32_t padding = m_bit_count & 7;
+    m_bit_cache <<= padding;
+    m_bit_count -= padding;
+    uint32_t crc_pos = bytePosition();
+    uint32_t crc = getBits(16);
+    if (underflow())
+    {
+        return need_data;
+    }
+
+    if (flac_crc16(&m_in_buf[m_frame_pos], crc_pos - m_frame_pos) != crc)
+    {
+        return FLAC_ERROR;
+    }
+
+    // Restore left and right channels from stereo decorrelation
+    int32_t *ch0 = m_samples[0];
+    int32_t *ch1 = m_samples[1];
+    if (header.channel_mode == 8)
+    {
+        // Left and side
+        for (uint32_t i = 0; i < header.blocksize; i++)
+        {
+            ch1[i] = ch0[i] - ch1[i];
+        }
+    }
+    else if (header.channel_mode == 9)
+    {
+        // Side and right
+        for (uint32_t i = 0; i < header.blocksize; i++)
+        {
+            ch0[i] += ch1[i];
+        }
+    }
+    else if (header.channel_mode == 10)
+    {
+        // Mid and side, mid has lost its lowest bit which equals that of side
+        for (uint32_t i = 0; i < header.blocksize; i++)
+        {
+            int32_t side = ch1[i];
+            int32_t mid = ch0[i] * 2 | (side & 1);
+            ch0[i] = (mid + side) >> 1;
+            ch1[i] = (mid - side) >> 1;
+        }
+    }
+
+    addSeekPoint(header.sample, m_in_offset + m_frame_pos);
+    m_frame_pos = bytePosition();
+    m_frame_sample = header.sample;
+    m_frame_samples = header.blocksize;
+    m_out_pos = 0;
+    return FLAC_OK;
+}
+
+bool FLACDecoder::decodeSubframe(int32_t *dst, uint32_t blocksize, uint32_t bps)
+{
+    uint32_t header = getBits(8);
+    if (header & 0x80)
+    {
+        return false;
+    }
+
+    uint32_t type = (header >> 1) & 0x3F;
+    uint32_t wasted = 0;
+    if (header & 1)
+    {
+        // Samples have been shifted right by this many bits
+        wasted = getUnary() + 1;
+        if (wasted >= bps)
+        {
+            return false;
+        }
+        bps -= wasted;
+    }
+
+    if (type == 0)
+    {
+        // CONSTANT
+        int32_t value = getSigned(bps);
+        for (uint32_t i = 0; i < blocksize; i++)
+        {
+            dst[i] = value;
+        }
+    }
+    else if (type == 1)
+    {
+        // VERBATIM
+        for (uint32_t i = 0; i < blocksize; i++)
+        {
+            dst[i] = getSigned(bps);
+        }
+    }
+    else if (type >= 8 && type <= 12)
+    {
+        // FIXED predictor
+        uint32_t order = type - 8;
+        if (order > blocksize)
+        {
+            return false;
+        }
+
+        for (uint32_t i = 0; i < order; i++)
+        {
+            dst[i] = getSigned(bps);
+        }
+
+        if (!decodeResidual(dst, blocksize, order))
+        {
+            return false;
+        }
+
+        restoreFixed(dst, blocksize, order);
+    }
+    else if (type >= 32)
+    {
+        // LPC predictor
+        uint32_t order = type - 31;
+        if (order > blocksize)
+        {
+            return false;
+        }
+
+        for (uint32_t i = 0; i < order; i++)
+        {
+            dst[i] = getSigned(bps);
+        }
+
+        uint32_t precision = getBits(4) + 1;
+        int32_t shift = getSigned(5);
+        if (precision > 15 || shift < 0)
+        {
+            return false;
+        }
+
+        int32_t coefs[32];
+        for (uint32_t i = 0; i < order; i++)
+        {
+            coefs[i] = getSigned(precision);
+        }
+
+        if (!decodeResidual(dst, blocksize, order))
+        {
+            return false;
+        }
+
+        restoreLPC(dst, blocksize, coefs, order, precision, shift, bps);
+    }
+    else
+    {
+        return false;
+    }
+
+    if (wasted > 0)
+    {
+        for (uint32_t i = 0; i < blocksize; i++)
+        {
+            dst[i] = (int32_t)((uint32_t)dst[i] << wasted);
+        }
+    }
+
+    if (m_yield) m_yield();
+    return true;
+}
+
+bool FLACDecoder::decodeResidual(int32_t *dst, uint32_t blocksize, uint32_t order)
+{
+    uint32_t method = getBits(2);
+    if (method > 1)
+    {
+        return false;
+    }
+
+    // Method 0 has 4-bit Rice parameters, method 1 has 5-bit.
+    // Largest parameter value is an escape code for unencoded samples.
+    uint32_t param_bits = (method == 0) ? 4 : 5;
+    uint32_t escape = (1 << param_bits) - 1;
+    uint32_t partition_order = getBits(4);
+    uint32_t partition_size = blocksize >> partition_order;
+    if ((partition_size << partition_order) != blocksize || partition_size < order)
+    {
+        return false;
+    }
+
+    int32_t *out = dst + order;
+    uint32_t partitions = 1 << partition_order;
+    for (uint32_t p = 0; p < partitions; p++)
+    {
+        uint32_t count = (p == 0) ? (partition_size - order) : partition_size;
+        uint32_t param = getBits(param_bits);
+
+        if (param == escape)
+        {
+            uint32_t bits = getBits(5);
+            for (uint32_t i = 0; i < count; i++)
+            {
+                *out++ = getSigned(bits);
+            }
+        }
+        else
+        {
+            for (uint32_t i = 0; i < count; i++)
+            {
+                uint32_t value = (getUnary() << param) | getBits(param);
+                *out++ = (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+            }
+        }
+
+        if (underflow())
+        {
+            return false;
+        }
+
+        if (m_yield) m_yield();
+    }
+
+    return true;
+}
+
+void FLACDecoder::restoreFixed(int32_t *data, uint32_t blocksize, uint32_t order)
+{
+    switch (order)
+    {
+        case 1:
+            for (uint32_t i = 1; i < blocksize; i++)
+                data[i] += data[i - 1];
+            break;
+
+        case 2:
+            for (uint32_t i = 2; i < blocksize; i++)
+                data[i] += 2 * data[i - 1] - data[i - 2];
+            break;
+
+        case 3:
+            for (uint32_t i = 3; i < blocksize; i++)
+                data[i] += 3 * (data[i - 1] - data[i - 2]) + data[i - 3];
+            break;
+
+        case 4:
+            for (uint32_t i = 4; i < blocksize; i++)
+                data[i] += 4 * (data[i - 1] + data[i - 3]) - 6 * data[i - 2] - data[i - 4];
+            break;
+    }
+}
+
+void FLACDecoder::restoreLPC(int32_t *data, uint32_t blocksize, const int32_t *coefs,
+                             uint32_t order, uint32_t precision, uint32_t shift, uint32_t bps)
+{
+    if (bps + precision + flac_ilog2(order) <= 32)
+    {
+        // Sum fits in 32 bits, which is much faster on Cortex-M0+
+        for (uint32_t i = order; i < blocksize; i++)
+        {
+            const int32_t *history = &data[i - 1];
+            int32_t sum = 0;
+            for (uint32_t j = 0; j < order; j++)
+            {
+                sum += coefs[j] * history[-(int32_t)j];
+            }
+            data[i] += sum >> shift;
+        }
+    }
+    else
+    {
+        for (uint32_t i = order; i < blocksize; i++)
+        {
+            const int32_t *history = &data[i - 1];
+            int64_t sum = 0;
+            for (uint32_t j = 0; j < order; j++)
+            {
+                sum += (int64_t)coefs[j] * history[-(int32_t)j];
+            }
+            data[i] += (int32_t)(sum >> shift);
+        }
+    }
+}
+
+void FLACDecoder::addSeekPoint(uint64_t sample, uint64_t offset)
+{
+    if (sample >= m_info.total_samples || offset > UINT32_MAX)
+    {
+        return;
+    }
+
+    // Keep the first frame of each part of the stream
+    SeekPoint &point = m_seek_index[sample / m_seek_interval];
+    if (point.offset == 0 || sample < point.sample)
+    {
+        point.sample = sample;
+        point.offset = offset;
+    }
+}
+
+int FLACDecoder::seekIndexEntries() const
+{
+    int count = 0;
+    for (int i = 0; i < FLAC_SEEK_INDEX_SIZE; i++)
+    {
+        if (m_seek_index[i].offset != 0) count++;
+    }
+    return count;
+}
+
+void FLACDecoder::startBits(uint32_t pos)
+{
+    m_bit_cache = 0;
+    m_bit_count = 0;
+    m_read_pos = pos;
+    }
+
+void FLACDecoder::refillBits()
+{
+    while (m_bit_count <= 24)
+    {
+        // Past end of data, ones terminate any unary code.
+        // Caller checks underflow() after reading.
+        uint32_t byte = 0xFF;
+        if (m_read_pos < m_in_len)
+        {
+            byte = m_in_buf[m_read_pos];
+        }
+
+        m_read_pos++;
+        m_bit_cache |= byte << (24 - m_bit_count);
+        m_bit_count += 8;
+    }
+}
+
+uint32_t FLACDecoder::getBits(uint32_t count)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+    else if (count > 24)
+    {
+        uint32_t high = getBits(count - 16);
+        return (high << 16) | getBits(16);
+    }
+
+    if (m_bit_count < count)
+    {
+        refillBits();
+    }
+
+    uint32_t result = m_bit_cache >> (32 - count);
+    m_bit_cache <<= count;
+    m_bit_count -= count;
+    return result;
+}
+
+int32_t FLACDecoder::getSigned(uint32_t count)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    uint32_t shift = 32 - count;
+    return (int32_t)(getBits(count) << shift) >> shift;
+}
+
+uint32_t FLACDecoder::getUnary()
+{
+    // Cache bits after the m_bit_count valid ones are always zero
+    uint32_t count = 0;
+    while (m_bit_cache == 0)
+    {
+        count += m_bit_count;
+        m_bit_count = 0;
+        refillBits();
+    }
+
+    uint32_t zeros = __builtin_clz(m_bit_cache);
+    m_bit_cache <<= zeros;
+    m_bit_cache <<= 1;
+    m_bit_count -= zeros + 1;
+    return count + zeros;
+}
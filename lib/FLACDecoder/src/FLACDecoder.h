@@ -0,0 +1,212 @@
+/*
+ * Minimal FLAC decoder for CD audio images on embedded systems.
+ *
+ *  Copyright (c) 2023 Rabbit Hole Computing
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Decodes 16-bit mono or stereo FLAC streams into interleaved 16-bit
+// little-endian stereo samples, the same format that audio tracks have in
+// BIN images. Memory use is fixed: compressed data is buffered in an
+// internal input buffer and one frame is decoded at a time.
+//
+// Reading compressed data from the source and decoding it are separate
+// steps, so that storage access can happen on one processor core while
+// another one does the decoding.
+//
+// Random access is done with a seek index that is initialized from the
+// SEEKTABLE metadata block and extended with the position of every frame
+// that gets decoded or located. Positions not covered by the index are
+// found by bisection, using the frame header sync code and CRC.
+
+#pragma once
+
+#include <stdint.h>
+
+// Largest supported block size, in samples per channel.
+// 4608 is the largest block size of the FLAC streamable subset at 44.1 kHz.
+#ifndef FLAC_MAX_BLOCKSIZE
+#define FLAC_MAX_BLOCKSIZE 4608
+#endif
+
+// Size of compressed data buffer, must hold at least one complete frame.
+// Default fits an uncompressed stereo frame with one 17-bit side channel.
+#ifndef FLAC_INPUT_BUFFER_SIZE
+#define FLAC_INPUT_BUFFER_SIZE (FLAC_MAX_BLOCKSIZE * 33 / 8 + 64)
+#endif
+
+// Number of entries in seek index. The stream is divided into this many
+// equal parts, and the first frame seen in each part is remembered.
+#ifndef FLAC_SEEK_INDEX_SIZE
+#define FLAC_SEEK_INDEX_SIZE 256
+#endif
+
+// Compressed data source
+class FLACSource
+{
+public:
+    virtual ~FLACSource() {}
+
+    // Read data from current position, returns number of bytes read.
+    virtual uint32_t read(uint8_t *dst, uint32_t len) = 0;
+
+    // Set position for next read, in bytes from start of file
+    virtual bool seek(uint64_t pos) = 0;
+
+    // Total size of file in bytes
+    virtual uint64_t size() = 0;
+};
+
+enum FLACResult
+{
+    FLAC_OK = 0,
+    FLAC_NEED_DATA, // Input buffer must be refilled with fill()
+    FLAC_END,       // End of stream reached
+    FLAC_ERROR      // Corrupted or unsupported data
+};
+
+struct FLACStreamInfo
+{
+    uint32_t min_blocksize;
+    uint32_t max_blocksize;
+    uint32_t max_framesize; // 0 if unknown
+    uint32_t sample_rate;
+    uint8_t channels;
+    uint8_t bits_per_sample;
+    uint64_t total_samples;
+};
+
+class FLACDecoder
+{
+public:
+    FLACDecoder();
+
+    // Read metadata from the source and prepare decoding from first sample.
+    // Returns false if the stream is invalid or has unsupported format.
+    bool open(FLACSource *source);
+
+    // Stop using the source
+    void close();
+
+    bool isOpen() const { return m_source != nullptr; }
+    FLACSource *source() const { return m_source; }
+    const FLACStreamInfo &streamInfo() const { return m_info; }
+
+    // Length of the decoded stream in bytes, 4 bytes per sample
+    uint64_t decodedSize() const { return m_info.total_samples * 4; }
+
+    // Sample number that next call to read() returns
+    uint64_t position() const { return m_frame_sample + m_out_pos; }
+
+    // Move decoding position to the given sample number.
+    // This reads from the source and may decode several frames.
+    bool seek(uint64_t sample);
+
+    // Read more compressed data from source into the input buffer.
+    // Returns number of bytes added.
+    uint32_t fill();
+
+    // Number of bytes that next fill() can add to the input buffer
+    uint32_t inputFree() const { return sizeof(m_in_buf) - m_in_len + m_frame_pos; }
+
+    // Decode samples to dst as 16-bit little-endian stereo, len must be a multiple of 4.
+    // If refill is true, the input buffer is filled from source as needed.
+    // Otherwise decoding stops with FLAC_NEED_DATA when input buffer runs out,
+    // and can be continued with another call after fill().
+    // Number of bytes written to dst is stored to bytes_done.
+    FLACResult read(uint8_t *dst, uint32_t len, uint32_t *bytes_done, bool refill = true);
+
+    // Set a function that is called periodically during decoding.
+    // This allows servicing time critical tasks while a frame is decoded.
+    void setYieldCallback(void (*callback)()) { m_yield = callback; }
+
+    // Number of seek index entries that are known
+    int seekIndexEntries() const;
+
+protected:
+    struct FrameHeader
+    {
+        uint64_t sample;        // Number of first sample in frame
+        uint32_t blocksize;     // Samples per channel
+        uint8_t channel_mode;   // 0-7 independent, 8 left/side, 9 right/side, 10 mid/side
+        uint8_t channels;
+        uint8_t length;         // Length of header in bytes
+    };
+
+    struct SeekPoint
+    {
+        uint32_t sample;
+        uint32_t offset;        // 0 if unknown
+    };
+
+    FLACSource *m_source;
+    FLACStreamInfo m_info;
+    uint32_t m_audio_start;     // Offset of first frame in file
+    void (*m_yield)();
+
+    // Input buffer, holds file data starting at m_in_offset
+    uint8_t m_in_buf[FLAC_INPUT_BUFFER_SIZE];
+    uint64_t m_in_offset;
+    uint32_t m_in_len;          // Valid bytes in buffer
+    uint32_t m_frame_pos;       // Start of next frame in buffer
+
+    // Bit reader state
+    uint32_t m_bit_cache;       // Left-aligned bits
+    uint32_t m_bit_count;       // Valid bits in cache
+    uint32_t m_read_pos;        // Next byte to load to cache
+
+    // Decoded frame
+    int32_t m_samples[2][FLAC_MAX_BLOCKSIZE];
+    uint64_t m_frame_sample;    // Number of first sample in frame
+    uint32_t m_frame_samples;   // Valid samples in frame
+    uint32_t m_out_pos;         // Next sample to output
+
+    SeekPoint m_seek_index[FLAC_SEEK_INDEX_SIZE];
+    uint32_t m_seek_interval;
+
+    // Parse metadata blocks from start of file
+    bool readMetadata();
+
+    // Drop buffered data and continue reading from the given file offset
+    void restartInput(uint64_t offset, uint64_t sample);
+
+    // Parse frame header at p, avail is the number of bytes available
+    FLACResult parseFrameHeader(const uint8_t *p, uint32_t avail, FrameHeader *header);
+
+    // Find the first frame header at or after the given offset, below limit.
+    bool findFrame(uint64_t offset, uint64_t limit, uint64_t *frame_offset, uint64_t *frame_sample);
+
+    // Decode frame at m_frame_pos to m_samples
+    FLACResult decodeFrame();
+    bool decodeSubframe(int32_t *dst, uint32_t blocksize, uint32_t bps);
+    bool decodeResidual(int32_t *dst, uint32_t blocksize, uint32_t order);
+    void restoreFixed(int32_t *data, uint32_t blocksize, uint32_t order);
+    void restoreLPC(int32_t *data, uint32_t blocksize, const int32_t *coefs,
+                    uint32_t order, uint32_t precision, uint32_t shift, uint32_t bps);
+
+    // Record frame position to seek index
+    void addSeekPoint(uint64_t sample, uint64_t offset);
+
+    // Bit reader
+    void startBits(uint32_t pos);
+    void refillBits();
+    uint32_t getBits(uint32_t count);
+    int32_t getSigned(uint32_t count);
+    uint32_t getUnary();
+    uint32_t bytePosition() const { return m_read_pos - m_bit_count / 8; }
+
+    // True if more bits have been read than there are in input buffer
+    bool underflow() const { return m_read_pos * 8 - m_bit_count > m_in_len * 8; }
+};
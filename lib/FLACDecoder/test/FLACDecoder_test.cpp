@@ -0,0 +1,669 @@
+#include "FLACDecoder.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <vector>
+
+/* Unit test helpers */
+#define COMMENT(x) printf("\n----" x "----\n");
+#define TEST(x) \
+    if (!(x)) { \
+        fprintf(stderr, "\033[31;1mFAILED:\033[22;39m %s:%d %s\n", __FILE__, __LINE__, #x); \
+        status = false; \
+    } else { \
+        printf("\033[32;1mOK:\033[22;39m %s\n", #x); \
+    }
+
+/* Reference encoder.
+ * Produces valid FLAC streams that use every subframe type and channel mode
+ * the decoder supports. Compression ratio does not matter here, only
+ * coverage of the format features.
+ */
+
+class BitWriter
+{
+public:
+    std::vector<uint8_t> data;
+
+    BitWriter(): m_bits(0), m_count(0) {}
+
+    void put(uint32_t value, int bits)
+    {
+        for (int i = bits - 1; i >= 0; i--)
+        {
+            m_bits = (m_bits << 1) | ((value >> i) & 1);
+            if (++m_count == 8)
+            {
+                data.push_back(m_bits);
+                m_bits = 0;
+                m_count = 0;
+            }
+        }
+    }
+
+    void putSigned(int32_t value, int bits) { put((uint32_t)value & ((bits == 32) ? 0xFFFFFFFF : ((1u << bits) - 1)), bits); }
+    void putUnary(uint32_t zeros) { for (uint32_t i = 0; i < zeros; i++) put(0, 1); put(1, 1); }
+    void align() { while (m_count != 0) put(0, 1); }
+    size_t bitCount() const { return data.size() * 8 + m_count; }
+
+    void append(const BitWriter &other)
+    {
+        for (size_t i = 0; i < other.data.size(); i++) put(other.data[i], 8);
+        put(other.m_bits, other.m_count);
+    }
+
+private:
+    uint8_t m_bits;
+    int m_count;
+};
+
+static uint8_t ref_crc8(const uint8_t *data, size_t len)
+{
+    uint8_t crc = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        crc ^= data[i];
+        for (int j = 0; j < 8; j++) crc = (crc & 0x80) ? ((crc << 1) ^ 0x07) : (crc << 1);
+    }
+    return crc;
+}
+
+static uint16_t ref_crc16(const uint8_t *data, size_t len)
+{
+    uint16_t crc = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int j = 0; j < 8; j++) crc = (crc & 0x8000) ? ((crc << 1) ^ 0x8005) : (crc << 1);
+    }
+    return crc;
+}
+
+enum SubframeType { SUB_AUTO, SUB_VERBATIM, SUB_FIXED, SUB_LPC };
+
+struct SubframePlan
+{
+    SubframeType type;
+    int order;
+    int precision;
+    int shift;
+    int method;          // Residual coding method 0 or 1
+    int partition_order;
+    bool escape;         // Store second partition unencoded
+};
+
+static void writeResidual(BitWriter &bw, const int32_t *residual, int blocksize, int order, const SubframePlan &plan)
+{
+    int porder = plan.partition_order;
+    while (porder > 0 && ((blocksize >> porder) << porder != blocksize || (blocksize >> porder) < order)) porder--;
+
+    int param_bits = plan.method ? 5 : 4;
+    int escape = (1 << param_bits) - 1;
+    bw.put(plan.method, 2);
+    bw.put(porder, 4);
+
+    int psize = blocksize >> porder;
+    int pos = order;
+    for (int p = 0; p < (1 << porder); p++)
+    {
+        int count = (p == 0) ? psize - order : psize;
+        const int32_t *r = residual + pos;
+        pos += count;
+
+        // Choose parameter with smallest size
+        int best_k = -1;
+        uint64_t best_bits = 0;
+        for (int k = 0; k < escape; k++)
+        {
+            uint64_t bits = 0;
+            for (int i = 0; i < count; i++)
+            {
+                uint32_t u = ((uint32_t)r[i] << 1) ^ (uint32_t)(r[i] >> 31);
+                bits += (u >> k) + 1 + k;
+            }
+            if (best_k < 0 || bits < best_bits) { best_k = k; best_bits = bits; }
+        }
+
+        if (plan.escape && p == 1)
+        {
+            int bits = 0;
+            for (int i = 0; i < count; i++)
+            {
+                while (bits < 31 && (r[i] < -(1 << (bits - 1 < 0 ? 0 : bits - 1)) || r[i] >= (bits ? (1 << (bits - 1)) : 1) || (bits == 0 && r[i] != 0))) bits++;
+            }
+            bw.put(escape, param_bits);
+            bw.put(bits, 5);
+            for (int i = 0; i < count; i++) bw.putSigned(r[i], bits);
+        }
+        else
+        {
+            bw.put(best_k, param_bits);
+            for (int i = 0; i < count; i++)
+            {
+                uint32_t u = ((uint32_t)r[i] << 1) ^ (uint32_t)(r[i] >> 31);
+                bw.putUnary(u >> best_k);
+                if (best_k) bw.put(u & ((1u << best_k) - 1), best_k);
+            }
+        }
+    }
+}
+
+static void writeSubframe(BitWriter &out, const int32_t *input, int blocksize, int bps, SubframePlan plan)
+{
+    BitWriter bw;
+    std::vector<int32_t> x(input, input + blocksize);
+
+    bool constant = true;
+    for (int i = 1; i < blocksize; i++) if (x[i] != x[0]) constant = false;
+
+    int wasted = 0;
+    if (!constant)
+    {
+        int32_t all = 0;
+        for (int i = 0; i < blocksize; i++) all |= x[i];
+        while (!(all & 1)) { all >>= 1; wasted++; }
+        for (int i = 0; i < blocksize; i++) x[i] >>= wasted;
+        bps -= wasted;
+    }
+
+    int type_code;
+    if (constant) type_code = 0;
+    else if (plan.type == SUB_VERBATIM) type_code = 1;
+    else if (plan.type == SUB_LPC) type_code = 31 + plan.order;
+    else type_code = 8 + plan.order;
+
+    bw.put(0, 1);
+    bw.put(type_code, 6);
+    if (wasted) { bw.put(1, 1); bw.putUnary(wasted - 1); }
+    else bw.put(0, 1);
+
+    if (type_code == 0)
+    {
+        bw.putSigned(x[0], bps);
+        out.append(bw);
+        return;
+    }
+    else if (type_code == 1)
+    {
+        for (int i = 0; i < blocksize; i++) bw.putSigned(x[i], bps);
+        out.append(bw);
+        return;
+    }
+
+    int order = plan.order;
+    std::vector<int32_t> residual(blocksize);
+    for (int i = 0; i < order; i++) bw.putSigned(x[i], bps);
+
+    if (plan.type == SUB_LPC)
+    {
+        // Predict from previous sample with small arbitrary corrections,
+        // which keeps the residual small enough for Rice coding
+        int32_t coefs[32];
+        for (int j = 0; j < order; j++)
+        {
+            coefs[j] = (j * 7919 + order * 31) % 17 - 8;
+        }
+        coefs[0] = 1 << plan.shift;
+        if (order == 2)
+        {
+            coefs[0] = 2 << plan.shift;
+            coefs[1] = -(1 << plan.shift);
+        }
+
+        bw.put(plan.precision - 1, 4);
+        bw.putSigned(plan.shift, 5);
+        for (int j = 0; j < order; j++) bw.putSigned(coefs[j], plan.precision);
+
+        for (int i = order; i < blocksize; i++)
+        {
+            int64_t sum = 0;
+            for (int j = 0; j < order; j++) sum += (int64_t)coefs[j] * x[i - 1 - j];
+            residual[i] = x[i] - (int32_t)(sum >> plan.shift);
+        }
+    }
+    else
+    {
+        for (int i = order; i < blocksize; i++)
+        {
+            int64_t pred = 0;
+            if (order == 1) pred = x[i - 1];
+            if (order == 2) pred = 2 * x[i - 1] - x[i - 2];
+            if (order == 3) pred = 3 * x[i - 1] - 3 * x[i - 2] + x[i - 3];
+            if (order == 4) pred = 4 * x[i - 1] - 6 * x[i - 2] + 4 * x[i - 3] - x[i - 4];
+            residual[i] = x[i] - (int32_t)pred;
+        }
+    }
+
+    writeResidual(bw, residual.data(), blocksize, order, plan);
+
+    if (bw.bitCount() > (size_t)blocksize * (bps + wasted))
+    {
+        // Fall back to verbatim like real encoders, keeps frames within size limit
+        plan.type = SUB_VERBATIM;
+        writeSubframe(out, input, blocksize, bps + wasted, plan);
+        return;
+    }
+
+    out.append(bw);
+}
+
+static void putUTF8(BitWriter &bw, uint64_t value)
+{
+    if (value < 0x80) { bw.put(value, 8); return; }
+    int extra = 1;
+    while (extra < 6 && value >= (1ull << (6 * extra + 6 - extra))) extra++;
+    bw.put(((0xFF00 >> (extra + 1)) & 0xFF) | (uint32_t)(value >> (6 * extra)), 8);
+    for (int i = extra - 1; i >= 0; i--) bw.put(0x80 | ((value >> (6 * i)) & 0x3F), 8);
+}
+
+struct EncoderOptions
+{
+    int channels;
+    bool variable_blocksize;
+    bool seektable;
+};
+
+// Block size pattern for variable block size streams
+static const int g_variable_sizes[] = {1152, 4608, 192, 4096, 577, 2304, 16, 3000};
+
+static std::vector<uint8_t> encodeFLAC(const std::vector<int16_t> &pcm, const EncoderOptions &opt)
+{
+    static const SubframePlan plans[] = {
+        {SUB_FIXED, 2, 0, 0, 0, 0, false},
+        {SUB_FIXED, 1, 0, 0, 0, 2, false},
+        {SUB_LPC,   2, 12, 9, 0, 1, false},
+        {SUB_LPC,   8, 12, 10, 0, 4, false},
+        {SUB_VERBATIM, 0, 0, 0, 0, 0, false},
+        {SUB_FIXED, 3, 0, 0, 1, 3, false},
+        {SUB_LPC,   32, 15, 13, 1, 2, false},
+        {SUB_FIXED, 4, 0, 0, 0, 3, true},
+        {SUB_FIXED, 0, 0, 0, 1, 5, true},
+    };
+    static const int stereo_modes[] = {1, 8, 9, 10};
+
+    uint64_t total = pcm.size() / opt.channels;
+    std::vector<uint8_t> frames;
+    std::vector<std::pair<uint64_t, uint64_t> > seekpoints;
+    uint32_t max_framesize = 0;
+    uint32_t min_blocksize = 65535, max_blocksize = 0;
+
+    uint64_t sample = 0;
+    for (int frame = 0; sample < total; frame++)
+    {
+        int blocksize = opt.variable_blocksize ? g_variable_sizes[frame % 8] : 4608;
+        if (sample + blocksize > total) blocksize = total - sample;
+        if (blocksize > (int)max_blocksize) max_blocksize = blocksize;
+        if (blocksize < (int)min_blocksize && sample + blocksize < total) min_blocksize = blocksize;
+        if (frame % 3 == 0) seekpoints.push_back(std::make_pair(sample, (uint64_t)frames.size()));
+
+        const SubframePlan &plan = plans[frame % 9];
+        int mode = (opt.channels == 1) ? 0 : stereo_modes[frame % 4];
+
+        // Channel data after decorrelation
+        std::vector<int32_t> ch[2];
+        ch[0].resize(blocksize);
+        ch[1].resize(blocksize);
+        for (int i = 0; i < blocksize; i++)
+        {
+            int32_t l = pcm[(sample + i) * opt.channels];
+            int32_t r = pcm[(sample + i) * opt.channels + opt.channels - 1];
+            if (mode <= 1) { ch[0][i] = l; ch[1][i] = r; }
+            if (mode == 8) { ch[0][i] = l; ch[1][i] = l - r; }
+            if (mode == 9) { ch[0][i] = l - r; ch[1][i] = r; }
+            if (mode == 10) { ch[0][i] = (l + r) >> 1; ch[1][i] = l - r; }
+        }
+
+        BitWriter bw;
+        bw.put(0x3FFE, 14);
+        bw.put(0, 1);
+        bw.put(opt.variable_blocksize, 1);
+        int bs_code = (blocksize == 4608) ? 5 : (blocksize == 4096) ? 12 : (blocksize == 192) ? 1 : (blocksize <= 256) ? 6 : 7;
+        bw.put(bs_code, 4);
+        bw.put(9, 4); // 44.1 kHz
+        bw.put(mode, 4);
+        bw.put(4, 3); // 16 bits
+        bw.put(0, 1);
+        putUTF8(bw, opt.variable_blocksize ? sample : frame);
+        if (bs_code == 6) bw.put(blocksize - 1, 8);
+        if (bs_code == 7) bw.put(blocksize - 1, 16);
+        bw.put(ref_crc8(bw.data.data(), bw.data.size()), 8);
+
+        for (int c = 0; c < opt.channels; c++)
+        {
+            bool side = (mode == 8 && c == 1) || (mode == 9 && c == 0) || (mode == 10 && c == 1);
+            writeSubframe(bw, ch[c].data(), blocksize, side ? 17 : 16, plan);
+        }
+
+        bw.align();
+        bw.put(ref_crc16(bw.data.data(), bw.data.size()), 16);
+
+        if (bw.data.size() > max_framesize) max_framesize = bw.data.size();
+        frames.insert(frames.end(), bw.data.begin(), bw.data.end());
+        sample += blocksize;
+    }
+    if (min_blocksize > max_blocksize) min_blocksize = max_blocksize;
+    if (!opt.variable_blocksize) min_blocksize = max_blocksize = 4608;
+
+    BitWriter meta;
+    meta.put('f', 8); meta.put('L', 8); meta.put('a', 8); meta.put('C', 8);
+
+    meta.put(0, 1); meta.put(0, 7); meta.put(34, 24);
+    meta.put(min_blocksize, 16);
+    meta.put(max_blocksize, 16);
+    meta.put(0, 24);
+    meta.put(max_framesize, 24);
+    meta.put(44100, 20);
+    meta.put(opt.channels - 1, 3);
+    meta.put(15, 5);
+    meta.put((uint32_t)(total >> 32), 4);
+    meta.put((uint32_t)total, 32);
+    for (int i = 0; i < 16; i++) meta.put(0, 8); // MD5 not checked
+
+    if (opt.seektable)
+    {
+        int count = seekpoints.size() + 1;
+        meta.put(0, 1); meta.put(3, 7); meta.put(count * 18, 24);
+        for (size_t i = 0; i < seekpoints.size(); i++)
+        {
+            meta.put(0, 32); meta.put((uint32_t)seekpoints[i].first, 32);
+            meta.put(0, 32); meta.put((uint32_t)seekpoints[i].second, 32);
+            meta.put(4608, 16);
+        }
+        // Placeholder point
+        for (int i = 0; i < 16; i++) meta.put(0xFF, 8);
+        meta.put(0, 16);
+    }
+
+    // Padding block
+    meta.put(1, 1); meta.put(1, 7); meta.put(100, 24);
+    for (int i = 0; i < 100; i++) meta.put(0, 8);
+
+    std::vector<uint8_t> result = meta.data;
+    result.insert(result.end(), frames.begin(), frames.end());
+    return result;
+}
+
+/* Test signal with sections that exercise different encodings */
+static std::vector<int16_t> makeSignal(int channels, int samples)
+{
+    std::vector<int16_t> pcm(samples * channels);
+    uint32_t seed = 12345;
+    for (int i = 0; i < samples; i++)
+    {
+        int section = (i / 10000) % 5;
+        for (int c = 0; c < channels; c++)
+        {
+            seed = seed * 1103515245 + 12345;
+            int32_t noise = (int32_t)((seed >> 16) & 0x7FFF) - 0x4000;
+            int32_t v;
+            int32_t tri = (i * (c + 3) * 37) % 60000 - 30000;
+            if (section == 0) v = tri + noise / 64;          // Smooth signal
+            else if (section == 1) v = 0;                   // Digital silence
+            else if (section == 2) v = noise * 2;           // Full scale noise
+            else if (section == 3) v = (tri / 2) & ~7;      // Low bits unused
+            else v = (c == 0) ? 32767 : -32768;             // Clipped extremes
+            if (v > 32767) v = 32767;
+            if (v < -32768) v = -32768;
+            pcm[i * channels + c] = v;
+        }
+    }
+    return pcm;
+}
+
+// Reference output: 16-bit little endian stereo
+static std::vector<uint8_t> toStereoBytes(const std::vector<int16_t> &pcm, int channels)
+{
+    std::vector<uint8_t> result;
+    for (size_t i = 0; i < pcm.size(); i += channels)
+    {
+        int16_t l = pcm[i], r = pcm[i + channels - 1];
+        result.push_back(l & 0xFF); result.push_back((l >> 8) & 0xFF);
+        result.push_back(r & 0xFF); result.push_back((r >> 8) & 0xFF);
+    }
+    return result;
+}
+
+class MemorySource: public FLACSource
+{
+public:
+    MemorySource(const std::vector<uint8_t> &data, uint32_t max_read = 0xFFFFFFFF):
+        m_data(data), m_pos(0), m_max_read(max_read), seeks(0) {}
+
+    uint32_t read(uint8_t *dst, uint32_t len)
+    {
+        if (len > m_max_read) len = m_max_read;
+        if (m_pos >= m_data.size()) return 0;
+        if (len > m_data.size() - m_pos) len = m_data.size() - m_pos;
+        memcpy(dst, &m_data[m_pos], len);
+        m_pos += len;
+        return len;
+    }
+
+    bool seek(uint64_t pos) { seeks++; m_pos = pos; return true; }
+    uint64_t size() { return m_data.size(); }
+
+    const std::vector<uint8_t> &m_data;
+    uint64_t m_pos;
+    uint32_t m_max_read;
+    int seeks;
+};
+
+static FLACDecoder g_decoder;
+static int g_yield_count;
+static void countYield() { g_yield_count++; }
+
+#define NUM_SAMPLES 100000
+#define SECTOR 2352
+
+bool test_decode()
+{
+    bool status = true;
+    COMMENT("test_decode()");
+
+    for (int variant = 0; variant < 3; variant++)
+    {
+        EncoderOptions opt = {2, variant == 1, variant == 0};
+        if (variant == 2) opt.channels = 1;
+        printf("Stream variant %d: %d channels, %s block size, %s seek table\n", variant,
+               opt.channels, opt.variable_blocksize ? "variable" : "fixed", opt.seektable ? "with" : "no");
+
+        std::vector<int16_t> pcm = makeSignal(opt.channels, NUM_SAMPLES);
+        std::vector<uint8_t> flac = encodeFLAC(pcm, opt);
+        std::vector<uint8_t> ref = toStereoBytes(pcm, opt.channels);
+        MemorySource source(flac);
+
+        TEST(g_decoder.open(&source));
+        TEST(g_decoder.streamInfo().total_samples == NUM_SAMPLES);
+        TEST(g_decoder.streamInfo().sample_rate == 44100);
+        TEST(g_decoder.decodedSize() == ref.size());
+
+        // Read in CD sector sized pieces, which do not align with frames
+        std::vector<uint8_t> out(ref.size() + SECTOR);
+        uint32_t total = 0;
+        FLACResult result = FLAC_OK;
+        g_yield_count = 0;
+        g_decoder.setYieldCallback(countYield);
+        while (result == FLAC_OK)
+        {
+            uint32_t done = 0;
+            result = g_decoder.read(&out[total], SECTOR, &done);
+            total += done;
+        }
+        g_decoder.setYieldCallback(nullptr);
+
+        TEST(result == FLAC_END);
+        TEST(total == ref.size());
+        TEST(memcmp(out.data(), ref.data(), ref.size()) == 0);
+        TEST(g_decoder.position() == NUM_SAMPLES);
+        TEST(g_yield_count > 0);
+        TEST(g_decoder.seekIndexEntries() > 0);
+    }
+
+    return status;
+}
+
+bool test_seek()
+{
+    bool status = true;
+    COMMENT("test_seek()");
+
+    for (int variant = 0; variant < 2; variant++)
+    {
+        EncoderOptions opt = {2, variant == 1, false};
+        std::vector<int16_t> pcm = makeSignal(2, NUM_SAMPLES);
+        std::vector<uint8_t> flac = encodeFLAC(pcm, opt);
+        std::vector<uint8_t> ref = toStereoBytes(pcm, 2);
+        MemorySource source(flac);
+        TEST(g_decoder.open(&source));
+        TEST(g_decoder.seekIndexEntries() == 0);
+
+        COMMENT("Random access without seek table");
+        uint32_t seed = 1;
+        int failures = 0;
+        for (int i = 0; i < 200; i++)
+        {
+            seed = seed * 1103515245 + 12345;
+            uint32_t target = (seed >> 8) % (NUM_SAMPLES - 1000);
+            if (i == 0) target = 0;
+            if (i == 1) target = NUM_SAMPLES - 588;
+
+            uint8_t buf[SECTOR];
+            uint32_t done = 0;
+            if (!g_decoder.seek(target) || g_decoder.position() != target) { failures++; continue; }
+            g_decoder.read(buf, SECTOR, &done);
+            uint32_t expect = (NUM_SAMPLES - target) * 4;
+            if (expect > SECTOR) expect = SECTOR;
+            if (done != expect || memcmp(buf, &ref[target * 4], done) != 0) failures++;
+        }
+        TEST(failures == 0);
+        TEST(g_decoder.seekIndexEntries() > 10);
+
+        COMMENT("Seek to end of stream");
+        uint32_t done = 1;
+        uint8_t buf[SECTOR];
+        TEST(g_decoder.seek(NUM_SAMPLES));
+        TEST(g_decoder.read(buf, SECTOR, &done) == FLAC_END && done == 0);
+        TEST(!g_decoder.seek(NUM_SAMPLES + 1));
+
+        COMMENT("Short seek forward continues from buffered data");
+        TEST(g_decoder.seek(5000));
+        int seeks = source.seeks;
+        TEST(g_decoder.seek(6000));
+        TEST(g_decoder.read(buf, SECTOR, &done) == FLAC_OK && memcmp(buf, &ref[6000 * 4], SECTOR) == 0);
+        TEST(source.seeks == seeks);
+    }
+
+    return status;
+}
+
+bool test_separate_fill()
+{
+    bool status = true;
+    COMMENT("test_separate_fill()");
+
+    EncoderOptions opt = {2, false, true};
+    std::vector<int16_t> pcm = makeSignal(2, NUM_SAMPLES);
+    std::vector<uint8_t> flac = encodeFLAC(pcm, opt);
+    std::vector<uint8_t> ref = toStereoBytes(pcm, 2);
+
+    // Source gives small pieces, like reads from SD card
+    MemorySource source(flac, 1000);
+    TEST(g_decoder.open(&source));
+
+    std::vector<uint8_t> out(ref.size());
+    uint32_t total = 0;
+    int need_data = 0;
+    FLACResult result = FLAC_OK;
+    while (total < out.size())
+    {
+        uint32_t done = 0;
+        uint32_t len = out.size() - total;
+        if (len > 4096) len = 4096;
+        result = g_decoder.read(&out[total], len, &done, false);
+        total += done;
+
+        if (result == FLAC_NEED_DATA)
+        {
+            need_data++;
+            if (g_decoder.fill() == 0) break;
+        }
+        else if (result != FLAC_OK)
+        {
+            break;
+        }
+    }
+
+    TEST(need_data > 0);
+    TEST(total == ref.size());
+    TEST(memcmp(out.data(), ref.data(), ref.size()) == 0);
+
+    return status;
+}
+
+bool test_errors()
+{
+    bool status = true;
+    COMMENT("test_errors()");
+
+    EncoderOptions opt = {2, false, false};
+    std::vector<int16_t> pcm = makeSignal(2, 20000);
+    std::vector<uint8_t> flac = encodeFLAC(pcm, opt);
+
+    COMMENT("Not a FLAC file");
+    std::vector<uint8_t> bad = flac;
+    bad[0] = 'X';
+    MemorySource badsource(bad);
+    TEST(!g_decoder.open(&badsource));
+    TEST(!g_decoder.isOpen());
+
+    COMMENT("24-bit samples are not supported");
+    bad = flac;
+    bad[8 + 13] = (bad[8 + 13] & 0x0F) | (23 << 4);
+    TEST(!g_decoder.open(&badsource));
+
+    COMMENT("Corrupted frame data is detected by CRC");
+    bad = flac;
+    bad[bad.size() / 2] ^= 0x10;
+    TEST(g_decoder.open(&badsource));
+    FLACResult result = FLAC_OK;
+    while (result == FLAC_OK)
+    {
+        uint8_t buf[SECTOR];
+        uint32_t done;
+        result = g_decoder.read(buf, SECTOR, &done);
+    }
+    TEST(result == FLAC_ERROR);
+
+    COMMENT("Truncated file");
+    bad = flac;
+    bad.resize(bad.size() - 100);
+    TEST(g_decoder.open(&badsource));
+    result = FLAC_OK;
+    while (result == FLAC_OK)
+    {
+        uint8_t buf[SECTOR];
+        uint32_t done;
+        result = g_decoder.read(buf, SECTOR, &done);
+    }
+    TEST(result == FLAC_ERROR);
+
+    return status;
+}
+
+int main()
+{
+    bool status = test_decode();
+    status &= test_seek();
+    status &= test_separate_fill();
+    status &= test_errors();
+
+    if (status)
+    {
+        return 0;
+    }
+    else
+    {
+        printf("Some tests failed\n");
+        return 1;
+    }
+}
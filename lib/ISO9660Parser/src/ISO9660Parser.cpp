@@ -0,0 +1,297 @@
+/*
+ * ISO9660 filesystem structure tracker for CD-ROM read-ahead.
+ *
+ *  Copyright (c) 2023 Rabbit Hole Computing
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Refer to ECMA-119 for the ISO9660 structures.
+//
+// Volume descriptors start at sector 16, one per sector:
+//   0      type: 1 = primary, 2 = supplementary, 255 = set terminator
+//   1-5    "CD001"
+//   6      version, 1
+//   88-90  escape sequence %/@, %/C or %/E for Joliet supplementary descriptors
+//   128    logical block size, little-endian 16 bit
+//   156    directory record of the root directory, 34 bytes
+//
+// Directory records, which do not cross sector boundaries:
+//   0      length of record, 0 means rest of sector is unused
+//   1      extended attribute record length in sectors
+//   2      first sector of extent, little-endian 32 bit
+//   10     data length in bytes, little-endian 32 bit
+//   25     flags, bit 1 is set for directories
+//   26-27  file unit size and interleave gap, non-zero for interleaved files
+//   32     length of name
+//   33     name, 0x00 for the directory itself and 0x01 for parent
+
+#include "ISO9660Parser.h"
+#include <string.h>
+
+#define ISO9660_FLAG_DIRECTORY 0x02
+
+static uint32_t getLe32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+ISO9660Parser::ISO9660Parser()
+{
+    clear();
+}
+
+void ISO9660Parser::clear()
+{
+    m_root.lba = m_root.sectors = 0;
+    m_joliet = false;
+    m_vd_end = 0;
+    m_dir_count = 0;
+    m_dir_replace = 0;
+    m_file_count = 0;
+    m_files_dir = 0;
+    m_files_next = 0;
+}
+
+void ISO9660Parser::sectorRead(uint32_t lba, const uint8_t *data)
+{
+    const ISO9660Extent *dir = findDirectory(lba);
+    if (dir)
+    {
+        parseDirectory(dir, lba, data);
+    }
+    else if (lba >= 16 && (m_vd_end == 0 || lba < m_vd_end))
+    {
+        parseVolumeDescriptor(lba, data);
+    }
+}
+
+bool ISO9660Parser::predict(uint32_t next_lba, uint32_t *lba, uint32_t *count) const
+{
+    // Reading inside a file continues to the end of it
+    for (uint32_t i = 0; i < m_file_count; i++)
+    {
+        const ISO9660Extent &file = m_files[i];
+        if (next_lba >= file.lba && next_lba < file.lba + file.sectors)
+        {
+            *lba = next_lba;
+            *count = file.lba + file.sectors - next_lba;
+            return true;
+        }
+    }
+
+    // At the end of a file, the next file in the directory is read
+    for (uint32_t i = 0; i + 1 < m_file_count; i++)
+    {
+        if (next_lba == m_files[i].lba + m_files[i].sectors)
+        {
+            *lba = m_files[i + 1].lba;
+            *count = m_files[i + 1].sectors;
+            return true;
+        }
+    }
+
+    // After directory listing, a file from it is opened.
+    // Directories are often next to each other, so check this before
+    // the sequential case below.
+    const ISO9660Extent *dir = findDirectory(m_files_dir);
+    if (m_file_count > 0 && dir && dir->lba == m_files_dir && next_lba == dir->lba + dir->sectors)
+    {
+        *lba = m_files[0].lba;
+        *count = m_files[0].sectors;
+        return true;
+    }
+
+    // Reading inside a directory continues to the end of it
+    dir = findDirectory(next_lba);
+    if (dir)
+    {
+        *lba = next_lba;
+        *count = dir->lba + dir->sectors - next_lba;
+        return true;
+    }
+
+    // After volume descriptors, the root directory is read
+    if (m_vd_end != 0 && next_lba == m_vd_end && hasVolume())
+    {
+        *lba = m_root.lba;
+        *count = m_root.sectors;
+        return true;
+    }
+
+    return false;
+}
+
+bool ISO9660Parser::parseVolumeDescriptor(uint32_t lba, const uint8_t *data)
+{
+    if (memcmp(data + 1, "CD001", 5) != 0 || data[6] != 1)
+    {
+        return false;
+    }
+
+    uint8_t type = data[0];
+    if (type == 255)
+    {
+        m_vd_end = lba + 1;
+        return true;
+    }
+    else if (type != 1 && type != 2)
+    {
+        // Boot record or volume partition descriptor
+        return true;
+    }
+
+    uint32_t blocksize = data[128] | (data[129] << 8);
+    if (blocksize != ISO9660_SECTOR_SIZE)
+    {
+        return true;
+    }
+
+    bool joliet = false;
+    if (type == 2)
+    {
+        const uint8_t *esc = data + 88;
+        joliet = (esc[0] == '%' && esc[1] == '/' && (esc[2] == '@' || esc[2] == 'C' || esc[2] == 'E'));
+        if (!joliet)
+        {
+            // Other supplementary volumes are not commonly used by hosts
+            return true;
+        }
+    }
+
+    ISO9660Extent root;
+    uint8_t flags;
+    if (!parseRecord(data + 156, 34, &root, &flags) || !(flags & ISO9660_FLAG_DIRECTORY) || root.sectors == 0)
+    {
+        return true;
+    }
+
+    addDirectory(root);
+    if (joliet || !m_joliet)
+    {
+        m_root = root;
+        m_joliet = joliet;
+    }
+
+    return true;
+}
+
+void ISO9660Parser::parseDirectory(const ISO9660Extent *dir, uint32_t lba, const uint8_t *data)
+{
+    if (lba == dir->lba || m_files_dir != dir->lba || lba != m_files_next)
+    {
+        // Start new file list, unless this continues the previous sector
+        m_files_dir = dir->lba;
+        m_file_count = 0;
+    }
+    m_files_next = lba + 1;
+
+    uint32_t pos = 0;
+    while (pos < ISO9660_SECTOR_SIZE)
+    {
+        uint32_t len = data[pos];
+        if (len == 0 || pos + len > ISO9660_SECTOR_SIZE)
+        {
+            // Rest of sector is padding, or record is corrupted
+            break;
+        }
+
+        ISO9660Extent extent;
+        uint8_t flags;
+        if (!parseRecord(data + pos, len, &extent, &flags))
+        {
+            break;
+        }
+
+        uint8_t namelen = data[pos + 32];
+        uint8_t name0 = data[pos + 33];
+        bool self_or_parent = (namelen == 1 && name0 <= 1);
+
+        if (!self_or_parent && extent.sectors > 0)
+        {
+            if (flags & ISO9660_FLAG_DIRECTORY)
+            {
+                addDirectory(extent);
+            }
+            else if (m_file_count < ISO9660_MAX_FILES)
+            {
+                m_files[m_file_count++] = extent;
+            }
+        }
+
+        pos += len;
+    }
+}
+
+bool ISO9660Parser::parseRecord(const uint8_t *record, uint32_t len, ISO9660Extent *extent, uint8_t *flags) const
+{
+    if (len < 34 || record[0] < 34 || record[0] > len || 33 + record[32] > record[0])
+    {
+        return false;
+    }
+
+    uint32_t size = getLe32(record + 10);
+    extent->lba = getLe32(record + 2) + record[1];
+    extent->sectors = size / ISO9660_SECTOR_SIZE + ((size % ISO9660_SECTOR_SIZE) ? 1 : 0);
+    *flags = record[25];
+
+    if (record[26] != 0 || record[27] != 0)
+    {
+        // Interleaved file, data is not in one contiguous extent
+        extent->sectors = 0;
+    }
+
+    return true;
+}
+
+void ISO9660Parser::addDirectory(const ISO9660Extent &extent)
+{
+    for (uint32_t i = 0; i < m_dir_count; i++)
+    {
+        if (m_dirs[i].lba == extent.lba)
+        {
+            m_dirs[i] = extent;
+            return;
+        }
+    }
+
+    if (m_dir_count < ISO9660_MAX_DIRECTORIES)
+    {
+        m_dirs[m_dir_count++] = extent;
+    }
+    else
+    {
+        m_dirs[m_dir_replace] = extent;
+        m_dir_replace = (m_dir_replace + 1) % ISO9660_MAX_DIRECTORIES;
+    }
+}
+
+const ISO9660Extent *ISO9660Parser::findDirectory(uint32_t lba) const
+{
+    // Root directory is always kept, even if the list has been replaced
+    if (m_root.sectors > 0 && lba >= m_root.lba && lba < m_root.lba + m_root.sectors)
+    {
+        return &m_root;
+    }
+
+    for (uint32_t i = 0; i < m_dir_count; i++)
+    {
+        if (lba >= m_dirs[i].lba && lba < m_dirs[i].lba + m_dirs[i].sectors)
+        {
+            return &m_dirs[i];
+        }
+    }
+
+    return nullptr;
+}
@@ -0,0 +1,110 @@
+/*
+ * ISO9660 filesystem structure tracker for CD-ROM read-ahead.
+ *
+ *  Copyright (c) 2023 Rabbit Hole Computing
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Follows the sectors that a host reads from an ISO9660 data disc and
+// parses the volume descriptors and directories among them. No extra
+// reads are done, so the parser only knows the parts of the filesystem
+// that the host has already looked at. This is enough to predict that:
+//
+// - after volume descriptors, the root directory is read
+// - after a directory, the first file listed in it is read
+// - a read inside a file continues up to the end of the file extent
+// - after a file, the next file in the same directory is read
+//
+// Joliet supplementary volume descriptors are recognized, and their root
+// directory is preferred, as that is what most hosts that support it use.
+
+#pragma once
+
+#include <stdint.h>
+
+#define ISO9660_SECTOR_SIZE 2048
+
+// Number of directory extents to remember, used to recognize directory sectors
+#ifndef ISO9660_MAX_DIRECTORIES
+#define ISO9660_MAX_DIRECTORIES 16
+#endif
+
+// Number of file extents to remember from the directory that was read last
+#ifndef ISO9660_MAX_FILES
+#define ISO9660_MAX_FILES 64
+#endif
+
+struct ISO9660Extent
+{
+    uint32_t lba;       // First sector
+    uint32_t sectors;   // Length in 2048 byte sectors
+};
+
+class ISO9660Parser
+{
+public:
+    ISO9660Parser();
+
+    // Forget everything, for example after media change
+    void clear();
+
+    // Process a sector that the host has read.
+    // Volume descriptors and known directory sectors are parsed,
+    // anything else is ignored.
+    void sectorRead(uint32_t lba, const uint8_t *data);
+
+    // Predict the next read after a read command that ended before next_lba.
+    // Returns false if there is no prediction. If the read is expected to
+    // continue sequentially, *lba is next_lba and *count is the number of
+    // sectors until end of the file or directory. Otherwise *lba and *count
+    // give the extent that the host is expected to read next.
+    bool predict(uint32_t next_lba, uint32_t *lba, uint32_t *count) const;
+
+    // Has a volume descriptor with a valid root directory been seen?
+    bool hasVolume() const { return m_root.sectors > 0; }
+    bool isJoliet() const { return m_joliet; }
+    const ISO9660Extent &rootDirectory() const { return m_root; }
+
+    int directoryCount() const { return m_dir_count; }
+    int fileCount() const { return m_file_count; }
+
+protected:
+    ISO9660Extent m_root;
+    bool m_joliet;
+    uint32_t m_vd_end;          // Sector after volume descriptor set terminator, 0 if not seen
+
+    // Directory extents that have been seen, replaced in round robin order
+    ISO9660Extent m_dirs[ISO9660_MAX_DIRECTORIES];
+    uint32_t m_dir_count;
+    uint32_t m_dir_replace;
+
+    // Files listed in the directory that was read last, in directory order
+    ISO9660Extent m_files[ISO9660_MAX_FILES];
+    uint32_t m_file_count;
+    uint32_t m_files_dir;       // First sector of the directory the files are from
+    uint32_t m_files_next;      // Next sector of that directory, appends to the list
+
+    // Parse volume descriptor, returns false if sector is not one
+    bool parseVolumeDescriptor(uint32_t lba, const uint8_t *data);
+
+    // Parse records in one sector of a directory
+    void parseDirectory(const ISO9660Extent *dir, uint32_t lba, const uint8_t *data);
+
+    // Parse extent from directory record, returns false if record is invalid
+    bool parseRecord(const uint8_t *record, uint32_t len, ISO9660Extent *extent, uint8_t *flags) const;
+
+    void addDirectory(const ISO9660Extent &extent);
+    const ISO9660Extent *findDirectory(uint32_t lba) const;
+};
@@ -0,0 +1,326 @@
+#include "ISO9660Parser.h"
+#include <stdio.h>
+#include <string.h>
+
+/* Unit test helpers */
+#define COMMENT(x) printf("\n----" x "----\n");
+#define TEST(x) \
+    if (!(x)) { \
+        fprintf(stderr, "\033[31;1mFAILED:\033[22;39m %s:%d %s\n", __FILE__, __LINE__, #x); \
+        status = false; \
+    } else { \
+        printf("\033[32;1mOK:\033[22;39m %s\n", #x); \
+    }
+
+// Sample disc image built in memory:
+//  16      primary volume descriptor, root directory at 20
+//  17      Joliet supplementary volume descriptor, root directory at 21
+//  18      volume descriptor set terminator
+//  20, 21  root directories: FILE1 at 30, SUBDIR at 22-23, FILE2 at 40
+//  22-23   SUBDIR with SUBDIR_FILES files starting at 100, 2 sectors each
+#define IMAGE_SECTORS 64
+#define SUBDIR_FILES 60
+static uint8_t g_image[IMAGE_SECTORS][ISO9660_SECTOR_SIZE];
+
+static void put_both32(uint8_t *p, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        p[i] = (uint8_t)(value >> (i * 8));
+        p[7 - i] = (uint8_t)(value >> (i * 8));
+    }
+}
+
+// Write directory record, returns its length
+static int put_record(uint8_t *p, uint32_t lba, uint32_t size, uint8_t flags, const char *name, int namelen)
+{
+    int len = 33 + namelen + (namelen % 2 == 0 ? 1 : 0);
+    memset(p, 0, len);
+    p[0] = len;
+    put_both32(p + 2, lba);
+    put_both32(p + 10, size);
+    p[25] = flags;
+    p[28] = 1; p[31] = 1; // Volume sequence number
+    p[32] = namelen;
+    memcpy(p + 33, name, namelen);
+    return len;
+}
+
+static void put_volume_descriptor(uint8_t *s, uint8_t type, uint32_t root_lba, bool joliet)
+{
+    memset(s, 0, ISO9660_SECTOR_SIZE);
+    s[0] = type;
+    memcpy(s + 1, "CD001", 5);
+    s[6] = 1;
+    if (type == 255) return;
+
+    if (joliet) memcpy(s + 88, "%/E", 3);
+    s[128] = ISO9660_SECTOR_SIZE & 0xFF;
+    s[129] = ISO9660_SECTOR_SIZE >> 8;
+    put_record(s + 156, root_lba, ISO9660_SECTOR_SIZE, 0x02, "\0", 1);
+}
+
+static void put_root_directory(uint8_t *s, uint32_t self_lba)
+{
+    int pos = 0;
+    memset(s, 0, ISO9660_SECTOR_SIZE);
+    pos += put_record(s + pos, self_lba, ISO9660_SECTOR_SIZE, 0x02, "\0", 1);
+    pos += put_record(s + pos, self_lba, ISO9660_SECTOR_SIZE, 0x02, "\1", 1);
+    pos += put_record(s + pos, 30, 5000, 0, "FILE1.TXT;1", 11);
+    pos += put_record(s + pos, 22, 2 * ISO9660_SECTOR_SIZE, 0x02, "SUBDIR", 6);
+    pos += put_record(s + pos, 40, 2048, 0, "FILE2.TXT;1", 11);
+}
+
+static void build_image(bool joliet)
+{
+    memset(g_image, 0, sizeof(g_image));
+    put_volume_descriptor(g_image[16], 1, 20, false);
+    if (joliet)
+    {
+        put_volume_descriptor(g_image[17], 2, 21, true);
+        put_volume_descriptor(g_image[18], 255, 0, false);
+    }
+    else
+    {
+        put_volume_descriptor(g_image[17], 255, 0, false);
+    }
+
+    put_root_directory(g_image[20], 20);
+    put_root_directory(g_image[21], 21);
+
+    // Records do not cross sector boundary, so they continue to next sector
+    uint8_t *s = g_image[22];
+    int pos = 0;
+    pos += put_record(s + pos, 22, 2 * ISO9660_SECTOR_SIZE, 0x02, "\0", 1);
+    pos += put_record(s + pos, 20, ISO9660_SECTOR_SIZE, 0x02, "\1", 1);
+    for (int i = 0; i < SUBDIR_FILES; i++)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "FILE_WITH_A_LONG_NAME_%04d.DAT", i);
+        if (pos + 64 > ISO9660_SECTOR_SIZE)
+        {
+            s = g_image[23];
+            pos = 0;
+        }
+        pos += put_record(s + pos, 100 + i * 2, 4096, 0, name, strlen(name));
+    }
+}
+
+static void read_sectors(ISO9660Parser &parser, uint32_t lba, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        parser.sectorRead(lba + i, g_image[lba + i]);
+    }
+}
+
+bool test_volume()
+{
+    bool status = true;
+    ISO9660Parser parser;
+    uint32_t lba = 0, count = 0;
+
+    COMMENT("test_volume()");
+    build_image(true);
+
+    COMMENT("Sectors before volume descriptors are ignored");
+    read_sectors(parser, 0, 16);
+    TEST(!parser.hasVolume());
+
+    COMMENT("Primary volume descriptor");
+    read_sectors(parser, 16, 1);
+    TEST(parser.hasVolume());
+    TEST(!parser.isJoliet());
+    TEST(parser.rootDirectory().lba == 20);
+
+    COMMENT("Joliet root is preferred");
+    read_sectors(parser, 17, 2);
+    TEST(parser.isJoliet());
+    TEST(parser.rootDirectory().lba == 21);
+    TEST(parser.rootDirectory().sectors == 1);
+
+    COMMENT("Root directory is read after volume descriptors");
+    TEST(parser.predict(19, &lba, &count));
+    TEST(lba == 21 && count == 1);
+
+    COMMENT("Without Joliet, primary root is used");
+    build_image(false);
+    parser.clear();
+    read_sectors(parser, 16, 2);
+    TEST(parser.hasVolume() && !parser.isJoliet());
+    TEST(parser.predict(18, &lba, &count));
+    TEST(lba == 20 && count == 1);
+
+    COMMENT("clear() forgets volume");
+    parser.clear();
+    TEST(!parser.hasVolume());
+    TEST(!parser.predict(18, &lba, &count));
+
+    return status;
+}
+
+bool test_directories()
+{
+    bool status = true;
+    ISO9660Parser parser;
+    uint32_t lba = 0, count = 0;
+
+    COMMENT("test_directories()");
+    build_image(true);
+    read_sectors(parser, 16, 3);
+
+    COMMENT("Root directory lists files and subdirectory");
+    read_sectors(parser, 21, 1);
+    TEST(parser.fileCount() == 2);
+
+    COMMENT("First file is read after directory");
+    TEST(parser.predict(22, &lba, &count));
+    TEST(lba == 30 && count == 3);
+
+    COMMENT("Read inside file continues to end of file");
+    TEST(parser.predict(31, &lba, &count));
+    TEST(lba == 31 && count == 2);
+
+    COMMENT("Next file is read after end of file");
+    TEST(parser.predict(33, &lba, &count));
+    TEST(lba == 40 && count == 1);
+
+    COMMENT("No prediction after last file");
+    TEST(!parser.predict(41, &lba, &count));
+
+    COMMENT("Subdirectory spanning two sectors");
+    read_sectors(parser, 22, 2);
+    TEST(parser.fileCount() == SUBDIR_FILES);
+    TEST(parser.predict(24, &lba, &count));
+    TEST(lba == 100 && count == 2);
+    TEST(parser.predict(100 + 2 * (SUBDIR_FILES - 1), &lba, &count));
+    TEST(lba == 100 + 2 * (SUBDIR_FILES - 1) && count == 2);
+
+    COMMENT("Read of second sector only lists its files");
+    read_sectors(parser, 23, 1);
+    TEST(parser.fileCount() > 0 && parser.fileCount() < SUBDIR_FILES);
+
+    COMMENT("Read inside directory continues to end of directory");
+    read_sectors(parser, 21, 1);
+    TEST(parser.predict(23, &lba, &count));
+    TEST(lba == 23 && count == 1);
+
+    return status;
+}
+
+bool test_robustness()
+{
+    bool status = true;
+    ISO9660Parser parser;
+    uint32_t lba = 0, count = 0;
+
+    COMMENT("test_robustness()");
+    build_image(true);
+
+    COMMENT("Data without CD001 signature is not a volume");
+    uint8_t sector[ISO9660_SECTOR_SIZE];
+    memset(sector, 0x55, sizeof(sector));
+    parser.sectorRead(16, sector);
+    TEST(!parser.hasVolume());
+
+    COMMENT("Wrong logical block size is not used");
+    memcpy(sector, g_image[16], sizeof(sector));
+    sector[129] = 0x04;
+    parser.sectorRead(16, sector);
+    TEST(!parser.hasVolume());
+
+    COMMENT("Corrupted record stops parsing");
+    read_sectors(parser, 16, 3);
+    memcpy(sector, g_image[21], sizeof(sector));
+    int pos = 0;
+    while (sector[pos] != 0) pos += sector[pos];
+    sector[pos] = 200; // Name length in garbage does not fit in record
+    memset(sector + pos + 1, 0xFF, ISO9660_SECTOR_SIZE - pos - 1);
+    parser.sectorRead(21, sector);
+    TEST(parser.fileCount() == 2);
+
+    COMMENT("Interleaved files are not followed");
+    memcpy(sector, g_image[21], sizeof(sector));
+    sector[34 * 2 + 26] = 1; // FILE1 file unit size
+    parser.sectorRead(21, sector);
+    TEST(parser.fileCount() == 1);
+    TEST(parser.predict(22, &lba, &count));
+    TEST(lba == 40);
+
+    COMMENT("Root directory is kept when many directories are seen");
+    for (int i = 0; i < ISO9660_MAX_DIRECTORIES * 2; i++)
+    {
+        memset(sector, 0, sizeof(sector));
+        put_record(sector, 1000 + i, ISO9660_SECTOR_SIZE, 0x02, "DIR", 3);
+        parser.sectorRead(21, sector);
+    }
+    TEST(parser.directoryCount() == ISO9660_MAX_DIRECTORIES);
+    read_sectors(parser, 21, 1);
+    TEST(parser.fileCount() == 2);
+
+    return status;
+}
+
+// Print what parser finds in an ISO image given on command line
+static void walk_iso(const char *filename)
+{
+    FILE *f = fopen(filename, "rb");
+    if (!f)
+    {
+        perror(filename);
+        return;
+    }
+
+    ISO9660Parser parser;
+    uint8_t sector[ISO9660_SECTOR_SIZE];
+    uint32_t lba = 16, count = 0, next_lba = 16;
+    for (int i = 0; i < 16; i++)
+    {
+        if (fseek(f, (long)next_lba * ISO9660_SECTOR_SIZE, SEEK_SET) != 0 ||
+            fread(sector, ISO9660_SECTOR_SIZE, 1, f) != 1)
+        {
+            break;
+        }
+
+        parser.sectorRead(next_lba, sector);
+        next_lba++;
+        if (parser.predict(next_lba, &lba, &count)) break;
+    }
+
+    printf("%s: volume %d, joliet %d, root at %u\n", filename,
+           parser.hasVolume(), parser.isJoliet(), (unsigned)parser.rootDirectory().lba);
+
+    // Follow predictions like a host reading one sector at a time
+    for (int i = 0; i < 32 && parser.predict(next_lba, &lba, &count); i++)
+    {
+        printf("  after %u: read %u sectors at %u\n", (unsigned)next_lba, (unsigned)count, (unsigned)lba);
+        if (fseek(f, (long)lba * ISO9660_SECTOR_SIZE, SEEK_SET) != 0 ||
+            fread(sector, ISO9660_SECTOR_SIZE, 1, f) != 1)
+        {
+            break;
+        }
+        parser.sectorRead(lba, sector);
+        next_lba = lba + 1;
+    }
+
+    fclose(f);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1)
+    {
+        walk_iso(argv[1]);
+        return 0;
+    }
+
+    if (test_volume() && test_directories() && test_robustness())
+    {
+        return 0;
+    }
+    else
+    {
+        printf("Some tests failed\n");
+        return 1;
+    }
+}
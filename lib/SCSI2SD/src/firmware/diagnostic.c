@@ -141,16 +141,60 @@ void scsiReceiveDiagnostic()
 	}
 }
 
+// READ/WRITE BUFFER data is kept in scsiDev.data, so that the transfers
+// use the same DMA path as normal reads and writes without touching the
+// SD card. Offsets must be aligned to 2^BUFFER_OFFSET_BOUNDARY bytes.
+#define BUFFER_OFFSET_BOUNDARY 2
+
+// Echo buffer is separate so that other commands do not overwrite it.
+// SPC-3 limits the echo buffer capacity to 4 bytes less than 256.
+#define ECHO_BUFFER_SIZE 252
+static uint8_t echoBuffer[ECHO_BUFFER_SIZE];
+static uint8_t echoBufferLen;
+static int echoBufferInitiator = -1; // Initiator that wrote the data
+
+// Decode BUFFER ID, BUFFER OFFSET and length fields from CDB.
+// Returns 0 if the request does not fit in the data buffer.
+static int getBufferRange(uint32_t* offset, uint32_t* length)
+{
+	*offset =
+		(((uint32_t) scsiDev.cdb[3]) << 16) +
+		(((uint32_t) scsiDev.cdb[4]) << 8) +
+		scsiDev.cdb[5];
+	*length =
+		(((uint32_t) scsiDev.cdb[6]) << 16) +
+		(((uint32_t) scsiDev.cdb[7]) << 8) +
+		scsiDev.cdb[8];
+
+	return scsiDev.cdb[2] == 0 && // Only one buffer
+		(*offset & ((1 << BUFFER_OFFSET_BOUNDARY) - 1)) == 0 &&
+		*offset <= sizeof(scsiDev.data);
+}
+
+static void setBufferDataPtr(uint32_t offset, uint32_t length)
+{
+	scsiDev.dataPtr = offset;
+	scsiDev.savedDataPtr = offset;
+	scsiDev.dataLen = offset + length;
+}
+
+static void invalidBufferCommand(void)
+{
+	scsiDev.status = CHECK_CONDITION;
+	scsiDev.target->sense.code = ILLEGAL_REQUEST;
+	scsiDev.target->sense.asc = INVALID_FIELD_IN_CDB;
+	scsiDev.phase = STATUS;
+}
+
 void scsiReadBuffer()
 {
 	// READ BUFFER
 	// Used for testing the speed of the SCSI interface.
-	uint8_t mode = scsiDev.data[1] & 7;
+	uint8_t mode = scsiDev.cdb[1] & 0x1F;
 
-	int allocLength =
-		(((uint32_t) scsiDev.cdb[6]) << 16) +
-		(((uint32_t) scsiDev.cdb[7]) << 8) +
-		scsiDev.cdb[8];
+	uint32_t offset;
+	uint32_t allocLength;
+	int validRange = getBufferRange(&offset, &allocLength);
 
 	if (mode == 0)
 	{
@@ -165,18 +209,17 @@ void scsiReadBuffer()
 			(allocLength > sizeof(scsiDev.data)) ? sizeof(scsiDev.data) : allocLength;
 		scsiDev.phase = DATA_IN;
 	}
-	else if (mode == 0x2 && (scsiDev.cdb[2] == 0))
+	else if (mode == 0x2 && validRange)
 	{
-		// TODO support BUFFER OFFSET fields in CDB
-		scsiDev.dataLen =
-			(allocLength > sizeof(scsiDev.data)) ? sizeof(scsiDev.data) : allocLength;
+		uint32_t maxLen = sizeof(scsiDev.data) - offset;
+		setBufferDataPtr(offset, (allocLength > maxLen) ? maxLen : allocLength);
 		scsiDev.phase = DATA_IN;
 	}
 	else if (mode == 0x3)
 	{
-		uint32_t maxSize = sizeof(scsiDev.data) - 4;
-		// 4 byte header
-		scsiDev.data[0] = 0;
+		uint32_t maxSize = sizeof(scsiDev.data);
+		// 4 byte descriptor
+		scsiDev.data[0] = BUFFER_OFFSET_BOUNDARY;
 		scsiDev.data[1] = (maxSize >> 16) & 0xff;
 		scsiDev.data[2] = (maxSize >> 8) & 0xff;
 		scsiDev.data[3] = maxSize & 0xff;
@@ -185,13 +228,40 @@ void scsiReadBuffer()
 			(allocLength > 4) ? 4: allocLength;
 		scsiDev.phase = DATA_IN;
 	}
+	else if (mode == 0x0A)
+	{
+		// Echo buffer
+		if (echoBufferInitiator != scsiDev.initiatorId)
+		{
+			scsiDev.status = CHECK_CONDITION;
+			scsiDev.target->sense.code = ILLEGAL_REQUEST;
+			scsiDev.target->sense.asc = COMMAND_SEQUENCE_ERROR;
+			scsiDev.phase = STATUS;
+		}
+		else
+		{
+			uint32_t len = (allocLength > echoBufferLen) ? echoBufferLen : allocLength;
+			memcpy(scsiDev.data, echoBuffer, len);
+			scsiDev.dataLen = len;
+			scsiDev.phase = DATA_IN;
+		}
+	}
+	else if (mode == 0x0B)
+	{
+		// Echo buffer descriptor
+		scsiDev.data[0] = 0; // EBOS = 0, shared by all initiators
+		scsiDev.data[1] = 0;
+		scsiDev.data[2] = (ECHO_BUFFER_SIZE >> 8) & 0x1F;
+		scsiDev.data[3] = ECHO_BUFFER_SIZE & 0xff;
+
+		scsiDev.dataLen =
+			(allocLength > 4) ? 4: allocLength;
+		scsiDev.phase = DATA_IN;
+	}
 	else
 	{
 		// error.
-		scsiDev.status = CHECK_CONDITION;
-		scsiDev.target->sense.code = ILLEGAL_REQUEST;
-		scsiDev.target->sense.asc = INVALID_FIELD_IN_CDB;
-		scsiDev.phase = STATUS;
+		invalidBufferCommand();
 	}
 }
 
@@ -207,30 +277,53 @@ static void doWriteBuffer(void)
 	}
 }
 
+// Callback after the DATA OUT phase is complete.
+static void doWriteEchoBuffer(void)
+{
+	if (scsiDev.status == GOOD) // skip if we've already encountered an error
+	{
+		memcpy(echoBuffer, scsiDev.data, scsiDev.dataLen);
+		echoBufferLen = scsiDev.dataLen;
+		echoBufferInitiator = scsiDev.initiatorId;
+		scsiDev.phase = STATUS;
+	}
+}
+
 void scsiWriteBuffer()
 {
 	// WRITE BUFFER
 	// Used for testing the speed of the SCSI interface.
-	uint8_t mode = scsiDev.data[1] & 7;
+	uint8_t mode = scsiDev.cdb[1] & 0x1F;
 
-	int allocLength =
-		(((uint32_t) scsiDev.cdb[6]) << 16) +
-		(((uint32_t) scsiDev.cdb[7]) << 8) +
-		scsiDev.cdb[8];
+	uint32_t offset;
+	uint32_t allocLength;
+	int validRange = getBufferRange(&offset, &allocLength);
 
-	if ((mode == 0 || mode == 2) && allocLength <= sizeof(scsiDev.data))
+	if (mode == 0 && allocLength <= sizeof(scsiDev.data))
 	{
 		scsiDev.dataLen = allocLength;
 		scsiDev.phase = DATA_OUT;
 		scsiDev.postDataOutHook = doWriteBuffer;
 	}
+	else if (mode == 2 && validRange &&
+		allocLength <= sizeof(scsiDev.data) - offset)
+	{
+		setBufferDataPtr(offset, allocLength);
+		scsiDev.phase = DATA_OUT;
+		scsiDev.postDataOutHook = doWriteBuffer;
+	}
+	else if (mode == 0x0A && allocLength <= ECHO_BUFFER_SIZE)
+	{
+		// Echo buffer, invalid until the data has been received
+		echoBufferInitiator = -1;
+		scsiDev.dataLen = allocLength;
+		scsiDev.phase = DATA_OUT;
+		scsiDev.postDataOutHook = doWriteEchoBuffer;
+	}
 	else
 	{
 		// error.
-		scsiDev.status = CHECK_CONDITION;
-		scsiDev.target->sense.code = ILLEGAL_REQUEST;
-		scsiDev.target->sense.asc = INVALID_FIELD_IN_CDB;
-		scsiDev.phase = STATUS;
+		invalidBufferCommand();
 	}
 }
 
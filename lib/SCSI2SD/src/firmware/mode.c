@@ -256,9 +256,105 @@ static void pageIn(int pc, int dataIdx, const uint8_t* pageData, int pageLen)
 	}
 }
 
+// Hosts poll MODE SENSE heavily during enumeration, so the last response
+// for each target and page control value is kept and replayed as long as
+// the request is identical. The stored data is limited to the allocation
+// length, so responses larger than the cache slot are simply rebuilt.
+#ifndef MODE_SENSE_CACHE_SIZE
+#define MODE_SENSE_CACHE_SIZE 192
+#endif
+
+#if MODE_SENSE_CACHE_SIZE > 0
+typedef struct
+{
+	uint8_t valid;
+	uint8_t sixByteCmd;
+	uint8_t dbd;
+	uint8_t pageCode;
+	uint8_t compatMode;
+	uint16_t allocLength;
+	uint16_t dataLen;
+	uint8_t data[MODE_SENSE_CACHE_SIZE];
+} ModeSenseCache;
+
+// Indexed by SCSI ID and page control value
+static ModeSenseCache modeSenseCache[S2S_MAX_TARGETS][4];
+
+static ModeSenseCache* modeSenseCacheLookup(
+	int sixByteCmd, int dbd, int pc, int pageCode, int allocLength)
+{
+	ModeSenseCache* entry =
+		&modeSenseCache[scsiDev.target->targetId & S2S_CFG_TARGET_ID_BITS][pc];
+
+	if (entry->valid &&
+		entry->sixByteCmd == sixByteCmd &&
+		entry->dbd == dbd &&
+		entry->pageCode == pageCode &&
+		entry->compatMode == scsiDev.compatMode &&
+		entry->allocLength == allocLength)
+	{
+		return entry;
+	}
+	return 0;
+}
+
+static void modeSenseCacheStore(
+	int sixByteCmd, int dbd, int pc, int pageCode, int allocLength)
+{
+	ModeSenseCache* entry =
+		&modeSenseCache[scsiDev.target->targetId & S2S_CFG_TARGET_ID_BITS][pc];
+
+	if (scsiDev.dataLen > MODE_SENSE_CACHE_SIZE)
+	{
+		entry->valid = 0;
+		return;
+	}
+
+	entry->sixByteCmd = sixByteCmd;
+	entry->dbd = dbd;
+	entry->pageCode = pageCode;
+	entry->compatMode = scsiDev.compatMode;
+	entry->allocLength = allocLength;
+	entry->dataLen = scsiDev.dataLen;
+	memcpy(entry->data, scsiDev.data, scsiDev.dataLen);
+	entry->valid = 1;
+}
+
+void s2s_modeSenseCacheInvalidate(int scsiId)
+{
+	if (scsiId < 0)
+	{
+		memset(modeSenseCache, 0, sizeof(modeSenseCache));
+	}
+	else
+	{
+		memset(&modeSenseCache[scsiId & S2S_CFG_TARGET_ID_BITS], 0,
+			sizeof(modeSenseCache[0]));
+	}
+}
+#else
+void s2s_modeSenseCacheInvalidate(int scsiId)
+{
+	(void)scsiId;
+}
+#endif
+
 static void doModeSense(
 	int sixByteCmd, int dbd, int pc, int pageCode, int allocLength)
 {
+#if MODE_SENSE_CACHE_SIZE > 0
+	ModeSenseCache* cached =
+		modeSenseCacheLookup(sixByteCmd, dbd, pc, pageCode, allocLength);
+	if (cached)
+	{
+		memcpy(scsiDev.data, cached->data, cached->dataLen);
+		scsiDev.dataLen = cached->dataLen;
+		scsiDev.phase = DATA_IN;
+		return;
+	}
+#endif
+
+
 	////////////// Mode Parameter Header
 	////////////////////////////////////
 
@@ -574,6 +670,10 @@ static void doModeSense(
 
 		scsiDev.dataLen = idx > allocLength ? allocLength : idx;
 		scsiDev.phase = DATA_IN;
+
+#if MODE_SENSE_CACHE_SIZE > 0
+		modeSenseCacheStore(sixByteCmd, dbd, pc, pageCode, allocLength);
+#endif
 	}
 }
 
@@ -581,6 +681,9 @@ static void doModeSense(
 // Callback after the DATA OUT phase is complete.
 static void doModeSelect(void)
 {
+	// Block size and CD audio settings may change below
+	s2s_modeSenseCacheInvalidate(scsiDev.target->targetId);
+
 	if (scsiDev.status == GOOD) // skip if we've already encountered an error
 	{
 		// scsiDev.dataLen bytes are in scsiDev.data
@@ -19,4 +19,8 @@
 
 int scsiModeCommand(void);
 
+// Drop cached MODE SENSE responses for target, or all targets if scsiId < 0.
+// Must be called whenever the data reported by doModeSense() may change.
+void s2s_modeSenseCacheInvalidate(int scsiId);
+
 #endif
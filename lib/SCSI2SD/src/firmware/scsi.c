@@ -378,6 +378,12 @@ static void process_Command()
 		// REQUEST SENSE
 		uint32_t allocLength = scsiDev.cdb[4];
 
+		if (unlikely(scsiDev.target->formatInProgress))
+		{
+			scsiDev.target->sense.code = NOT_READY;
+			scsiDev.target->sense.asc = LOGICAL_UNIT_NOT_READY_FORMAT_IN_PROGRESS;
+		}
+
 		if (scsiDev.target->cfg->quirks == S2S_CFG_QUIRKS_XEBEC)
 		{
 			// Completely non-standard
@@ -461,7 +467,8 @@ static void process_Command()
 			// Newer initiators won't be specifying 0 anyway.
 			if (allocLength == 0) allocLength = 4;
 
-			memset(scsiDev.data, 0, 256); // Max possible alloc length
+			// Only clear what is returned, this is polled often.
+			memset(scsiDev.data, 0, allocLength > 18 ? allocLength : 18);
 			scsiDev.data[0] = 0xF0;
 			scsiDev.data[2] = scsiDev.target->sense.code & 0x0F;
 
@@ -474,6 +481,14 @@ static void process_Command()
 			scsiDev.data[7] = 10; // additional length
 			scsiDev.data[12] = scsiDev.target->sense.asc >> 8;
 			scsiDev.data[13] = scsiDev.target->sense.asc;
+
+			if (unlikely(scsiDev.target->formatInProgress))
+			{
+				// Sense key specific progress indication
+				scsiDev.data[15] = 0x80; // SKSV
+				scsiDev.data[16] = scsiDev.target->formatProgress >> 8;
+				scsiDev.data[17] = scsiDev.target->formatProgress;
+			}
 		}
 
 		// Silently truncate results. SCSI-2 spec 8.2.14.
@@ -499,6 +514,13 @@ static void process_Command()
 
 		enter_Status(CHECK_CONDITION);
 	}
+	else if (unlikely(scsiDev.target->formatInProgress))
+	{
+		// Only INQUIRY and REQUEST SENSE are accepted during a background format
+		scsiDev.target->sense.code = NOT_READY;
+		scsiDev.target->sense.asc = LOGICAL_UNIT_NOT_READY_FORMAT_IN_PROGRESS;
+		enter_Status(CHECK_CONDITION);
+	}
 	else if (scsiDev.lun)
 	{
 		scsiDev.target->sense.code = ILLEGAL_REQUEST;
@@ -514,6 +536,19 @@ static void process_Command()
 	{
 		enter_Status(CONFLICT);
 	}
+	else if (command == 0x00 && scsiDev.target->readyStatus)
+	{
+		// TEST UNIT READY, media state unchanged since last check.
+		// Hosts may poll this continuously on removable devices.
+		uint32_t readyStatus = scsiDev.target->readyStatus;
+		uint8_t senseKey = (readyStatus >> 16) & 0xFF;
+		if (senseKey != NO_SENSE)
+		{
+			scsiDev.target->sense.code = senseKey;
+			scsiDev.target->sense.asc = readyStatus & 0xFFFF;
+			enter_Status(CHECK_CONDITION);
+		}
+	}
 	// Handle odd device types first that may override basic read and
 	// write commands. Will fall-through to generic disk handling.
 	else if (((cfg->deviceType == S2S_CFG_OPTICAL) && scsiCDRomCommand()) ||
@@ -564,6 +599,27 @@ static void process_Command()
 
 }
 
+#define READY_STATUS_VALID 0x80000000
+
+void s2s_readyStatusStore(uint8_t senseKey, uint16_t asc)
+{
+	scsiDev.target->readyStatus =
+		READY_STATUS_VALID | ((uint32_t)senseKey << 16) | asc;
+}
+
+void s2s_readyStatusInvalidate(int scsiId)
+{
+	int i;
+	for (i = 0; i < S2S_MAX_TARGETS; ++i)
+	{
+		if (scsiId < 0 ||
+			scsiDev.targets[i].targetId == (scsiId & S2S_CFG_TARGET_ID_BITS))
+		{
+			scsiDev.targets[i].readyStatus = 0;
+		}
+	}
+}
+
 static void doReserveRelease()
 {
 	int extentReservation = scsiDev.cdb[1] & 1;
@@ -1236,6 +1292,8 @@ void scsiInit()
 		// LOGICAL_UNIT_NOT_READY_INITIALIZING_COMMAND_REQUIRED sense
 		// code
 		scsiDev.targets[i].started = 1;
+		scsiDev.targets[i].formatInProgress = 0;
+		scsiDev.targets[i].readyStatus = 0;
 	}
 	firstInit = 0;
 }
@@ -112,6 +112,15 @@ typedef struct
 	uint8_t syncPeriod;
 
 	uint8_t started; // Controlled by START STOP UNIT
+
+	// Set while FORMAT UNIT with IMMED bit is running in the background.
+	// Progress is reported in REQUEST SENSE, scaled to 0 - 0xFFFF.
+	uint8_t formatInProgress;
+	uint16_t formatProgress;
+
+	// Result of the last TEST UNIT READY check, replayed while the media
+	// state stays the same. See s2s_readyStatusStore().
+	uint32_t readyStatus;
 } TargetState;
 
 typedef struct
@@ -193,6 +202,15 @@ void scsiPoll(void);
 void scsiDisconnect(void);
 int scsiReconnect(void);
 
+// Remember TEST UNIT READY result for the current target, given as the
+// sense key and ASC that are reported, NO_SENSE when ready. Later TEST UNIT
+// READY commands are answered from it without calling the device handler.
+void s2s_readyStatusStore(uint8_t senseKey, uint16_t asc);
+
+// Drop stored TEST UNIT READY result for target, or all targets if scsiId < 0.
+// Must be called whenever the media state of the target may change.
+void s2s_readyStatusInvalidate(int scsiId);
+
 
 // Utility macros, consistent with the Linux Kernel code.
 #define likely(x)       __builtin_expect(!!(x), 1)
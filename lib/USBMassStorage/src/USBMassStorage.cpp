@@ -0,0 +1,534 @@
+/*
+ * USB mass storage class (bulk-only transport) state machine.
+ *
+ *  Copyright (c) 2023 Rabbit Hole Computing
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "USBMassStorage.h"
+#include <string.h>
+
+#define CBW_SIGNATURE 0x43425355
+#define CSW_SIGNATURE 0x53425355
+#define CBW_LENGTH 31
+#define CSW_LENGTH 13
+
+#define CSW_STATUS_GOOD 0
+#define CSW_STATUS_FAILED 1
+#define CSW_STATUS_PHASE_ERROR 2
+
+#define SENSE_NO_SENSE 0x00
+#define SENSE_NOT_READY 0x02
+#define SENSE_MEDIUM_ERROR 0x03
+#define SENSE_ILLEGAL_REQUEST 0x05
+#define SENSE_UNIT_ATTENTION 0x06
+#define SENSE_DATA_PROTECT 0x07
+
+#define ASC_WRITE_FAULT 0x03
+#define ASC_UNRECOVERED_READ_ERROR 0x11
+#define ASC_INVALID_COMMAND 0x20
+#define ASC_LBA_OUT_OF_RANGE 0x21
+#define ASC_INVALID_FIELD_IN_CDB 0x24
+#define ASC_WRITE_PROTECTED 0x27
+#define ASC_MEDIUM_CHANGED 0x28
+#define ASC_MEDIUM_NOT_PRESENT 0x3A
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static uint32_t get_be32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static void put_be32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+static void copy_padded(char *dest, const char *src, size_t len)
+{
+    size_t srclen = strlen(src);
+    for (size_t i = 0; i < len; i++)
+    {
+        dest[i] = (i < srclen) ? src[i] : ' ';
+    }
+}
+
+USBMassStorage::USBMassStorage():
+    m_storage(NULL), m_buffer(m_response_buffer), m_buffer_size(sizeof(m_response_buffer)),
+    m_bytes_read(0), m_bytes_written(0)
+{
+    setInquiry("ZuluSCSI", "SD card", "1.0");
+    m_ejected = false;
+    m_unit_attention = false;
+    m_sense_key = SENSE_NO_SENSE;
+    m_sense_asc = 0;
+    reset();
+}
+
+void USBMassStorage::setStorage(MSCStorage *storage, uint8_t *buffer, uint32_t buffer_size)
+{
+    m_storage = storage;
+    m_buffer = buffer;
+    m_buffer_size = buffer_size;
+
+    if (!m_buffer || m_buffer_size < MSC_SECTOR_SIZE)
+    {
+        m_storage = NULL;
+        m_buffer = m_response_buffer;
+        m_buffer_size = sizeof(m_response_buffer);
+    }
+
+    m_ejected = false;
+    m_unit_attention = (m_storage != NULL);
+    reset();
+}
+
+void USBMassStorage::setInquiry(const char *vendor, const char *product, const char *revision)
+{
+    copy_padded(m_vendor, vendor, sizeof(m_vendor));
+    copy_padded(m_product, product, sizeof(m_product));
+    copy_padded(m_revision, revision, sizeof(m_revision));
+}
+
+void USBMassStorage::reset()
+{
+    m_state = STATE_CBW;
+    m_in_stall = false;
+    m_out_stall = false;
+    m_tag = 0;
+    m_host_length = 0;
+    m_transferred = 0;
+    m_data_in = false;
+    m_status = CSW_STATUS_GOOD;
+    m_buf_len = 0;
+    m_buf_pos = 0;
+    m_lba = 0;
+    m_sectors_left = 0;
+    m_sector_transfer = false;
+}
+
+void USBMassStorage::clearInStall()
+{
+    // After invalid CBW, only reset recovery clears the stall
+    if (m_state != STATE_ERROR) m_in_stall = false;
+}
+
+void USBMassStorage::clearOutStall()
+{
+    if (m_state != STATE_ERROR) m_out_stall = false;
+}
+
+void USBMassStorage::setSense(uint8_t key, uint8_t asc)
+{
+    m_sense_key = key;
+    m_sense_asc = asc;
+}
+
+void USBMassStorage::fail(uint8_t key, uint8_t asc)
+{
+    setSense(key, asc);
+    m_status = CSW_STATUS_FAILED;
+}
+
+bool USBMassStorage::checkReady()
+{
+    if (!m_storage || m_ejected || !m_storage->ready())
+    {
+        fail(SENSE_NOT_READY, ASC_MEDIUM_NOT_PRESENT);
+        return false;
+    }
+
+    if (m_unit_attention)
+    {
+        m_unit_attention = false;
+        fail(SENSE_UNIT_ATTENTION, ASC_MEDIUM_CHANGED);
+        return false;
+    }
+
+    return true;
+}
+
+bool USBMassStorage::checkRange(uint32_t lba, uint32_t count)
+{
+    uint32_t capacity = m_storage->sectorCount();
+    if (lba >= capacity || count > capacity - lba)
+    {
+        fail(SENSE_ILLEGAL_REQUEST, ASC_LBA_OUT_OF_RANGE);
+        return false;
+    }
+    return true;
+}
+
+void USBMassStorage::packetOut(const uint8_t *data, uint32_t len)
+{
+    if (m_out_stall)
+    {
+        return;
+    }
+
+    if (m_state == STATE_CBW)
+    {
+        handleCBW(data, len);
+    }
+    else if (m_state == STATE_DATA_OUT)
+    {
+        while (len > 0)
+        {
+            uint32_t wanted = m_sectors_left * MSC_SECTOR_SIZE - m_buf_len;
+            uint32_t space = m_buffer_size - m_buf_len;
+            uint32_t n = len;
+            if (n > wanted) n = wanted;
+            if (n > space) n = space;
+            if (n == 0) break;
+
+            memcpy(m_buffer + m_buf_len, data, n);
+            m_buf_len += n;
+            m_transferred += n;
+            data += n;
+            len -= n;
+
+            if (m_buf_len == m_buffer_size || n == wanted)
+            {
+                flushWriteBuffer();
+            }
+        }
+
+        if (m_sectors_left == 0)
+        {
+            endDataPhase();
+        }
+    }
+}
+
+uint32_t USBMassStorage::packetIn(uint8_t *data, uint32_t maxlen)
+{
+    if (m_in_stall)
+    {
+        return 0;
+    }
+
+    if (m_state == STATE_DATA_IN)
+    {
+        if (m_buf_pos >= m_buf_len && m_sector_transfer && m_sectors_left > 0)
+        {
+            if (!fillReadBuffer())
+            {
+                endDataPhase();
+                return 0;
+            }
+        }
+
+        uint32_t n = m_buf_len - m_buf_pos;
+        if (n > maxlen) n = maxlen;
+        memcpy(data, m_buffer + m_buf_pos, n);
+        m_buf_pos += n;
+        m_transferred += n;
+
+        if (m_buf_pos >= m_buf_len && (!m_sector_transfer || m_sectors_left == 0))
+        {
+            endDataPhase();
+        }
+
+        return n;
+    }
+    else if (m_state == STATE_CSW && maxlen >= CSW_LENGTH)
+    {
+        put_le32(&data[0], CSW_SIGNATURE);
+        put_le32(&data[4], m_tag);
+        put_le32(&data[8], m_host_length - m_transferred);
+        data[12] = m_status;
+        m_state = STATE_CBW;
+        return CSW_LENGTH;
+    }
+
+    return 0;
+}
+
+void USBMassStorage::handleCBW(const uint8_t *cbw, uint32_t len)
+{
+    if (len != CBW_LENGTH || get_le32(&cbw[0]) != CBW_SIGNATURE ||
+        cbw[14] < 1 || cbw[14] > 16)
+    {
+        // Invalid CBW, host must perform reset recovery
+        m_state = STATE_ERROR;
+        m_in_stall = true;
+        m_out_stall = true;
+        return;
+    }
+
+    m_tag = get_le32(&cbw[4]);
+    m_host_length = get_le32(&cbw[8]);
+    m_data_in = (cbw[12] & 0x80) != 0;
+    m_transferred = 0;
+    m_status = CSW_STATUS_GOOD;
+    m_buf_len = 0;
+    m_buf_pos = 0;
+    m_sector_transfer = false;
+    m_sectors_left = 0;
+    m_state = STATE_CSW;
+
+    if (cbw[13] != 0)
+    {
+        // Only one LUN is reported by GET MAX LUN
+        fail(SENSE_ILLEGAL_REQUEST, ASC_INVALID_FIELD_IN_CDB);
+    }
+    else
+    {
+        executeCommand(&cbw[15]);
+    }
+
+    if (m_state == STATE_CSW)
+    {
+        // No data phase
+        endDataPhase();
+    }
+}
+
+void USBMassStorage::sendResponse(uint32_t len, uint32_t alloc_len)
+{
+    if (len > alloc_len) len = alloc_len;
+    if (len > m_host_length) len = m_host_length;
+
+    if (len > 0 && !m_data_in)
+    {
+        // Host wants to send data, but the command returns data
+        m_status = CSW_STATUS_PHASE_ERROR;
+        return;
+    }
+
+    m_buf_len = len;
+    m_buf_pos = 0;
+    if (len > 0) m_state = STATE_DATA_IN;
+}
+
+bool USBMassStorage::fillReadBuffer()
+{
+    uint32_t count = m_buffer_size / MSC_SECTOR_SIZE;
+    if (count > m_sectors_left) count = m_sectors_left;
+
+    if (!m_storage->readSectors(m_lba, m_buffer, count))
+    {
+        fail(SENSE_MEDIUM_ERROR, ASC_UNRECOVERED_READ_ERROR);
+        m_sectors_left = 0;
+        m_buf_len = m_buf_pos = 0;
+        return false;
+    }
+
+    m_lba += count;
+    m_sectors_left -= count;
+    m_buf_len = count * MSC_SECTOR_SIZE;
+    m_buf_pos = 0;
+    m_bytes_read += m_buf_len;
+    return true;
+}
+
+bool USBMassStorage::flushWriteBuffer()
+{
+    uint32_t count = m_buf_len / MSC_SECTOR_SIZE;
+    bool ok = true;
+
+    // After a write error the rest of the data is received but discarded
+    if (m_status == CSW_STATUS_GOOD)
+    {
+        if (m_storage->writeSectors(m_lba, m_buffer, count))
+        {
+            m_bytes_written += count * MSC_SECTOR_SIZE;
+        }
+        else
+        {
+            fail(SENSE_MEDIUM_ERROR, ASC_WRITE_FAULT);
+            ok = false;
+        }
+    }
+
+    m_lba += count;
+    m_sectors_left -= count;
+    m_buf_len = 0;
+    return ok;
+}
+
+void USBMassStorage::endDataPhase()
+{
+    if (m_transferred < m_host_length)
+    {
+        // Device transferred less data than host expected.
+        // Stalling the endpoint tells host to stop and read the CSW.
+        if (m_data_in)
+            m_in_stall = true;
+        else
+            m_out_stall = true;
+    }
+
+    m_state = STATE_CSW;
+}
+
+void USBMassStorage::executeCommand(const uint8_t *cdb)
+{
+    uint8_t opcode = cdb[0];
+
+    if (opcode == 0x00)
+    {
+        // TEST UNIT READY
+        checkReady();
+    }
+    else if (opcode == 0x03)
+    {
+        // REQUEST SENSE
+        uint8_t *r = m_buffer;
+        memset(r, 0, 18);
+        r[0] = 0x70;
+        r[2] = m_sense_key;
+        r[7] = 10;
+        r[12] = m_sense_asc;
+        setSense(SENSE_NO_SENSE, 0);
+        sendResponse(18, cdb[4]);
+    }
+    else if (opcode == 0x12)
+    {
+        // INQUIRY
+        if (cdb[1] & 0x01)
+        {
+            // Vital product data pages are not supported
+            fail(SENSE_ILLEGAL_REQUEST, ASC_INVALID_FIELD_IN_CDB);
+            return;
+        }
+
+        uint8_t *r = m_buffer;
+        memset(r, 0, 36);
+        r[0] = 0x00; // Direct access device
+        r[1] = 0x80; // Removable medium
+        r[2] = 0x04; // SPC-2
+        r[3] = 0x02; // Response data format
+        r[4] = 36 - 5;
+        memcpy(&r[8], m_vendor, sizeof(m_vendor));
+        memcpy(&r[16], m_product, sizeof(m_product));
+        memcpy(&r[32], m_revision, sizeof(m_revision));
+        sendResponse(36, ((uint32_t)cdb[3] << 8) | cdb[4]);
+    }
+    else if (opcode == 0x1A || opcode == 0x5A)
+    {
+        // MODE SENSE(6) / MODE SENSE(10), header only
+        bool wp = m_storage && m_storage->writeProtected();
+        uint8_t *r = m_buffer;
+        if (opcode == 0x1A)
+        {
+            memset(r, 0, 4);
+            r[0] = 3;
+            r[2] = wp ? 0x80 : 0;
+            sendResponse(4, cdb[4]);
+        }
+        else
+        {
+            memset(r, 0, 8);
+            r[1] = 6;
+            r[3] = wp ? 0x80 : 0;
+            sendResponse(8, ((uint32_t)cdb[7] << 8) | cdb[8]);
+        }
+    }
+    else if (opcode == 0x1B)
+    {
+        // START STOP UNIT
+        bool loej = cdb[4] & 0x02;
+        bool start = cdb[4] & 0x01;
+        if (loej && !start)
+        {
+            if (m_storage) m_storage->sync();
+            m_ejected = true;
+        }
+    }
+    else if (opcode == 0x1E)
+    {
+        // PREVENT ALLOW MEDIUM REMOVAL
+    }
+    else if (opcode == 0x23)
+    {
+        // READ FORMAT CAPACITIES
+        bool ready = m_storage && !m_ejected && m_storage->ready();
+        uint8_t *r = m_buffer;
+        memset(r, 0, 12);
+        r[3] = 8;
+        put_be32(&r[4], ready ? m_storage->sectorCount() : 0xFFFFFFFF);
+        r[8] = ready ? 0x02 : 0x03; // Formatted media / no media
+        r[10] = MSC_SECTOR_SIZE >> 8;
+        r[11] = MSC_SECTOR_SIZE & 0xFF;
+        sendResponse(12, ((uint32_t)cdb[7] << 8) | cdb[8]);
+    }
+    else if (opcode == 0x25)
+    {
+        // READ CAPACITY(10)
+        if (!checkReady()) return;
+
+        uint8_t *r = m_buffer;
+        put_be32(&r[0], m_storage->sectorCount() - 1);
+        put_be32(&r[4], MSC_SECTOR_SIZE);
+        sendResponse(8, 8);
+    }
+    else if (opcode == 0x28 || opcode == 0x2A)
+    {
+        // READ(10) / WRITE(10)
+        bool is_write = (opcode == 0x2A);
+        uint32_t lba = get_be32(&cdb[2]);
+        uint32_t count = ((uint32_t)cdb[7] << 8) | cdb[8];
+
+        if (!checkReady()) return;
+        if (!checkRange(lba, count)) return;
+
+        if (is_write && m_storage->writeProtected())
+        {
+            fail(SENSE_DATA_PROTECT, ASC_WRITE_PROTECTED);
+            return;
+        }
+
+        if (count == 0) return;
+
+        if (m_data_in == is_write || (uint64_t)count * MSC_SECTOR_SIZE > m_host_length)
+        {
+            // Direction mismatch or host buffer too small
+            m_status = CSW_STATUS_PHASE_ERROR;
+            return;
+        }
+
+        m_lba = lba;
+        m_sectors_left = count;
+        m_sector_transfer = true;
+        m_state = is_write ? STATE_DATA_OUT : STATE_DATA_IN;
+    }
+    else if (opcode == 0x2F)
+    {
+        // VERIFY(10), data is not compared
+        checkReady();
+    }
+    else if (opcode == 0x35)
+    {
+        // SYNCHRONIZE CACHE(10)
+        if (checkReady() && !m_storage->sync())
+        {
+            fail(SENSE_MEDIUM_ERROR, ASC_WRITE_FAULT);
+        }
+    }
+    else
+    {
+        fail(SENSE_ILLEGAL_REQUEST, ASC_INVALID_COMMAND);
+    }
+}
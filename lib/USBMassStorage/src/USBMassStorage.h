@@ -0,0 +1,164 @@
+/*
+ * USB mass storage class (bulk-only transport) state machine.
+ *
+ *  Copyright (c) 2023 Rabbit Hole Computing
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// This module implements the SCSI command set and the bulk-only transport
+// protocol used by USB flash drives and card readers. It does not depend on
+// any USB stack: the platform code passes bulk endpoint packets in and out.
+// This allows testing the protocol handling on a PC against a file.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef MSC_SECTOR_SIZE
+#define MSC_SECTOR_SIZE 512
+#endif
+
+// Storage accessed by the host
+class MSCStorage
+{
+public:
+    virtual ~MSCStorage() {}
+
+    // Returns false if medium is not present
+    virtual bool ready() { return true; }
+
+    virtual bool writeProtected() { return false; }
+
+    // Total number of MSC_SECTOR_SIZE sectors
+    virtual uint32_t sectorCount() = 0;
+
+    // Multi-sector transfers, count is at most buffer size / MSC_SECTOR_SIZE
+    virtual bool readSectors(uint32_t lba, uint8_t *dst, uint32_t count) = 0;
+    virtual bool writeSectors(uint32_t lba, const uint8_t *src, uint32_t count) = 0;
+
+    // Flush any cached data to the medium
+    virtual bool sync() { return true; }
+};
+
+class USBMassStorage
+{
+public:
+    USBMassStorage();
+
+    // Set storage and the buffer used for data transfers.
+    // Buffer must hold at least one sector, larger buffers allow longer
+    // multi-sector reads and writes. Storage and buffer can be NULL when
+    // no medium is available, commands then report NOT READY.
+    void setStorage(MSCStorage *storage, uint8_t *buffer, uint32_t buffer_size);
+
+    // Strings reported in INQUIRY response, padded with spaces
+    void setInquiry(const char *vendor, const char *product, const char *revision);
+
+    // Bulk-only mass storage reset request from host
+    void reset();
+
+    // Data received from host on bulk OUT endpoint
+    void packetOut(const uint8_t *data, uint32_t len);
+
+    // Get next packet to send to host on bulk IN endpoint.
+    // Returns number of bytes or 0 if there is nothing to send.
+    uint32_t packetIn(uint8_t *data, uint32_t maxlen);
+
+    // The host must clear endpoint halt before transfer can continue.
+    bool inStalled() const { return m_in_stall; }
+    bool outStalled() const { return m_out_stall; }
+    void clearInStall();
+    void clearOutStall();
+
+    // True if waiting for next command from host
+    bool idle() const { return m_state == STATE_CBW; }
+
+    // Host has requested medium to be ejected
+    bool ejected() const { return m_ejected; }
+
+    // Sense key and additional sense code of last error
+    uint8_t senseKey() const { return m_sense_key; }
+    uint8_t senseASC() const { return m_sense_asc; }
+
+    // Transfer statistics
+    uint64_t bytesRead() const { return m_bytes_read; }
+    uint64_t bytesWritten() const { return m_bytes_written; }
+
+protected:
+    enum State {
+        STATE_CBW,      // Waiting for command block wrapper
+        STATE_DATA_IN,  // Sending data to host
+        STATE_DATA_OUT, // Receiving data from host
+        STATE_CSW,      // Sending command status wrapper
+        STATE_ERROR     // Invalid command block, waiting for reset
+    };
+
+    MSCStorage *m_storage;
+    uint8_t *m_buffer;
+    uint32_t m_buffer_size;
+    uint8_t m_response_buffer[36]; // Used for responses when no buffer is set
+
+    char m_vendor[8];
+    char m_product[16];
+    char m_revision[4];
+
+    State m_state;
+    bool m_in_stall;
+    bool m_out_stall;
+    bool m_ejected;
+    bool m_unit_attention; // Medium has changed since last command
+
+    // Current command
+    uint32_t m_tag;
+    uint32_t m_host_length;   // dCBWDataTransferLength
+    uint32_t m_transferred;   // Bytes transferred in data phase
+    bool m_data_in;           // Direction requested by host
+    uint8_t m_status;         // bCSWStatus
+
+    // Data buffer state
+    uint32_t m_buf_len;       // Valid bytes in buffer
+    uint32_t m_buf_pos;       // Read / write position in buffer
+
+    // Sector transfer state for READ and WRITE commands
+    uint32_t m_lba;
+    uint32_t m_sectors_left;
+    bool m_sector_transfer;
+
+    uint8_t m_sense_key;
+    uint8_t m_sense_asc;
+
+    uint64_t m_bytes_read;
+    uint64_t m_bytes_written;
+
+    void handleCBW(const uint8_t *cbw, uint32_t len);
+    void executeCommand(const uint8_t *cdb);
+    void setSense(uint8_t key, uint8_t asc);
+    void fail(uint8_t key, uint8_t asc);
+    bool checkReady();
+    bool checkRange(uint32_t lba, uint32_t count);
+
+    // Start data phase with response in m_buffer
+    void sendResponse(uint32_t len, uint32_t alloc_len);
+
+    // Read next batch of sectors to buffer
+    bool fillReadBuffer();
+
+    // Write received sectors in buffer to storage
+    bool flushWriteBuffer();
+
+    // End data phase, stall the endpoint if host expected more data
+    void endDataPhase();
+};
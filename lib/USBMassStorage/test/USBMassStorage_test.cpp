@@ -0,0 +1,253 @@
+#include "USBMassStorage.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+/* Unit test helpers */
+#define COMMENT(x) printf("\n----" x "----\n");
+#define TEST(x) \
+    if (!(x)) { \
+        fprintf(stderr, "\033[31;1mFAILED:\033[22;39m %s:%d %s\n", __FILE__, __LINE__, #x); \
+        status = false; \
+    } else { \
+        printf("\033[32;1mOK:\033[22;39m %s\n", #x); \
+    }
+
+#define PACKET_SIZE 64
+#define CARD_SECTORS 256
+
+// SD card emulated with a temporary file
+class FileStorage: public MSCStorage
+{
+public:
+    FileStorage()
+    {
+        m_file = tmpfile();
+        uint8_t zero[MSC_SECTOR_SIZE] = {0};
+        for (int i = 0; i < CARD_SECTORS; i++) fwrite(zero, 1, sizeof(zero), m_file);
+        reads = writes = 0;
+        fail_reads = false;
+    }
+
+    ~FileStorage() { fclose(m_file); }
+
+    uint32_t sectorCount() { return CARD_SECTORS; }
+
+    bool readSectors(uint32_t lba, uint8_t *dst, uint32_t count)
+    {
+        reads++;
+        if (fail_reads) return false;
+        fseek(m_file, (long)lba * MSC_SECTOR_SIZE, SEEK_SET);
+        return fread(dst, MSC_SECTOR_SIZE, count, m_file) == count;
+    }
+
+    bool writeSectors(uint32_t lba, const uint8_t *src, uint32_t count)
+    {
+        writes++;
+        fseek(m_file, (long)lba * MSC_SECTOR_SIZE, SEEK_SET);
+        return fwrite(src, MSC_SECTOR_SIZE, count, m_file) == count;
+    }
+
+    int reads, writes;
+    bool fail_reads;
+
+private:
+    FILE *m_file;
+};
+
+// Host side of bulk-only transport
+struct TestHost
+{
+    USBMassStorage *msc;
+    uint32_t tag;
+
+    uint32_t residue;
+    uint8_t csw_status;
+    bool stalled;
+
+    // Execute a command and return CSW status, or -1 on protocol error
+    int command(const uint8_t *cdb, int cdblen, bool data_in, uint8_t *data, uint32_t datalen)
+    {
+        uint8_t cbw[31] = {'U', 'S', 'B', 'C'};
+        tag++;
+        memcpy(&cbw[4], &tag, 4);
+        memcpy(&cbw[8], &datalen, 4);
+        cbw[12] = data_in ? 0x80 : 0x00;
+        cbw[14] = cdblen;
+        memcpy(&cbw[15], cdb, cdblen);
+        msc->packetOut(cbw, sizeof(cbw));
+
+        stalled = false;
+        uint32_t pos = 0;
+        while (pos < datalen)
+        {
+            if (data_in)
+            {
+                uint8_t packet[PACKET_SIZE];
+                uint32_t len = msc->packetIn(packet, sizeof(packet));
+                if (len == 0) break;
+                memcpy(data + pos, packet, len);
+                pos += len;
+                if (len < PACKET_SIZE) break; // Short packet ends data phase
+            }
+            else
+            {
+                if (msc->outStalled()) break;
+                uint32_t len = datalen - pos;
+                if (len > PACKET_SIZE) len = PACKET_SIZE;
+                msc->packetOut(data + pos, len);
+                pos += len;
+            }
+        }
+
+        if (msc->inStalled() || msc->outStalled())
+        {
+            stalled = true;
+            msc->clearInStall();
+            msc->clearOutStall();
+        }
+
+        uint8_t csw[PACKET_SIZE];
+        uint32_t len = msc->packetIn(csw, sizeof(csw));
+        if (len != 13 || memcmp(csw, "USBS", 4) != 0 || memcmp(&csw[4], &tag, 4) != 0)
+        {
+            return -1;
+        }
+
+        memcpy(&residue, &csw[8], 4);
+        csw_status = csw[12];
+        return csw_status;
+    }
+
+    int rw10(uint8_t opcode, uint32_t lba, uint16_t count, uint8_t *data, uint32_t datalen)
+    {
+        uint8_t cdb[10] = {opcode, 0,
+            (uint8_t)(lba >> 24), (uint8_t)(lba >> 16), (uint8_t)(lba >> 8), (uint8_t)lba,
+            0, (uint8_t)(count >> 8), (uint8_t)count, 0};
+        return command(cdb, 10, opcode == 0x28, data, datalen);
+    }
+
+    uint8_t sense_key()
+    {
+        uint8_t cdb[6] = {0x03, 0, 0, 0, 18, 0};
+        uint8_t sense[18] = {0};
+        command(cdb, 6, true, sense, sizeof(sense));
+        return sense[2];
+    }
+};
+
+bool test_basics()
+{
+    bool status = true;
+    static uint8_t buffer[4096];
+    FileStorage storage;
+    USBMassStorage msc;
+    TestHost host = {&msc, 0, 0, 0, false};
+
+    COMMENT("test_basics()");
+    COMMENT("No medium");
+    uint8_t tur[6] = {0};
+    TEST(host.command(tur, 6, false, NULL, 0) == 1);
+    TEST(host.sense_key() == 0x02);
+
+    COMMENT("Medium inserted, unit attention first");
+    msc.setStorage(&storage, buffer, sizeof(buffer));
+    TEST(host.command(tur, 6, false, NULL, 0) == 1);
+    TEST(host.sense_key() == 0x06);
+    TEST(host.command(tur, 6, false, NULL, 0) == 0);
+
+    COMMENT("INQUIRY");
+    uint8_t inquiry[6] = {0x12, 0, 0, 0, 36, 0};
+    uint8_t response[36] = {0};
+    TEST(host.command(inquiry, 6, true, response, sizeof(response)) == 0);
+    TEST(response[1] == 0x80);
+    TEST(memcmp(&response[8], "ZuluSCSI", 8) == 0);
+    TEST(host.residue == 0);
+
+    COMMENT("READ CAPACITY");
+    uint8_t readcap[10] = {0x25};
+    TEST(host.command(readcap, 10, true, response, 8) == 0);
+    TEST(response[3] == CARD_SECTORS - 1 && response[6] == 0x02);
+
+    COMMENT("Host expects more data than INQUIRY returns");
+    TEST(host.command(inquiry, 6, true, response, 64) == 0);
+    TEST(host.stalled);
+    TEST(host.residue == 64 - 36);
+
+    COMMENT("Unsupported command");
+    uint8_t unknown[6] = {0x04};
+    TEST(host.command(unknown, 6, false, NULL, 0) == 1);
+    TEST(host.sense_key() == 0x05);
+
+    return status;
+}
+
+bool test_read_write()
+{
+    bool status = true;
+    static uint8_t buffer[4096];
+    FileStorage storage;
+    USBMassStorage msc;
+    TestHost host = {&msc, 0, 0, 0, false};
+    msc.setStorage(&storage, buffer, sizeof(buffer));
+    uint8_t tur[6] = {0};
+    host.command(tur, 6, false, NULL, 0);
+
+    COMMENT("test_read_write()");
+    const int count = 21; // Not a multiple of buffer size
+    static uint8_t wrdata[count * MSC_SECTOR_SIZE];
+    static uint8_t rddata[count * MSC_SECTOR_SIZE];
+    for (size_t i = 0; i < sizeof(wrdata); i++) wrdata[i] = (uint8_t)(i * 7 + i / 512);
+
+    TEST(host.rw10(0x2A, 100, count, wrdata, sizeof(wrdata)) == 0);
+    TEST(host.residue == 0);
+    TEST(storage.writes == 3); // 8 + 8 + 5 sectors
+    TEST(msc.bytesWritten() == sizeof(wrdata));
+
+    TEST(host.rw10(0x28, 100, count, rddata, sizeof(rddata)) == 0);
+    TEST(storage.reads == 3);
+    TEST(memcmp(wrdata, rddata, sizeof(wrdata)) == 0);
+
+    COMMENT("Read past end of card");
+    TEST(host.rw10(0x28, CARD_SECTORS - 1, 2, rddata, 1024) == 1);
+    TEST(host.stalled);
+    TEST(host.residue == 1024);
+    TEST(host.sense_key() == 0x05);
+
+    COMMENT("Read error");
+    storage.fail_reads = true;
+    TEST(host.rw10(0x28, 0, 1, rddata, 512) == 1);
+    TEST(host.sense_key() == 0x03);
+    storage.fail_reads = false;
+
+    COMMENT("Invalid CBW stalls until reset");
+    uint8_t garbage[31] = {0};
+    msc.packetOut(garbage, sizeof(garbage));
+    TEST(msc.inStalled() && msc.outStalled());
+    msc.clearInStall();
+    TEST(msc.inStalled());
+    msc.reset();
+    TEST(!msc.inStalled() && msc.idle());
+    TEST(host.command(tur, 6, false, NULL, 0) == 0);
+
+    COMMENT("Eject");
+    uint8_t eject[6] = {0x1B, 0, 0, 0, 0x02, 0};
+    TEST(host.command(eject, 6, false, NULL, 0) == 0);
+    TEST(msc.ejected());
+    TEST(host.command(tur, 6, false, NULL, 0) == 1);
+
+    return status;
+}
+
+int main()
+{
+    if (test_basics() && test_read_write())
+    {
+        return 0;
+    }
+    else
+    {
+        printf("Some tests failed\n");
+        return 1;
+    }
+}
@@ -25,6 +25,7 @@
 #include "ZuluSCSI_log.h"
 #include "ZuluSCSI_config.h"
 #include "greenpak.h"
+#include "scsiPhy.h"
 #include <SdFat.h>
 #include <scsi.h>
 #include <assert.h>
@@ -495,6 +496,7 @@ void platform_reset_watchdog()
 void platform_poll()
 {
     adc_poll();
+    scsiPhyCalibrationPoll();
 }
 
 uint8_t platform_get_buttons()
@@ -579,6 +581,11 @@ bool platform_rewrite_flash_page(uint32_t offset, uint8_t buffer[PLATFORM_FLASH_
     return true;
 }
 
+const uint8_t *platform_get_flash_ptr(uint32_t offset)
+{
+    return (const uint8_t*)(FLASH_BASE + offset);
+}
+
 void platform_boot_to_main_firmware()
 {
     uint32_t *mainprogram_start = (uint32_t*)(0x08000000 + PLATFORM_BOOTLOADER_SIZE);
@@ -51,6 +51,7 @@ extern const char *g_platform_name;
 #   define PLATFORM_OPTIMAL_MIN_SD_WRITE_SIZE 4096
 #   define PLATFORM_OPTIMAL_MAX_SD_WRITE_SIZE 65536
 #   define PLATFORM_OPTIMAL_LAST_SD_WRITE_SIZE 8192
+#   define PLATFORM_HAS_NONBLOCKING_SD_WRITE 1
 #   include "ZuluSCSI_v1_1_gpio.h"
 #endif
 
@@ -117,16 +118,27 @@ void platform_emergency_log_save();
 typedef void (*sd_callback_t)(uint32_t bytes_complete);
 void platform_set_sd_callback(sd_callback_t func, const uint8_t *buffer);
 
+// With PLATFORM_HAS_NONBLOCKING_SD_WRITE, SD card writes that use the callback
+// return once the transfer has started. Poll this until it returns false
+// before reusing the buffer; the callback gets called with progress meanwhile.
+// When the write has finished, *failed is set if it ended in error.
+bool platform_sd_write_pending(bool *failed);
+
 // This function is called by scsiPhy.cpp.
 // It resets the systick counter to give 1 millisecond of uninterrupted transfer time.
 // The total number of skips is kept track of to keep the correct time on average.
 void SysTick_Handle_PreEmptively();
 
+// Free running counter for timing measurements, DWT is enabled in platform_init()
+#define PLATFORM_CYCLE_COUNT() (DWT->CYCCNT)
+#define PLATFORM_CYCLES_PER_US (SystemCoreClock / 1000000)
+
 // Reprogram firmware in main program area.
 #define PLATFORM_BOOTLOADER_SIZE 32768
 #define PLATFORM_FLASH_TOTAL_SIZE (256 * 1024)
 #define PLATFORM_FLASH_PAGE_SIZE 2048
 bool platform_rewrite_flash_page(uint32_t offset, uint8_t buffer[PLATFORM_FLASH_PAGE_SIZE]);
+const uint8_t *platform_get_flash_ptr(uint32_t offset); // Current flash contents at offset
 void platform_boot_to_main_firmware();
 
 // Configuration customizations based on DIP switch settings
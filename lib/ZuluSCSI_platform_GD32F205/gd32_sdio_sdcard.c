@@ -122,6 +122,16 @@ static uint32_t totalnumber_bytes = 0, stopcondition = 0;
 static __IO sd_error_enum transerror = SD_OK;
 static __IO uint32_t transend = 0, number_bytes = 0;
 
+/* state of multiple block write started with sd_multiblocks_write_start() */
+typedef enum {
+    SD_WRITE_IDLE = 0,                    /* no write in progress */
+    SD_WRITE_DMA,                         /* DMA is moving data to SDIO FIFO */
+    SD_WRITE_DATA_END,                    /* waiting for end of data transfer on bus */
+    SD_WRITE_PROGRAMMING                  /* waiting for card to finish programming */
+} sd_write_phase_enum;
+static sd_write_phase_enum write_phase = SD_WRITE_IDLE;
+static uint32_t write_start_time = 0;
+
 /* check if the command sent error occurs */
 static sd_error_enum cmdsent_error_check(void);
 /* check if error occurs for R1 response */
@@ -145,6 +155,8 @@ static sd_error_enum sd_bus_width_config(uint32_t buswidth);
 static sd_error_enum sd_scr_get(uint16_t rca, uint32_t *pscr);
 /* get the data block size */
 static uint32_t sd_datablocksize_get(uint16_t bytesnumber);
+/* send the commands for multiple block write and configure the DSM */
+static sd_error_enum sd_multiblocks_write_setup(uint32_t *pwritebuffer, uint64_t writeaddr, uint16_t blocksize, uint32_t blocksnumber);
 
 /* configure the DMA for SDIO transfer request */
 static void dma_transfer_config(uint32_t *srcbuf, uint32_t bufsize);
@@ -941,7 +953,7 @@ sd_error_enum sd_block_write(uint32_t *pwritebuffer, uint64_t writeaddr, uint16_
 }
 
 /*!
-    \brief      write multiple blocks data to the specified address of a card
+    \brief      send the commands for multiple block write and configure the DSM
     \param[in]  pwritebuffer: a pointer that store multiple blocks data to be transferred
     \param[in]  writeaddr: the read data address
     \param[in]  blocksize: the data block size
@@ -949,14 +961,12 @@ sd_error_enum sd_block_write(uint32_t *pwritebuffer, uint64_t writeaddr, uint16_
     \param[out] none
     \retval     sd_error_enum
 */
-sd_error_enum sd_multiblocks_write(uint32_t *pwritebuffer, uint64_t writeaddr, uint16_t blocksize, uint32_t blocksnumber, sdio_callback_t callback)
+static sd_error_enum sd_multiblocks_write_setup(uint32_t *pwritebuffer, uint64_t writeaddr, uint16_t blocksize, uint32_t blocksnumber)
 {
     /* initialize the variables */
     sd_error_enum status = SD_OK;
-    uint8_t cardstate = 0;
-    uint32_t count = 0, align = 0, datablksize = SDIO_DATABLOCKSIZE_1BYTE, *ptempbuff = pwritebuffer;
-    uint32_t transbytes = 0, restwords = 0;
-    
+    uint32_t align = 0, datablksize = SDIO_DATABLOCKSIZE_1BYTE;
+
     if(NULL == pwritebuffer) {
         status = SD_PARAMETER_INVALID;
         return status;
@@ -986,16 +996,19 @@ sd_error_enum sd_multiblocks_write(uint32_t *pwritebuffer, uint64_t writeaddr, u
     align = blocksize & (blocksize - 1);
     if((blocksize > 0) && (blocksize <= 2048) && (0 == align)) {
         datablksize = sd_datablocksize_get(blocksize);
-        /* send CMD16(SET_BLOCKLEN) to set the block length */
-        sdio_csm_disable();
-        sdio_command_response_config(SD_CMD_SET_BLOCKLEN, (uint32_t)blocksize, SDIO_RESPONSETYPE_SHORT);
-        sdio_wait_type_set(SDIO_WAITTYPE_NO);
-        sdio_csm_enable();
+        /* block length of SDHC cards is fixed, CMD16 is only needed for standard capacity cards */
+        if(SDIO_HIGH_CAPACITY_SD_CARD != cardtype) {
+            /* send CMD16(SET_BLOCKLEN) to set the block length */
+            sdio_csm_disable();
+            sdio_command_response_config(SD_CMD_SET_BLOCKLEN, (uint32_t)blocksize, SDIO_RESPONSETYPE_SHORT);
+            sdio_wait_type_set(SDIO_WAITTYPE_NO);
+            sdio_csm_enable();
 
-        /* check if some error occurs */
-        status = r1_error_check(SD_CMD_SET_BLOCKLEN);
-        if(SD_OK != status) {
-            return status;
+            /* check if some error occurs */
+            status = r1_error_check(SD_CMD_SET_BLOCKLEN);
+            if(SD_OK != status) {
+                return status;
+            }
         }
     } else {
         status = SD_PARAMETER_INVALID;
@@ -1061,95 +1074,107 @@ sd_error_enum sd_multiblocks_write(uint32_t *pwritebuffer, uint64_t writeaddr, u
         sdio_data_config(SD_DATATIMEOUT, totalnumber_bytes, datablksize);
         sdio_data_transfer_config(SDIO_TRANSMODE_BLOCK, SDIO_TRANSDIRECTION_TOCARD);
         sdio_dsm_enable();
+    } else {
+        status = SD_PARAMETER_INVALID;
+    }
+    return status;
+}
 
-        if(SD_POLLING_MODE == transmode) {
-            /* polling mode */
-            while(!sdio_flag_get(SDIO_FLAG_DTCRCERR | SDIO_FLAG_DTTMOUT | SDIO_FLAG_TXURE | SDIO_FLAG_DTEND | SDIO_FLAG_STBITE)) {
-                if(RESET != sdio_flag_get(SDIO_FLAG_TFH)) {
-                    /* at least 8 words can be written into the FIFO */
-                    if(!((totalnumber_bytes - transbytes) < SD_FIFOHALF_BYTES)) {
-                        for(count = 0; count < SD_FIFOHALF_WORDS; count++) {
-                            sdio_data_write(*(ptempbuff + count));
-                        }
-                        /* 8 words(32 bytes) has been transferred */
-                        ptempbuff += SD_FIFOHALF_WORDS;
-                        transbytes += SD_FIFOHALF_BYTES;
-                    } else {
-                        restwords = (totalnumber_bytes - transbytes) / 4 + (((totalnumber_bytes - transbytes) % 4 == 0) ? 0 : 1);
-                        for(count = 0; count < restwords; count++) {
-                            sdio_data_write(*ptempbuff);
-                            ++ptempbuff;
-                            transbytes += 4;
-                        }
-                    }
-                }
-            }
+/*!
+    \brief      write multiple blocks data to the specified address of a card
+    \param[in]  pwritebuffer: a pointer that store multiple blocks data to be transferred
+    \param[in]  writeaddr: the read data address
+    \param[in]  blocksize: the data block size
+    \param[in]  blocksnumber: number of blocks that will be written
+    \param[in]  callback: called with progress while waiting, may be NULL
+    \param[out] none
+    \retval     sd_error_enum
+*/
+sd_error_enum sd_multiblocks_write(uint32_t *pwritebuffer, uint64_t writeaddr, uint16_t blocksize, uint32_t blocksnumber, sdio_callback_t callback)
+{
+    /* initialize the variables */
+    sd_error_enum status = SD_OK;
+    uint8_t cardstate = 0;
+    uint32_t count = 0, *ptempbuff = pwritebuffer;
+    uint32_t transbytes = 0, restwords = 0;
 
-            /* whether some error occurs and return it */
-            if(RESET != sdio_flag_get(SDIO_FLAG_DTCRCERR)) {
-                status = SD_DATA_CRC_ERROR;
-                sdio_flag_clear(SDIO_FLAG_DTCRCERR);
-                return status;
-            } else if(RESET != sdio_flag_get(SDIO_FLAG_DTTMOUT)) {
-                status = SD_DATA_TIMEOUT;
-                sdio_flag_clear(SDIO_FLAG_DTTMOUT);
-                return status;
-            } else if(RESET != sdio_flag_get(SDIO_FLAG_TXURE)) {
-                status = SD_TX_UNDERRUN_ERROR;
-                sdio_flag_clear(SDIO_FLAG_TXURE);
-                return status;
-            } else if(RESET != sdio_flag_get(SDIO_FLAG_STBITE)) {
-                status = SD_START_BIT_ERROR;
-                sdio_flag_clear(SDIO_FLAG_STBITE);
-                return status;
+    if(SD_DMA_MODE == transmode) {
+        /* DMA mode: start the transfer and poll until the card has finished programming */
+        uint32_t complete = 0;
+        uint8_t done = 0;
+        status = sd_multiblocks_write_start(pwritebuffer, writeaddr, blocksize, blocksnumber);
+        while((SD_OK == status) && (0 == done)) {
+            status = sd_multiblocks_write_poll(&complete, &done);
+            if (callback)
+            {
+                callback(complete);
             }
+        }
+        return status;
+    } else if(SD_POLLING_MODE != transmode) {
+        status = SD_PARAMETER_INVALID;
+        return status;
+    }
 
-            if(RESET != sdio_flag_get(SDIO_FLAG_DTEND)) {
-                if((SDIO_STD_CAPACITY_SD_CARD_V1_1 == cardtype) || (SDIO_STD_CAPACITY_SD_CARD_V2_0 == cardtype) ||
-                        (SDIO_HIGH_CAPACITY_SD_CARD == cardtype)) {
-                    /* send CMD12(STOP_TRANSMISSION) to stop transmission */
-                    sdio_csm_disable();
-                    sdio_command_response_config(SD_CMD_STOP_TRANSMISSION, (uint32_t)0x0, SDIO_RESPONSETYPE_SHORT);
-                    sdio_wait_type_set(SDIO_WAITTYPE_NO);
-                    sdio_csm_enable();
-                    /* check if some error occurs */
-                    status = r1_error_check(SD_CMD_STOP_TRANSMISSION);
-                    if(SD_OK != status) {
-                        return status;
-                    }
-                }
-            }
-            sdio_flag_clear(SDIO_MASK_INTC_FLAGS);
-        } else if(SD_DMA_MODE == transmode) {
-            /* DMA mode */
-            /* enable SDIO corresponding interrupts and DMA */
-            sdio_interrupt_enable(SDIO_INT_DTCRCERR | SDIO_INT_DTTMOUT | SDIO_INT_TXURE | SDIO_INT_DTEND | SDIO_INT_STBITE);
-            sdio_dma_enable();
-            dma_transfer_config(pwritebuffer, totalnumber_bytes);
+    status = sd_multiblocks_write_setup(pwritebuffer, writeaddr, blocksize, blocksnumber);
+    if(SD_OK != status) {
+        return status;
+    }
 
-            uint32_t start = millis();
-            while((RESET == dma_flag_get(DMA1, DMA_CH3, DMA_FLAG_FTF))) {
-                if((uint32_t)(millis() - start) > 1000) {
-                    return SD_ERROR;
-                }
-                if (callback)
-                {
-                    uint32_t complete = (totalnumber_bytes - DMA_CHCNT(DMA1, DMA_CH3) * 4);
-                    callback(complete);
+    /* polling mode */
+    while(!sdio_flag_get(SDIO_FLAG_DTCRCERR | SDIO_FLAG_DTTMOUT | SDIO_FLAG_TXURE | SDIO_FLAG_DTEND | SDIO_FLAG_STBITE)) {
+        if(RESET != sdio_flag_get(SDIO_FLAG_TFH)) {
+            /* at least 8 words can be written into the FIFO */
+            if(!((totalnumber_bytes - transbytes) < SD_FIFOHALF_BYTES)) {
+                for(count = 0; count < SD_FIFOHALF_WORDS; count++) {
+                    sdio_data_write(*(ptempbuff + count));
                 }
-            }
-            while((0 == transend) && (SD_OK == transerror)) {
-                if (callback)
-                {
-                    callback(totalnumber_bytes);
+                /* 8 words(32 bytes) has been transferred */
+                ptempbuff += SD_FIFOHALF_WORDS;
+                transbytes += SD_FIFOHALF_BYTES;
+            } else {
+                restwords = (totalnumber_bytes - transbytes) / 4 + (((totalnumber_bytes - transbytes) % 4 == 0) ? 0 : 1);
+                for(count = 0; count < restwords; count++) {
+                    sdio_data_write(*ptempbuff);
+                    ++ptempbuff;
+                    transbytes += 4;
                 }
             }
-            if(SD_OK != transerror) {
-                return transerror;
+        }
+    }
+
+    /* whether some error occurs and return it */
+    if(RESET != sdio_flag_get(SDIO_FLAG_DTCRCERR)) {
+        status = SD_DATA_CRC_ERROR;
+        sdio_flag_clear(SDIO_FLAG_DTCRCERR);
+        return status;
+    } else if(RESET != sdio_flag_get(SDIO_FLAG_DTTMOUT)) {
+        status = SD_DATA_TIMEOUT;
+        sdio_flag_clear(SDIO_FLAG_DTTMOUT);
+        return status;
+    } else if(RESET != sdio_flag_get(SDIO_FLAG_TXURE)) {
+        status = SD_TX_UNDERRUN_ERROR;
+        sdio_flag_clear(SDIO_FLAG_TXURE);
+        return status;
+    } else if(RESET != sdio_flag_get(SDIO_FLAG_STBITE)) {
+        status = SD_START_BIT_ERROR;
+        sdio_flag_clear(SDIO_FLAG_STBITE);
+        return status;
+    }
+
+    if(RESET != sdio_flag_get(SDIO_FLAG_DTEND)) {
+        if((SDIO_STD_CAPACITY_SD_CARD_V1_1 == cardtype) || (SDIO_STD_CAPACITY_SD_CARD_V2_0 == cardtype) ||
+                (SDIO_HIGH_CAPACITY_SD_CARD == cardtype)) {
+            /* send CMD12(STOP_TRANSMISSION) to stop transmission */
+            sdio_csm_disable();
+            sdio_command_response_config(SD_CMD_STOP_TRANSMISSION, (uint32_t)0x0, SDIO_RESPONSETYPE_SHORT);
+            sdio_wait_type_set(SDIO_WAITTYPE_NO);
+            sdio_csm_enable();
+            /* check if some error occurs */
+            status = r1_error_check(SD_CMD_STOP_TRANSMISSION);
+            if(SD_OK != status) {
+                return status;
             }
-        } else {
-            status = SD_PARAMETER_INVALID;
-            return status;
         }
     }
 
@@ -1167,6 +1192,96 @@ sd_error_enum sd_multiblocks_write(uint32_t *pwritebuffer, uint64_t writeaddr, u
     return status;
 }
 
+/*!
+    \brief      start writing multiple blocks in DMA mode and return without waiting,
+                the write must be completed by calling sd_multiblocks_write_poll()
+                until it reports done, before any other card access
+    \param[in]  pwritebuffer: a pointer that store multiple blocks data to be transferred,
+                must stay unmodified until the write has completed
+    \param[in]  writeaddr: the read data address
+    \param[in]  blocksize: the data block size
+    \param[in]  blocksnumber: number of blocks that will be written
+    \param[out] none
+    \retval     sd_error_enum
+*/
+sd_error_enum sd_multiblocks_write_start(uint32_t *pwritebuffer, uint64_t writeaddr, uint16_t blocksize, uint32_t blocksnumber)
+{
+    sd_error_enum status = SD_OK;
+
+    if(SD_DMA_MODE != transmode) {
+        status = SD_OPERATION_IMPROPER;
+        return status;
+    }
+
+    status = sd_multiblocks_write_setup(pwritebuffer, writeaddr, blocksize, blocksnumber);
+    if(SD_OK != status) {
+        return status;
+    }
+
+    /* enable SDIO corresponding interrupts and DMA */
+    sdio_interrupt_enable(SDIO_INT_DTCRCERR | SDIO_INT_DTTMOUT | SDIO_INT_TXURE | SDIO_INT_DTEND | SDIO_INT_STBITE);
+    sdio_dma_enable();
+    dma_transfer_config(pwritebuffer, totalnumber_bytes);
+
+    write_start_time = millis();
+    write_phase = SD_WRITE_DMA;
+    return status;
+}
+
+/*!
+    \brief      advance a write started with sd_multiblocks_write_start(), does not block
+    \param[in]  none
+    \param[out] pcomplete: number of bytes that have been read from the buffer
+    \param[out] pdone: set to 1 when the card has finished programming, 0 otherwise
+    \retval     sd_error_enum
+*/
+sd_error_enum sd_multiblocks_write_poll(uint32_t *pcomplete, uint8_t *pdone)
+{
+    sd_error_enum status = SD_OK;
+    uint8_t cardstate = 0;
+
+    *pdone = 0;
+    *pcomplete = totalnumber_bytes;
+
+    if(SD_WRITE_DMA == write_phase) {
+        if(RESET == dma_flag_get(DMA1, DMA_CH3, DMA_FLAG_FTF)) {
+            if((uint32_t)(millis() - write_start_time) > 1000) {
+                write_phase = SD_WRITE_IDLE;
+                return SD_ERROR;
+            }
+            *pcomplete = (totalnumber_bytes - DMA_CHCNT(DMA1, DMA_CH3) * 4);
+            return status;
+        }
+        write_phase = SD_WRITE_DATA_END;
+    }
+
+    if(SD_WRITE_DATA_END == write_phase) {
+        /* CMD12 is sent by the interrupt handler at end of data */
+        if(SD_OK != transerror) {
+            write_phase = SD_WRITE_IDLE;
+            return transerror;
+        }
+        if(0 == transend) {
+            return status;
+        }
+        /* clear the SDIO_INTC flags */
+        sdio_flag_clear(SDIO_MASK_INTC_FLAGS);
+        write_phase = SD_WRITE_PROGRAMMING;
+    }
+
+    if(SD_WRITE_PROGRAMMING == write_phase) {
+        /* wait the card is out of programming and receiving state */
+        status = sd_card_state_get(&cardstate);
+        if((SD_OK == status) && ((SD_CARDSTATE_PROGRAMMING == cardstate) || (SD_CARDSTATE_RECEIVING == cardstate))) {
+            return status;
+        }
+    }
+
+    write_phase = SD_WRITE_IDLE;
+    *pdone = 1;
+    return status;
+}
+
 /*!
     \brief      erase a continuous area of a card
     \param[in]  startaddr: the start address
@@ -236,6 +236,10 @@ sd_error_enum sd_multiblocks_read(uint32_t *preadbuffer, uint64_t readaddr, uint
 sd_error_enum sd_block_write(uint32_t *pwritebuffer, uint64_t writeaddr, uint16_t blocksize, sdio_callback_t callback);
 /* write multiple blocks data to the specified address of a card */
 sd_error_enum sd_multiblocks_write(uint32_t *pwritebuffer, uint64_t writeaddr, uint16_t blocksize, uint32_t blocksnumber, sdio_callback_t callback);
+/* start writing multiple blocks in DMA mode, without waiting for completion */
+sd_error_enum sd_multiblocks_write_start(uint32_t *pwritebuffer, uint64_t writeaddr, uint16_t blocksize, uint32_t blocksnumber);
+/* advance a write started with sd_multiblocks_write_start(), pdone is set when finished */
+sd_error_enum sd_multiblocks_write_poll(uint32_t *pcomplete, uint8_t *pdone);
 /* erase a continuous area of a card */
 sd_error_enum sd_erase(uint64_t startaddr, uint64_t endaddr);
 /* process all the interrupts which the corresponding flags are set */
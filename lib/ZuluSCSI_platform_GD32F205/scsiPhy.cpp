@@ -32,8 +32,11 @@
 #include "scsi_accel_sync.h"
 #include "ZuluSCSI_log.h"
 #include "ZuluSCSI_log_trace.h"
+#include "ZuluSCSI_cycletrace.h"
 #include "ZuluSCSI_config.h"
 #include <minIni.h>
+#include <SdFat.h>
+#include <string.h>
 
 #include <scsi2sd.h>
 extern "C" {
@@ -47,7 +50,8 @@ static enum {
     PHY_MODE_PIO = 1,
     PHY_MODE_DMA_TIMER = 2,
     PHY_MODE_GREENPAK_PIO = 3,
-    PHY_MODE_GREENPAK_DMA = 4
+    PHY_MODE_GREENPAK_DMA = 4,
+    PHY_MODE_COUNT
 } g_scsi_phy_mode;
 static const char *g_scsi_phy_mode_names[] = {
     "Unknown", "PIO", "DMA_TIMER", "GREENPAK_PIO", "GREENPAK_DMA"
@@ -142,9 +146,355 @@ static void scsi_rst_assert_interrupt()
     {
         dbgmsg("BUS RESET");
         scsiDev.resetFlag = 1;
+        g_scsi_bus_reset_count++;
     }
 }
 
+/*************************/
+/* PHY mode calibration  */
+/*************************/
+
+// When PhyMode is not set in the configuration file, each available mode
+// is measured on READ BUFFER transfers, which tools such as sg_test_rwbuf
+// use for testing the SCSI bus. Their data comes from RAM and is known to
+// the host, so the measurement does not include SD card latency and live
+// data is never sent using an untested mode. Other transfers keep using the
+// default mode. The fastest mode that did not repeatedly time out is saved
+// in PHYMODEFILE and used directly on later boots.
+//
+// This cannot be done as a self-test at boot, because the timing depends
+// on the host and cabling and there is no initiator to transfer with. Until
+// enough READ BUFFER data has been transferred, which with normal hosts may
+// be never, the default mode that selectPhyMode() picks for
+// PHY_MODE_BEST_AVAILABLE stays in use. That is the same mode that would
+// be used without calibration support.
+//
+// A bus reset from the host during a transfer, e.g. a host reboot, is not
+// counted as a PHY failure. Synchronous mode is disabled only after several
+// synchronous transfers in a row have been interrupted.
+//
+// Both results are stored together with the firmware version and the
+// modification time of CONFIGFILE, and are ignored after either changes.
+#define PHY_CALIBRATION_BYTES (1024 * 1024)
+#define PHY_CALIBRATION_MIN_TRANSFER 4096
+#define PHY_CALIBRATION_MAX_ERRORS 3
+#define PHY_SYNC_MAX_FAILURES 3
+
+extern SdFs SD;
+
+// Incremented on every bus reset from host
+static volatile uint32_t g_scsi_bus_reset_count;
+
+static struct {
+    enum { CALIB_IDLE = 0, CALIB_RUNNING, CALIB_DONE } state;
+    bool save_pending; // Result should be written to SD card
+    bool switch_pending; // Change to live_mode before next transfer
+    bool sync_failed; // Synchronous transfer has failed, negotiate async only
+    uint8_t sync_failures; // Interrupted synchronous transfers in a row
+    uint8_t candidates[PHY_MODE_COUNT];
+    uint8_t num_candidates;
+    uint8_t index; // Index of the candidate being measured
+    uint8_t winner;
+    uint8_t live_mode; // Mode used for all transfers that are not measured
+
+    uint32_t bytes[PHY_MODE_COUNT];
+    uint32_t time_us[PHY_MODE_COUNT];
+    uint32_t errors[PHY_MODE_COUNT];
+
+    // Transfer currently being measured
+    uint32_t xfer_start;
+    uint32_t xfer_bytes;
+    uint32_t xfer_resets;
+    bool xfer_sync;
+    bool xfer_calib; // Transfer uses a candidate mode
+} g_phy_calib;
+
+static bool isPhyModeAvailable(int mode)
+{
+    switch (mode)
+    {
+        case PHY_MODE_PIO: return true;
+#ifdef SCSI_ACCEL_DMA_AVAILABLE
+        case PHY_MODE_DMA_TIMER: return true;
+        case PHY_MODE_GREENPAK_DMA: return greenpak_is_ready();
+#endif
+        case PHY_MODE_GREENPAK_PIO: return greenpak_is_ready();
+        default: return false;
+    }
+}
+
+static void phyConfigTimestamp(uint16_t *date, uint16_t *time)
+{
+    *date = *time = 0;
+    FsFile file = SD.open(CONFIGFILE, O_RDONLY);
+    if (file.isOpen())
+    {
+        file.getModifyDateTime(date, time);
+        file.close();
+    }
+}
+
+// Check that PHYMODEFILE was saved by this firmware with the current configuration
+static bool phyCalibrationFileCurrent()
+{
+    char firmware[64];
+    uint16_t date, time;
+    ini_gets("SCSI", "Firmware", "", firmware, sizeof(firmware), PHYMODEFILE);
+    phyConfigTimestamp(&date, &time);
+
+    return strcmp(firmware, g_log_firmwareversion) == 0 &&
+           ini_getl("SCSI", "ConfigDate", -1, PHYMODEFILE) == date &&
+           ini_getl("SCSI", "ConfigTime", -1, PHYMODEFILE) == time;
+}
+
+// Returns the mode that calibration wants to use for live transfers
+static int phyCalibrationSelect()
+{
+    if (g_phy_calib.state == g_phy_calib.CALIB_RUNNING)
+    {
+        return PHY_MODE_BEST_AVAILABLE;
+    }
+    else if (g_phy_calib.state == g_phy_calib.CALIB_DONE)
+    {
+        return g_phy_calib.winner;
+    }
+
+    int cached = PHY_MODE_BEST_AVAILABLE;
+    g_phy_calib.sync_failed = false;
+    if (SD.exists(PHYMODEFILE))
+    {
+        if (phyCalibrationFileCurrent())
+        {
+            cached = ini_getl("SCSI", "PhyMode", PHY_MODE_BEST_AVAILABLE, PHYMODEFILE);
+            g_phy_calib.sync_failed = ini_getbool("SCSI", "SyncFailed", 0, PHYMODEFILE);
+        }
+        else
+        {
+            // Overwrite the stale results so that sync mode is retried
+            logmsg(PHYMODEFILE " was saved with different firmware or " CONFIGFILE ", ignoring it");
+            g_phy_calib.save_pending = true;
+        }
+    }
+    if (cached != PHY_MODE_BEST_AVAILABLE && isPhyModeAvailable(cached))
+    {
+        logmsg("SCSI PHY mode ", g_scsi_phy_mode_names[cached], " loaded from " PHYMODEFILE);
+        g_phy_calib.state = g_phy_calib.CALIB_DONE;
+        g_phy_calib.winner = cached;
+        return cached;
+    }
+
+    g_phy_calib.num_candidates = 0;
+    for (int mode = PHY_MODE_PIO; mode < PHY_MODE_COUNT; mode++)
+    {
+        if (isPhyModeAvailable(mode))
+        {
+            g_phy_calib.candidates[g_phy_calib.num_candidates++] = mode;
+        }
+    }
+
+    if (g_phy_calib.num_candidates <= 1)
+    {
+        g_phy_calib.state = g_phy_calib.CALIB_DONE;
+        g_phy_calib.winner = PHY_MODE_BEST_AVAILABLE;
+        return PHY_MODE_BEST_AVAILABLE;
+    }
+
+    logmsg("SCSI PHY calibration of ", (int)g_phy_calib.num_candidates, " modes waits for READ BUFFER"
+           " transfers from host, e.g. sg_test_rwbuf. Set PhyMode in " CONFIGFILE " to skip it.");
+    g_phy_calib.state = g_phy_calib.CALIB_RUNNING;
+    g_phy_calib.index = 0;
+    return PHY_MODE_BEST_AVAILABLE;
+}
+
+static void phyModeInit()
+{
+    scsi_accel_dma_stopWrite();
+
+    if (g_scsi_phy_mode == PHY_MODE_DMA_TIMER)
+    {
+        scsi_accel_timer_dma_init();
+    }
+    else if (g_scsi_phy_mode == PHY_MODE_GREENPAK_DMA)
+    {
+        scsi_accel_greenpak_dma_init();
+    }
+}
+
+static void phyCalibrationSetMode(int mode)
+{
+    if (g_scsi_phy_mode != mode)
+    {
+        g_scsi_phy_mode = (typeof(g_scsi_phy_mode))mode;
+        phyModeInit();
+    }
+}
+
+// Called before a new transfer is started, when no write is queued or in progress
+static void phyCalibrationSwitchMode(bool read_buffer)
+{
+    g_phy_calib.switch_pending = false;
+
+    if (g_phy_calib.state == g_phy_calib.CALIB_RUNNING && read_buffer)
+    {
+        phyCalibrationSetMode(g_phy_calib.candidates[g_phy_calib.index]);
+        g_phy_calib.xfer_calib = true;
+    }
+    else
+    {
+        phyCalibrationSetMode(g_phy_calib.live_mode);
+    }
+}
+
+static void phyCalibrationStart(uint32_t count, bool use_sync_mode)
+{
+    if (!g_phy_calib.xfer_calib && !use_sync_mode)
+    {
+        return;
+    }
+
+    if (g_phy_calib.xfer_bytes == 0)
+    {
+        g_phy_calib.xfer_start = DWT->CYCCNT;
+        g_phy_calib.xfer_resets = g_scsi_bus_reset_count;
+        g_phy_calib.xfer_sync = false;
+    }
+    g_phy_calib.xfer_bytes += count;
+    g_phy_calib.xfer_sync |= use_sync_mode;
+}
+
+static void phyCalibrationNextMode()
+{
+    int mode = g_scsi_phy_mode;
+    uint32_t speed = 0;
+    if (g_phy_calib.time_us[mode] > 0)
+    {
+        speed = (uint64_t)g_phy_calib.bytes[mode] * 1000 / g_phy_calib.time_us[mode];
+    }
+    logmsg("-- SCSI PHY mode ", g_scsi_phy_mode_names[mode], ": ", (int)speed, " kB/s, ",
+           (int)g_phy_calib.errors[mode], " errors");
+
+    if (++g_phy_calib.index < g_phy_calib.num_candidates)
+    {
+        return;
+    }
+
+    // All candidates measured, select the fastest one that did not fail repeatedly
+    uint32_t best_speed = 0;
+    int best_mode = PHY_MODE_PIO;
+    for (int i = 0; i < g_phy_calib.num_candidates; i++)
+    {
+        int m = g_phy_calib.candidates[i];
+        if (g_phy_calib.errors[m] < PHY_CALIBRATION_MAX_ERRORS && g_phy_calib.time_us[m] > 0)
+        {
+            uint32_t s = (uint64_t)g_phy_calib.bytes[m] * 1000 / g_phy_calib.time_us[m];
+            if (s > best_speed)
+            {
+                best_speed = s;
+                best_mode = m;
+            }
+        }
+    }
+
+    g_phy_calib.state = g_phy_calib.CALIB_DONE;
+    g_phy_calib.winner = best_mode;
+    g_phy_calib.live_mode = best_mode;
+    g_phy_calib.save_pending = true;
+    logmsg("SCSI PHY operating mode: ", g_scsi_phy_mode_names[best_mode], " selected by calibration");
+}
+
+// Called when a write has finished, can change PHY mode as all transfers are done
+static void phyCalibrationFinish()
+{
+    uint32_t bytes = g_phy_calib.xfer_bytes;
+    uint32_t time_us = (DWT->CYCCNT - g_phy_calib.xfer_start) / (SystemCoreClock / 1000000);
+    bool host_reset = (g_scsi_bus_reset_count != g_phy_calib.xfer_resets);
+    bool calib = g_phy_calib.xfer_calib;
+    g_phy_calib.xfer_bytes = 0;
+    g_phy_calib.xfer_calib = false;
+
+    if (g_phy_calib.xfer_sync)
+    {
+        // Synchronous transfers do not depend on PHY mode, only check for errors.
+        // A hung transfer ends with a bus reset from host, which a host reboot
+        // also causes, so only repeated failures with no success in between count.
+        if (!scsiDev.resetFlag)
+        {
+            g_phy_calib.sync_failures = 0;
+        }
+        else if (++g_phy_calib.sync_failures >= PHY_SYNC_MAX_FAILURES && !g_phy_calib.sync_failed)
+        {
+            logmsg("Synchronous transfer failed ", (int)g_phy_calib.sync_failures, " times in a row, disabling sync mode");
+            g_phy_calib.sync_failed = true;
+            g_phy_calib.save_pending = true;
+            scsiDev.boardCfg.scsiSpeed = S2S_CFG_SPEED_ASYNC_50;
+        }
+        return;
+    }
+
+    if (!calib || g_phy_calib.state != g_phy_calib.CALIB_RUNNING)
+    {
+        return;
+    }
+
+    // Go back to the default mode before any other transfer
+    g_phy_calib.switch_pending = true;
+
+    int mode = g_scsi_phy_mode;
+    if (host_reset)
+    {
+        // Not caused by this end, discard measurement
+        return;
+    }
+    else if (scsiDev.resetFlag)
+    {
+        // Transfer was aborted by timeout in the PHY code
+        g_phy_calib.errors[mode]++;
+    }
+    else if (bytes >= PHY_CALIBRATION_MIN_TRANSFER)
+    {
+        g_phy_calib.bytes[mode] += bytes;
+        g_phy_calib.time_us[mode] += time_us;
+    }
+
+    if (g_phy_calib.errors[mode] >= PHY_CALIBRATION_MAX_ERRORS ||
+        g_phy_calib.bytes[mode] >= PHY_CALIBRATION_BYTES)
+    {
+        phyCalibrationNextMode();
+    }
+}
+
+// Store calibration result on SD card, called from platform_poll().
+// platform_poll() also runs in the middle of transfers while waiting for
+// SD card or SCSI bus, so the file is only written when the bus is free.
+extern "C" void scsiPhyCalibrationPoll()
+{
+    if (!g_phy_calib.save_pending) return;
+    if (scsiDev.phase != BUS_FREE || g_scsi_sts_selection) return;
+    g_phy_calib.save_pending = false;
+
+    FsFile file = SD.open(PHYMODEFILE, O_WRONLY | O_CREAT | O_TRUNC);
+    if (!file.isOpen())
+    {
+        logmsg("Failed to save SCSI PHY calibration to " PHYMODEFILE);
+        return;
+    }
+
+    uint16_t date, time;
+    phyConfigTimestamp(&date, &time);
+
+    char buf[192];
+    int len = snprintf(buf, sizeof(buf),
+                       "[SCSI]\r\nPhyMode = %d\r\nSyncFailed = %d\r\n"
+                       "Firmware = %s\r\nConfigDate = %u\r\nConfigTime = %u\r\n",
+                       (g_phy_calib.state == g_phy_calib.CALIB_DONE) ? (int)g_phy_calib.winner : 0,
+                       g_phy_calib.sync_failed ? 1 : 0,
+                       g_log_firmwareversion, (unsigned)date, (unsigned)time);
+    if (len >= (int)sizeof(buf)) len = sizeof(buf) - 1;
+    file.write(buf, len);
+    file.close();
+    logmsg("SCSI PHY calibration saved to " PHYMODEFILE);
+}
+
 static void selectPhyMode()
 {
     int oldmode = g_scsi_phy_mode;
@@ -154,6 +504,17 @@ static void selectPhyMode()
     // Read overriding setting from configuration file
     int wanted_mode = ini_getl("SCSI", "PhyMode", default_mode, CONFIGFILE);
 
+    if (wanted_mode == PHY_MODE_BEST_AVAILABLE)
+    {
+        // Use mode that has been measured to work best on this unit
+        wanted_mode = phyCalibrationSelect();
+    }
+
+    if (g_phy_calib.sync_failed)
+    {
+        scsiDev.boardCfg.scsiSpeed = S2S_CFG_SPEED_ASYNC_50;
+    }
+
     // Default: software GPIO bitbang, available on all revisions
     g_scsi_phy_mode = PHY_MODE_PIO;
     
@@ -187,8 +548,11 @@ static void selectPhyMode()
 
     if (g_scsi_phy_mode != oldmode)
     {
-        logmsg("SCSI PHY operating mode: ", g_scsi_phy_mode_names[g_scsi_phy_mode]);
+        logmsg("SCSI PHY operating mode: ", g_scsi_phy_mode_names[g_scsi_phy_mode],
+               (g_phy_calib.state == g_phy_calib.CALIB_RUNNING) ? ", default until calibration completes" : "");
     }
+
+    g_phy_calib.live_mode = g_scsi_phy_mode;
 }
 
 extern "C" void scsiPhyReset(void)
@@ -199,6 +563,9 @@ extern "C" void scsiPhyReset(void)
     g_scsi_sts_selection = 0;
     g_scsi_ctrl_bsy = 0;
     g_scsi_writereq.count = 0;
+    g_phy_calib.xfer_bytes = 0;
+    g_phy_calib.xfer_calib = false;
+    g_phy_calib.switch_pending = false;
     init_irqs();
 
 #ifdef SCSI_SYNC_MODE_AVAILABLE
@@ -206,15 +573,7 @@ extern "C" void scsiPhyReset(void)
 #endif
 
     selectPhyMode();
-
-    if (g_scsi_phy_mode == PHY_MODE_DMA_TIMER)
-    {
-        scsi_accel_timer_dma_init();
-    }
-    else if (g_scsi_phy_mode == PHY_MODE_GREENPAK_DMA)
-    {
-        scsi_accel_greenpak_dma_init();
-    }
+    phyModeInit();
 }
 
 /************************/
@@ -237,6 +596,8 @@ extern "C" uint32_t scsiEnterPhaseImmediate(int phase)
 {
     if (phase != g_scsi_phase)
     {
+        CYCLE_TRACE(TRACE_PHASE, phase, scsiDev.cdb[0]);
+
         // ANSI INCITS 362-2002 SPI-3 10.7.1:
         // Phase changes are not allowed while REQ or ACK is asserted.
         while (likely(!scsiDev.resetFlag) && SCSI_IN(ACK)) {}
@@ -343,6 +704,14 @@ extern "C" void scsiStartWrite(const uint8_t* data, uint32_t count)
 
     g_scsi_writereq.use_sync_mode = (g_scsi_phase == DATA_IN && scsiDev.target->syncOffset > 0);
 
+    if ((g_phy_calib.switch_pending || g_phy_calib.state == g_phy_calib.CALIB_RUNNING) &&
+        g_scsi_writereq.count == 0 && g_phy_calib.xfer_bytes == 0 &&
+        scsi_accel_dma_isWriteFinished(NULL))
+    {
+        phyCalibrationSwitchMode(g_scsi_phase == DATA_IN && scsiDev.cdb[0] == 0x3C &&
+                                 !g_scsi_writereq.use_sync_mode);
+    }
+
     if (g_scsi_phy_mode == PHY_MODE_PIO
         || g_scsi_phy_mode == PHY_MODE_GREENPAK_PIO
         || g_scsi_writereq.use_sync_mode)
@@ -357,6 +726,7 @@ extern "C" void scsiStartWrite(const uint8_t* data, uint32_t count)
             {
                 // Combine with previous one
                 g_scsi_writereq.count += count;
+                phyCalibrationStart(count, g_scsi_writereq.use_sync_mode);
                 return;
             }
             else
@@ -378,6 +748,10 @@ extern "C" void scsiStartWrite(const uint8_t* data, uint32_t count)
     {
         logmsg("Unknown SCSI PHY mode: ", (int)g_scsi_phy_mode);
     }
+
+    // Done after any queued write has been flushed above, so that
+    // measurement covers the whole transfer up to scsiFinishWrite().
+    phyCalibrationStart(count, g_scsi_writereq.use_sync_mode);
 }
 
 static void processPollingWrite(uint32_t count)
@@ -500,6 +874,13 @@ extern "C" void scsiFinishWrite()
     {
         scsi_accel_dma_finishWrite(&scsiDev.resetFlag);
     }
+
+    CYCLE_TRACE(TRACE_SCSI_WRITE_DONE, 0, 0);
+
+    if (g_phy_calib.xfer_bytes > 0)
+    {
+        phyCalibrationFinish();
+    }
 }
 
 /*********************/
@@ -560,6 +941,7 @@ extern "C" void scsiRead(uint8_t* data, uint32_t count, int* parityError)
         }
     }
 
+    CYCLE_TRACE(TRACE_SCSI_READ_DONE, 0, count);
     scsiLogDataOut(data, count);
 }
 
@@ -55,6 +55,10 @@ extern volatile uint8_t g_scsi_ctrl_bsy;
 // Called when SCSI RST signal has been asserted, should release bus.
 void scsiPhyReset(void);
 
+// Save result of automatic PHY mode calibration, called from platform_poll().
+// Does nothing unless the bus is free.
+void scsiPhyCalibrationPoll(void);
+
 // Change MSG / CD / IO signal states and wait for necessary transition time.
 // Phase argument is one of SCSI_PHASE enum values.
 void scsiEnterPhase(int phase);
@@ -39,6 +39,7 @@ static uint32_t g_sdio_clk_kHz;
 static sdio_card_type_enum g_sdio_card_type;
 static uint16_t g_sdio_card_rca;
 static uint32_t g_sdio_sector_count;
+static bool g_sdio_use_dma;
 
 #define checkReturnOk(call) ((g_sdio_error = (call)) == SD_OK ? true : logSDError(__LINE__))
 static bool logSDError(int line)
@@ -48,6 +49,64 @@ static bool logSDError(int line)
     return false;
 }
 
+// Multiblock write that continues after writeSectors() has returned.
+// Any other card access waits for it to finish first.
+static bool g_sdio_write_pending;
+static bool g_sdio_write_failed;
+static sdio_callback_t g_sdio_write_callback;
+
+// Advance background write, returns true while it is in progress
+static bool sdioWritePoll()
+{
+    if (!g_sdio_write_pending)
+    {
+        return false;
+    }
+
+    uint32_t complete = 0;
+    uint8_t done = 0;
+    if (!checkReturnOk(sd_multiblocks_write_poll(&complete, &done)))
+    {
+        g_sdio_write_pending = false;
+        g_sdio_write_failed = true;
+        return false;
+    }
+
+    if (g_sdio_write_callback)
+    {
+        g_sdio_write_callback(complete);
+    }
+
+    if (done)
+    {
+        g_sdio_write_pending = false;
+    }
+
+    return g_sdio_write_pending;
+}
+
+// Wait for background write to finish before next card access.
+// Returns false if it failed and nobody has been told yet.
+static bool sdioWriteFinish()
+{
+    while (sdioWritePoll());
+
+    bool failed = g_sdio_write_failed;
+    g_sdio_write_failed = false;
+    return !failed;
+}
+
+bool platform_sd_write_pending(bool *failed)
+{
+    if (sdioWritePoll())
+    {
+        return true;
+    }
+
+    *failed = !sdioWriteFinish();
+    return false;
+}
+
 bool SdioCard::begin(SdioConfig sdioConfig)
 {
     rcu_periph_clock_enable(RCU_SDIO);
@@ -62,6 +121,9 @@ bool SdioCard::begin(SdioConfig sdioConfig)
         return false;
     }
 
+    g_sdio_use_dma = sdioConfig.useDma();
+    g_sdio_write_pending = false;
+    g_sdio_write_failed = false;
     return checkReturnOk(sd_card_information_get_short(&g_sdio_card_type, &g_sdio_card_rca))
         && checkReturnOk(sd_card_select_deselect(g_sdio_card_rca))
         && checkReturnOk(sd_cardstatus_get(&g_sdio_card_status))
@@ -90,6 +152,9 @@ uint32_t SdioCard::errorLine() const
 
 bool SdioCard::isBusy() 
 {
+    if (g_sdio_write_pending)
+        return true;
+
     return (GPIO_ISTAT(SD_SDIO_DATA_PORT) & SD_SDIO_D0) == 0;
 }
 
@@ -114,6 +179,9 @@ bool SdioCard::readOCR(uint32_t* ocr)
 {
     // SDIO mode does not have CMD58, but main program uses this to
     // poll for card presence. Return status register instead.
+    if (!sdioWriteFinish())
+        return false;
+
     return sd_cardstatus_get(ocr) == SD_OK;
 }
 
@@ -145,7 +213,7 @@ uint32_t SdioCard::sectorCount()
 uint32_t SdioCard::status()
 {
     uint32_t status = 0;
-    if (!checkReturnOk(sd_cardstatus_get(&status)))
+    if (!sdioWriteFinish() || !checkReturnOk(sd_cardstatus_get(&status)))
         return 0;
     else
         return status;
@@ -153,7 +221,7 @@ uint32_t SdioCard::status()
 
 bool SdioCard::stopTransmission(bool blocking)
 {
-    if (!checkReturnOk(sd_transfer_stop()))
+    if (!sdioWriteFinish() || !checkReturnOk(sd_transfer_stop()))
         return false;
 
     if (!blocking)
@@ -180,6 +248,11 @@ bool SdioCard::stopTransmission(bool blocking)
 
 bool SdioCard::syncDevice()
 {
+    if (!sdioWriteFinish())
+    {
+        return false;
+    }
+
     if (sd_transfer_state_get() != SD_NO_TRANSFER)
     {
         return stopTransmission(true);
@@ -217,7 +290,7 @@ bool SdioCard::writeStop()
 
 bool SdioCard::erase(uint32_t firstSector, uint32_t lastSector)
 {
-    return checkReturnOk(sd_erase(firstSector * 512, lastSector * 512));
+    return sdioWriteFinish() && checkReturnOk(sd_erase((uint64_t)firstSector * 512, (uint64_t)lastSector * 512));
 }
 
 bool SdioCard::cardCMD6(uint32_t arg, uint8_t* status) {
@@ -278,24 +351,43 @@ static sdio_callback_t get_stream_callback(const uint8_t *buf, uint32_t count, c
 
 bool SdioCard::writeSector(uint32_t sector, const uint8_t* src)
 {
-    return checkReturnOk(sd_block_write((uint32_t*)src, (uint64_t)sector * 512, 512,
+    return sdioWriteFinish() && checkReturnOk(sd_block_write((uint32_t*)src, (uint64_t)sector * 512, 512,
         get_stream_callback(src, 512, "writeSector", sector)));
 }
 
 bool SdioCard::writeSectors(uint32_t sector, const uint8_t* src, size_t n)
 {
-    return checkReturnOk(sd_multiblocks_write((uint32_t*)src, (uint64_t)sector * 512, 512, n,
-        get_stream_callback(src, n * 512, "writeSectors", sector)));
+    if (!sdioWriteFinish())
+    {
+        return false;
+    }
+
+    sdio_callback_t callback = get_stream_callback(src, n * 512, "writeSectors", sector);
+    if (callback && g_sdio_use_dma)
+    {
+        // Streaming write from SCSI bus: return while DMA is still running,
+        // caller polls platform_sd_write_pending() before reusing the buffer.
+        g_sdio_write_callback = callback;
+        g_sdio_write_pending = checkReturnOk(sd_multiblocks_write_start((uint32_t*)src, (uint64_t)sector * 512, 512, n));
+        return g_sdio_write_pending;
+    }
+
+    return checkReturnOk(sd_multiblocks_write((uint32_t*)src, (uint64_t)sector * 512, 512, n, callback));
 }
 
 bool SdioCard::readSector(uint32_t sector, uint8_t* dst)
 {
-    return checkReturnOk(sd_block_read((uint32_t*)dst, (uint64_t)sector * 512, 512,
+    return sdioWriteFinish() && checkReturnOk(sd_block_read((uint32_t*)dst, (uint64_t)sector * 512, 512,
         get_stream_callback(dst, 512, "readSector", sector)));
 }
 
 bool SdioCard::readSectors(uint32_t sector, uint8_t* dst, size_t n)
 {
+    if (!sdioWriteFinish())
+    {
+        return false;
+    }
+
     if (sector + n >= g_sdio_sector_count)
     {
         // sd_multiblocks_read() seems to have trouble reading the very last sector
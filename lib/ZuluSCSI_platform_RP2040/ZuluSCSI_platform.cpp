@@ -29,6 +29,8 @@
 #include <hardware/uart.h>
 #include <hardware/pll.h>
 #include <hardware/clocks.h>
+#include <hardware/vreg.h>
+#include <hardware/watchdog.h>
 #include <hardware/spi.h>
 #include <hardware/adc.h>
 #include <hardware/flash.h>
@@ -39,6 +41,7 @@
 #include <USB/PluggableUSBSerial.h>
 #include "audio.h"
 #include "scsi_accel_target.h"
+#include "usb_msc.h"
 
 extern "C" {
 
@@ -67,13 +70,79 @@ static void gpio_conf(uint gpio, enum gpio_function fn, bool pullup, bool pulldo
     }
 }
 
-#ifdef ENABLE_AUDIO_OUTPUT
-// Increases clk_sys and clk_peri to 135.428571MHz at runtime to support
-// division to audio output rates. Invoke before anything is using clk_peri
-// except for the logging UART, which is handled below.
-static void reclock_for_audio() {
+/*****************************************/
+/* System clock profiles                 */
+/*****************************************/
+
+uint16_t g_scsi_pio_clkdiv = 0x100;
+uint32_t g_scsi_pio_cycle_ps = 8000;
+uint16_t g_sdio_clkdiv = 0x100;
+uint8_t g_delay_100ns_loops = 0;
+
+typedef struct {
+    const char *name;
+    uint32_t sys_hz;
+    uint32_t vco_hz;
+    uint8_t postdiv1;
+    uint8_t postdiv2;
+    enum vreg_voltage voltage;
+    bool peri_from_sys; // clk_peri follows clk_sys, otherwise 48 MHz from pll_usb
+    uint16_t scsi_pio_clkdiv; // 8.8 fixed point, SCSI PIO clock is sys_hz / scsi_pio_clkdiv
+    uint16_t sdio_clkdiv; // 8.8 fixed point, SD card clock is sys_hz / 5 / sdio_clkdiv
+} clock_profile_t;
+
+// Indexes match RP2040_CLOCK_* in ZuluSCSI_platform.h
+// SCSI PIO clock is kept between 125 and 135.43 MHz, and SD card clock at
+// most 25 MHz because the card is not switched to high speed mode.
+// Fractional dividers average to the target rate with one system clock of jitter.
+static const clock_profile_t g_clock_profiles[] = {
+    {"125 MHz",         125000000, 1500000000, 6, 2, VREG_VOLTAGE_1_10, true,  0x100, 0x100}, // 125 MHz, 25 MHz
+    // Audio profile allows division to audio output rates
+    {"135.428571 MHz",  135428571,  948000000, 7, 1, VREG_VOLTAGE_1_10, true,  0x100, 0x116}, // 135.4 MHz, 24.9 MHz
+    {"150 MHz",         150000000, 1500000000, 5, 2, VREG_VOLTAGE_1_10, false, 0x133, 0x134}, // 125.1 MHz, 24.9 MHz
+    {"200 MHz",         200000000, 1200000000, 6, 1, VREG_VOLTAGE_1_15, false, 0x199, 0x19A}, // 125.2 MHz, 25.0 MHz
+    {"250 MHz",         250000000, 1500000000, 6, 1, VREG_VOLTAGE_1_20, false, 0x200, 0x200}, // 125 MHz, 25 MHz
+};
+
+// Watchdog scratch register survives the reset done by crash handler.
+// It marks a clock profile whose startup has not completed yet, so that
+// a profile that crashes the system is not tried again on next boot.
+#define CLOCK_PROFILE_SCRATCH 2
+#define CLOCK_PROFILE_MAGIC 0x434C4B00
+#define CLOCK_PROFILE_CONFIRM_MS 10000
+
+static int g_clock_profile = RP2040_CLOCK_125MHZ;
+static bool g_clock_profile_confirmed = false;
+static enum vreg_voltage g_core_voltage = VREG_VOLTAGE_DEFAULT;
+
+// Recompute dividers and delays that depend on the system clock
+static void update_clock_dividers(const clock_profile_t *profile)
+{
+    g_scsi_pio_clkdiv = profile->scsi_pio_clkdiv;
+    g_scsi_pio_cycle_ps = (uint32_t)(1000000000000ULL * g_scsi_pio_clkdiv / 256 / profile->sys_hz);
+    g_sdio_clkdiv = profile->sdio_clkdiv;
+
+    // delay_100ns() covers about 13 cycles with its nops,
+    // one extra loop iteration takes about 3 cycles.
+    uint32_t cycles = profile->sys_hz / 10000000;
+    g_delay_100ns_loops = (cycles > 13) ? (cycles - 13 + 2) / 3 : 0;
+}
+
+// Change clk_sys and clk_peri at runtime. Invoke before anything is using
+// clk_peri except for the logging UART, which is handled below.
+static void set_clock_profile(const clock_profile_t *profile)
+{
     // ensure UART is fully drained before we mess up its clock
     uart_tx_wait_blocking(uart0);
+
+    // Core voltage must be raised before and lowered after changing clock
+    if (profile->voltage > g_core_voltage)
+    {
+        vreg_set_voltage(profile->voltage);
+        g_core_voltage = profile->voltage;
+        busy_wait_us(1000);
+    }
+
     // switch clk_sys and clk_peri to pll_usb
     // see code in 2.15.6.1 of the datasheet for useful comments
     clock_configure(clk_sys,
@@ -86,23 +155,130 @@ static void reclock_for_audio() {
             CLOCKS_CLK_PERI_CTRL_AUXSRC_VALUE_CLKSRC_PLL_USB,
             48 * MHZ,
             48 * MHZ);
-    // reset PLL for 135.428571MHz
-    pll_init(pll_sys, 1, 948000000, 7, 1);
+    // reset PLL for the new frequency
+    pll_init(pll_sys, 1, profile->vco_hz, profile->postdiv1, profile->postdiv2);
     // switch clocks back to pll_sys
     clock_configure(clk_sys,
             CLOCKS_CLK_SYS_CTRL_SRC_VALUE_CLKSRC_CLK_SYS_AUX,
             CLOCKS_CLK_SYS_CTRL_AUXSRC_VALUE_CLKSRC_PLL_SYS,
-            135428571,
-            135428571);
-    clock_configure(clk_peri,
-            0,
-            CLOCKS_CLK_PERI_CTRL_AUXSRC_VALUE_CLKSRC_PLL_SYS,
-            135428571,
-            135428571);
+            profile->sys_hz,
+            profile->sys_hz);
+    if (profile->peri_from_sys)
+    {
+        clock_configure(clk_peri,
+                0,
+                CLOCKS_CLK_PERI_CTRL_AUXSRC_VALUE_CLKSRC_PLL_SYS,
+                profile->sys_hz,
+                profile->sys_hz);
+    }
+
+    if (profile->voltage < g_core_voltage)
+    {
+        vreg_set_voltage(profile->voltage);
+        g_core_voltage = profile->voltage;
+    }
+
     // reset UART for the new clock speed
     uart_init(uart0, 1000000);
+
+    update_clock_dividers(profile);
 }
+
+// Check that the PLL runs at the expected frequency and that
+// repeated computation over RAM gives consistent results.
+static bool clock_selftest(const clock_profile_t *profile)
+{
+    uint32_t measured_khz = frequency_count_khz(CLOCKS_FC0_SRC_VALUE_CLK_SYS);
+    uint32_t expected_khz = profile->sys_hz / 1000;
+    if (measured_khz < expected_khz - expected_khz / 100 || measured_khz > expected_khz + expected_khz / 100)
+    {
+        logmsg("-- Clock self-test: clk_sys measured ", (int)measured_khz, " kHz, expected ", (int)expected_khz, " kHz");
+        return false;
+    }
+
+    static uint32_t buf[1024];
+    uint32_t reference = 0;
+    for (int round = 0; round < 16; round++)
+    {
+        uint32_t x = 0x12345678;
+        for (int i = 0; i < 1024; i++)
+        {
+            x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+            buf[i] = x;
+        }
+
+        uint32_t crc = 0;
+        for (int i = 0; i < 1024; i++)
+        {
+            crc = (crc << 5) + (crc >> 27) + buf[i] * 0x9E3779B1;
+        }
+
+        if (round == 0)
+        {
+            reference = crc;
+        }
+        else if (crc != reference)
+        {
+            logmsg("-- Clock self-test: inconsistent results on round ", round);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Switch to the clock profile selected at build time.
+// Called from platform_late_init(), so that the bootloader stays at the default clock.
+static void select_clock_profile()
+{
+    int profile = RP2040_CLOCK_PROFILE;
+#ifdef ENABLE_AUDIO_OUTPUT
+    // Audio profile is already active from platform_init()
+    profile = RP2040_CLOCK_AUDIO;
 #endif
+    if (profile == g_clock_profile)
+    {
+        g_clock_profile_confirmed = true;
+        return;
+    }
+
+    if (watchdog_hw->scratch[CLOCK_PROFILE_SCRATCH] == CLOCK_PROFILE_MAGIC + profile)
+    {
+        logmsg("-- Previous boot with clock profile ", g_clock_profiles[profile].name,
+               " did not complete, staying at ", g_clock_profiles[RP2040_CLOCK_125MHZ].name);
+        watchdog_hw->scratch[CLOCK_PROFILE_SCRATCH] = 0;
+        g_clock_profile_confirmed = true;
+        return;
+    }
+
+    watchdog_hw->scratch[CLOCK_PROFILE_SCRATCH] = CLOCK_PROFILE_MAGIC + profile;
+
+    logmsg("-- Changing system clock to ", g_clock_profiles[profile].name);
+    set_clock_profile(&g_clock_profiles[profile]);
+
+    if (clock_selftest(&g_clock_profiles[profile]))
+    {
+        g_clock_profile = profile;
+    }
+    else
+    {
+        logmsg("-- Clock self-test failed, returning to ", g_clock_profiles[RP2040_CLOCK_125MHZ].name);
+        set_clock_profile(&g_clock_profiles[RP2040_CLOCK_125MHZ]);
+        watchdog_hw->scratch[CLOCK_PROFILE_SCRATCH] = 0;
+        g_clock_profile_confirmed = true;
+    }
+}
+
+// Clear the startup marker once the system has been running for a while
+static void confirm_clock_profile()
+{
+    if (!g_clock_profile_confirmed && millis() > CLOCK_PROFILE_CONFIRM_MS)
+    {
+        watchdog_hw->scratch[CLOCK_PROFILE_SCRATCH] = 0;
+        g_clock_profile_confirmed = true;
+        dbgmsg("Clock profile ", g_clock_profiles[g_clock_profile].name, " confirmed");
+    }
+}
 
 void platform_init()
 {
@@ -161,7 +337,8 @@ void platform_init()
 #ifdef ENABLE_AUDIO_OUTPUT
     logmsg("SP/DIF audio to expansion header enabled");
     logmsg("-- Overclocking to 135.428571MHz");
-    reclock_for_audio();
+    set_clock_profile(&g_clock_profiles[RP2040_CLOCK_AUDIO]);
+    g_clock_profile = RP2040_CLOCK_AUDIO;
 #endif
 
     // Get flash chip size
@@ -242,6 +419,8 @@ static bool read_initiator_dip_switch()
 // late_init() only runs in main application, SCSI not needed in bootloader
 void platform_late_init()
 {
+    select_clock_profile();
+
 #if defined(HAS_DIP_SWITCHES) && defined(PLATFORM_HAS_INITIATOR_MODE)
     if (read_initiator_dip_switch())
     {
@@ -607,12 +786,17 @@ void platform_reset_watchdog()
     usb_log_poll();
 }
 
+// Set by usb_msc_enable(), see usb_msc.h
+void (*g_usb_msc_poll)() = NULL;
+
 // Poll function that is called every few milliseconds.
 // Can be left empty or used for platform-specific processing.
 void platform_poll()
 {
     usb_log_poll();
+    if (g_usb_msc_poll) g_usb_msc_poll();
     adc_poll();
+    confirm_clock_profile();
     
 #ifdef ENABLE_AUDIO_OUTPUT
     audio_poll();
@@ -716,6 +900,12 @@ bool platform_rewrite_flash_page(uint32_t offset, uint8_t buffer[PLATFORM_FLASH_
     return true;
 }
 
+const uint8_t *platform_get_flash_ptr(uint32_t offset)
+{
+    // Bypass the XIP cache, it is disabled once flashing has started
+    return (const uint8_t*)(XIP_NOCACHE_BASE + offset);
+}
+
 void platform_boot_to_main_firmware()
 {
     // To ensure that the system state is reset properly, we perform
@@ -25,6 +25,7 @@
 
 #include <stdint.h>
 #include <Arduino.h>
+#include <hardware/structs/timer.h>
 
 #ifdef ZULUSCSI_BS2
 // BS2 hardware variant, using Raspberry Pico board on a carrier PCB
@@ -60,6 +61,9 @@ extern const char *g_platform_name;
 #define SD_USE_SDIO 1
 #define PLATFORM_HAS_PARITY_CHECK 1
 
+// SD card can be accessed as USB mass storage device, see usb_msc.h
+#define PLATFORM_HAS_USB_MSC 1
+
 #ifndef PLATFORM_VDD_WARNING_LIMIT_mV
 #define PLATFORM_VDD_WARNING_LIMIT_mV 2800
 #endif
@@ -68,6 +72,41 @@ extern const char *g_platform_name;
 // has not been tested due to lack of fast enough SCSI adapter.
 // #define PLATFORM_MAX_SCSI_SPEED S2S_CFG_SPEED_TURBO
 
+// System clock profiles, selected at build time with -DRP2040_CLOCK_PROFILE=n.
+// Audio builds always use the audio profile because S/PDIF output rates
+// are derived from it.
+#define RP2040_CLOCK_125MHZ 0
+#define RP2040_CLOCK_AUDIO  1
+#define RP2040_CLOCK_150MHZ 2
+#define RP2040_CLOCK_200MHZ 3
+#define RP2040_CLOCK_250MHZ 4
+
+#ifndef RP2040_CLOCK_PROFILE
+#ifdef ENABLE_AUDIO_OUTPUT
+#define RP2040_CLOCK_PROFILE RP2040_CLOCK_AUDIO
+#else
+#define RP2040_CLOCK_PROFILE RP2040_CLOCK_125MHZ
+#endif
+#endif
+
+#if defined(ENABLE_AUDIO_OUTPUT) && RP2040_CLOCK_PROFILE != RP2040_CLOCK_AUDIO
+#error Audio output requires RP2040_CLOCK_AUDIO clock profile
+#endif
+
+// Clock dividers and timing for the active clock profile.
+// SCSI PIO programs have delays in clock cycles that assume a PIO clock of
+// 125 to 135.43 MHz, so faster profiles run the SCSI state machines divided.
+// Dividers are 8.8 fixed point, as used by sm_config_set_clkdiv_int_frac().
+extern uint16_t g_scsi_pio_clkdiv;
+extern uint32_t g_scsi_pio_cycle_ps;
+extern uint16_t g_sdio_clkdiv;
+extern uint8_t g_delay_100ns_loops;
+
+// Free running counter for timing measurements.
+// Cortex-M0+ has no cycle counter, so the 1 MHz system timer is used.
+#define PLATFORM_CYCLE_COUNT() (timer_hw->timerawl)
+#define PLATFORM_CYCLES_PER_US 1
+
 // Debug logging function, can be used to print to e.g. serial port.
 // May get called from interrupt handlers.
 void platform_log(const char *s);
@@ -85,9 +124,14 @@ static inline void delay_ns(unsigned long ns)
 }
 
 // Approximate fast delay
+// Extra loops are only needed on clock profiles faster than 125 MHz.
 static inline void delay_100ns()
 {
     asm volatile ("nop \n nop \n nop \n nop \n nop \n nop \n nop \n nop \n nop \n nop \n nop");
+    for (uint8_t i = g_delay_100ns_loops; i > 0; i--)
+    {
+        asm volatile ("nop");
+    }
 }
 
 // Initialize SD card and GPIO configuration
@@ -128,6 +172,7 @@ void platform_set_sd_callback(sd_callback_t func, const uint8_t *buffer);
 #define PLATFORM_FLASH_TOTAL_SIZE (1024 * 1024)
 #define PLATFORM_FLASH_PAGE_SIZE 4096
 bool platform_rewrite_flash_page(uint32_t offset, uint8_t buffer[PLATFORM_FLASH_PAGE_SIZE]);
+const uint8_t *platform_get_flash_ptr(uint32_t offset); // Current flash contents at offset
 void platform_boot_to_main_firmware();
 #endif
 
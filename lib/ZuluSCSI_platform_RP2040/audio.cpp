@@ -19,6 +19,7 @@
 
 #include <SdFat.h>
 #include <stdbool.h>
+#include <string.h>
 #include <hardware/dma.h>
 #include <hardware/irq.h>
 #include <hardware/spi.h>
@@ -26,6 +27,7 @@
 #include "audio.h"
 #include "ZuluSCSI_audio.h"
 #include "ZuluSCSI_config.h"
+#include "ZuluSCSI_flac.h"
 #include "ZuluSCSI_log.h"
 #include "ZuluSCSI_platform.h"
 
@@ -137,6 +139,16 @@ static ImageBackingStore* audio_file;
 static uint64_t fpos;
 static uint32_t fleft;
 
+// tracking for FLAC playback, the decoder runs on Core1 while Core0 keeps
+// its input buffer filled from the memory card
+static FLACDecoder* audio_flac; // NULL when playing uncompressed samples
+static volatile bool flac_busy = false; // Core1 is using the decoder
+static volatile bool flac_need_data = false;
+static volatile bool flac_error = false;
+static uint8_t* flac_buf; // sample buffer being decoded
+static uint16_t flac_len;
+static volatile uint16_t flac_done;
+
 // historical playback status information
 static audio_status_code audio_last_status[8] = {ASC_NO_STATUS};
 
@@ -305,6 +317,37 @@ static void snd_process_b() {
     }
 }
 
+// Called by the FLAC decoder while a frame is decoded on Core1. Runs the
+// biphase encoding requested by the DMA interrupt meanwhile, as decoding a
+// long frame can take longer than one wire buffer lasts.
+static void flac_yield() {
+    while (multicore_fifo_rvalid()) {
+        void (*function)() = (void (*)()) multicore_fifo_pop_blocking();
+        (*function)();
+    }
+}
+
+// Decodes samples to the buffer in FILLING state. If the input buffer runs
+// out, Core0 refills it and passes this function to Core1 again.
+static void flac_decode() {
+    uint32_t done = 0;
+    FLACResult result = audio_flac->read(flac_buf + flac_done, flac_len - flac_done, &done, false);
+    flac_done += done;
+    if (result == FLAC_NEED_DATA) {
+        flac_need_data = true;
+    } else {
+        if (result == FLAC_ERROR) flac_error = true;
+        // zero the tail of the last buffer, and any part that failed to decode
+        memset(flac_buf + flac_done, 0, AUDIO_BUFFER_SIZE - flac_done);
+        if (flac_buf == sample_buf_a) {
+            sbufst_a = READY;
+        } else {
+            sbufst_b = READY;
+        }
+    }
+    flac_busy = false;
+}
+
 // Allows execution on Core1 via function pointers. Each function can take
 // no parameters and should return nothing, operating via side-effects only.
 static void core1_handler() {
@@ -370,6 +413,61 @@ void audio_setup() {
     multicore_launch_core1(core1_handler);
 }
 
+// Core0 side of FLAC playback: refills decoder input and hands sample
+// buffers to Core1 for decoding.
+static void flac_poll() {
+    if (flac_busy) return;
+
+    if (flac_error) {
+        logmsg("Audio FLAC stream decoding failed, ID:", audio_owner);
+        uint8_t owner = audio_owner;
+        audio_stop(owner);
+        audio_last_status[owner] = ASC_ERRORED;
+        return;
+    } else if (!audio_file->isOpen()) {
+        dbgmsg("------ Playback stop due to closed file");
+        audio_stop(audio_owner);
+        return;
+    }
+
+    // decoder is idle, keep its input buffer filled
+    if (flac_need_data || audio_flac->inputFree() >= FLAC_INPUT_BUFFER_SIZE / 2) {
+        platform_set_sd_callback(NULL, NULL);
+        if (audio_flac->fill() == 0 && flac_need_data) {
+            logmsg("Audio FLAC stream ended unexpectedly, ID:", audio_owner);
+            uint8_t owner = audio_owner;
+            audio_stop(owner);
+            audio_last_status[owner] = ASC_ERRORED;
+            return;
+        }
+        flac_need_data = false;
+    }
+
+    if (sbufst_a == FILLING || sbufst_b == FILLING) {
+        // continue buffer that ran out of input data
+    } else if (fleft == 0) {
+        return;
+    } else if (sbufst_a == STALE || sbufst_b == STALE) {
+        if (sbufst_a == STALE) {
+            sbufst_a = FILLING;
+            flac_buf = sample_buf_a;
+        } else {
+            sbufst_b = FILLING;
+            flac_buf = sample_buf_b;
+        }
+        flac_len = AUDIO_BUFFER_SIZE;
+        if (fleft < flac_len) flac_len = fleft;
+        flac_done = 0;
+        fleft -= flac_len;
+    } else {
+        // no data needed this time
+        return;
+    }
+
+    flac_busy = true;
+    multicore_fifo_push_blocking((uintptr_t) &flac_decode);
+}
+
 void audio_poll() {
     if (!audio_is_active()) return;
     if (audio_paused) return;
@@ -377,6 +475,9 @@ void audio_poll() {
         // out of data and ready to stop
         audio_stop(audio_owner);
         return;
+    } else if (audio_flac) {
+        flac_poll();
+        return;
     } else if (fleft == 0) {
         // out of data to read but still working on remainder
         return;
@@ -425,6 +526,52 @@ void audio_poll() {
     }
 }
 
+// Starts output of the two filled sample buffers
+static void snd_start(uint8_t owner, bool swap) {
+    // prepare initial tracking state
+    sbufsel = A;
+    sbufpos = 0;
+    sbufswap = swap;
+    sbufst_a = READY;
+    sbufst_b = READY;
+    audio_owner = owner & 7;
+    audio_last_status[audio_owner] = ASC_PLAYING;
+    audio_paused = false;
+
+    // prepare the wire buffers
+    for (uint16_t i = 0; i < WIRE_BUFFER_SIZE; i++) {
+        wire_buf_a[i] = 0;
+        wire_buf_b[i] = 0;
+    }
+    sfcnt = 0;
+    invert = 0;
+
+    // setup the two DMA units to hand-off to each other
+    // to maintain a stable bitstream these need to run without interruption
+	snd_dma_a_cfg = dma_channel_get_default_config(SOUND_DMA_CHA);
+	channel_config_set_transfer_data_size(&snd_dma_a_cfg, DMA_SIZE_16);
+	channel_config_set_dreq(&snd_dma_a_cfg, spi_get_dreq(AUDIO_SPI, true));
+	channel_config_set_read_increment(&snd_dma_a_cfg, true);
+	channel_config_set_chain_to(&snd_dma_a_cfg, SOUND_DMA_CHB);
+    // version of pico-sdk lacks channel_config_set_high_priority()
+    snd_dma_a_cfg.ctrl |= DMA_CH0_CTRL_TRIG_HIGH_PRIORITY_BITS;
+	dma_channel_configure(SOUND_DMA_CHA, &snd_dma_a_cfg, &(spi_get_hw(AUDIO_SPI)->dr),
+			&wire_buf_a, WIRE_BUFFER_SIZE, false);
+    dma_channel_set_irq0_enabled(SOUND_DMA_CHA, true);
+	snd_dma_b_cfg = dma_channel_get_default_config(SOUND_DMA_CHB);
+	channel_config_set_transfer_data_size(&snd_dma_b_cfg, DMA_SIZE_16);
+	channel_config_set_dreq(&snd_dma_b_cfg, spi_get_dreq(AUDIO_SPI, true));
+	channel_config_set_read_increment(&snd_dma_b_cfg, true);
+	channel_config_set_chain_to(&snd_dma_b_cfg, SOUND_DMA_CHA);
+    snd_dma_b_cfg.ctrl |= DMA_CH0_CTRL_TRIG_HIGH_PRIORITY_BITS;
+	dma_channel_configure(SOUND_DMA_CHB, &snd_dma_b_cfg, &(spi_get_hw(AUDIO_SPI)->dr),
+			&wire_buf_b, WIRE_BUFFER_SIZE, false);
+    dma_channel_set_irq0_enabled(SOUND_DMA_CHB, true);
+
+    // ready to go
+    dma_channel_start(SOUND_DMA_CHA);
+}
+
 bool audio_play(uint8_t owner, ImageBackingStore* img, uint64_t start, uint64_t end, bool swap) {
     // stop any existing playback first
     if (audio_is_active()) audio_stop(audio_owner);
@@ -477,50 +624,66 @@ bool audio_play(uint8_t owner, ImageBackingStore* img, uint64_t start, uint64_t
         return false;
     }
 
-    // prepare initial tracking state
     fpos = audio_file->position();
     fleft -= AUDIO_BUFFER_SIZE * 2;
-    sbufsel = A;
-    sbufpos = 0;
-    sbufswap = swap;
-    sbufst_a = READY;
-    sbufst_b = READY;
-    audio_owner = owner & 7;
-    audio_last_status[audio_owner] = ASC_PLAYING;
-    audio_paused = false;
+    audio_flac = NULL;
+    snd_start(owner, swap);
+    return true;
+}
 
-    // prepare the wire buffers
-    for (uint16_t i = 0; i < WIRE_BUFFER_SIZE; i++) {
-        wire_buf_a[i] = 0;
-        wire_buf_b[i] = 0;
+bool audio_play_flac(uint8_t owner, ImageBackingStore* img, uint64_t start, uint64_t end) {
+    // stop any existing playback first
+    if (audio_is_active()) audio_stop(audio_owner);
+
+    if (owner == 0xFF) {
+        logmsg("Illegal audio owner");
+        return false;
+    }
+    if (start >= end) {
+        logmsg("Invalid range for audio (", start, ":", end, ")");
+        return false;
+    }
+    platform_set_sd_callback(NULL, NULL);
+    audio_file = img;
+    FLACDecoder* decoder = flacGetDecoder(img);
+    if (!decoder) {
+        logmsg("File not open for FLAC audio playback, ", owner);
+        return false;
+    }
+    uint64_t len = decoder->decodedSize();
+    if (start > len) {
+        logmsg("File playback request start (", start, ":", len, ") outside file bounds");
+        return false;
+    }
+    if (end > len) {
+        dbgmsg("------ Truncate audio play request end ", end, " to decoded size ", len);
+        end = len;
+    }
+    fleft = end - start;
+    if (fleft <= 2 * AUDIO_BUFFER_SIZE) {
+        logmsg("File playback request (", start, ":", end, ") too short");
+        return false;
     }
-    sfcnt = 0;
-    invert = 0;
 
-    // setup the two DMA units to hand-off to each other
-    // to maintain a stable bitstream these need to run without interruption
-	snd_dma_a_cfg = dma_channel_get_default_config(SOUND_DMA_CHA);
-	channel_config_set_transfer_data_size(&snd_dma_a_cfg, DMA_SIZE_16);
-	channel_config_set_dreq(&snd_dma_a_cfg, spi_get_dreq(AUDIO_SPI, true));
-	channel_config_set_read_increment(&snd_dma_a_cfg, true);
-	channel_config_set_chain_to(&snd_dma_a_cfg, SOUND_DMA_CHB);
-    // version of pico-sdk lacks channel_config_set_high_priority()
-    snd_dma_a_cfg.ctrl |= DMA_CH0_CTRL_TRIG_HIGH_PRIORITY_BITS;
-	dma_channel_configure(SOUND_DMA_CHA, &snd_dma_a_cfg, &(spi_get_hw(AUDIO_SPI)->dr),
-			&wire_buf_a, WIRE_BUFFER_SIZE, false);
-    dma_channel_set_irq0_enabled(SOUND_DMA_CHA, true);
-	snd_dma_b_cfg = dma_channel_get_default_config(SOUND_DMA_CHB);
-	channel_config_set_transfer_data_size(&snd_dma_b_cfg, DMA_SIZE_16);
-	channel_config_set_dreq(&snd_dma_b_cfg, spi_get_dreq(AUDIO_SPI, true));
-	channel_config_set_read_increment(&snd_dma_b_cfg, true);
-	channel_config_set_chain_to(&snd_dma_b_cfg, SOUND_DMA_CHA);
-    snd_dma_b_cfg.ctrl |= DMA_CH0_CTRL_TRIG_HIGH_PRIORITY_BITS;
-	dma_channel_configure(SOUND_DMA_CHB, &snd_dma_b_cfg, &(spi_get_hw(AUDIO_SPI)->dr),
-			&wire_buf_b, WIRE_BUFFER_SIZE, false);
-    dma_channel_set_irq0_enabled(SOUND_DMA_CHB, true);
+    // decode initial sample buffers here, later ones are decoded by Core1
+    uint32_t done_a = 0, done_b = 0;
+    if (!decoder->seek(start / 4)) {
+        logmsg("FLAC playback failed start seek to ", start);
+        return false;
+    }
+    if (decoder->read(sample_buf_a, AUDIO_BUFFER_SIZE, &done_a) != FLAC_OK || done_a != AUDIO_BUFFER_SIZE ||
+        decoder->read(sample_buf_b, AUDIO_BUFFER_SIZE, &done_b) != FLAC_OK || done_b != AUDIO_BUFFER_SIZE) {
+        logmsg("FLAC playback start failed to decode initial samples");
+        return false;
+    }
 
-    // ready to go
-    dma_channel_start(SOUND_DMA_CHA);
+    fleft -= AUDIO_BUFFER_SIZE * 2;
+    flac_busy = false;
+    flac_need_data = false;
+    flac_error = false;
+    decoder->setYieldCallback(flac_yield);
+    audio_flac = decoder;
+    snd_start(owner, false);
     return true;
 }
 
@@ -541,6 +704,13 @@ bool audio_set_paused(uint8_t id, bool paused) {
 void audio_stop(uint8_t id) {
     if (audio_owner != (id & 7)) return;
 
+    // let Core1 finish decoding, the decoder is shared with SCSI commands
+    while (flac_busy) tight_loop_contents();
+    if (audio_flac) {
+        audio_flac->setYieldCallback(NULL);
+        audio_flac = NULL;
+    }
+
     // to help mute external hardware, send a bunch of '0' samples prior to
     // halting the datastream; easiest way to do this is invalidating the
     // sample buffers, same as if there was a sample data underrun
@@ -38,7 +38,7 @@ volatile int g_scsiHostPhyReset;
 // Dummy functions for platforms without hardware support for
 // SCSI initiator mode.
 void scsiHostPhyReset(void) {}
-bool scsiHostPhySelect(int target_id) { return false; }
+bool scsiHostPhySelect(int target_id, uint32_t timeout_us) { return false; }
 int scsiHostPhyGetPhase() { return 0; }
 bool scsiHostRequestWaiting() { return false; }
 uint32_t scsiHostWrite(const uint8_t *data, uint32_t count) { return 0; }
@@ -63,8 +63,8 @@ void scsiHostPhyReset(void)
 }
 
 // Select a device, id 0-7.
-// Returns true if the target answers to selection request.
-bool scsiHostPhySelect(int target_id)
+// Returns true if the target answers to selection request within timeout.
+bool scsiHostPhySelect(int target_id, uint32_t timeout_us)
 {
     SCSI_RELEASE_OUTPUTS();
 
@@ -98,14 +98,12 @@ bool scsiHostPhySelect(int target_id)
     delayMicroseconds(5);
     SCSI_OUT(BSY, 0);
 
-    // Wait for target to respond
-    for (int wait = 0; wait < 2500; wait++)
+    // Wait for target to respond.
+    // BSY is polled continuously so that the response is noticed as soon
+    // as the target asserts it, instead of at the next fixed poll step.
+    uint32_t start = time_us_32();
+    while (!SCSI_IN(BSY) && (uint32_t)(time_us_32() - start) < timeout_us)
     {
-        delayMicroseconds(100);
-        if (SCSI_IN(BSY))
-        {
-            break;
-        }
     }
 
     if (!SCSI_IN(BSY))
@@ -264,18 +262,18 @@ uint32_t scsiHostRead(uint8_t *data, uint32_t count)
     }
     else
     {
-        for (uint32_t i = 0; i < count; i++)
+        uint32_t i = 0;
+        while (i < count)
         {
-            while (!SCSI_IN(REQ))
+            if (SCSI_IN(REQ))
             {
-                if (g_scsiHostPhyReset || !SCSI_IN(IO) || SCSI_IN(CD) != cd_start || SCSI_IN(MSG) != msg_start)
-                {
-                    // Target switched out of DATA_IN mode
-                    count = i;
-                }
+                data[i++] = scsiHostReadOneByte(&parityError);
+            }
+            else if (g_scsiHostPhyReset || !SCSI_IN(IO) || SCSI_IN(CD) != cd_start || SCSI_IN(MSG) != msg_start)
+            {
+                // Target switched out of DATA_IN mode
+                count = i;
             }
-
-            data[i] = scsiHostReadOneByte(&parityError);
         }
     }
 
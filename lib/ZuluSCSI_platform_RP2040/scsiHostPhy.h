@@ -34,8 +34,9 @@ extern volatile int g_scsiHostPhyReset;
 void scsiHostPhyReset(void);
 
 // Select a device, id 0-7.
-// Returns true if the target answers to selection request.
-bool scsiHostPhySelect(int target_id);
+// Returns true if the target answers to selection request within timeout.
+// The default is the 250 ms selection timeout recommended by SCSI standard.
+bool scsiHostPhySelect(int target_id, uint32_t timeout_us = 250000);
 
 // Read the current communication phase as signaled by the target
 // Matches SCSI_PHASE enumeration from scsi.h.
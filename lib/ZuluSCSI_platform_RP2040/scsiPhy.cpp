@@ -28,6 +28,7 @@
 #include "ZuluSCSI_platform.h"
 #include "ZuluSCSI_log.h"
 #include "ZuluSCSI_log_trace.h"
+#include "ZuluSCSI_cycletrace.h"
 #include "ZuluSCSI_config.h"
 #include "scsi_accel_target.h"
 #include "hardware/structs/iobank0.h"
@@ -202,6 +203,8 @@ extern "C" uint32_t scsiEnterPhaseImmediate(int phase)
 {
     if (phase != g_scsi_phase)
     {
+        CYCLE_TRACE(TRACE_PHASE, phase, scsiDev.cdb[0]);
+
         // ANSI INCITS 362-2002 SPI-3 10.7.1:
         // Phase changes are not allowed while REQ or ACK is asserted.
         while (likely(!scsiDev.resetFlag) && SCSI_IN(ACK)) {}
@@ -358,6 +361,7 @@ extern "C" bool scsiIsWriteFinished(const uint8_t *data)
 extern "C" void scsiFinishWrite()
 {
     scsi_accel_rp2040_finishWrite(&scsiDev.resetFlag);
+    CYCLE_TRACE(TRACE_SCSI_WRITE_DONE, 0, 0);
 }
 
 /*********************/
@@ -409,6 +413,7 @@ extern "C" void scsiFinishRead(uint8_t* data, uint32_t count, int *parityError)
 {
     if (!(scsiDev.boardCfg.flags & S2S_CFG_ENABLE_PARITY)) { parityError = NULL; }
     scsi_accel_rp2040_finishRead(data, count, parityError, &scsiDev.resetFlag);
+    CYCLE_TRACE(TRACE_SCSI_READ_DONE, 0, count);
     scsiLogDataOut(data, count);
 }
 
@@ -81,6 +81,38 @@ static void scsi_accel_host_config_gpio()
     }
 }
 
+// Collect the remaining data after target ended the transfer early.
+// If odd number of bytes was received, the last one is still in the input shift register.
+// It is pushed out followed by the byte counter, which tells whether it is valid.
+static uint32_t scsi_accel_host_read_tail(uint8_t *buf, uint8_t *dst, uint32_t count, uint32_t *paritycheck)
+{
+    while (!pio_sm_is_rx_fifo_empty(SCSI_PIO, SCSI_SM))
+    {
+        uint32_t word = pio_sm_get(SCSI_PIO, SCSI_SM);
+        *paritycheck ^= word;
+        word = ~word;
+        *dst++ = word & 0xFF;
+        *dst++ = word >> 16;
+    }
+
+    pio_sm_exec(SCSI_PIO, SCSI_SM, pio_encode_push(false, false) | pio_encode_sideset(1, 1));
+    pio_sm_exec(SCSI_PIO, SCSI_SM, pio_encode_mov(pio_isr, pio_x) | pio_encode_sideset(1, 1));
+    pio_sm_exec(SCSI_PIO, SCSI_SM, pio_encode_push(false, false) | pio_encode_sideset(1, 1));
+
+    uint32_t partial = pio_sm_get_blocking(SCSI_PIO, SCSI_SM);
+    uint32_t remaining = pio_sm_get_blocking(SCSI_PIO, SCSI_SM);
+    uint32_t received = count - 1 - remaining;
+
+    if (received > (uint32_t)(dst - buf))
+    {
+        // Odd byte is in the upper half of the word, lower half is zero
+        *paritycheck ^= partial;
+        *dst++ = (~partial) >> 16;
+    }
+
+    return dst - buf;
+}
+
 uint32_t scsi_accel_host_read(uint8_t *buf, uint32_t count, int *parityError, volatile int *resetFlag)
 {
     // Currently this method just reads from the PIO RX fifo directly in software loop.
@@ -111,7 +143,7 @@ uint32_t scsi_accel_host_read(uint8_t *buf, uint32_t count, int *parityError, vo
             if (*resetFlag || !SCSI_IN(IO) || SCSI_IN(CD) != cd_start || SCSI_IN(MSG) != msg_start)
             {
                 // Target switched out of DATA_IN mode
-                count = dst - buf;
+                count = scsi_accel_host_read_tail(buf, dst, count, &paritycheck);
                 break;
             }
         }
@@ -161,6 +193,7 @@ void scsi_accel_host_init()
     sm_config_set_sideset_pins(&g_scsi_host.pio_cfg_async_read, SCSI_OUT_ACK);
     sm_config_set_out_shift(&g_scsi_host.pio_cfg_async_read, true, false, 32);
     sm_config_set_in_shift(&g_scsi_host.pio_cfg_async_read, true, true, 32);
+    sm_config_set_clkdiv_int_frac(&g_scsi_host.pio_cfg_async_read, g_scsi_pio_clkdiv >> 8, g_scsi_pio_clkdiv & 0xFF);
 }
 
 #endif
\ No newline at end of file
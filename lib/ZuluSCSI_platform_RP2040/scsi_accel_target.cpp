@@ -64,18 +64,48 @@
 // B: Lookup from g_scsi_parity_check_lookup and copy to scsi_read_parity PIO
 // C: Addresses from scsi_accel_read PIO to lookup DMA READ_ADDR register
 // D: From pacer to data state machine to trigger transfers
+//
+// With SCSI_ACCEL_FAST_PARITY, reads use 3 DMA channels (data flow D->C->A):
+// A: Bytes from scsi_read_direct PIO to memory buffer
+// C: Raw data + parity words from scsi_accel_read PIO to scsi_read_direct PIO
+// D: From pacer to data state machine to trigger transfers
+// Channel C has the DMA sniffer enabled in parity mode. The words hold the active
+// low bus signals, so a byte with valid odd parity has an even number of bits set
+// and leaves the sniffer result unchanged. At the end of each transfer the result
+// must be zero. This detects any odd number of parity errors per transfer,
+// while avoiding the lookup table accesses.
 #define SCSI_DMA_CH_A 0
 #define SCSI_DMA_CH_B 1
 #define SCSI_DMA_CH_C 2
 #define SCSI_DMA_CH_D 3
 
+// Number of application buffers that can be queued behind the active transfer.
+// The DMA interrupt handler moves to the next queued buffer as soon as the
+// previous one completes, so the bus keeps running while the main loop is busy.
+#ifndef SCSI_DMA_QUEUE_SIZE
+#define SCSI_DMA_QUEUE_SIZE 8
+#endif
+
+#ifndef SCSI_ACCEL_FAST_PARITY
+#define SCSI_ACCEL_FAST_PARITY 0
+#endif
+
+struct scsidma_buf_t {
+    uint8_t *buf; // Buffer provided by application
+    uint32_t bytes; // Bytes available in buffer
+};
+
 static struct {
     uint8_t *app_buf; // Buffer provided by application
     uint32_t app_bytes; // Bytes available in application buffer
     uint32_t dma_bytes; // Bytes that have been scheduled for DMA so far
     
-    uint8_t *next_app_buf; // Next buffer from application after current one finishes
-    uint32_t next_app_bytes; // Bytes in next buffer
+    // Queue of buffers to process after current one finishes.
+    // Items are added by scsi_accel_rp2040_startWrite/startRead and
+    // removed by the DMA interrupt handler.
+    scsidma_buf_t queue[SCSI_DMA_QUEUE_SIZE];
+    volatile uint32_t queue_head; // Index of next buffer to process
+    volatile uint32_t queue_count; // Number of buffers in queue
 
     // Synchronous mode?
     int syncOffset;
@@ -83,6 +113,11 @@ static struct {
     int syncOffsetDivider; // Autopush/autopull threshold for the write pacer state machine
     int syncOffsetPreload; // Number of items to preload in the RX fifo of scsi_sync_write
 
+    // Parity check by DMA sniffer when SCSI_ACCEL_FAST_PARITY is enabled
+    uint8_t *sniff_buf; // Start of current read transfer
+    uint32_t sniff_bytes; // Length of current read transfer
+    uint8_t *parity_error_buf; // Start of first transfer that had a parity error
+
     // PIO configurations
     uint32_t pio_offset_parity;
     uint32_t pio_offset_async_write;
@@ -123,7 +158,7 @@ static void scsidma_config_gpio();
 void scsi_accel_log_state()
 {
     logmsg("SCSI DMA state: ", scsidma_states[g_scsi_dma_state]);
-    logmsg("Current buffer: ", g_scsi_dma.dma_bytes, "/", g_scsi_dma.app_bytes, ", next ", g_scsi_dma.next_app_bytes, " bytes");
+    logmsg("Current buffer: ", g_scsi_dma.dma_bytes, "/", g_scsi_dma.app_bytes, ", queued ", (int)g_scsi_dma.queue_count, " buffers");
     logmsg("SyncOffset: ", g_scsi_dma.syncOffset, " SyncPeriod ", g_scsi_dma.syncPeriod);
     logmsg("PIO Parity SM:",
         " tx_fifo ", (int)pio_sm_get_tx_fifo_level(SCSI_DMA_PIO, SCSI_PARITY_SM),
@@ -155,6 +190,106 @@ void scsi_accel_log_state()
     logmsg("GPIO states: ", sio_hw->gpio_in);
 }
 
+/****************************************/
+/* Buffer queue handling                */
+/****************************************/
+
+// Try to add a request to the currently running transfer.
+// Requests that continue directly from the previous buffer are combined with it.
+// Must be called with interrupts disabled.
+// Returns false if the queue is full.
+static bool scsidma_queue_add(uint8_t *data, uint32_t count)
+{
+    if (g_scsi_dma.queue_count == 0)
+    {
+        if (data == g_scsi_dma.app_buf + g_scsi_dma.app_bytes)
+        {
+            // Combine with currently running request
+            g_scsi_dma.app_bytes += count;
+            return true;
+        }
+    }
+    else
+    {
+        uint32_t last = (g_scsi_dma.queue_head + g_scsi_dma.queue_count - 1) % SCSI_DMA_QUEUE_SIZE;
+        if (data == g_scsi_dma.queue[last].buf + g_scsi_dma.queue[last].bytes)
+        {
+            // Combine with last queued request
+            g_scsi_dma.queue[last].bytes += count;
+            return true;
+        }
+    }
+
+    if (g_scsi_dma.queue_count < SCSI_DMA_QUEUE_SIZE)
+    {
+        // Add as queued request
+        uint32_t idx = (g_scsi_dma.queue_head + g_scsi_dma.queue_count) % SCSI_DMA_QUEUE_SIZE;
+        g_scsi_dma.queue[idx].buf = data;
+        g_scsi_dma.queue[idx].bytes = count;
+        g_scsi_dma.queue_count++;
+        return true;
+    }
+
+    return false;
+}
+
+// Move to next queued buffer once the current one has been fully processed.
+static void scsidma_queue_next()
+{
+    if (g_scsi_dma.app_bytes <= g_scsi_dma.dma_bytes)
+    {
+        g_scsi_dma.dma_bytes = 0;
+
+        if (g_scsi_dma.queue_count > 0)
+        {
+            scsidma_buf_t *item = &g_scsi_dma.queue[g_scsi_dma.queue_head];
+            g_scsi_dma.app_buf = item->buf;
+            g_scsi_dma.app_bytes = item->bytes;
+            g_scsi_dma.queue_head = (g_scsi_dma.queue_head + 1) % SCSI_DMA_QUEUE_SIZE;
+            g_scsi_dma.queue_count = g_scsi_dma.queue_count - 1;
+        }
+        else
+        {
+            g_scsi_dma.app_buf = 0;
+            g_scsi_dma.app_bytes = 0;
+        }
+    }
+}
+
+// Check if the data pointer belongs to a queued or currently running request.
+// dma_pos is the address DMA channel A is currently processing in app_buf.
+// Must be called with interrupts disabled.
+static bool scsidma_queue_contains(const uint8_t *data, uint32_t dma_pos)
+{
+    if (data >= g_scsi_dma.app_buf &&
+        data < g_scsi_dma.app_buf + g_scsi_dma.app_bytes &&
+        (uint32_t)data >= dma_pos)
+    {
+        return true; // In current transfer
+    }
+
+    for (uint32_t i = 0; i < g_scsi_dma.queue_count; i++)
+    {
+        const scsidma_buf_t *item = &g_scsi_dma.queue[(g_scsi_dma.queue_head + i) % SCSI_DMA_QUEUE_SIZE];
+        if (data >= item->buf && data < item->buf + item->bytes)
+        {
+            return true; // In queued transfer
+        }
+    }
+
+    return false;
+}
+
+// Clear the queue and set the first buffer of a new transfer
+static void scsidma_queue_reset(uint8_t *data, uint32_t count)
+{
+    g_scsi_dma.app_buf = data;
+    g_scsi_dma.app_bytes = count;
+    g_scsi_dma.dma_bytes = 0;
+    g_scsi_dma.queue_head = 0;
+    g_scsi_dma.queue_count = 0;
+}
+
 /****************************************/
 /* Accelerated writes to SCSI bus       */
 /****************************************/
@@ -190,15 +325,8 @@ static void config_parity_sm_for_write()
 
 static void start_dma_write()
 {
-    if (g_scsi_dma.app_bytes <= g_scsi_dma.dma_bytes)
-    {
-        // Buffer has been fully processed, swap it
-        g_scsi_dma.dma_bytes = 0;
-        g_scsi_dma.app_buf = g_scsi_dma.next_app_buf;
-        g_scsi_dma.app_bytes = g_scsi_dma.next_app_bytes;
-        g_scsi_dma.next_app_buf = 0;
-        g_scsi_dma.next_app_bytes = 0;
-    }
+    // If buffer has been fully processed, take next one from queue
+    scsidma_queue_next();
 
     // Check if we are all done.
     // From SCSIDMA_WRITE_DONE state we can either go to IDLE in stopWrite()
@@ -228,33 +356,28 @@ void scsi_accel_rp2040_startWrite(const uint8_t* data, uint32_t count, volatile
     // Any read requests should be matched with a stopRead()
     assert(g_scsi_dma_state != SCSIDMA_READ && g_scsi_dma_state != SCSIDMA_READ_DONE);
 
-    __disable_irq();
-    if (g_scsi_dma_state == SCSIDMA_WRITE)
+    uint32_t start = millis();
+    while (g_scsi_dma_state == SCSIDMA_WRITE && !*resetFlag)
     {
-        if (!g_scsi_dma.next_app_buf && data == g_scsi_dma.app_buf + g_scsi_dma.app_bytes)
-        {
-            // Combine with currently running request
-            g_scsi_dma.app_bytes += count;
-            count = 0;
-        }
-        else if (data == g_scsi_dma.next_app_buf + g_scsi_dma.next_app_bytes)
+        __disable_irq();
+        bool queued = (g_scsi_dma_state == SCSIDMA_WRITE) && scsidma_queue_add((uint8_t*)data, count);
+        __enable_irq();
+
+        if (queued)
         {
-            // Combine with queued request
-            g_scsi_dma.next_app_bytes += count;
-            count = 0;
+            // Request was combined or queued
+            return;
         }
-        else if (!g_scsi_dma.next_app_buf)
+
+        // Queue is full, wait for the oldest request to finish
+        if ((uint32_t)(millis() - start) > 5000)
         {
-            // Add as queued request
-            g_scsi_dma.next_app_buf = (uint8_t*)data;
-            g_scsi_dma.next_app_bytes = count;
-            count = 0;
+            logmsg("scsi_accel_rp2040_startWrite() timeout waiting for queue");
+            scsi_accel_log_state();
+            *resetFlag = 1;
+            return;
         }
     }
-    __enable_irq();
-
-    // Check if the request was combined
-    if (count == 0) return;
 
     if (g_scsi_dma_state != SCSIDMA_IDLE && g_scsi_dma_state != SCSIDMA_WRITE_DONE)
     {
@@ -268,11 +391,7 @@ void scsi_accel_rp2040_startWrite(const uint8_t* data, uint32_t count, volatile
 
     bool must_reconfig_gpio = (g_scsi_dma_state == SCSIDMA_IDLE);
     g_scsi_dma_state = SCSIDMA_WRITE;
-    g_scsi_dma.app_buf = (uint8_t*)data;
-    g_scsi_dma.app_bytes = count;
-    g_scsi_dma.dma_bytes = 0;
-    g_scsi_dma.next_app_buf = 0;
-    g_scsi_dma.next_app_bytes = 0;
+    scsidma_queue_reset((uint8_t*)data, count);
     
     if (must_reconfig_gpio)
     {
@@ -349,19 +468,8 @@ bool scsi_accel_rp2040_isWriteFinished(const uint8_t* data)
         return false;
     
     // Check if this data item is still in queue.
-    bool finished = true;
     __disable_irq();
-    if (data >= g_scsi_dma.app_buf &&
-        data < g_scsi_dma.app_buf + g_scsi_dma.app_bytes &&
-        (uint32_t)data >= dma_hw->ch[SCSI_DMA_CH_A].al1_read_addr)
-    {
-        finished = false; // In current transfer
-    }
-    else if (data >= g_scsi_dma.next_app_buf &&
-             data < g_scsi_dma.next_app_buf + g_scsi_dma.next_app_bytes)
-    {
-        finished = false; // In queued transfer
-    }
+    bool finished = !scsidma_queue_contains(data, dma_hw->ch[SCSI_DMA_CH_A].al1_read_addr);
     __enable_irq();
 
     return finished;
@@ -459,9 +567,14 @@ static void config_parity_sm_for_read()
     // Configure parity check state machine
     pio_sm_init(SCSI_DMA_PIO, SCSI_PARITY_SM, g_scsi_dma.pio_offset_read_parity, &g_scsi_dma.pio_cfg_read_parity);
 
-    // Load base address to state machine register X
+    // Load base address to state machine register Y
+#if SCSI_ACCEL_FAST_PARITY
+    // Raw data words are passed to scsi_read_direct, no lookup table
+    uint32_t addrbase = 0;
+#else
     uint32_t addrbase = (uint32_t)&g_scsi_parity_check_lookup[0];
     assert((addrbase & 0x3FF) == 0);
+#endif
     pio_sm_init(SCSI_DMA_PIO, SCSI_DATA_SM, g_scsi_dma.pio_offset_read, &g_scsi_dma.pio_cfg_read);
     pio_sm_put(SCSI_DMA_PIO, SCSI_DATA_SM, addrbase >> 10);
     pio_sm_exec(SCSI_DMA_PIO, SCSI_DATA_SM, pio_encode_pull(false, false) | pio_encode_sideset(1, 1));
@@ -473,6 +586,18 @@ static void config_parity_sm_for_read()
         pio_sm_set_sideset_pins(SCSI_DMA_PIO, SCSI_DATA_SM, 0);
     }
 
+#if SCSI_ACCEL_FAST_PARITY
+    // DMA channel C will copy data words from data PIO to scsi_read_direct PIO.
+    // Transfer count is set for each buffer in start_dma_read().
+    dma_channel_configure(SCSI_DMA_CH_C,
+        &g_scsi_dma.dmacfg_read_chC,
+        &SCSI_DMA_PIO->txf[SCSI_PARITY_SM],
+        &SCSI_DMA_PIO->rxf[SCSI_DATA_SM],
+        0, false);
+    dma_sniffer_enable(SCSI_DMA_CH_C, DMA_SNIFF_CTRL_CALC_VALUE_EVEN, false);
+    g_scsi_dma.sniff_bytes = 0;
+    g_scsi_dma.parity_error_buf = NULL;
+#else
     // DMA channel B will read g_scsi_parity_check_lookup and write to scsi_read_parity PIO.
     dma_channel_configure(SCSI_DMA_CH_B,
         &g_scsi_dma.dmacfg_read_chB,
@@ -489,6 +614,7 @@ static void config_parity_sm_for_read()
         &dma_hw->ch[SCSI_DMA_CH_B].al3_read_addr_trig,
         &SCSI_DMA_PIO->rxf[SCSI_DATA_SM],
         1, true);
+#endif
 
     if (g_scsi_dma.syncOffset == 0)
     {
@@ -518,22 +644,38 @@ static void config_parity_sm_for_read()
     SCSI_DMA_PIO->irq = 1;
 }
 
+#if SCSI_ACCEL_FAST_PARITY
+// Check the sniffer result for the transfer that just completed.
+// Errors are latched to PIO IRQ flag 0, same as scsi_read_parity program does.
+static void check_sniffed_parity()
+{
+    if (g_scsi_dma.sniff_bytes > 0 && (dma_hw->sniff_data & 1) != 0)
+    {
+        if (!(SCSI_DMA_PIO->irq & 1))
+        {
+            g_scsi_dma.parity_error_buf = g_scsi_dma.sniff_buf;
+        }
+
+        SCSI_DMA_PIO->irq_force = 1;
+    }
+
+    g_scsi_dma.sniff_bytes = 0;
+}
+#endif
+
 static void start_dma_read()
 {
+#if SCSI_ACCEL_FAST_PARITY
+    check_sniffed_parity();
+#endif
+
     pio_sm_set_enabled(SCSI_DMA_PIO, SCSI_PARITY_SM, false);
     pio_sm_set_enabled(SCSI_DMA_PIO, SCSI_DATA_SM, false);
     pio_sm_clear_fifos(SCSI_DMA_PIO, SCSI_PARITY_SM);
     pio_sm_clear_fifos(SCSI_DMA_PIO, SCSI_DATA_SM);
     
-    if (g_scsi_dma.app_bytes <= g_scsi_dma.dma_bytes)
-    {
-        // Buffer has been fully processed, swap it
-        g_scsi_dma.dma_bytes = 0;
-        g_scsi_dma.app_buf = g_scsi_dma.next_app_buf;
-        g_scsi_dma.app_bytes = g_scsi_dma.next_app_bytes;
-        g_scsi_dma.next_app_buf = 0;
-        g_scsi_dma.next_app_bytes = 0;
-    }
+    // If buffer has been fully processed, take next one from queue
+    scsidma_queue_next();
     
     // Check if we are all done.
     // From SCSIDMA_READ_DONE state we can either go to IDLE in stopRead()
@@ -589,6 +731,15 @@ static void start_dma_read()
     // Start DMA to fill the destination buffer
     uint8_t *dest_buf = &g_scsi_dma.app_buf[g_scsi_dma.dma_bytes];
     g_scsi_dma.dma_bytes += bytes_to_read;
+
+#if SCSI_ACCEL_FAST_PARITY
+    // Start passing data words to scsi_read_direct and reset the parity accumulator
+    dma_hw->sniff_data = 0;
+    g_scsi_dma.sniff_buf = dest_buf;
+    g_scsi_dma.sniff_bytes = bytes_to_read;
+    dma_channel_set_trans_count(SCSI_DMA_CH_C, bytes_to_read, true);
+#endif
+
     dma_channel_configure(SCSI_DMA_CH_A,
         &g_scsi_dma.dmacfg_read_chA,
         dest_buf,
@@ -613,33 +764,28 @@ void scsi_accel_rp2040_startRead(uint8_t *data, uint32_t count, int *parityError
     // Any write requests should be matched with a stopWrite()
     assert(g_scsi_dma_state != SCSIDMA_WRITE && g_scsi_dma_state != SCSIDMA_WRITE_DONE);
 
-    __disable_irq();
-    if (g_scsi_dma_state == SCSIDMA_READ)
+    uint32_t start = millis();
+    while (g_scsi_dma_state == SCSIDMA_READ && !*resetFlag)
     {
-        if (!g_scsi_dma.next_app_buf && data == g_scsi_dma.app_buf + g_scsi_dma.app_bytes)
-        {
-            // Combine with currently running request
-            g_scsi_dma.app_bytes += count;
-            count = 0;
-        }
-        else if (data == g_scsi_dma.next_app_buf + g_scsi_dma.next_app_bytes)
+        __disable_irq();
+        bool queued = (g_scsi_dma_state == SCSIDMA_READ) && scsidma_queue_add((uint8_t*)data, count);
+        __enable_irq();
+
+        if (queued)
         {
-            // Combine with queued request
-            g_scsi_dma.next_app_bytes += count;
-            count = 0;
+            // Request was combined or queued
+            return;
         }
-        else if (!g_scsi_dma.next_app_buf)
+
+        // Queue is full, wait for the oldest request to finish
+        if ((uint32_t)(millis() - start) > 5000)
         {
-            // Add as queued request
-            g_scsi_dma.next_app_buf = (uint8_t*)data;
-            g_scsi_dma.next_app_bytes = count;
-            count = 0;
+            logmsg("scsi_accel_rp2040_startRead() timeout waiting for queue");
+            scsi_accel_log_state();
+            *resetFlag = 1;
+            return;
         }
     }
-    __enable_irq();
-
-    // Check if the request was combined
-    if (count == 0) return;
 
     if (g_scsi_dma_state != SCSIDMA_IDLE && g_scsi_dma_state != SCSIDMA_READ_DONE)
     {
@@ -653,11 +799,7 @@ void scsi_accel_rp2040_startRead(uint8_t *data, uint32_t count, int *parityError
 
     bool must_reconfig_gpio = (g_scsi_dma_state == SCSIDMA_IDLE);
     g_scsi_dma_state = SCSIDMA_READ;
-    g_scsi_dma.app_buf = (uint8_t*)data;
-    g_scsi_dma.app_bytes = count;
-    g_scsi_dma.dma_bytes = 0;
-    g_scsi_dma.next_app_buf = 0;
-    g_scsi_dma.next_app_bytes = 0;
+    scsidma_queue_reset((uint8_t*)data, count);
 
     if (must_reconfig_gpio)
     {
@@ -681,19 +823,8 @@ bool scsi_accel_rp2040_isReadFinished(const uint8_t* data)
         return false;
 
     // Check if this data item is still in queue.
-    bool finished = true;
     __disable_irq();
-    if (data >= g_scsi_dma.app_buf &&
-        data < g_scsi_dma.app_buf + g_scsi_dma.app_bytes &&
-        (uint32_t)data >= dma_hw->ch[SCSI_DMA_CH_A].write_addr)
-    {
-        finished = false; // In current transfer
-    }
-    else if (data >= g_scsi_dma.next_app_buf &&
-             data < g_scsi_dma.next_app_buf + g_scsi_dma.next_app_bytes)
-    {
-        finished = false; // In queued transfer
-    }
+    bool finished = !scsidma_queue_contains(data, dma_hw->ch[SCSI_DMA_CH_A].write_addr);
     __enable_irq();
 
     return finished;
@@ -739,6 +870,12 @@ void scsi_accel_rp2040_finishRead(const uint8_t *data, uint32_t count, int *pari
     if (parityError != NULL && (SCSI_DMA_PIO->irq & 1))
     {
         dbgmsg("scsi_accel_rp2040_finishRead(", bytearray(data, count), ") detected parity error");
+#if SCSI_ACCEL_FAST_PARITY
+        if (data && g_scsi_dma.parity_error_buf)
+        {
+            dbgmsg("-- First parity error in transfer starting at offset ", (int)(g_scsi_dma.parity_error_buf - data));
+        }
+#endif
         *parityError = true;
     }
 }
@@ -858,6 +995,9 @@ void scsi_accel_rp2040_init()
     }
 
     // Load PIO programs
+    // Programs that drive bus signals run at g_scsi_pio_clkdiv so that their
+    // cycle delays stay valid on fast clock profiles. Parity programs only
+    // generate addresses and run at full system clock.
     pio_clear_instruction_memory(SCSI_DMA_PIO);
     
     // Parity lookup generator
@@ -873,11 +1013,13 @@ void scsi_accel_rp2040_init()
     sm_config_set_sideset_pins(&g_scsi_dma.pio_cfg_async_write, SCSI_OUT_REQ);
     sm_config_set_fifo_join(&g_scsi_dma.pio_cfg_async_write, PIO_FIFO_JOIN_TX);
     sm_config_set_out_shift(&g_scsi_dma.pio_cfg_async_write, true, false, 32);
+    sm_config_set_clkdiv_int_frac(&g_scsi_dma.pio_cfg_async_write, g_scsi_pio_clkdiv >> 8, g_scsi_pio_clkdiv & 0xFF);
 
     // Synchronous SCSI write pacer / ACK handler
     g_scsi_dma.pio_offset_sync_write_pacer = pio_add_program(SCSI_DMA_PIO, &scsi_sync_write_pacer_program);
     g_scsi_dma.pio_cfg_sync_write_pacer = scsi_sync_write_pacer_program_get_default_config(g_scsi_dma.pio_offset_sync_write_pacer);
     sm_config_set_out_shift(&g_scsi_dma.pio_cfg_sync_write_pacer, true, true, 1);
+    sm_config_set_clkdiv_int_frac(&g_scsi_dma.pio_cfg_sync_write_pacer, g_scsi_pio_clkdiv >> 8, g_scsi_pio_clkdiv & 0xFF);
 
     // Synchronous SCSI data writer
     g_scsi_dma.pio_offset_sync_write = pio_add_program(SCSI_DMA_PIO, &scsi_sync_write_program);
@@ -886,6 +1028,7 @@ void scsi_accel_rp2040_init()
     sm_config_set_sideset_pins(&g_scsi_dma.pio_cfg_sync_write, SCSI_OUT_REQ);
     sm_config_set_out_shift(&g_scsi_dma.pio_cfg_sync_write, true, true, 32);
     sm_config_set_in_shift(&g_scsi_dma.pio_cfg_sync_write, true, true, 1);
+    sm_config_set_clkdiv_int_frac(&g_scsi_dma.pio_cfg_sync_write, g_scsi_pio_clkdiv >> 8, g_scsi_pio_clkdiv & 0xFF);
 
     // Asynchronous / synchronous SCSI read
     g_scsi_dma.pio_offset_read = pio_add_program(SCSI_DMA_PIO, &scsi_accel_read_program);
@@ -894,15 +1037,24 @@ void scsi_accel_rp2040_init()
     sm_config_set_sideset_pins(&g_scsi_dma.pio_cfg_read, SCSI_OUT_REQ);
     sm_config_set_out_shift(&g_scsi_dma.pio_cfg_read, true, false, 32);
     sm_config_set_in_shift(&g_scsi_dma.pio_cfg_read, true, true, 32);
+    sm_config_set_clkdiv_int_frac(&g_scsi_dma.pio_cfg_read, g_scsi_pio_clkdiv >> 8, g_scsi_pio_clkdiv & 0xFF);
 
     // Synchronous SCSI read pacer
     g_scsi_dma.pio_offset_sync_read_pacer = pio_add_program(SCSI_DMA_PIO, &scsi_sync_read_pacer_program);
     g_scsi_dma.pio_cfg_sync_read_pacer = scsi_sync_read_pacer_program_get_default_config(g_scsi_dma.pio_offset_sync_read_pacer);
     sm_config_set_sideset_pins(&g_scsi_dma.pio_cfg_sync_read_pacer, SCSI_OUT_REQ);
+    sm_config_set_clkdiv_int_frac(&g_scsi_dma.pio_cfg_sync_read_pacer, g_scsi_pio_clkdiv >> 8, g_scsi_pio_clkdiv & 0xFF);
 
+#if SCSI_ACCEL_FAST_PARITY
+    // Read data pass-through, parity is checked by DMA sniffer.
+    // Only one of the read parity programs fits in the instruction memory.
+    g_scsi_dma.pio_offset_read_parity = pio_add_program(SCSI_DMA_PIO, &scsi_read_direct_program);
+    g_scsi_dma.pio_cfg_read_parity = scsi_read_direct_program_get_default_config(g_scsi_dma.pio_offset_read_parity);
+#else
     // Read parity check
     g_scsi_dma.pio_offset_read_parity = pio_add_program(SCSI_DMA_PIO, &scsi_read_parity_program);
     g_scsi_dma.pio_cfg_read_parity = scsi_read_parity_program_get_default_config(g_scsi_dma.pio_offset_read_parity);
+#endif
     sm_config_set_out_shift(&g_scsi_dma.pio_cfg_read_parity, true, true, 32);
     sm_config_set_in_shift(&g_scsi_dma.pio_cfg_read_parity, true, false, 32);
 
@@ -970,11 +1122,16 @@ void scsi_accel_rp2040_init()
     // Channel C: Addresses from scsi_read PIO to channel B READ_ADDR register
     // A single transfer starts when PIO RX FIFO has data.
     // The DMA channel is re-enabled by channel B chaining.
+    // With SCSI_ACCEL_FAST_PARITY, copies data words to scsi_read_direct PIO instead
+    // and feeds them to the DMA sniffer.
     cfg = dma_channel_get_default_config(SCSI_DMA_CH_C);
     channel_config_set_transfer_data_size(&cfg, DMA_SIZE_32);
     channel_config_set_read_increment(&cfg, false);
     channel_config_set_write_increment(&cfg, false);
     channel_config_set_dreq(&cfg, pio_get_dreq(SCSI_DMA_PIO, SCSI_DATA_SM, false));
+#if SCSI_ACCEL_FAST_PARITY
+    channel_config_set_sniff_enable(&cfg, true);
+#endif
     g_scsi_dma.dmacfg_read_chC = cfg;
 
     // Channel D: In synchronous mode a second DMA channel is used to transfer dummy words
@@ -1044,34 +1201,36 @@ bool scsi_accel_rp2040_setSyncMode(int syncOffset, int syncPeriod)
 
             // Set up the timing parameters to PIO program
             // The scsi_sync_write PIO program consists of three instructions.
-            // The delays are in clock cycles, each taking 8 ns.
+            // The delays are in PIO clock cycles, each taking g_scsi_pio_cycle_ps
+            // (8 ns at 125 MHz).
             // delay0: Delay from data write to REQ assertion
             // delay1: Delay from REQ assert to REQ deassert
             // delay2: Delay from REQ deassert to data write
             int delay0, delay1, delay2;
-            int totalDelay = syncPeriod * 4 / 8;
+            int cycle_ps = g_scsi_pio_cycle_ps;
+            int totalDelay = syncPeriod * 4000 / cycle_ps;
 
             if (syncPeriod <= 25)
             {
                 // Fast SCSI timing: 30 ns assertion period, 25 ns skew delay
                 // The hardware rise and fall time require some extra delay,
-                // the values below are tuned based on oscilloscope measurements.
-                delay0 = 3;
-                delay1 = 5;
-                delay2 = totalDelay - delay0 - delay1 - 3;
-                if (delay2 < 0) delay2 = 0;
-                if (delay2 > 15) delay2 = 15;
+                // the values below are tuned based on oscilloscope measurements at 125 MHz.
+                delay0 = (24000 + cycle_ps / 2) / cycle_ps;
+                delay1 = (40000 + cycle_ps / 2) / cycle_ps;
             }
             else
             {
                 // Slow SCSI timing: 90 ns assertion period, 55 ns skew delay
-                delay0 = 6;
-                delay1 = 12;
-                delay2 = totalDelay - delay0 - delay1 - 3;
-                if (delay2 < 0) delay2 = 0;
-                if (delay2 > 15) delay2 = 15;
+                delay0 = (48000 + cycle_ps / 2) / cycle_ps;
+                delay1 = (96000 + cycle_ps / 2) / cycle_ps;
             }
 
+            if (delay0 > 15) delay0 = 15;
+            if (delay1 > 15) delay1 = 15;
+            delay2 = totalDelay - delay0 - delay1 - 3;
+            if (delay2 < 0) delay2 = 0;
+            if (delay2 > 15) delay2 = 15;
+
             // Patch the delay values into the instructions in scsi_sync_write.
             // The code in scsi_accel.pio must have delay set to 0 for this to work correctly.
             uint16_t instr0 = scsi_sync_write_program_instructions[0] | pio_encode_delay(delay0);
@@ -223,3 +223,33 @@ static inline pio_sm_config scsi_read_parity_program_get_default_config(uint off
 }
 #endif
 
+// ---------------- //
+// scsi_read_direct //
+// ---------------- //
+
+#define scsi_read_direct_wrap_target 0
+#define scsi_read_direct_wrap 4
+
+static const uint16_t scsi_read_direct_program_instructions[] = {
+            //     .wrap_target
+    0x6061, //  0: out    null, 1                    
+    0x6028, //  1: out    x, 8                       
+    0xa0c9, //  2: mov    isr, ~x                    
+    0x8020, //  3: push   block                      
+    0x6077, //  4: out    null, 23                   
+            //     .wrap
+};
+
+#if !PICO_NO_HARDWARE
+static const struct pio_program scsi_read_direct_program = {
+    .instructions = scsi_read_direct_program_instructions,
+    .length = 5,
+    .origin = -1,
+};
+
+static inline pio_sm_config scsi_read_direct_program_get_default_config(uint offset) {
+    pio_sm_config c = pio_get_default_sm_config();
+    sm_config_set_wrap(&c, offset + scsi_read_direct_wrap_target, offset + scsi_read_direct_wrap);
+    return c;
+}
+#endif
@@ -90,7 +90,7 @@ bool SdioCard::begin(SdioConfig sdioConfig)
     sdio_status_t status;
     
     // Initialize at 1 MHz clock speed
-    rp2040_sdio_init(25);
+    rp2040_sdio_init((25 * g_sdio_clkdiv) >> 8, (25 * g_sdio_clkdiv) & 0xFF);
 
     // Establish initial connection with the card
     for (int retries = 0; retries < 5; retries++)
@@ -167,8 +167,21 @@ bool SdioCard::begin(SdioConfig sdioConfig)
         return false;
     }
 
-    // Increase to 25 MHz clock rate
-    rp2040_sdio_init(1);
+    // Increase to 25 MHz clock rate, or the closest rate the clock profile allows.
+    // If the card does not respond at the higher rate, retry with slower clock.
+    for (int clkdiv = g_sdio_clkdiv; clkdiv <= 4 * g_sdio_clkdiv; clkdiv *= 2)
+    {
+        rp2040_sdio_init(clkdiv >> 8, clkdiv & 0xFF);
+        if (checkReturnOk(rp2040_sdio_command_R1(CMD13, g_sdio_rca, &reply)))
+        {
+            if (clkdiv != g_sdio_clkdiv)
+            {
+                logmsg("SDIO card did not respond at full clock rate, using divider ", clkdiv, "/256");
+                g_sdio_clkdiv = clkdiv;
+            }
+            break;
+        }
+    }
 
     return true;
 }
@@ -316,8 +329,30 @@ bool SdioCard::writeStop()
 
 bool SdioCard::erase(uint32_t firstSector, uint32_t lastSector)
 {
-    logmsg("SdioCard::erase() not implemented");
-    return false;
+    // Cards up to 2GB use byte addressing, SDHC cards use sector addressing
+    uint32_t mult = (type() == SD_CARD_TYPE_SDHC) ? 1 : 512;
+
+    uint32_t reply;
+    if (!checkReturnOk(rp2040_sdio_command_R1(CMD32, firstSector * mult, &reply)) || // ERASE_WR_BLK_START
+        !checkReturnOk(rp2040_sdio_command_R1(CMD33, lastSector * mult, &reply)) || // ERASE_WR_BLK_END
+        !checkReturnOk(rp2040_sdio_command_R1(CMD38, 0, &reply))) // ERASE
+    {
+        return false;
+    }
+
+    // Card signals busy on D0 until erase completes
+    uint32_t start = millis();
+    while ((uint32_t)(millis() - start) < 30000 && isBusy())
+    {
+    }
+
+    if (isBusy())
+    {
+        logmsg("SdioCard::erase() timeout");
+        return false;
+    }
+
+    return true;
 }
 
 bool SdioCard::cardCMD6(uint32_t arg, uint8_t* status) {
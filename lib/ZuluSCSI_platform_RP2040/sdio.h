@@ -70,4 +70,5 @@ sdio_status_t rp2040_sdio_tx_poll(uint32_t *bytes_complete = nullptr);
 sdio_status_t rp2040_sdio_stop();
 
 // (Re)initialize the SDIO interface
-void rp2040_sdio_init(int clock_divider = 1);
+// Clock divider has optional fractional part in 1/256 steps.
+void rp2040_sdio_init(int clock_divider = 1, int clock_divider_frac = 0);
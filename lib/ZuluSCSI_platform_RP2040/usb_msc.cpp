@@ -0,0 +1,278 @@
+/**
+ * ZuluSCSI™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluSCSI™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// Glue between the mbed PluggableUSB stack and the USBMassStorage state machine.
+// Endpoint callbacks run in USB interrupt context, so they only record
+// the completed transfer. All command processing, including SD card access,
+// happens in usb_msc_poll() from the main loop.
+
+#include "usb_msc.h"
+#include <USBMassStorage.h>
+#include <Arduino.h>
+#include <string.h>
+#include <USB/PluggableUSBDevice.h>
+
+using namespace arduino;
+
+#define MSC_MAX_PACKET 64
+
+// Bulk-only transport class requests
+#define MSC_REQUEST_RESET 0xFF
+#define MSC_REQUEST_GET_MAX_LUN 0xFE
+
+class USBMSCInterface: public internal::PluggableUSBModule
+{
+public:
+    USBMSCInterface(): internal::PluggableUSBModule(1)
+    {
+        m_configured = false;
+        m_in_idle = true;
+        m_out_len = 0;
+        m_out_ready = false;
+        m_reset_pending = false;
+        m_max_lun = 0;
+        PluggableUSBD().plug(this);
+    }
+
+    USBMassStorage msc;
+
+    bool configured() const { return m_configured; }
+
+    void poll()
+    {
+        if (!m_configured) return;
+
+        if (m_reset_pending)
+        {
+            m_reset_pending = false;
+            msc.reset();
+        }
+
+        if (m_out_ready)
+        {
+            // Pass received packet to the state machine and start next reception
+            msc.packetOut(m_out_buf, m_out_len);
+            m_out_ready = false;
+
+            if (msc.outStalled())
+            {
+                // Host clears the halt condition and then resets the interface
+                PluggableUSBD().endpoint_stall(m_bulk_out);
+                msc.clearOutStall();
+            }
+
+            PluggableUSBD().read_start(m_bulk_out, m_out_buf, MSC_MAX_PACKET);
+        }
+
+        if (m_in_idle)
+        {
+            if (msc.inStalled())
+            {
+                // Host clears the halt condition before it reads the status
+                PluggableUSBD().endpoint_stall(m_bulk_in);
+                msc.clearInStall();
+            }
+
+            uint32_t len = msc.packetIn(m_in_buf, MSC_MAX_PACKET);
+            if (len > 0)
+            {
+                m_in_idle = false;
+                PluggableUSBD().write_start(m_bulk_in, m_in_buf, len);
+            }
+        }
+    }
+
+protected:
+    void init(EndpointResolver &resolver) override
+    {
+        m_bulk_in = resolver.endpoint_in(USB_EP_TYPE_BULK, MSC_MAX_PACKET);
+        m_bulk_out = resolver.endpoint_out(USB_EP_TYPE_BULK, MSC_MAX_PACKET);
+    }
+
+    bool callback_request(const USBDevice::setup_packet_t *setup, USBDevice::RequestResult *result,
+                          uint8_t **data, uint32_t *size) override
+    {
+        if (setup->bmRequestType.Type != CLASS_TYPE || setup->wIndex != pluggedInterface)
+        {
+            return false;
+        }
+
+        if (setup->bRequest == MSC_REQUEST_GET_MAX_LUN)
+        {
+            *result = USBDevice::Send;
+            *data = &m_max_lun;
+            *size = 1;
+            return true;
+        }
+        else if (setup->bRequest == MSC_REQUEST_RESET)
+        {
+            // The state machine is reset from main loop on next poll
+            m_reset_pending = true;
+            *result = USBDevice::Success;
+            return true;
+        }
+
+        return false;
+    }
+
+    bool callback_request_xfer_done(const USBDevice::setup_packet_t *setup, bool aborted) override
+    {
+        return false;
+    }
+
+    bool callback_set_configuration(uint8_t configuration) override
+    {
+        PluggableUSBD().endpoint_add(m_bulk_in, MSC_MAX_PACKET, USB_EP_TYPE_BULK,
+                                     mbed::callback(this, &USBMSCInterface::bulk_in_done));
+        PluggableUSBD().endpoint_add(m_bulk_out, MSC_MAX_PACKET, USB_EP_TYPE_BULK,
+                                     mbed::callback(this, &USBMSCInterface::bulk_out_done));
+
+        m_in_idle = true;
+        m_out_ready = false;
+        m_reset_pending = true;
+        PluggableUSBD().read_start(m_bulk_out, m_out_buf, MSC_MAX_PACKET);
+        m_configured = true;
+        return true;
+    }
+
+    void callback_set_interface(uint16_t interface, uint8_t alternate) override
+    {
+    }
+
+    void callback_state_change(USBDevice::DeviceState new_state) override
+    {
+        if (new_state != USBDevice::Configured)
+        {
+            m_configured = false;
+        }
+    }
+
+    const uint8_t *configuration_desc(uint8_t index) override
+    {
+        if (index != 0)
+        {
+            return NULL;
+        }
+
+        uint8_t desc[] = {
+            // Interface descriptor: mass storage, SCSI transparent, bulk-only
+            INTERFACE_DESCRIPTOR_LENGTH, INTERFACE_DESCRIPTOR,
+            pluggedInterface, 0x00, 0x02, 0x08, 0x06, 0x50, 0x00,
+
+            // Bulk IN endpoint
+            ENDPOINT_DESCRIPTOR_LENGTH, ENDPOINT_DESCRIPTOR,
+            m_bulk_in, E_BULK, (uint8_t)LSB(MSC_MAX_PACKET), (uint8_t)MSB(MSC_MAX_PACKET), 0,
+
+            // Bulk OUT endpoint
+            ENDPOINT_DESCRIPTOR_LENGTH, ENDPOINT_DESCRIPTOR,
+            m_bulk_out, E_BULK, (uint8_t)LSB(MSC_MAX_PACKET), (uint8_t)MSB(MSC_MAX_PACKET), 0,
+        };
+
+        static_assert(sizeof(desc) == sizeof(m_config_desc), "Descriptor size mismatch");
+        memcpy(m_config_desc, desc, sizeof(m_config_desc));
+        return m_config_desc;
+    }
+
+    uint8_t getProductVersion() override
+    {
+        return 1;
+    }
+
+private:
+    usb_ep_t m_bulk_in;
+    usb_ep_t m_bulk_out;
+    volatile bool m_configured;
+    volatile bool m_in_idle;
+    volatile bool m_out_ready;
+    volatile bool m_reset_pending;
+    volatile uint32_t m_out_len;
+    uint8_t m_max_lun;
+    uint8_t m_in_buf[MSC_MAX_PACKET];
+    uint8_t m_out_buf[MSC_MAX_PACKET];
+    uint8_t m_config_desc[INTERFACE_DESCRIPTOR_LENGTH + 2 * ENDPOINT_DESCRIPTOR_LENGTH];
+
+    void bulk_in_done()
+    {
+        PluggableUSBD().write_finish(m_bulk_in);
+        m_in_idle = true;
+    }
+
+    void bulk_out_done()
+    {
+        m_out_len = PluggableUSBD().read_finish(m_bulk_out);
+        m_out_ready = true;
+    }
+};
+
+// Created on first use, a static instance would plug itself into the
+// USB stack from its constructor on every boot.
+static USBMSCInterface *g_usb_msc;
+
+void usb_msc_enable()
+{
+    if (g_usb_msc) return;
+
+    // Host only sees the new interface after the device re-enumerates
+    PluggableUSBD().disconnect();
+    g_usb_msc = new USBMSCInterface();
+    PluggableUSBD().connect();
+    g_usb_msc_poll = usb_msc_poll;
+}
+
+void usb_msc_start(MSCStorage *storage, uint8_t *buffer, uint32_t buffer_size)
+{
+    if (g_usb_msc) g_usb_msc->msc.setStorage(storage, buffer, buffer_size);
+}
+
+void usb_msc_stop()
+{
+    if (g_usb_msc) g_usb_msc->msc.setStorage(NULL, NULL, 0);
+}
+
+bool usb_msc_host_connected()
+{
+    return g_usb_msc && g_usb_msc->configured();
+}
+
+bool usb_msc_ejected()
+{
+    return g_usb_msc && g_usb_msc->msc.ejected();
+}
+
+bool usb_msc_busy()
+{
+    return g_usb_msc && !g_usb_msc->msc.idle();
+}
+
+uint64_t usb_msc_bytes_read()
+{
+    return g_usb_msc ? g_usb_msc->msc.bytesRead() : 0;
+}
+
+uint64_t usb_msc_bytes_written()
+{
+    return g_usb_msc ? g_usb_msc->msc.bytesWritten() : 0;
+}
+
+void usb_msc_poll()
+{
+    if (g_usb_msc) g_usb_msc->poll();
+}
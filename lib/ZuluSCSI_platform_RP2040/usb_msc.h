@@ -0,0 +1,61 @@
+/**
+ * ZuluSCSI™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluSCSI™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// USB mass storage interface for RP2040.
+// The interface is added next to the CDC log port by usb_msc_enable(),
+// making the device a composite USB device. It reports no medium until
+// usb_msc_start() is called.
+
+#pragma once
+
+#include <stdint.h>
+
+class MSCStorage;
+
+// Add the mass storage interface and re-enumerate on the USB bus.
+// Nothing is registered with the USB stack before this is called.
+void usb_msc_enable();
+
+// Give host access to storage. Buffer is used for multi-sector transfers.
+void usb_msc_start(MSCStorage *storage, uint8_t *buffer, uint32_t buffer_size);
+
+// Remove storage from host, further commands report NOT READY.
+void usb_msc_stop();
+
+// True if USB host has configured the device
+bool usb_msc_host_connected();
+
+// True if host has requested medium eject
+bool usb_msc_ejected();
+
+// True if a command is being processed
+bool usb_msc_busy();
+
+// Total transfer statistics since boot
+uint64_t usb_msc_bytes_read();
+uint64_t usb_msc_bytes_written();
+
+// Process packets received from host and queue new ones for sending.
+// Called from platform_poll() through g_usb_msc_poll, which is set by
+// usb_msc_enable(). The bootloader never enables it, so it does not
+// link the mass storage code.
+void usb_msc_poll();
+extern void (*g_usb_msc_poll)();
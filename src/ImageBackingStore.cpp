@@ -25,11 +25,29 @@
 #include <ZuluSCSI_platform.h>
 #include "ZuluSCSI_log.h"
 #include "ZuluSCSI_config.h"
+#include "ZuluSCSI_cycletrace.h"
 #include <minIni.h>
 #include <strings.h>
 #include <string.h>
 #include <assert.h>
 
+// Erase that takes longer than this stalls the SCSI transfer too much,
+// zeros are written instead after that.
+#ifndef DISCARD_MAX_ERASE_MS
+#define DISCARD_MAX_ERASE_MS 100
+#endif
+
+uint32_t sdCardEraseSectors(SdCard *card)
+{
+    csd_t csd;
+    if (!card->readCSD(&csd))
+    {
+        return 0;
+    }
+
+    return csd.eraseSingleBlock() ? 1 : csd.eraseSize();
+}
+
 ImageBackingStore::ImageBackingStore()
 {
     m_israw = false;
@@ -37,10 +55,137 @@ ImageBackingStore::ImageBackingStore()
     m_isreadonly_attr = false;
     m_blockdev = nullptr;
     m_bgnsector = m_endsector = m_cursector = 0;
+    m_erasesectors = 0;
+    m_erasestate = ERASE_UNKNOWN;
+}
+
+// Find the sector range of partition from MBR or GPT partition table on SD card.
+// Partitions are numbered starting from 1.
+static bool getPartitionRange(uint32_t part, uint32_t *bgnSector, uint32_t *endSector)
+{
+    static uint8_t sector[SD_SECTOR_SIZE];
+    SdCard *card = SD.card();
+
+    // Check for GPT first, it is commonly accompanied by a protective MBR
+    if (card->readSector(1, sector) &&
+        memcmp(((const GPT_Header_t*)sector)->signature, "EFI PART", 8) == 0)
+    {
+        const GPT_Header_t *gpt = (const GPT_Header_t*)sector;
+        uint64_t entry_lba = getLe64(gpt->part_entry_start_lba);
+        uint32_t num_entries = getLe32(gpt->num_part_entries);
+        uint32_t entry_size = getLe32(gpt->part_entry_size);
+
+        if (part > num_entries || entry_size < sizeof(GPT_PartitionEntry_t) || entry_size > SD_SECTOR_SIZE)
+        {
+            logmsg("---- GPT partition table does not have partition ", (int)part);
+            return false;
+        }
+
+        uint64_t offset = (uint64_t)(part - 1) * entry_size;
+        if (!card->readSector(entry_lba + offset / SD_SECTOR_SIZE, sector))
+        {
+            logmsg("---- Failed to read GPT partition entry");
+            return false;
+        }
+
+        const GPT_PartitionEntry_t *entry = (const GPT_PartitionEntry_t*)(sector + offset % SD_SECTOR_SIZE);
+        uint64_t first = getLe64(entry->first_lba);
+        uint64_t last = getLe64(entry->last_lba);
+        static const uint8_t unused_type[16] = {0};
+        if (memcmp(entry->part_type_guid, unused_type, 16) == 0 || last < first)
+        {
+            logmsg("---- GPT partition ", (int)part, " is unused");
+            return false;
+        }
+
+        if (last > 0xFFFFFFFFULL)
+        {
+            logmsg("---- GPT partition ", (int)part, " is beyond 2 TB limit");
+            return false;
+        }
+
+        *bgnSector = first;
+        *endSector = last;
+        return true;
+    }
+
+    if (!card->readSector(0, sector))
+    {
+        logmsg("---- Failed to read MBR partition table");
+        return false;
+    }
+
+    const MbrSector_t *mbr = (const MbrSector_t*)sector;
+    if (getLe16(mbr->signature) != MBR_SIGNATURE)
+    {
+        logmsg("---- SD card has no MBR or GPT partition table");
+        return false;
+    }
+
+    if (part < 1 || part > 4)
+    {
+        logmsg("---- Only primary partitions 1 to 4 are supported for MBR partition table");
+        return false;
+    }
+
+    const MbrPart_t *mp = &mbr->part[part - 1];
+    uint32_t start = getLe32(mp->relativeSectors);
+    uint32_t count = getLe32(mp->totalSectors);
+    if (mp->type == 0 || count == 0)
+    {
+        logmsg("---- MBR partition ", (int)part, " is unused");
+        return false;
+    }
+
+    *bgnSector = start;
+    *endSector = start + count - 1;
+    return true;
+}
+
+// Check that the partition does not contain the filesystem mounted by firmware.
+// Host writes to it would corrupt the configuration and image files.
+static bool checkPartitionNotMounted(uint32_t part, uint32_t bgnSector, uint32_t endSector)
+{
+    if (SD.fatType() == 0)
+    {
+        return true;
+    }
+
+    uint32_t volBgn = SD.fatStartSector();
+    uint32_t volEnd = SD.dataStartSector() + SD.clusterCount() * SD.sectorsPerCluster() - 1;
+    if (bgnSector <= volEnd && endSector >= volBgn)
+    {
+        logmsg("---- Partition ", (int)part, " contains the filesystem with " CONFIGFILE
+               " and image files, refusing to use it as an image");
+        return false;
+    }
+
+    return true;
+}
+
+// Log whether partition is aligned to SD card erase blocks.
+// Misaligned partitions cause SD card to do extra read-modify-write cycles.
+static void checkPartitionAlignment(uint32_t part, uint32_t bgnSector, uint32_t endSector)
+{
+    uint32_t erase_size = sdCardEraseSectors(SD.card());
+    if (erase_size == 0) erase_size = 1;
+
+    logmsg("---- Partition ", (int)part, " is sectors ", bgnSector, " to ", endSector);
+    if (erase_size > 1 && (bgnSector % erase_size != 0 || (endSector + 1) % erase_size != 0))
+    {
+        logmsg("---- WARNING: Partition is not aligned to SD card erase block size of ",
+               (int)erase_size, " sectors, write performance may be reduced");
+    }
+    else
+    {
+        dbgmsg("---- Partition is aligned to SD card erase block size of ", (int)erase_size, " sectors");
+    }
 }
 
 ImageBackingStore::ImageBackingStore(const char *filename, uint32_t scsi_block_size): ImageBackingStore()
 {
+    bool israw = false;
+
     if (strncasecmp(filename, "RAW:", 4) == 0)
     {
         char *endptr, *endptr2;
@@ -53,6 +198,36 @@ ImageBackingStore::ImageBackingStore(const char *filename, uint32_t scsi_block_s
             return;
         }
 
+        israw = true;
+    }
+    else if (strncasecmp(filename, "PART:", 5) == 0)
+    {
+        char *endptr;
+        uint32_t part = strtoul(filename + 5, &endptr, 0);
+
+        if (*endptr != '\0' || part == 0)
+        {
+            logmsg("Invalid format for partition filename: ", filename);
+            return;
+        }
+
+        if (!getPartitionRange(part, &m_bgnsector, &m_endsector))
+        {
+            logmsg("Could not map SD card partition ", (int)part);
+            return;
+        }
+
+        if (!checkPartitionNotMounted(part, m_bgnsector, m_endsector))
+        {
+            return;
+        }
+
+        checkPartitionAlignment(part, m_bgnsector, m_endsector);
+        israw = true;
+    }
+
+    if (israw)
+    {
         if ((scsi_block_size % SD_SECTOR_SIZE) != 0)
         {
             logmsg("SCSI block size ", (int)scsi_block_size, " is not supported for RAW partitions (must be divisible by 512 bytes)");
@@ -229,6 +404,8 @@ bool ImageBackingStore::seek(uint64_t pos)
 
 ssize_t ImageBackingStore::read(void* buf, size_t count)
 {
+    CYCLE_TRACE_SCOPE(TRACE_SD_READ_START, count);
+
     uint32_t sectorcount = count / SD_SECTOR_SIZE;
     if (m_israw && (uint64_t)sectorcount * SD_SECTOR_SIZE != count)
     {
@@ -271,6 +448,8 @@ ssize_t ImageBackingStore::read(void* buf, size_t count)
 
 ssize_t ImageBackingStore::write(const void* buf, size_t count)
 {
+    CYCLE_TRACE_SCOPE(TRACE_SD_WRITE_START, count);
+
     uint32_t sectorcount = count / SD_SECTOR_SIZE;
     if (m_israw && (uint64_t)sectorcount * SD_SECTOR_SIZE != count)
     {
@@ -306,6 +485,78 @@ ssize_t ImageBackingStore::write(const void* buf, size_t count)
     }
 }
 
+bool ImageBackingStore::discard(size_t count)
+{
+    uint32_t sectorcount = count / SD_SECTOR_SIZE;
+    if (!m_israw || !m_blockdev || m_erasestate == ERASE_UNUSABLE ||
+        sectorcount == 0 || (uint64_t)sectorcount * SD_SECTOR_SIZE != count ||
+        m_cursector + sectorcount - 1 > m_endsector)
+    {
+        return false;
+    }
+
+    if (m_erasesectors == 0)
+    {
+        m_erasesectors = sdCardEraseSectors(m_blockdev);
+        if (m_erasesectors == 0)
+        {
+            dbgmsg("---- SD card erase unit size unknown, writing zeros to image instead");
+            m_erasestate = ERASE_UNUSABLE;
+            return false;
+        }
+    }
+
+    uint32_t first = m_cursector;
+    uint32_t last = m_cursector + sectorcount - 1;
+    if (first % m_erasesectors != 0 || (last + 1) % m_erasesectors != 0)
+    {
+        // Card would erase whole erase units, including sectors outside the range
+        return false;
+    }
+
+    CYCLE_TRACE_SCOPE(TRACE_SD_WRITE_START, count);
+
+    uint32_t start = millis();
+    if (!m_blockdev->erase(first, last))
+    {
+        dbgmsg("---- SD card erase failed, writing zeros to image instead");
+        m_erasestate = ERASE_UNUSABLE;
+        return false;
+    }
+
+    uint32_t elapsed = millis() - start;
+
+    if (m_erasestate == ERASE_UNKNOWN)
+    {
+        // Cards may erase to either 0x00 or 0xFF, check which one this is
+        uint32_t sector[SD_SECTOR_SIZE / 4];
+        bool zeros = m_blockdev->readSector(first, (uint8_t*)sector);
+        for (int i = 0; zeros && i < SD_SECTOR_SIZE / 4; i++)
+        {
+            if (sector[i] != 0) zeros = false;
+        }
+
+        if (!zeros)
+        {
+            dbgmsg("---- SD card erase does not give zeros, writing zeros to image instead");
+            m_erasestate = ERASE_UNUSABLE;
+            return false;
+        }
+
+        m_erasestate = ERASE_ZEROS;
+    }
+
+    if (elapsed > DISCARD_MAX_ERASE_MS)
+    {
+        // This range is erased already, but don't stall further transfers
+        dbgmsg("---- SD card erase took ", (int)elapsed, " ms, writing zeros to image instead");
+        m_erasestate = ERASE_UNUSABLE;
+    }
+
+    m_cursector += sectorcount;
+    return true;
+}
+
 void ImageBackingStore::flush()
 {
     if (!m_israw && !m_isrom && !m_isreadonly_attr)
@@ -20,11 +20,17 @@ extern "C" {
 extern SdFs SD;
 #define SD_SECTOR_SIZE 512
 
+// Number of sectors that the SD card erases as one unit, 1 if single sectors
+// can be erased. Erasing a range that is not aligned to this clears the
+// neighbouring sectors too. Returns 0 if the card does not report it.
+uint32_t sdCardEraseSectors(SdCard *card);
+
 // This class wraps SdFat library FsFile to allow access
 // through either FAT filesystem or as a raw sector range.
 //
 // Raw access is activated by using filename like "RAW:0:12345"
-// where the numbers are the first and last sector.
+// where the numbers are the first and last sector, or "PART:2"
+// where the number is a partition in the SD card MBR or GPT table.
 //
 // If the platform supports a ROM drive, it is activated by using
 // filename "ROM:".
@@ -37,6 +43,7 @@ public:
     // Parse image file parameters from filename.
     // Special filename formats:
     //    RAW:start:end
+    //    PART:n
     //    ROM:
     ImageBackingStore(const char *filename, uint32_t scsi_block_size);
 
@@ -68,6 +75,13 @@ public:
     // Write data to image file, returns number of bytes written, or negative on error.
     ssize_t write(const void* buf, size_t count);
 
+    // Clear count bytes at current position to zeros by erasing the SD card
+    // sectors instead of writing them. Only possible for raw or contiguous
+    // images on cards that erase to zeros, and for ranges aligned to the
+    // card erase unit. Returns false if nothing was done, in which case the
+    // caller should write the zeros normally.
+    bool discard(size_t count);
+
     // Flush any pending changes to filesystem
     void flush();
 
@@ -85,4 +99,11 @@ protected:
     uint32_t m_bgnsector;
     uint32_t m_endsector;
     uint32_t m_cursector;
+    uint32_t m_erasesectors;
+
+    enum {
+        ERASE_UNKNOWN = 0,  // Not checked yet what erased sectors read as
+        ERASE_ZEROS,        // Erased sectors read as zeros, discard() can be used
+        ERASE_UNUSABLE      // Erase failed or does not give zeros
+    } m_erasestate;
 };
@@ -50,9 +50,11 @@
 #include "ZuluSCSI_platform.h"
 #include "ZuluSCSI_log.h"
 #include "ZuluSCSI_log_trace.h"
+#include "ZuluSCSI_cycletrace.h"
 #include "ZuluSCSI_presets.h"
 #include "ZuluSCSI_disk.h"
 #include "ZuluSCSI_initiator.h"
+#include "ZuluSCSI_msc.h"
 #include "ROMDrive.h"
 
 SdFs SD;
@@ -639,6 +641,19 @@ extern "C" void zuluscsi_setup(void)
     logmsg("SD card init succeeded after retry");
   }
 
+  if (g_sdcard_present)
+  {
+    if (zuluscsi_msc_run())
+    {
+      // Host may have reformatted or repartitioned the card
+      g_sdcard_present = mountSDCard();
+      if (!g_sdcard_present)
+      {
+        logmsg("SD card remount after USB mass storage mode failed, sdErrorCode: ", (int)SD.sdErrorCode());
+      }
+    }
+  }
+
   if (g_sdcard_present)
   {
     if (SD.clusterCount() == 0)
@@ -674,6 +689,7 @@ extern "C" void zuluscsi_setup(void)
   if (g_sdcard_present)
   {
     init_logfile();
+    cycletrace_init();
     if (ini_getbool("SCSI", "DisableStatusLED", false, CONFIGFILE))
     {
       platform_disable_led();
@@ -717,6 +733,11 @@ extern "C" void zuluscsi_main_loop(void)
       save_logfile();
       last_request_time = millis();
     }
+
+    if (scsiDev.phase == BUS_FREE)
+    {
+      cycletrace_poll();
+    }
   }
 
   if (g_sdcard_present)
@@ -752,6 +773,7 @@ extern "C" void zuluscsi_main_loop(void)
 
         reinitSCSI();
         init_logfile();
+        cycletrace_init();
       }
       else if (!g_romdrive_active)
       {
@@ -79,6 +79,18 @@ bool audio_is_playing(uint8_t id);
  */
 bool audio_play(uint8_t owner, ImageBackingStore* img, uint64_t start, uint64_t end, bool swap);
 
+/**
+ * Begins audio playback for a FLAC compressed file. Samples are decoded as
+ * they are played, using the decoder shared with other FLAC images.
+ *
+ * \param owner  The SCSI ID that initiated this playback operation.
+ * \param img    Pointer to the image containing the FLAC stream to play.
+ * \param start  Byte offset within decoded samples where playback will begin, inclusive.
+ * \param end    Byte offset within decoded samples where playback will end, exclusive.
+ * \return       True if successful, false otherwise.
+ */
+bool audio_play_flac(uint8_t owner, ImageBackingStore* img, uint64_t start, uint64_t end);
+
 /**
  * Pauses audio playback. This may be delayed slightly to allow sample buffers
  * to purge.
@@ -59,6 +59,36 @@ bool find_firmware_image(FsFile &file, char name[MAX_FILE_PATH + 1])
     return false;
 }
 
+// Number of flash pages to read from SD card at a time.
+// Multi-sector reads are much faster than reading one page per call.
+#ifndef BOOTLOADER_READ_PAGES
+#define BOOTLOADER_READ_PAGES 4
+#endif
+
+// CRC32 (IEEE 802.3) using a 16-entry table to keep the bootloader small
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, uint32_t len)
+{
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+        0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+        0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+    };
+
+    crc = ~crc;
+    for (uint32_t i = 0; i < len; i++)
+    {
+        crc = table[(crc ^ data[i]) & 0x0F] ^ (crc >> 4);
+        crc = table[(crc ^ (data[i] >> 4)) & 0x0F] ^ (crc >> 4);
+    }
+    return ~crc;
+}
+
+static uint32_t flash_crc32(uint32_t fwsize)
+{
+    return crc32_update(0, platform_get_flash_ptr(PLATFORM_BOOTLOADER_SIZE), fwsize);
+}
+
 bool program_firmware(FsFile &file)
 {
     uint32_t filesize = file.size();
@@ -66,7 +96,7 @@ bool program_firmware(FsFile &file)
     uint32_t num_pages = (fwsize + PLATFORM_FLASH_PAGE_SIZE - 1) / PLATFORM_FLASH_PAGE_SIZE;
 
     // Make sure the buffer is aligned to word boundary
-    static uint32_t buffer32[PLATFORM_FLASH_PAGE_SIZE / 4];
+    static uint32_t buffer32[PLATFORM_FLASH_PAGE_SIZE * BOOTLOADER_READ_PAGES / 4];
     uint8_t *buffer = (uint8_t*)buffer32;
 
     if (filesize > PLATFORM_FLASH_TOTAL_SIZE)
@@ -75,30 +105,112 @@ bool program_firmware(FsFile &file)
         return false;
     }
 
+    // Checksum the whole update file first, so that the data actually
+    // programmed can be checked against it. Compare it against flash at the
+    // same time, so that unchanged firmware is skipped.
     if (!file.seek(PLATFORM_BOOTLOADER_SIZE))
     {
         logmsg("Seek failed");
         return false;
     }
 
-    for (int i = 0; i < num_pages; i++)
+    uint32_t file_crc = 0;
+    bool flash_matches = true;
+    for (uint32_t pos = 0; pos < fwsize; )
     {
-        if (i % 2)
-            LED_ON();
-        else
-            LED_OFF();
-        
-        if (file.read(buffer, PLATFORM_FLASH_PAGE_SIZE) <= 0)
+        uint32_t len = fwsize - pos;
+        if (len > sizeof(buffer32)) len = sizeof(buffer32);
+
+        if (file.read(buffer, len) != (int)len)
         {
-            logmsg("Firmware file read failed on page ", i);
+            logmsg("Firmware file read failed at offset ", (int)pos);
             return false;
         }
 
-        if (!platform_rewrite_flash_page(PLATFORM_BOOTLOADER_SIZE + i * PLATFORM_FLASH_PAGE_SIZE, buffer))
+        file_crc = crc32_update(file_crc, buffer, len);
+        if (flash_matches &&
+            memcmp(buffer, platform_get_flash_ptr(PLATFORM_BOOTLOADER_SIZE + pos), len) != 0)
+        {
+            flash_matches = false;
+        }
+        pos += len;
+    }
+
+    logmsg("Firmware file CRC ", file_crc);
+    if (flash_matches)
+    {
+        logmsg("Flash already contains this firmware, skipping programming");
+        return true;
+    }
+
+    if (!file.seek(PLATFORM_BOOTLOADER_SIZE))
+    {
+        logmsg("Seek failed");
+        return false;
+    }
+
+    // Program only the pages that differ from current flash contents.
+    // Several pages are read at once, so the SD card access cost is
+    // amortized over the erase and program cycles.
+    uint32_t data_crc = 0;
+    int pages_written = 0;
+    uint32_t page = 0;
+    while (page < num_pages)
+    {
+        uint32_t pos = page * PLATFORM_FLASH_PAGE_SIZE;
+        uint32_t len = fwsize - pos;
+        if (len > sizeof(buffer32)) len = sizeof(buffer32);
+
+        if (file.read(buffer, len) != (int)len)
         {
-            logmsg("Flash programming failed on page ", i);
+            logmsg("Firmware file read failed on page ", (int)page);
             return false;
         }
+        data_crc = crc32_update(data_crc, buffer, len);
+
+        // Pad the last partial page with erased flash value
+        uint32_t chunk_pages = (len + PLATFORM_FLASH_PAGE_SIZE - 1) / PLATFORM_FLASH_PAGE_SIZE;
+        memset(buffer + len, 0xFF, chunk_pages * PLATFORM_FLASH_PAGE_SIZE - len);
+
+        for (uint32_t i = 0; i < chunk_pages; i++, page++)
+        {
+            if (page % 2)
+                LED_ON();
+            else
+                LED_OFF();
+
+            uint32_t offset = PLATFORM_BOOTLOADER_SIZE + page * PLATFORM_FLASH_PAGE_SIZE;
+            uint8_t *pagebuf = buffer + i * PLATFORM_FLASH_PAGE_SIZE;
+            uint32_t cmplen = fwsize - page * PLATFORM_FLASH_PAGE_SIZE;
+            if (cmplen > PLATFORM_FLASH_PAGE_SIZE) cmplen = PLATFORM_FLASH_PAGE_SIZE;
+
+            if (memcmp(pagebuf, platform_get_flash_ptr(offset), cmplen) == 0)
+            {
+                continue;
+            }
+
+            if (!platform_rewrite_flash_page(offset, pagebuf))
+            {
+                logmsg("Flash programming failed on page ", (int)page);
+                return false;
+            }
+            pages_written++;
+        }
+    }
+
+    logmsg("Programmed ", pages_written, " of ", (int)num_pages, " flash pages");
+
+    if (data_crc != file_crc)
+    {
+        logmsg("Firmware file CRC changed during programming: ", data_crc, " expected ", file_crc);
+        return false;
+    }
+
+    uint32_t new_crc = flash_crc32(fwsize);
+    if (new_crc != file_crc)
+    {
+        logmsg("Flash CRC check failed after programming: ", new_crc, " expected ", file_crc);
+        return false;
     }
 
     return true;
@@ -32,9 +32,11 @@
 #include "ZuluSCSI_log.h"
 #include "ZuluSCSI_config.h"
 #include <CUEParser.h>
+#include <ISO9660Parser.h>
 #include <assert.h>
 #ifdef ENABLE_AUDIO_OUTPUT
 #include "ZuluSCSI_audio.h"
+#include "ZuluSCSI_flac.h"
 #endif
 
 extern "C" {
@@ -253,13 +255,66 @@ static int32_t MSF2LBA(uint8_t m, uint8_t s, uint8_t f, bool relative)
     return lba;
 }
 
+// Size of the data that track offsets refer to.
+// For FLAC images this is the size of decoded audio.
+static uint64_t getImageSize(image_config_t &img, const CUETrackInfo* track)
+{
+    if (track->file_mode == CUEFile_FLAC)
+    {
+        return img.flac_decoded_size;
+    }
+    else
+    {
+        return img.file.size();
+    }
+}
+
+// Current read position in the image, in decoded audio for FLAC images
+static uint64_t getImagePosition(image_config_t &img)
+{
+#ifdef ENABLE_AUDIO_OUTPUT
+    FLACDecoder *decoder = flacAttachedDecoder(&img.file);
+    if (decoder)
+    {
+        return decoder->position() * 4;
+    }
+#endif
+    return img.file.position();
+}
+
+// Read track data from the image, decoding it for FLAC images
+static bool readImageData(image_config_t &img, const CUETrackInfo* track,
+                          uint64_t pos, uint8_t *buf, uint32_t len)
+{
+#ifdef ENABLE_AUDIO_OUTPUT
+    if (track->file_mode == CUEFile_FLAC)
+    {
+        // Sequential reads continue from the current decoder position
+        FLACDecoder *decoder = flacGetDecoder(&img.file);
+        uint32_t done = 0;
+        bool status = (decoder != NULL);
+        if (status && decoder->position() * 4 != pos)
+        {
+            status = decoder->seek(pos / 4);
+        }
+        if (status)
+        {
+            status = (decoder->read(buf, len, &done) == FLAC_OK && done == len);
+        }
+        memset(buf + done, 0, len - done);
+        return status;
+    }
+#endif
+    return img.file.seek(pos) && img.file.read(buf, len) == (ssize_t)len;
+}
+
 // Gets the LBA position of the lead-out for the current image
 static uint32_t getLeadOutLBA(const CUETrackInfo* lasttrack)
 {
     if (lasttrack != nullptr && lasttrack->track_number != 0)
     {
         image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
-        uint32_t lastTrackBlocks = (img.file.size() - lasttrack->file_offset)
+        uint32_t lastTrackBlocks = (getImageSize(img, lasttrack) - lasttrack->file_offset)
                 / lasttrack->sector_length;
         return lasttrack->track_start + lastTrackBlocks;
     }
@@ -1117,6 +1172,9 @@ bool cdromValidateCueSheet(image_config_t &img)
 
     const CUETrackInfo *trackinfo;
     int trackcount = 0;
+#ifdef ENABLE_AUDIO_OUTPUT
+    bool flac = false;
+#endif
     while ((trackinfo = parser.next_track()) != NULL)
     {
         trackcount++;
@@ -1128,6 +1186,17 @@ bool cdromValidateCueSheet(image_config_t &img)
             logmsg("---- Warning: track ", trackinfo->track_number, " has unsupported mode ", (int)trackinfo->track_mode);
         }
 
+#ifdef ENABLE_AUDIO_OUTPUT
+        if (trackinfo->file_mode == CUEFile_FLAC)
+        {
+            flac = true;
+            if (trackinfo->track_mode != CUETrack_AUDIO)
+            {
+                logmsg("---- Warning: track ", trackinfo->track_number, " is data track in FLAC file, only audio is supported");
+            }
+        }
+        else
+#endif
         if (trackinfo->file_mode != CUEFile_BINARY)
         {
             logmsg("---- Unsupported CUE data file mode ", (int)trackinfo->file_mode);
@@ -1140,6 +1209,22 @@ bool cdromValidateCueSheet(image_config_t &img)
         return false;
     }
 
+#ifdef ENABLE_AUDIO_OUTPUT
+    if (flac)
+    {
+        if (!flacOpenImage(&img.file))
+        {
+            logmsg("---- Image is not a supported FLAC stream, only 16-bit stereo or mono is supported");
+            return false;
+        }
+
+        const FLACStreamInfo &info = flacAttachedDecoder(&img.file)->streamInfo();
+        img.flac_decoded_size = info.total_samples * 4;
+        logmsg("---- FLAC stream with ", (int)info.channels, " channels, ",
+               (int)(info.total_samples / 588), " sectors, block size ", (int)info.max_blocksize);
+    }
+#endif
+
     logmsg("---- Cue sheet loaded with ", (int)trackcount, " tracks");
     return true;
 }
@@ -1157,6 +1242,7 @@ void cdromCloseTray(image_config_t &img)
         dbgmsg("------ CDROM close tray on ID ", (int)target);
         img.ejected = false;
         img.cdrom_events = 2; // New media
+        s2s_readyStatusInvalidate(target);
 
         if (scsiDev.boardCfg.flags & S2S_CFG_ENABLE_UNIT_ATTENTION)
         {
@@ -1180,6 +1266,7 @@ void cdromPerformEject(image_config_t &img)
         dbgmsg("------ CDROM open tray on ID ", (int)target);
         img.ejected = true;
         img.cdrom_events = 3; // Media removal
+        s2s_readyStatusInvalidate(target);
         cdromSwitchNextImage(img); // Switch media for next time
     }
     else
@@ -1304,7 +1391,7 @@ void cdromGetAudioPlaybackStatus(uint8_t *status, uint32_t *current_lba, bool cu
     if (current_lba)
     {
         if (img.file.isOpen()) {
-            *current_lba = img.file.position() / 2352;
+            *current_lba = getImagePosition(img) / 2352;
         } else {
             *current_lba = 0;
         }
@@ -1342,7 +1429,7 @@ static void doPlayAudio(uint32_t lba, uint32_t length)
         if (lba == 0xFFFFFFFF)
         {
             // request to start playback from 'current position'
-            lba = img.file.position() / 2352;
+            lba = getImagePosition(img) / 2352;
         }
 
         uint64_t offset = trackinfo.file_offset
@@ -1362,8 +1449,19 @@ static void doPlayAudio(uint32_t lba, uint32_t length)
 
         // playback request appears to be sane, so perform it
         // see earlier note for context on the block length below
-        if (!audio_play(target_id, &(img.file), offset,
-                offset + length * trackinfo.sector_length, false))
+        bool status;
+        if (trackinfo.file_mode == CUEFile_FLAC)
+        {
+            status = audio_play_flac(target_id, &(img.file), offset,
+                offset + length * trackinfo.sector_length);
+        }
+        else
+        {
+            status = audio_play(target_id, &(img.file), offset,
+                offset + length * trackinfo.sector_length, false);
+        }
+
+        if (!status)
         {
             // Underlying data/media error? Fake a disk scratch, which should
             // be a condition most CD-DA players are expecting
@@ -1498,10 +1596,11 @@ static void doReadCD(uint32_t lba, uint32_t length, uint8_t sector_type,
 
     // Ensure read is not out of range of the image
     uint64_t readend = offset + trackinfo.sector_length * length;
-    if (readend > img.file.size())
+    uint64_t imagesize = getImageSize(img, &trackinfo);
+    if (readend > imagesize)
     {
         logmsg("WARNING: Host attempted CD read at sector ", lba, "+", length,
-              ", exceeding image size ", img.file.size());
+              ", exceeding image size ", imagesize);
         scsiDev.status = CHECK_CONDITION;
         scsiDev.target->sense.code = ILLEGAL_REQUEST;
         scsiDev.target->sense.asc = LOGICAL_BLOCK_ADDRESS_OUT_OF_RANGE;
@@ -1625,8 +1724,6 @@ static void doReadCD(uint32_t lba, uint32_t length, uint8_t sector_type,
         platform_poll();
         diskEjectButtonUpdate(false);
 
-        img.file.seek(offset + idx * trackinfo.sector_length + skip_begin);
-
         // Verify that previous write using this buffer has finished
         uint8_t *buf = ((idx & 1) ? buf1 : buf0);
         uint8_t *bufstart = buf;
@@ -1662,7 +1759,11 @@ static void doReadCD(uint32_t lba, uint32_t length, uint8_t sector_type,
         if (sector_length > 0)
         {
             // User data
-            img.file.read(buf, sector_length);
+            if (!readImageData(img, &trackinfo, offset + idx * trackinfo.sector_length + skip_begin,
+                               buf, sector_length))
+            {
+                logmsg("---- Failed to read CD sector ", (int)(lba + idx));
+            }
             buf += sector_length;
         }
 
@@ -1838,6 +1939,60 @@ static bool doReadCapacity(uint32_t lba, uint8_t pmi)
     return true;
 }
 
+/**************************************/
+/* ISO9660 aware read-ahead           */
+/**************************************/
+
+// Only one parser is kept, and it follows the image that was read last.
+// Hosts usually access one CD at a time.
+static ISO9660Parser g_iso_parser;
+static image_config_t *g_iso_img;
+
+void cdromReadAheadData(image_config_t &img, uint32_t lba, const uint8_t *data, uint32_t sectors)
+{
+    if (img.bytesPerSector != ISO9660_SECTOR_SIZE)
+    {
+        return;
+    }
+
+    if (g_iso_img != &img)
+    {
+        g_iso_parser.clear();
+        g_iso_img = &img;
+    }
+
+    bool had_volume = g_iso_parser.hasVolume();
+    for (uint32_t i = 0; i < sectors; i++)
+    {
+        g_iso_parser.sectorRead(lba + i, data + i * ISO9660_SECTOR_SIZE);
+    }
+
+    if (!had_volume && g_iso_parser.hasVolume())
+    {
+        dbgmsg("---- ISO9660 volume found, root directory at ", (int)g_iso_parser.rootDirectory().lba,
+               g_iso_parser.isJoliet() ? " (Joliet)" : "");
+    }
+}
+
+bool cdromReadAheadPredict(image_config_t &img, uint32_t next_lba, uint32_t *lba, uint32_t *count)
+{
+    if (g_iso_img != &img)
+    {
+        return false;
+    }
+
+    return g_iso_parser.predict(next_lba, lba, count);
+}
+
+void cdromReadAheadReset(image_config_t &img)
+{
+    if (g_iso_img == &img)
+    {
+        g_iso_parser.clear();
+        g_iso_img = NULL;
+    }
+}
+
 /**************************************/
 /* CD-ROM command dispatching         */
 /**************************************/
@@ -2035,7 +2190,7 @@ extern "C" int scsiCDRomCommand()
         {
             // request to start playback from 'current position'
             image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
-            lba = img.file.position() / 2352;
+            lba = getImagePosition(img) / 2352;
         }
 
         uint32_t length = end - lba;
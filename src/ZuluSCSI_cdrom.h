@@ -28,6 +28,17 @@ bool cdromSwitchNextImage(image_config_t &img);
 // and print warnings about unsupported track types
 bool cdromValidateCueSheet(image_config_t &img);
 
+// ISO9660 aware read-ahead for images without cue sheet.
+// Sectors that the host has read are passed to cdromReadAheadData(), which
+// parses the volume descriptors and directories among them.
+// cdromReadAheadPredict() then gives the expected next read after a read
+// command ending before next_lba, see ISO9660Parser::predict().
+void cdromReadAheadData(image_config_t &img, uint32_t lba, const uint8_t *data, uint32_t sectors);
+bool cdromReadAheadPredict(image_config_t &img, uint32_t next_lba, uint32_t *lba, uint32_t *count);
+
+// Forget filesystem structure of image, called when image is changed
+void cdromReadAheadReset(image_config_t &img);
+
 // Audio playback status
 // boolean flag is true if just basic mechanism status (playback true/false)
 // is desired, or false if historical audio status codes should be returned
@@ -35,6 +35,10 @@
 #define CONFIGFILE  "zuluscsi.ini"
 #define LOGFILE     "zululog.txt"
 #define CRASHFILE   "zuluerr.txt"
+#define PROGRESSFILE "zuluprog.txt"
+#define PHYMODEFILE "zuluphy.txt"
+#define TRACEFILE   "zulutrc.bin"
+#define BOOTPROFILEFILE "zuluboot.bin"
 
 // Prefix for command file to create new image (case-insensitive)
 #define CREATEFILE "create"
@@ -45,6 +49,13 @@
 #endif
 #define LOG_SAVE_INTERVAL_MS 1000
 
+// Number of events in the cycle tracer ring buffer, 0 to disable.
+// Each event takes 12 bytes of RAM. See ZuluSCSI_cycletrace.h
+#ifndef CYCLE_TRACE_EVENTS
+#define CYCLE_TRACE_EVENTS 0
+#endif
+#define CYCLE_TRACE_SAVE_INTERVAL_MS 1000
+
 // Watchdog timeout
 // Watchdog will first issue a bus reset and if that does not help, crashdump.
 #define WATCHDOG_BUS_RESET_TIMEOUT 15000
@@ -98,3 +109,11 @@
 #ifndef PREFETCH_BUFFER_SIZE
 #define PREFETCH_BUFFER_SIZE 8192
 #endif
+
+// Reads done by host during boot are recorded to BOOTPROFILEFILE,
+// and staged into the prefetch buffer ahead of the host on next boot.
+#ifndef BOOT_PROFILE_MAX_RANGES
+#define BOOT_PROFILE_MAX_RANGES 128
+#endif
+#define BOOT_PROFILE_RECORD_MS 30000
+#define BOOT_PROFILE_RESYNC_RANGES 8
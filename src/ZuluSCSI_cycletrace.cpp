@@ -0,0 +1,131 @@
+/** 
+ * ZuluSCSI™ - Copyright (c) 2023 Rabbit Hole Computing™
+ * 
+ * ZuluSCSI™ firmware is licensed under the GPL version 3 or any later version. 
+ * 
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. 
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. 
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#include "ZuluSCSI_cycletrace.h"
+
+#if CYCLE_TRACE_EVENTS > 0
+
+#include "ZuluSCSI_log.h"
+#include <ZuluSCSI_platform.h>
+#include <SdFat.h>
+
+extern SdFs SD;
+
+// File starts with this header, followed by cycletrace_record_t entries
+struct cycletrace_header_t {
+    char magic[4]; // "ZTRC"
+    uint32_t version;
+    uint32_t cycles_per_us;
+    uint32_t record_size;
+};
+
+static struct {
+    cycletrace_record_t events[CYCLE_TRACE_EVENTS];
+    uint32_t head; // Total number of events recorded
+    uint32_t tail; // Total number of events saved or lost
+    uint32_t prev_save;
+    bool first_open_after_boot;
+    FsFile file;
+} g_cycletrace = {{}, 0, 0, 0, true};
+
+extern "C" void cycletrace_event(uint8_t type, uint8_t arg8, uint32_t arg)
+{
+    cycletrace_record_t *rec = &g_cycletrace.events[g_cycletrace.head % CYCLE_TRACE_EVENTS];
+    rec->timestamp = PLATFORM_CYCLE_COUNT();
+    rec->type = type;
+    rec->arg8 = arg8;
+    rec->reserved = 0;
+    rec->arg = arg;
+    g_cycletrace.head++;
+}
+
+void cycletrace_init()
+{
+    if (g_cycletrace.file.isOpen())
+    {
+        g_cycletrace.file.close();
+    }
+
+    bool truncate = g_cycletrace.first_open_after_boot;
+    int flags = O_WRONLY | O_CREAT | (truncate ? O_TRUNC : O_APPEND);
+    g_cycletrace.file = SD.open(TRACEFILE, flags);
+    if (!g_cycletrace.file.isOpen())
+    {
+        logmsg("Failed to open trace file " TRACEFILE);
+        return;
+    }
+
+    if (truncate)
+    {
+        cycletrace_header_t header = {
+            {'Z', 'T', 'R', 'C'}, 1, PLATFORM_CYCLES_PER_US, sizeof(cycletrace_record_t)
+        };
+        g_cycletrace.file.write(&header, sizeof(header));
+        g_cycletrace.file.flush();
+        logmsg("Cycle tracer enabled, ", (int)CYCLE_TRACE_EVENTS, " events, saving to " TRACEFILE);
+    }
+
+    g_cycletrace.first_open_after_boot = false;
+}
+
+void cycletrace_poll()
+{
+    uint32_t head = g_cycletrace.head;
+    uint32_t pending = head - g_cycletrace.tail;
+    if (pending == 0 || !g_cycletrace.file.isOpen())
+    {
+        return;
+    }
+
+    // Save when buffer is getting full, or periodically to catch the last events
+    if (pending < CYCLE_TRACE_EVENTS / 2 &&
+        (uint32_t)(millis() - g_cycletrace.prev_save) < CYCLE_TRACE_SAVE_INTERVAL_MS)
+    {
+        return;
+    }
+
+    if (pending > CYCLE_TRACE_EVENTS)
+    {
+        // Oldest events have been overwritten, tell the converter about the gap
+        cycletrace_record_t lost = {g_cycletrace.events[head % CYCLE_TRACE_EVENTS].timestamp,
+                                    TRACE_LOST, 0, 0, pending - CYCLE_TRACE_EVENTS};
+        g_cycletrace.file.write(&lost, sizeof(lost));
+        g_cycletrace.tail = head - CYCLE_TRACE_EVENTS;
+    }
+
+    while (g_cycletrace.tail != head)
+    {
+        uint32_t idx = g_cycletrace.tail % CYCLE_TRACE_EVENTS;
+        uint32_t count = head - g_cycletrace.tail;
+        if (count > CYCLE_TRACE_EVENTS - idx)
+        {
+            count = CYCLE_TRACE_EVENTS - idx;
+        }
+
+        g_cycletrace.file.write(&g_cycletrace.events[idx], count * sizeof(cycletrace_record_t));
+        g_cycletrace.tail += count;
+    }
+
+    g_cycletrace.file.flush();
+    g_cycletrace.prev_save = millis();
+}
+
+#endif
@@ -0,0 +1,107 @@
+/** 
+ * ZuluSCSI™ - Copyright (c) 2023 Rabbit Hole Computing™
+ * 
+ * ZuluSCSI™ firmware is licensed under the GPL version 3 or any later version. 
+ * 
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. 
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details. 
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// Low overhead event tracer for performance analysis.
+// Events are timestamped with PLATFORM_CYCLE_COUNT() and stored in a RAM ring
+// buffer, which is written to TRACEFILE on the SD card while the bus is free.
+// utils/trace_to_chrome.py converts the file to Chrome trace JSON format.
+//
+// Enable by building with -DCYCLE_TRACE_EVENTS=1024 or similar.
+// Events must only be recorded from the main loop context, not from interrupts.
+
+#pragma once
+
+#include <stdint.h>
+#include "ZuluSCSI_config.h"
+
+// Event types, the file format is also parsed by utils/trace_to_chrome.py
+enum cycletrace_event_t {
+    TRACE_NONE = 0,
+    TRACE_PHASE = 1,            // arg8 = new SCSI phase, arg = command opcode
+    TRACE_SD_READ_START = 2,    // arg = byte count
+    TRACE_SD_READ_END = 3,
+    TRACE_SD_WRITE_START = 4,   // arg = byte count
+    TRACE_SD_WRITE_END = 5,
+    TRACE_SCSI_WRITE_DONE = 6,  // DATA IN transfer to host has completed
+    TRACE_SCSI_READ_DONE = 7,   // DATA OUT transfer from host has completed, arg = byte count
+    TRACE_SD_CALLBACK = 8,      // arg8 = 0 for read, 1 for write, arg = bytes complete
+    TRACE_LOST = 9,             // arg = number of events overwritten before saving
+};
+
+struct cycletrace_record_t {
+    uint32_t timestamp;
+    uint8_t type;
+    uint8_t arg8;
+    uint16_t reserved;
+    uint32_t arg;
+};
+
+#if CYCLE_TRACE_EVENTS > 0
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void cycletrace_event(uint8_t type, uint8_t arg8, uint32_t arg);
+
+#ifdef __cplusplus
+}
+
+// Record a start event when constructed and the matching end event when destroyed
+class CycleTraceScope
+{
+public:
+    CycleTraceScope(uint8_t start_type, uint32_t arg): m_type(start_type)
+    {
+        cycletrace_event(start_type, 0, arg);
+    }
+
+    ~CycleTraceScope()
+    {
+        cycletrace_event(m_type + 1, 0, 0);
+    }
+
+private:
+    uint8_t m_type;
+};
+
+// Reopen trace file after SD card has been (re)initialized
+void cycletrace_init();
+
+// Save new events to SD card, called from main loop when bus is free
+void cycletrace_poll();
+
+#endif
+
+#define CYCLE_TRACE(type, arg8, arg) cycletrace_event((type), (arg8), (arg))
+#define CYCLE_TRACE_SCOPE(type, arg) CycleTraceScope _cycletrace_scope((type), (arg))
+
+#else
+
+#define CYCLE_TRACE(type, arg8, arg) ((void)0)
+#define CYCLE_TRACE_SCOPE(type, arg) ((void)0)
+
+#ifdef __cplusplus
+static inline void cycletrace_init() {}
+static inline void cycletrace_poll() {}
+#endif
+
+#endif
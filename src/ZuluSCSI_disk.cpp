@@ -29,8 +29,10 @@
 #include "ZuluSCSI_disk.h"
 #include "ZuluSCSI_log.h"
 #include "ZuluSCSI_config.h"
+#include "ZuluSCSI_cycletrace.h"
 #include "ZuluSCSI_presets.h"
 #include "ZuluSCSI_cdrom.h"
+#include "ZuluSCSI_flac.h"
 #include "ImageBackingStore.h"
 #include "ROMDrive.h"
 #include <minIni.h>
@@ -79,6 +81,20 @@ extern "C" {
 #endif
 #endif
 
+// Writes of all zeros at least this long are done by erasing SD card sectors.
+// Smaller erases can be slower than writing, depending on the card.
+#ifndef ZERO_WRITE_DISCARD_MIN_BYTES
+#define ZERO_WRITE_DISCARD_MIN_BYTES 32768
+#endif
+
+// Number of slots the data buffer is divided into when reading from SD card.
+// Each SD card read fills one or more consecutive slots that have already been
+// transferred to the SCSI bus, so a larger number of slots allows SD reads to
+// start earlier, while free slots next to each other are combined to larger reads.
+#ifndef PLATFORM_DATAIN_RING_SLOTS
+#define PLATFORM_DATAIN_RING_SLOTS 4
+#endif
+
 #ifndef PLATFORM_SCSIPHY_HAS_NONBLOCKING_READ
 // For platforms that do not have non-blocking read from SCSI bus
 void scsiStartRead(uint8_t* data, uint32_t count, int *parityError)
@@ -95,6 +111,15 @@ bool scsiIsReadFinished(const uint8_t *data)
 }
 #endif
 
+#ifndef PLATFORM_HAS_NONBLOCKING_SD_WRITE
+// For platforms where SD card write has finished when write() returns
+bool platform_sd_write_pending(bool *failed)
+{
+    *failed = false;
+    return false;
+}
+#endif
+
 /************************************************/
 /* ROM drive support (in microcontroller flash) */
 /************************************************/
@@ -161,12 +186,31 @@ SdDevice sdDev = {2, 256 * 1024 * 1024 * 2}; /* For SCSI2SD */
 
 static image_config_t g_DiskImages[S2S_MAX_TARGETS];
 
+// Stop any background FORMAT UNIT, defined below
+static void diskFormatAbort();
+
+// Forget loaded boot access profile, defined below
+static void diskBootProfileReset();
+
+// Drop prefetch and boot profile state that refers to the previous image, defined below
+static void diskImageChanged(image_config_t &img, const char *filename);
+
+// Clear I/O statistics and activity, defined below
+static void diskIOStatsReset();
+
 void scsiDiskResetImages()
 {
     for (int i = 0; i < S2S_MAX_TARGETS; i++)
     {
         g_DiskImages[i].clear();
     }
+
+    diskFormatAbort();
+    diskBootProfileReset();
+    diskIOStatsReset();
+
+    s2s_modeSenseCacheInvalidate(-1);
+    s2s_readyStatusInvalidate(-1);
 }
 
 void image_config_t::clear()
@@ -185,7 +229,13 @@ void scsiDiskCloseSDCardImages()
         }
 
         g_DiskImages[i].cuesheetfile.close();
+        cdromReadAheadReset(g_DiskImages[i]);
+#ifdef ENABLE_AUDIO_OUTPUT
+        flacCloseImage(&g_DiskImages[i].file);
+#endif
     }
+
+    s2s_readyStatusInvalidate(-1);
 }
 
 // Verify format conformance to SCSI spec:
@@ -338,7 +388,15 @@ bool scsiDiskOpenHDDImage(int target_idx, const char *filename, int scsi_id, int
 {
     image_config_t &img = g_DiskImages[target_idx];
     img.cuesheetfile.close();
+    img.flac_decoded_size = 0;
+    cdromReadAheadReset(img);
+#ifdef ENABLE_AUDIO_OUTPUT
+    flacCloseImage(&img.file);
+#endif
     img.file = ImageBackingStore(filename, blocksize);
+    s2s_modeSenseCacheInvalidate(scsi_id);
+    s2s_readyStatusInvalidate(scsi_id);
+    diskImageChanged(img, filename);
 
     if (img.file.isOpen())
     {
@@ -409,11 +467,18 @@ bool scsiDiskOpenHDDImage(int target_idx, const char *filename, int scsi_id, int
             logmsg("---- Read prefetch disabled");
         }
 
-        if (img.deviceType == S2S_CFG_OPTICAL &&
-            strncasecmp(filename + strlen(filename) - 4, ".bin", 4) == 0)
+        const char *extension = strrchr(filename, '.');
+        bool is_bin = (extension && strcasecmp(extension, ".bin") == 0);
+#ifdef ENABLE_AUDIO_OUTPUT
+        bool is_flac = (extension && strcasecmp(extension, ".flac") == 0);
+#else
+        bool is_flac = false;
+#endif
+
+        if (img.deviceType == S2S_CFG_OPTICAL && (is_bin || is_flac))
         {
             char cuesheetname[MAX_FILE_PATH + 1] = {0};
-            strncpy(cuesheetname, filename, strlen(filename) - 4);
+            strncpy(cuesheetname, filename, extension - filename);
             strlcat(cuesheetname, ".cue", sizeof(cuesheetname));
             img.cuesheetfile = SD.open(cuesheetname, O_RDONLY);
 
@@ -422,10 +487,22 @@ bool scsiDiskOpenHDDImage(int target_idx, const char *filename, int scsi_id, int
                 logmsg("---- Found CD-ROM CUE sheet at ", cuesheetname);
                 if (!cdromValidateCueSheet(img))
                 {
-                    logmsg("---- Failed to parse cue sheet, using as plain binary image");
                     img.cuesheetfile.close();
+                    if (is_flac)
+                    {
+                        logmsg("---- Failed to parse cue sheet, FLAC image cannot be used");
+                        img.file.close();
+                        return false;
+                    }
+                    logmsg("---- Failed to parse cue sheet, using as plain binary image");
                 }
             }
+            else if (is_flac)
+            {
+                logmsg("---- No CUE sheet found at ", cuesheetname, ", FLAC image cannot be used");
+                img.file.close();
+                return false;
+            }
             else
             {
                 logmsg("---- No CUE sheet found at ", cuesheetname, ", using as plain binary image");
@@ -513,6 +590,10 @@ static void scsiDiskConfigDefaults(int target_idx)
     img.prefetchbytes = defaults.prefetchBytes;
     img.reinsert_on_inquiry = true;
     img.reinsert_after_eject = true;
+    img.format_clears_image = true;
+    img.discard_zero_writes = true;
+    img.io_priority = IO_PRIORITY_NORMAL;
+    img.io_share = 25;
     memset(img.vendor, 0, sizeof(img.vendor));
     memset(img.prodId, 0, sizeof(img.prodId));
     memset(img.revision, 0, sizeof(img.revision));
@@ -534,6 +615,13 @@ static void scsiDiskLoadConfig(int target_idx, const char *section)
     img.reinsert_on_inquiry = ini_getbool(section, "ReinsertCDOnInquiry", img.reinsert_on_inquiry, CONFIGFILE);
     img.reinsert_after_eject = ini_getbool(section, "ReinsertAfterEject", img.reinsert_after_eject, CONFIGFILE);
     img.ejectButton = ini_getl(section, "EjectButton", 0, CONFIGFILE);
+    img.format_clears_image = ini_getbool(section, "FormatClearsImage", img.format_clears_image, CONFIGFILE);
+    img.discard_zero_writes = ini_getbool(section, "DiscardZeroWrites", img.discard_zero_writes, CONFIGFILE);
+
+    long io_priority = ini_getl(section, "IOPriority", img.io_priority, CONFIGFILE);
+    long io_share = ini_getl(section, "IOShare", img.io_share, CONFIGFILE);
+    img.io_priority = (io_priority < IO_PRIORITY_LOW) ? IO_PRIORITY_LOW : (io_priority > IO_PRIORITY_HIGH) ? IO_PRIORITY_HIGH : io_priority;
+    img.io_share = (io_share < 0) ? 0 : (io_share > 100) ? 100 : io_share;
 
     char tmp[32];
     memset(tmp, 0, sizeof(tmp));
@@ -725,6 +813,8 @@ void scsiDiskLoadConfig(int target_idx)
 
     // Set default settings
     scsiDiskConfigDefaults(target_idx);
+    s2s_modeSenseCacheInvalidate(target_idx);
+    s2s_readyStatusInvalidate(target_idx);
 
     // First load global settings
     scsiDiskLoadConfig(target_idx, "SCSI");
@@ -967,22 +1057,22 @@ const S2S_TargetCfg* s2s_getConfigById(int scsiId)
 /* FormatUnit command */
 /**********************/
 
-// Callback once all data has been read in the data out phase.
-static void doFormatUnitComplete(void)
-{
-    scsiDev.phase = STATUS;
-}
+// Performs the actual formatting, defined below
+static void diskFormatStart(bool immed);
 
 static void doFormatUnitSkipData(int bytes)
 {
     // We may not have enough memory to store the initialisation pattern and
     // defect list data.  Since we're not making use of it yet anyway, just
-    // discard the bytes.
+    // discard the bytes, reading them in as large blocks as possible.
     scsiEnterPhase(DATA_OUT);
-    int i;
-    for (i = 0; i < bytes; ++i)
+    int parityError = 0;
+    while (bytes > 0)
     {
-        scsiReadByte();
+        int len = bytes;
+        if (len > (int)sizeof(scsiDev.data)) len = sizeof(scsiDev.data);
+        scsiRead(scsiDev.data, len, &parityError);
+        bytes -= len;
     }
 }
 
@@ -997,8 +1087,11 @@ static void doFormatUnitPatternHeader(void)
         ((((uint16_t)scsiDev.data[4 + 2])) << 8) +
         scsiDev.data[4 + 3];
 
-        doFormatUnitSkipData(defectLength + patternLength);
-        doFormatUnitComplete();
+    // IMMED is only valid together with FOV
+    bool immed = (scsiDev.data[1] & 0x82) == 0x82;
+
+    doFormatUnitSkipData(defectLength + patternLength);
+    diskFormatStart(immed);
 }
 
 // Callback from the data out phase.
@@ -1028,8 +1121,9 @@ static void doFormatUnitHeader(void)
         int defectLength =
             ((((uint16_t)scsiDev.data[2])) << 8) +
             scsiDev.data[3];
+        bool immed = (scsiDev.data[1] & 0x82) == 0x82;
         doFormatUnitSkipData(defectLength);
-        doFormatUnitComplete();
+        diskFormatStart(immed);
     }
 }
 
@@ -1115,6 +1209,7 @@ static int doTestUnitReady()
             // We are now reporting to host that the drive is open.
             // Simulate a "close" for next time the host polls.
             cdromCloseTray(img);
+            return ready;
         }
     }
     else if (unlikely(!(blockDev.state & DISK_PRESENT)))
@@ -1133,6 +1228,13 @@ static int doTestUnitReady()
         scsiDev.target->sense.asc = LOGICAL_UNIT_NOT_READY_CAUSE_NOT_REPORTABLE;
         scsiDev.phase = STATUS;
     }
+
+    // Further TEST UNIT READY polls are answered by scsi.c until media state changes
+    if (ready)
+        s2s_readyStatusStore(NO_SENSE, NO_ADDITIONAL_SENSE_INFORMATION);
+    else
+        s2s_readyStatusStore(scsiDev.target->sense.code, scsiDev.target->sense.asc);
+
     return ready;
 }
 
@@ -1140,6 +1242,9 @@ static int doTestUnitReady()
 /* Seek command */
 /****************/
 
+// Stages data at the seek target into prefetch buffer, defined below
+static void diskPrefetchHint(uint32_t lba);
+
 static void doSeek(uint32_t lba)
 {
     image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
@@ -1164,6 +1269,9 @@ static void doSeek(uint32_t lba)
         {
             s2s_delay_us(10);
         }
+
+        // Hosts usually follow SEEK with a READ at the same location
+        diskPrefetchHint(lba);
     }
 }
 
@@ -1177,21 +1285,814 @@ static struct {
     uint8_t *buffer;
     uint32_t bytes_sd; // Number of bytes that have been scheduled for transfer on SD card side
     uint32_t bytes_scsi; // Number of bytes that have been scheduled for transfer on SCSI side
+    uint32_t bytes_sd_pending; // Number of bytes still being written to SD card after write() returned
 
     uint32_t bytes_scsi_started;
     uint32_t sd_transfer_start;
     int parityError;
+
+    uint32_t ring_slot; // Next slot in scsiDev.data to fill from SD card in diskDataIn()
 } g_disk_transfer;
 
+/*********************************/
+/* I/O priority and statistics   */
+/*********************************/
+
+// The host decides when each command runs, so IOPriority only governs the
+// SD card accesses that are done outside of commands: read-ahead into the
+// shared prefetch buffer and background FORMAT UNIT. While a target with
+// higher priority has been active recently, lower priority targets do not
+// replace its prefetched data, and their background work may use the SD
+// card at most IOShare percent of the time.
+
+#ifndef IO_PRIORITY_ACTIVE_MS
+#define IO_PRIORITY_ACTIVE_MS 500
+#endif
+
+#ifndef IO_STATS_LOG_INTERVAL_MS
+#define IO_STATS_LOG_INTERVAL_MS 60000
+#endif
+
+struct io_stats_t {
+    uint32_t count;
+    uint32_t max_us;
+    uint64_t total_us;
+};
+
+static struct {
+    bool loaded;
+    bool log_enabled; // LogIOStats in INI file
+    uint32_t log_time; // millis() of last statistics log
+
+    // millis() of last command from a target in each priority class, 0 if none
+    uint32_t active_time[IO_PRIORITY_COUNT];
+    uint32_t background_next; // millis() when background work may continue
+
+    // Command latency per target, for reads and writes
+    io_stats_t stats[S2S_MAX_TARGETS][2];
+
+    // Command in progress
+    image_config_t *cmd_img;
+    bool cmd_write;
+    uint32_t cmd_start;
+} g_disk_io;
+
+static uint32_t diskIOTimeUs(uint32_t start)
+{
+#ifdef PLATFORM_CYCLE_COUNT
+    return (uint32_t)(PLATFORM_CYCLE_COUNT() - start) / PLATFORM_CYCLES_PER_US;
+#else
+    return (uint32_t)(millis() - start) * 1000;
+#endif
+}
+
+static void diskIOStatsReset()
+{
+    memset(&g_disk_io, 0, sizeof(g_disk_io));
+}
+
+// Called at start of read and write commands
+static void diskIOCommandStart(image_config_t &img, bool write)
+{
+    g_disk_io.active_time[img.io_priority] = millis() | 1;
+    g_disk_io.cmd_img = &img;
+    g_disk_io.cmd_write = write;
+#ifdef PLATFORM_CYCLE_COUNT
+    g_disk_io.cmd_start = PLATFORM_CYCLE_COUNT();
+#else
+    g_disk_io.cmd_start = millis();
+#endif
+}
+
+// Called when data transfer of command has completed
+static void diskIOCommandEnd()
+{
+    uint32_t elapsed = diskIOTimeUs(g_disk_io.cmd_start);
+    io_stats_t &stats = g_disk_io.stats[g_disk_io.cmd_img - g_DiskImages][g_disk_io.cmd_write];
+    stats.count++;
+    stats.total_us += elapsed;
+    if (elapsed > stats.max_us) stats.max_us = elapsed;
+
+    g_disk_io.active_time[g_disk_io.cmd_img->io_priority] = millis() | 1;
+    g_disk_io.cmd_img = NULL;
+}
+
+// Check if a target with higher priority than img has been active recently
+static bool diskIOHigherPriorityActive(const image_config_t &img)
+{
+    for (int p = img.io_priority + 1; p < IO_PRIORITY_COUNT; p++)
+    {
+        if (g_disk_io.active_time[p] != 0 &&
+            (uint32_t)(millis() - g_disk_io.active_time[p]) < IO_PRIORITY_ACTIVE_MS)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Check if background work for img may use the SD card now
+static bool diskIOBackgroundAllowed(const image_config_t &img)
+{
+    if (!diskIOHigherPriorityActive(img))
+    {
+        return true;
+    }
+
+    return img.io_share > 0 && (int32_t)(millis() - g_disk_io.background_next) >= 0;
+}
+
+// Account SD card time used by background work that started at start_ms
+static void diskIOBackgroundUsed(const image_config_t &img, uint32_t start_ms)
+{
+    uint32_t used = millis() - start_ms;
+    uint32_t share = (img.io_share > 0) ? img.io_share : 1;
+    g_disk_io.background_next = millis() + used * (100 - share) / share;
+}
+
+// Log latency statistics periodically, called from scsiDiskPoll() when bus is free
+static void diskIOStatsPoll()
+{
+    if (!g_disk_io.loaded)
+    {
+        g_disk_io.loaded = true;
+        g_disk_io.log_enabled = ini_getbool("SCSI", "LogIOStats", 0, CONFIGFILE);
+        g_disk_io.log_time = millis();
+    }
+
+    if (!g_disk_io.log_enabled || (uint32_t)(millis() - g_disk_io.log_time) < IO_STATS_LOG_INTERVAL_MS)
+    {
+        return;
+    }
+
+    g_disk_io.log_time = millis();
+    for (int i = 0; i < S2S_MAX_TARGETS; i++)
+    {
+        io_stats_t *stats = g_disk_io.stats[i];
+        if (stats[0].count == 0 && stats[1].count == 0) continue;
+
+        logmsg("I/O stats for SCSI ID ", (int)(g_DiskImages[i].scsiId & S2S_CFG_TARGET_ID_BITS),
+               " priority ", (int)g_DiskImages[i].io_priority,
+               ": ", (int)stats[0].count, " reads avg ", (int)(stats[0].count ? stats[0].total_us / stats[0].count : 0),
+               " us max ", (int)stats[0].max_us,
+               " us, ", (int)stats[1].count, " writes avg ", (int)(stats[1].count ? stats[1].total_us / stats[1].count : 0),
+               " us max ", (int)stats[1].max_us, " us");
+        memset(stats, 0, sizeof(io_stats_t) * 2);
+    }
+}
+
 #ifdef PREFETCH_BUFFER_SIZE
 static struct {
     uint8_t buffer[PREFETCH_BUFFER_SIZE];
     uint32_t sector;
     uint32_t bytes;
     uint8_t scsiId;
+    uint8_t priority; // IOPriority of the target the data is for
+    uint32_t time; // millis() when data was staged or last used
+
+    // Read-ahead requested by SEEK, staged when the bus is free
+    image_config_t *hint_img;
+    uint32_t hint_sector;
+    uint32_t hint_bytesPerSector;
 } g_scsi_prefetch;
+
+// Check if prefetch buffer can be used for another image.
+// Data for a higher priority target is kept while that target is active.
+static bool diskPrefetchMayReplace(const image_config_t &img)
+{
+    return g_scsi_prefetch.bytes == 0 ||
+           img.scsiId == g_scsi_prefetch.scsiId ||
+           img.io_priority >= g_scsi_prefetch.priority ||
+           (uint32_t)(millis() - g_scsi_prefetch.time) > IO_PRIORITY_ACTIVE_MS;
+}
+#endif
+
+static void diskPrefetchHint(uint32_t lba)
+{
+#ifdef PREFETCH_BUFFER_SIZE
+    image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
+    uint32_t bytesPerSector = scsiDev.target->liveCfg.bytesPerSector;
+    uint32_t sectors_in_prefetch = g_scsi_prefetch.bytes / bytesPerSector;
+
+    if (img.prefetchbytes < (int)bytesPerSector ||
+        (img.scsiId == g_scsi_prefetch.scsiId &&
+         lba >= g_scsi_prefetch.sector &&
+         lba < g_scsi_prefetch.sector + sectors_in_prefetch))
+    {
+        // Prefetch disabled or data already in buffer
+        return;
+    }
+
+    g_scsi_prefetch.hint_img = &img;
+    g_scsi_prefetch.hint_sector = lba;
+    g_scsi_prefetch.hint_bytesPerSector = bytesPerSector;
+#endif
+}
+
+#ifdef PREFETCH_BUFFER_SIZE
+// Called from scsiDiskPoll() after SEEK command has completed.
+// The time the host spends between SEEK and READ hides the SD card latency.
+static void diskPrefetchStageHint()
+{
+    image_config_t &img = *g_scsi_prefetch.hint_img;
+    uint32_t bytesPerSector = g_scsi_prefetch.hint_bytesPerSector;
+    g_scsi_prefetch.hint_img = NULL;
+
+    if (img.scsiId == g_scsi_prefetch.scsiId &&
+        g_scsi_prefetch.hint_sector >= g_scsi_prefetch.sector &&
+        g_scsi_prefetch.hint_sector < g_scsi_prefetch.sector + g_scsi_prefetch.bytes / bytesPerSector)
+    {
+        // Already staged by read-ahead of previous command
+        return;
+    }
+
+    if (!diskPrefetchMayReplace(img))
+    {
+        dbgmsg("------ Prefetch hint skipped, buffer holds data for higher priority target");
+        return;
+    }
+
+    int prefetchbytes = img.prefetchbytes;
+    if (prefetchbytes > PREFETCH_BUFFER_SIZE) prefetchbytes = PREFETCH_BUFFER_SIZE;
+    uint32_t prefetch_sectors = prefetchbytes / bytesPerSector;
+    uint32_t img_sector_count = img.file.size() / bytesPerSector;
+
+    if (g_scsi_prefetch.hint_sector >= img_sector_count)
+    {
+        return;
+    }
+    else if (g_scsi_prefetch.hint_sector + prefetch_sectors > img_sector_count)
+    {
+        // Don't try to read past image end.
+        prefetch_sectors = img_sector_count - g_scsi_prefetch.hint_sector;
+    }
+
+    g_scsi_prefetch.sector = g_scsi_prefetch.hint_sector;
+    g_scsi_prefetch.bytes = 0;
+    g_scsi_prefetch.scsiId = img.scsiId;
+    g_scsi_prefetch.priority = img.io_priority;
+    g_scsi_prefetch.time = millis();
+
+    uint32_t bytes = prefetch_sectors * bytesPerSector;
+    if (!img.file.seek((uint64_t)g_scsi_prefetch.sector * bytesPerSector) ||
+        img.file.read(g_scsi_prefetch.buffer, bytes) != (ssize_t)bytes)
+    {
+        logmsg("Prefetch after seek failed");
+        return;
+    }
+
+    g_scsi_prefetch.bytes = bytes;
+    dbgmsg("------ Prefetched ", (int)prefetch_sectors, " sectors at seek target ", (int)g_scsi_prefetch.sector);
+}
+#endif
+
+/***************************/
+/* Boot access profile     */
+/***************************/
+
+// Hosts read mostly the same sectors every time they boot.
+// Reads during the first BOOT_PROFILE_RECORD_MS after the first bus reset or
+// read command are recorded and saved to BOOTPROFILEFILE. On next boot the
+// profile is replayed: while the host follows the recorded sequence, the next
+// range is staged into the prefetch buffer while the bus is free.
+//
+// The file starts with a header that identifies the image of each SCSI ID by
+// its size and a hash of its file name. Ranges for a SCSI ID whose image has
+// changed since the profile was recorded are not replayed.
+
+#define BOOT_PROFILE_MAGIC 0x50425A5A // "ZZBP"
+#define BOOT_PROFILE_VERSION 1
+#define BOOT_PROFILE_NO_ID 0xFF
+
+struct boot_profile_range_t {
+    uint32_t lba;
+    uint16_t blocks;
+    uint8_t scsiId;
+    uint8_t reserved;
+};
+
+struct boot_profile_image_t {
+    uint64_t size; // Image size in bytes, 0 if no image
+    uint32_t name_hash;
+    uint32_t reserved;
+};
+
+struct boot_profile_header_t {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count; // Number of ranges following the header
+    boot_profile_image_t images[S2S_MAX_TARGETS]; // Indexed by SCSI ID
+};
+
+static struct {
+    bool enabled;
+    bool loaded; // Replay profile has been loaded from SD card
+    bool finished; // Recording for this power-on has finished
+    uint32_t record_start; // millis() at start of recording, 0 if not started
+
+    boot_profile_range_t record[BOOT_PROFILE_MAX_RANGES];
+    uint32_t record_count;
+
+    boot_profile_header_t replay_header;
+    boot_profile_range_t replay[BOOT_PROFILE_MAX_RANGES];
+    uint32_t replay_count;
+    uint32_t replay_pos; // Next expected range
+    bool replay_staged; // Range at replay_pos has been given as prefetch hint
+} g_boot_profile;
+
+static void diskBootProfileReset()
+{
+    g_boot_profile.loaded = false;
+    g_boot_profile.replay_count = 0;
+    g_boot_profile.replay_pos = 0;
+    g_boot_profile.replay_staged = false;
+}
+
+static image_config_t *diskBootProfileGetImage(uint8_t scsiId)
+{
+    for (int i = 0; i < S2S_MAX_TARGETS; i++)
+    {
+        image_config_t &img = g_DiskImages[i];
+        if (img.file.isOpen() && (img.scsiId & S2S_CFG_TARGET_ID_BITS) == scsiId &&
+            img.deviceType != S2S_CFG_SEQUENTIAL)
+        {
+            return &img;
+        }
+    }
+    return NULL;
+}
+
+// Identify the image currently used by a SCSI ID
+static void diskBootProfileIdentity(uint8_t scsiId, boot_profile_image_t *identity)
+{
+    memset(identity, 0, sizeof(*identity));
+    image_config_t *img = diskBootProfileGetImage(scsiId);
+    if (img)
+    {
+        identity->size = img->file.size();
+        identity->name_hash = img->image_name_hash;
+    }
+}
+
+static void diskBootProfileLoad()
+{
+    g_boot_profile.loaded = true;
+    g_boot_profile.enabled = ini_getbool("SCSI", "BootProfile", 1, CONFIGFILE);
+    if (!g_boot_profile.enabled)
+    {
+        return;
+    }
+
+    FsFile file = SD.open(BOOTPROFILEFILE, O_RDONLY);
+    if (!file.isOpen())
+    {
+        return;
+    }
+
+    boot_profile_header_t &header = g_boot_profile.replay_header;
+    int bytes = file.read(&header, sizeof(header));
+    if (bytes != sizeof(header) ||
+        header.magic != BOOT_PROFILE_MAGIC ||
+        header.version != BOOT_PROFILE_VERSION ||
+        header.count > BOOT_PROFILE_MAX_RANGES)
+    {
+        logmsg("Ignoring " BOOTPROFILEFILE ", unknown format");
+        file.close();
+        return;
+    }
+
+    uint32_t expected = header.count * sizeof(boot_profile_range_t);
+    bytes = file.read(g_boot_profile.replay, expected);
+    file.close();
+
+    if (bytes != (int)expected)
+    {
+        logmsg("Ignoring " BOOTPROFILEFILE ", file is truncated");
+        return;
+    }
+
+    g_boot_profile.replay_count = header.count;
+
+    // Drop ranges for images that have changed since recording
+    int dropped = 0;
+    for (uint32_t i = 0; i < g_boot_profile.replay_count; i++)
+    {
+        boot_profile_range_t &range = g_boot_profile.replay[i];
+        if (range.scsiId >= S2S_MAX_TARGETS) continue;
+
+        boot_profile_image_t current;
+        diskBootProfileIdentity(range.scsiId, &current);
+        const boot_profile_image_t &saved = header.images[range.scsiId];
+        if (current.size != saved.size || current.name_hash != saved.name_hash)
+        {
+            range.scsiId = BOOT_PROFILE_NO_ID;
+            dropped++;
+        }
+    }
+
+    logmsg("Loaded boot access profile with ", (int)g_boot_profile.replay_count, " ranges from " BOOTPROFILEFILE);
+    if (dropped > 0)
+    {
+        logmsg("-- ", dropped, " ranges skipped because the image has changed");
+    }
+}
+
+static void diskBootProfileSave()
+{
+    g_boot_profile.finished = true;
+
+    uint32_t bytes = g_boot_profile.record_count * sizeof(boot_profile_range_t);
+    if (g_boot_profile.record_count == 0 ||
+        (g_boot_profile.record_count == g_boot_profile.replay_count &&
+         memcmp(g_boot_profile.record, g_boot_profile.replay, bytes) == 0))
+    {
+        // Nothing new to save
+        return;
+    }
+
+    boot_profile_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = BOOT_PROFILE_MAGIC;
+    header.version = BOOT_PROFILE_VERSION;
+    header.count = g_boot_profile.record_count;
+    for (uint8_t id = 0; id < S2S_MAX_TARGETS; id++)
+    {
+        diskBootProfileIdentity(id, &header.images[id]);
+    }
+
+    FsFile file = SD.open(BOOTPROFILEFILE, O_WRONLY | O_CREAT | O_TRUNC);
+    if (!file.isOpen() ||
+        file.write(&header, sizeof(header)) != sizeof(header) ||
+        file.write(g_boot_profile.record, bytes) != bytes)
+    {
+        logmsg("Failed to save boot access profile to " BOOTPROFILEFILE);
+    }
+    else
+    {
+        logmsg("Saved boot access profile with ", (int)g_boot_profile.record_count, " ranges to " BOOTPROFILEFILE);
+    }
+    file.close();
+}
+
+// Give the next expected range as prefetch hint
+static void diskBootProfileStageNext()
+{
+#ifdef PREFETCH_BUFFER_SIZE
+    if (g_boot_profile.replay_staged || g_boot_profile.replay_pos >= g_boot_profile.replay_count)
+    {
+        return;
+    }
+
+    g_boot_profile.replay_staged = true;
+    const boot_profile_range_t &range = g_boot_profile.replay[g_boot_profile.replay_pos];
+    image_config_t *img = diskBootProfileGetImage(range.scsiId);
+    if (img && img->prefetchbytes >= (int)img->bytesPerSector && !g_scsi_prefetch.hint_img)
+    {
+        g_scsi_prefetch.hint_img = img;
+        g_scsi_prefetch.hint_sector = range.lba;
+        g_scsi_prefetch.hint_bytesPerSector = img->bytesPerSector;
+    }
+#endif
+}
+
+// Called at start of each read command
+static void diskBootProfileRead(uint8_t scsiId, uint32_t lba, uint32_t blocks)
+{
+    if (!g_boot_profile.enabled) return;
+
+    if (g_boot_profile.replay_pos < g_boot_profile.replay_count)
+    {
+        // Check if host is still following the profile, allowing a few ranges
+        // to be skipped or reordered.
+        uint32_t end = g_boot_profile.replay_pos + BOOT_PROFILE_RESYNC_RANGES;
+        if (end > g_boot_profile.replay_count) end = g_boot_profile.replay_count;
+        for (uint32_t i = g_boot_profile.replay_pos; i < end; i++)
+        {
+            const boot_profile_range_t &range = g_boot_profile.replay[i];
+            if (range.scsiId == scsiId && lba >= range.lba && lba < range.lba + range.blocks)
+            {
+                g_boot_profile.replay_pos = i + 1;
+                g_boot_profile.replay_staged = false;
+                break;
+            }
+        }
+    }
+
+    if (g_boot_profile.finished) return;
+
+    if (g_boot_profile.record_start == 0)
+    {
+        g_boot_profile.record_start = millis() | 1;
+    }
+
+    if (g_boot_profile.record_count > 0)
+    {
+        // Combine sequential reads to one range
+        boot_profile_range_t &last = g_boot_profile.record[g_boot_profile.record_count - 1];
+        if (last.scsiId == scsiId && last.lba + last.blocks == lba && last.blocks + blocks <= 0xFFFF)
+        {
+            last.blocks += blocks;
+            return;
+        }
+    }
+
+    if (g_boot_profile.record_count < BOOT_PROFILE_MAX_RANGES)
+    {
+        boot_profile_range_t &range = g_boot_profile.record[g_boot_profile.record_count++];
+        range.lba = lba;
+        range.blocks = (blocks > 0xFFFF) ? 0xFFFF : blocks;
+        range.scsiId = scsiId;
+        range.reserved = 0;
+    }
+}
+
+// FNV-1a hash of image file name
+static uint32_t diskImageNameHash(const char *filename)
+{
+    uint32_t hash = 2166136261u;
+    while (*filename)
+    {
+        hash = (hash ^ (uint8_t)*filename++) * 16777619u;
+    }
+    return hash;
+}
+
+static void diskImageChanged(image_config_t &img, const char *filename)
+{
+    uint32_t name_hash = diskImageNameHash(filename);
+    bool same_image = (img.image_name_hash == name_hash);
+    img.image_name_hash = name_hash;
+
+#ifdef PREFETCH_BUFFER_SIZE
+    // Hint and staged data may refer to the previous image
+    if (g_scsi_prefetch.hint_img == &img)
+    {
+        g_scsi_prefetch.hint_img = NULL;
+    }
+
+    if (g_scsi_prefetch.bytes > 0 &&
+        (g_scsi_prefetch.scsiId & S2S_CFG_TARGET_ID_BITS) == (img.scsiId & S2S_CFG_TARGET_ID_BITS))
+    {
+        g_scsi_prefetch.bytes = 0;
+        g_scsi_prefetch.sector = 0;
+    }
+#endif
+
+    if (same_image) return;
+
+    // Ranges recorded or loaded for the previous image must not be used
+    uint8_t scsiId = img.scsiId & S2S_CFG_TARGET_ID_BITS;
+    for (uint32_t i = 0; i < g_boot_profile.replay_count; i++)
+    {
+        if (g_boot_profile.replay[i].scsiId == scsiId)
+            g_boot_profile.replay[i].scsiId = BOOT_PROFILE_NO_ID;
+    }
+
+    for (uint32_t i = 0; i < g_boot_profile.record_count; i++)
+    {
+        if (g_boot_profile.record[i].scsiId == scsiId)
+            g_boot_profile.record[i].scsiId = BOOT_PROFILE_NO_ID;
+    }
+}
+
+// Called on bus reset, the host has started booting
+static void diskBootProfileBusReset()
+{
+    if (g_boot_profile.record_start == 0)
+    {
+        g_boot_profile.record_start = millis() | 1;
+    }
+}
+
+// Called from scsiDiskPoll() when bus is free
+static void diskBootProfilePoll()
+{
+    if (!g_boot_profile.loaded)
+    {
+        diskBootProfileLoad();
+    }
+
+    if (!g_boot_profile.enabled) return;
+
+    diskBootProfileStageNext();
+
+    if (!g_boot_profile.finished && g_boot_profile.record_start != 0 &&
+        ((uint32_t)(millis() - g_boot_profile.record_start) > BOOT_PROFILE_RECORD_MS ||
+         g_boot_profile.record_count >= BOOT_PROFILE_MAX_RANGES))
+    {
+        diskBootProfileSave();
+    }
+}
+
+/***************************/
+/* FORMAT UNIT processing  */
+/***************************/
+
+// Formatting is done in steps, so that FORMAT UNIT with IMMED bit set
+// can proceed in scsiDiskPoll() while other targets are being accessed.
+#ifndef FORMAT_ERASE_STEP_SECTORS
+#define FORMAT_ERASE_STEP_SECTORS (64 * 2048)
 #endif
 
+#ifndef FORMAT_WRITE_STEP_BYTES
+#define FORMAT_WRITE_STEP_BYTES (256 * 1024)
+#endif
+
+static struct {
+    image_config_t *img; // Image being formatted, or NULL if idle
+    TargetState *target;
+    bool use_erase; // Image is a contiguous range on SD card that erases to zeros
+    bool erase_checked; // Erased sectors have been verified to read as zeros
+    uint32_t erase_sectors; // SD card erase unit, erases must be aligned to it
+    uint32_t bgn_sector;
+    uint64_t pos;
+    uint64_t size;
+} g_disk_format;
+
+static void diskFormatAbort()
+{
+    if (g_disk_format.img)
+    {
+        g_disk_format.target->formatInProgress = 0;
+        g_disk_format.img = NULL;
+    }
+}
+
+static void diskFormatFinish(bool success)
+{
+    image_config_t &img = *g_disk_format.img;
+    img.file.flush();
+
+    g_disk_format.target->formatInProgress = 0;
+    if (!success)
+    {
+        // Reported as deferred error on next command
+        g_disk_format.target->sense.code = MEDIUM_ERROR;
+        g_disk_format.target->sense.asc = FORMAT_COMMAND_FAILED;
+    }
+
+    logmsg("Format of SCSI ID ", (int)g_disk_format.target->targetId,
+           success ? " completed" : " failed", " at ", (int)(g_disk_format.pos / 1024), " kB");
+    g_disk_format.img = NULL;
+}
+
+// Clear the next part of the image, returns false on error
+static bool diskFormatStep()
+{
+    image_config_t &img = *g_disk_format.img;
+    uint64_t remain = g_disk_format.size - g_disk_format.pos;
+
+    // Erase only whole erase units, the unaligned start and end of the
+    // image are written with zeros so that neighbouring files are kept.
+    uint32_t first = g_disk_format.bgn_sector + (uint32_t)(g_disk_format.pos / SD_SECTOR_SIZE);
+    uint32_t unit = g_disk_format.erase_sectors;
+    uint32_t sectors = 0;
+    uint64_t write_limit = remain;
+    if (g_disk_format.use_erase)
+    {
+        uint32_t misalign = first % unit;
+        if (misalign != 0)
+        {
+            write_limit = (uint64_t)(unit - misalign) * SD_SECTOR_SIZE;
+        }
+        else
+        {
+            sectors = FORMAT_ERASE_STEP_SECTORS - FORMAT_ERASE_STEP_SECTORS % unit;
+            if (sectors > remain / SD_SECTOR_SIZE) sectors = remain / SD_SECTOR_SIZE;
+            sectors -= sectors % unit;
+        }
+    }
+
+    if (sectors > 0)
+    {
+        bool ok = SD.card()->erase(first, first + sectors - 1);
+        if (ok && !g_disk_format.erase_checked)
+        {
+            // Cards may erase to either 0x00 or 0xFF, check which one this is
+            ok = SD.card()->readSector(first, scsiDev.data);
+            for (int i = 0; ok && i < SD_SECTOR_SIZE; i++)
+            {
+                if (scsiDev.data[i] != 0) ok = false;
+            }
+            g_disk_format.erase_checked = true;
+        }
+
+        if (!ok)
+        {
+            dbgmsg("---- SD card erase not usable, formatting by writing zeros");
+            g_disk_format.use_erase = false;
+            return true;
+        }
+
+        g_disk_format.pos += (uint64_t)sectors * SD_SECTOR_SIZE;
+    }
+    else
+    {
+        // Other targets may have used the buffer between steps
+        uint32_t step = FORMAT_WRITE_STEP_BYTES;
+        if (step > write_limit) step = write_limit;
+        uint32_t buflen = sizeof(scsiDev.data);
+        if (buflen > step) buflen = step;
+        memset(scsiDev.data, 0, buflen);
+
+        if (!img.file.seek(g_disk_format.pos))
+        {
+            return false;
+        }
+
+        while (step > 0)
+        {
+            uint32_t len = (step > buflen) ? buflen : step;
+            if (img.file.write(scsiDev.data, len) != (ssize_t)len)
+            {
+                return false;
+            }
+            g_disk_format.pos += len;
+            step -= len;
+        }
+    }
+
+    g_disk_format.target->formatProgress =
+        (uint16_t)((g_disk_format.pos * 0xFFFF) / g_disk_format.size);
+    return true;
+}
+
+static void diskFormatStart(bool immed)
+{
+    image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
+
+    if (unlikely(blockDev.state & DISK_WP) ||
+        unlikely(scsiDev.target->cfg->deviceType == S2S_CFG_OPTICAL) ||
+        unlikely(!img.file.isWritable()))
+    {
+        scsiDev.status = CHECK_CONDITION;
+        scsiDev.target->sense.code = DATA_PROTECT;
+        scsiDev.target->sense.asc = WRITE_PROTECTED;
+        scsiDev.phase = STATUS;
+        return;
+    }
+
+    if (!img.format_clears_image)
+    {
+        // Keep image contents
+        scsiDev.phase = STATUS;
+        return;
+    }
+
+    if (g_disk_format.img)
+    {
+        // Only one image is formatted at a time, host can retry later
+        scsiDev.status = CHECK_CONDITION;
+        scsiDev.target->sense.code = NOT_READY;
+        scsiDev.target->sense.asc = LOGICAL_UNIT_NOT_READY_FORMAT_IN_PROGRESS;
+        scsiDev.phase = STATUS;
+        return;
+    }
+
+#ifdef PREFETCH_BUFFER_SIZE
+    // Invalidate prefetch buffer
+    g_scsi_prefetch.bytes = 0;
+    g_scsi_prefetch.sector = 0;
+#endif
+
+    uint32_t end_sector;
+    g_disk_format.img = &img;
+    g_disk_format.target = scsiDev.target;
+    g_disk_format.use_erase = img.file.contiguousRange(&g_disk_format.bgn_sector, &end_sector);
+    g_disk_format.erase_checked = false;
+    g_disk_format.erase_sectors = g_disk_format.use_erase ? sdCardEraseSectors(SD.card()) : 0;
+    if (g_disk_format.erase_sectors == 0) g_disk_format.use_erase = false;
+    g_disk_format.pos = 0;
+    g_disk_format.size = img.file.size();
+    scsiDev.target->formatInProgress = 1;
+    scsiDev.target->formatProgress = 0;
+
+    logmsg("Formatting SCSI ID ", (int)scsiDev.target->targetId, ", ",
+           (int)(g_disk_format.size / 1024), " kB",
+           g_disk_format.use_erase ? " using SD erase" : "",
+           immed ? " in background" : "");
+
+    // Without IMMED, format completes before status phase.
+    // On bus reset the format continues from scsiDiskPoll().
+    while (!immed && g_disk_format.img && !scsiDev.resetFlag)
+    {
+        if (g_disk_format.pos >= g_disk_format.size)
+        {
+            diskFormatFinish(true);
+        }
+        else if (!diskFormatStep())
+        {
+            diskFormatFinish(false);
+            scsiDev.status = CHECK_CONDITION;
+            scsiDev.target->sense.code = MEDIUM_ERROR;
+            scsiDev.target->sense.asc = FORMAT_COMMAND_FAILED;
+        }
+        platform_reset_watchdog();
+    }
+
+    scsiDev.phase = STATUS;
+}
+
 /*****************/
 /* Write command */
 /*****************/
@@ -1209,6 +2110,7 @@ void scsiDiskStartWrite(uint32_t lba, uint32_t blocks)
     uint32_t capacity = img.file.size() / bytesPerSector;
 
     dbgmsg("------ Write ", (int)blocks, "x", (int)bytesPerSector, " starting at ", (int)lba);
+    diskIOCommandStart(img, true);
 
     if (unlikely(blockDev.state & DISK_WP) ||
         unlikely(scsiDev.target->cfg->deviceType == S2S_CFG_OPTICAL) ||
@@ -1263,6 +2165,8 @@ void scsiDiskStartWrite(uint32_t lba, uint32_t blocks)
 // Usually called from SD card driver during waiting for SD card access.
 void diskDataOut_callback(uint32_t bytes_complete)
 {
+    CYCLE_TRACE(TRACE_SD_CALLBACK, 1, bytes_complete);
+
     // For best performance, do SCSI reads in blocks of 4 or more bytes
     bytes_complete &= ~3;
 
@@ -1307,6 +2211,38 @@ void diskDataOut_callback(uint32_t bytes_complete)
     }
 }
 
+// Check if buffer contains only zeros.
+// Compares 32 bytes at a time, so the first non-zero word ends the check quickly.
+static bool diskIsZeroData(const uint8_t *buf, uint32_t len)
+{
+    if (((uintptr_t)buf & 3) != 0 || (len & 31) != 0)
+    {
+        return false;
+    }
+
+    const uint32_t *p = (const uint32_t*)buf;
+    const uint32_t *end = p + len / 4;
+    while (p < end)
+    {
+        if (p[0] | p[1] | p[2] | p[3] | p[4] | p[5] | p[6] | p[7])
+        {
+            return false;
+        }
+        p += 8;
+    }
+
+    return true;
+}
+
+static void diskDataOut_writeError()
+{
+    logmsg("SD card write failed: ", SD.sdErrorCode());
+    scsiDev.status = CHECK_CONDITION;
+    scsiDev.target->sense.code = MEDIUM_ERROR;
+    scsiDev.target->sense.asc = WRITE_ERROR_AUTO_REALLOCATION_FAILED;
+    scsiDev.phase = STATUS;
+}
+
 void diskDataOut()
 {
     scsiEnterPhase(DATA_OUT);
@@ -1317,6 +2253,7 @@ void diskDataOut()
     g_disk_transfer.buffer = scsiDev.data;
     g_disk_transfer.bytes_scsi = blockcount * bytesPerSector;
     g_disk_transfer.bytes_sd = 0;
+    g_disk_transfer.bytes_sd_pending = 0;
     g_disk_transfer.bytes_scsi_started = 0;
     g_disk_transfer.sd_transfer_start = 0;
     g_disk_transfer.parityError = 0;
@@ -1328,6 +2265,27 @@ void diskDataOut()
         platform_poll();
         diskEjectButtonUpdate(false);
 
+        if (g_disk_transfer.bytes_sd_pending > 0)
+        {
+            // SD card write is continuing in background.
+            // Polling it calls diskDataOut_callback() to read more from SCSI bus.
+            bool failed;
+            if (platform_sd_write_pending(&failed))
+            {
+                continue;
+            }
+
+            platform_set_sd_callback(NULL, NULL);
+            g_disk_transfer.bytes_sd += g_disk_transfer.bytes_sd_pending;
+            g_disk_transfer.bytes_sd_pending = 0;
+
+            if (failed)
+            {
+                diskDataOut_writeError();
+            }
+            continue;
+        }
+
         // Figure out how many contiguous bytes are available for writing to SD card.
         uint32_t bufsize = sizeof(scsiDev.data);
         uint32_t start = g_disk_transfer.bytes_sd % bufsize;
@@ -1404,21 +2362,44 @@ void diskDataOut()
             // when buffer space is freed.
             uint8_t *buf = &scsiDev.data[start];
             g_disk_transfer.sd_transfer_start = start;
+
+            if (img.discard_zero_writes && len >= ZERO_WRITE_DISCARD_MIN_BYTES &&
+                diskIsZeroData(buf, len) && img.file.discard(len))
+            {
+                // Host wrote zeros (formatting, disk wipe), sectors were erased instead
+                g_disk_transfer.bytes_sd += len;
+                continue;
+            }
+
             // dbgmsg("SD write ", (int)start, " + ", (int)len, " ", bytearray(buf, len));
             platform_set_sd_callback(&diskDataOut_callback, buf);
-            if (img.file.write(buf, len) != len)
+            bool failed = (img.file.write(buf, len) != len);
+            if (!failed && platform_sd_write_pending(&failed))
             {
-                logmsg("SD card write failed: ", SD.sdErrorCode());
-                scsiDev.status = CHECK_CONDITION;
-                scsiDev.target->sense.code = MEDIUM_ERROR;
-                scsiDev.target->sense.asc = WRITE_ERROR_AUTO_REALLOCATION_FAILED;
-                scsiDev.phase = STATUS;
+                // Write continues in background, buffer is released when it completes
+                g_disk_transfer.bytes_sd_pending = len;
+                continue;
             }
+
             platform_set_sd_callback(NULL, NULL);
             g_disk_transfer.bytes_sd += len;
+
+            if (failed)
+            {
+                diskDataOut_writeError();
+            }
         }
     }
 
+    if (g_disk_transfer.bytes_sd_pending > 0)
+    {
+        // Transfer was aborted, no more SCSI reads but let the SD card write finish
+        bool failed;
+        platform_set_sd_callback(NULL, NULL);
+        while (platform_sd_write_pending(&failed));
+        g_disk_transfer.bytes_sd_pending = 0;
+    }
+
     // Release SCSI bus
     scsiFinishRead(NULL, 0, &g_disk_transfer.parityError);
 
@@ -1451,6 +2432,7 @@ void scsiDiskStartRead(uint32_t lba, uint32_t blocks)
     uint32_t capacity = img.file.size() / bytesPerSector;
     
     dbgmsg("------ Read ", (int)blocks, "x", (int)bytesPerSector, " starting at ", (int)lba);
+    diskIOCommandStart(img, false);
 
     if (unlikely(((uint64_t) lba) + blocks > capacity))
     {
@@ -1464,6 +2446,11 @@ void scsiDiskStartRead(uint32_t lba, uint32_t blocks)
     }
     else
     {
+        if (img.deviceType != S2S_CFG_SEQUENTIAL)
+        {
+            diskBootProfileRead(img.scsiId & S2S_CFG_TARGET_ID_BITS, lba, blocks);
+        }
+
         transfer.multiBlock = 1;
         transfer.lba = lba;
         transfer.blocks = blocks;
@@ -1471,6 +2458,7 @@ void scsiDiskStartRead(uint32_t lba, uint32_t blocks)
         scsiDev.phase = DATA_IN;
         scsiDev.dataLen = 0;
         scsiDev.dataPtr = 0;
+        g_disk_transfer.ring_slot = 0;
 
 #ifdef PREFETCH_BUFFER_SIZE
         uint32_t sectors_in_prefetch = g_scsi_prefetch.bytes / bytesPerSector;
@@ -1486,6 +2474,12 @@ void scsiDiskStartRead(uint32_t lba, uint32_t blocks)
             if (count > transfer.blocks) count = transfer.blocks;
             scsiStartWrite(g_scsi_prefetch.buffer + start_offset * bytesPerSector, count * bytesPerSector);
             dbgmsg("------ Found ", (int)count, " sectors in prefetch cache");
+            g_scsi_prefetch.time = millis();
+
+            if (unlikely(img.deviceType == S2S_CFG_OPTICAL))
+            {
+                cdromReadAheadData(img, transfer.lba, g_scsi_prefetch.buffer + start_offset * bytesPerSector, count);
+            }
             transfer.currentBlock += count;
         }
 
@@ -1514,6 +2508,8 @@ void scsiDiskStartRead(uint32_t lba, uint32_t blocks)
 
 void diskDataIn_callback(uint32_t bytes_complete)
 {
+    CYCLE_TRACE(TRACE_SD_CALLBACK, 0, bytes_complete);
+
     // On SCSI-1 devices the phase change has some extra delays.
     // Doing it here lets the SD card transfer proceed in background.
     scsiEnterPhase(DATA_IN);
@@ -1549,7 +2545,7 @@ void diskDataIn_callback(uint32_t bytes_complete)
 }
 
 // Start a data in transfer using given temporary buffer.
-// diskDataIn() below divides the scsiDev.data buffer to two halves for double buffering.
+// diskDataIn() below divides the scsiDev.data buffer to a ring of slots.
 static void start_dataInTransfer(uint8_t *buffer, uint32_t count)
 {
     g_disk_transfer.buffer = buffer;
@@ -1593,31 +2589,45 @@ static void start_dataInTransfer(uint8_t *buffer, uint32_t count)
 
 static void diskDataIn()
 {
-    // Figure out how many blocks we can fit in buffer
+    // Figure out how many blocks we can fit in buffer and in each slot
     uint32_t bytesPerSector = scsiDev.target->liveCfg.bytesPerSector;
     uint32_t maxblocks = sizeof(scsiDev.data) / bytesPerSector;
-    uint32_t maxblocks_half = maxblocks / 2;
-    
-    // Start transfer in first half of buffer
-    // Waits for the previous first half transfer to finish first.
-    uint32_t remain = (transfer.blocks - transfer.currentBlock);
-    if (remain > 0)
-    {
-        uint32_t transfer_blocks = std::min(remain, maxblocks_half);
-        uint32_t transfer_bytes = transfer_blocks * bytesPerSector;
-        start_dataInTransfer(&scsiDev.data[0], transfer_bytes);
-        transfer.currentBlock += transfer_blocks;
-    }
+    uint32_t slot_blocks = maxblocks / PLATFORM_DATAIN_RING_SLOTS;
+    if (slot_blocks == 0) slot_blocks = 1;
+    uint32_t slot_count = maxblocks / slot_blocks;
+    uint32_t slot_bytes = slot_blocks * bytesPerSector;
 
-    // Start transfer in second half of buffer
-    // Waits for the previous second half transfer to finish first
-    remain = (transfer.blocks - transfer.currentBlock);
-    if (remain > 0)
+    // Go around the ring once per call
+    for (uint32_t i = 0; i < slot_count && !scsiDev.resetFlag && scsiDev.phase == DATA_IN; i++)
     {
-        uint32_t transfer_blocks = std::min(remain, maxblocks_half);
+        uint32_t remain = (transfer.blocks - transfer.currentBlock);
+        if (remain == 0)
+            break;
+
+        // The first slot is always used, start_dataInTransfer() waits for it to be free.
+        // Following slots are combined to the same SD card read if SCSI has already
+        // released them, up to the end of the buffer.
+        uint32_t slot = g_disk_transfer.ring_slot;
+        uint32_t slots = 1;
+        while (slot + slots < slot_count && slots * slot_blocks < remain &&
+               scsiIsWriteFinished(&scsiDev.data[(slot + slots + 1) * slot_bytes - 1]))
+        {
+            slots++;
+        }
+
+        uint32_t transfer_blocks = std::min(remain, slots * slot_blocks);
         uint32_t transfer_bytes = transfer_blocks * bytesPerSector;
-        start_dataInTransfer(&scsiDev.data[maxblocks_half * bytesPerSector], transfer_bytes);
+        start_dataInTransfer(&scsiDev.data[slot * slot_bytes], transfer_bytes);
+
+        if (unlikely(scsiDev.target->cfg->deviceType == S2S_CFG_OPTICAL) && scsiDev.phase == DATA_IN)
+        {
+            // Let CD-ROM emulation see directory structure as the host reads it
+            image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
+            cdromReadAheadData(img, transfer.lba + transfer.currentBlock, &scsiDev.data[slot * slot_bytes], transfer_blocks);
+        }
+
         transfer.currentBlock += transfer_blocks;
+        g_disk_transfer.ring_slot = (slot + slots) % slot_count;
     }
 
     if (transfer.currentBlock == transfer.blocks)
@@ -1630,16 +2640,45 @@ static void diskDataIn()
         if (prefetchbytes > PREFETCH_BUFFER_SIZE) prefetchbytes = PREFETCH_BUFFER_SIZE;
         uint32_t prefetch_sectors = prefetchbytes / bytesPerSector;
         uint32_t img_sector_count = img.file.size() / bytesPerSector;
-        g_scsi_prefetch.sector = transfer.lba + transfer.blocks;
-        g_scsi_prefetch.bytes = 0;
-        g_scsi_prefetch.scsiId = scsiDev.target->cfg->scsiId;
-        
-        if (g_scsi_prefetch.sector + prefetch_sectors > img_sector_count)
+
+        if (!diskPrefetchMayReplace(img))
+        {
+            // Keep data that was staged for a higher priority target
+            prefetch_sectors = 0;
+        }
+        else
+        {
+            g_scsi_prefetch.sector = transfer.lba + transfer.blocks;
+            g_scsi_prefetch.bytes = 0;
+            g_scsi_prefetch.scsiId = scsiDev.target->cfg->scsiId;
+            g_scsi_prefetch.priority = img.io_priority;
+            g_scsi_prefetch.time = millis();
+        }
+
+        if (prefetch_sectors > 0 && g_scsi_prefetch.sector + prefetch_sectors > img_sector_count)
         {
             // Don't try to read past image end.
             prefetch_sectors = img_sector_count - g_scsi_prefetch.sector;
         }
 
+        uint32_t next_lba = transfer.lba + transfer.blocks;
+        uint32_t predict_lba, predict_count;
+        if (img.deviceType == S2S_CFG_OPTICAL &&
+            cdromReadAheadPredict(img, next_lba, &predict_lba, &predict_count))
+        {
+            if (predict_lba == next_lba)
+            {
+                // Don't read past end of the file or directory
+                if (prefetch_sectors > predict_count) prefetch_sectors = predict_count;
+            }
+            else
+            {
+                // Host is expected to open a file next, read its start when bus is free
+                prefetch_sectors = 0;
+                diskPrefetchHint(predict_lba);
+            }
+        }
+
         while (!scsiIsWriteFinished(NULL) && prefetch_sectors > 0 && !scsiDev.resetFlag)
         {
             platform_poll();
@@ -1709,6 +2748,7 @@ int scsiDiskCommand()
         {
             scsiDev.target->started = 0;
         }
+        s2s_readyStatusInvalidate(scsiDev.target->targetId);
     }
     else if (unlikely(command == 0x00))
     {
@@ -1778,8 +2818,8 @@ int scsiDiskCommand()
     else if (unlikely(command == 0x04))
     {
         // FORMAT UNIT
-        // We don't really do any formatting, but we need to read the correct
-        // number of bytes in the DATA_OUT phase to make the SCSI host happy.
+        // The defect list and initialization pattern are read and discarded,
+        // and the image is cleared to zero.
 
         int fmtData = (scsiDev.cdb[1] & 0x10) ? 1 : 0;
         if (fmtData)
@@ -1792,7 +2832,8 @@ int scsiDiskCommand()
         }
         else
         {
-            // No data to read, we're already finished!
+            // No parameter data, format with defaults
+            diskFormatStart(false);
         }
     }
     else if (unlikely(command == 0x25))
@@ -1905,6 +2946,36 @@ int scsiDiskCommand()
 extern "C"
 void scsiDiskPoll()
 {
+    if (scsiDev.phase == BUS_FREE)
+    {
+        diskBootProfilePoll();
+        diskIOStatsPoll();
+    }
+
+#ifdef PREFETCH_BUFFER_SIZE
+    if (g_scsi_prefetch.hint_img && scsiDev.phase == BUS_FREE)
+    {
+        diskPrefetchStageHint();
+    }
+#endif
+
+    if (g_disk_format.img && scsiDev.phase == BUS_FREE &&
+        diskIOBackgroundAllowed(*g_disk_format.img))
+    {
+        // Background format started with IMMED bit
+        uint32_t start = millis();
+        image_config_t &img = *g_disk_format.img;
+        if (g_disk_format.pos >= g_disk_format.size)
+        {
+            diskFormatFinish(true);
+        }
+        else if (!diskFormatStep())
+        {
+            diskFormatFinish(false);
+        }
+        diskIOBackgroundUsed(img, start);
+    }
+
     if (scsiDev.phase == DATA_IN &&
         transfer.currentBlock != transfer.blocks)
     {
@@ -1916,6 +2987,14 @@ void scsiDiskPoll()
         diskDataOut();
     }
 
+    if (g_disk_io.cmd_img &&
+        ((scsiDev.phase != DATA_IN && scsiDev.phase != DATA_OUT) ||
+         transfer.currentBlock == transfer.blocks))
+    {
+        // Read or write command has transferred all data, or ended in error
+        diskIOCommandEnd();
+    }
+
     if (scsiDev.phase == STATUS && scsiDev.target)
     {
         // Check if the command is affected by drive geometry.
@@ -1957,8 +3036,12 @@ void scsiDiskReset()
 #ifdef PREFETCH_BUFFER_SIZE
     g_scsi_prefetch.bytes = 0;
     g_scsi_prefetch.sector = 0;
+    g_scsi_prefetch.hint_img = NULL;
 #endif
 
+    diskBootProfileBusReset();
+    g_boot_profile.replay_staged = false;
+
     // Reinsert any ejected CD-ROMs on BUS RESET and restart from first image
     for (int i = 0; i < S2S_MAX_TARGETS; ++i)
     {
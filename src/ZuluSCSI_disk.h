@@ -41,6 +41,13 @@ extern "C" {
 }
 
 // Extended configuration stored alongside the normal SCSI2SD target information
+enum io_priority_t {
+    IO_PRIORITY_LOW = 0,
+    IO_PRIORITY_NORMAL = 1,
+    IO_PRIORITY_HIGH = 2,
+    IO_PRIORITY_COUNT
+};
+
 struct image_config_t: public S2S_TargetCfg
 {
     image_config_t() {};
@@ -65,6 +72,9 @@ struct image_config_t: public S2S_TargetCfg
     // the name of the currently mounted image in a dynamic image directory
     char current_image[MAX_FILE_PATH];
 
+    // Hash of the image file name, identifies the image in the boot access profile
+    uint32_t image_name_hash;
+
     // Index of image, for when image on-the-fly switching is used for CD drives
     // This is also used for dynamic directories to track how many images have been seen
     // Negative value forces restart from first image.
@@ -73,6 +83,9 @@ struct image_config_t: public S2S_TargetCfg
     // Cue sheet file for CD-ROM images
     FsFile cuesheetfile;
 
+    // Length of decoded audio for CD-ROM images compressed with FLAC, 0 otherwise
+    uint64_t flac_decoded_size;
+
     // Right-align vendor / product type strings (for Apple)
     // Standard SCSI uses left alignment
     // This field uses -1 for default when field is not set in .ini
@@ -84,6 +97,19 @@ struct image_config_t: public S2S_TargetCfg
     // Warning about geometry settings
     bool geometrywarningprinted;
 
+    // Clear image contents on FORMAT UNIT command
+    bool format_clears_image;
+
+    // Erase SD card sectors instead of writing when host writes all zeros
+    bool discard_zero_writes;
+
+    // Priority class for SD card use outside of commands, IO_PRIORITY_LOW .. IO_PRIORITY_HIGH
+    uint8_t io_priority;
+
+    // Percentage of time that background work may use the SD card
+    // while a higher priority target is active
+    uint8_t io_share;
+
     // Clear any image state to zeros
     void clear();
 
@@ -0,0 +1,134 @@
+/**
+ * ZuluSCSI™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluSCSI™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#include "ZuluSCSI_flac.h"
+
+#ifdef ENABLE_AUDIO_OUTPUT
+
+#include "ZuluSCSI_audio.h"
+#include "ZuluSCSI_log.h"
+
+// Reads compressed data from image file. The position is tracked here
+// because READ commands on the same image also move the file position.
+class ImageFLACSource: public FLACSource
+{
+public:
+    ImageBackingStore *file;
+    uint64_t pos;
+
+    uint32_t read(uint8_t *dst, uint32_t len)
+    {
+        if (file->position() != pos && !file->seek(pos))
+        {
+            return 0;
+        }
+
+        ssize_t count = file->read(dst, len);
+        if (count <= 0)
+        {
+            return 0;
+        }
+
+        pos += count;
+        return count;
+    }
+
+    bool seek(uint64_t offset)
+    {
+        pos = offset;
+        return true;
+    }
+
+    uint64_t size()
+    {
+        return file->size();
+    }
+};
+
+static ImageFLACSource g_flac_source;
+static FLACDecoder g_flac_decoder;
+
+static void flacDetach()
+{
+    // Playback may be decoding on the other core, stop it before
+    // the decoder state changes.
+    for (uint8_t id = 0; id < 8; id++)
+    {
+        audio_stop(id);
+    }
+
+    g_flac_decoder.close();
+    g_flac_source.file = NULL;
+}
+
+bool flacOpenImage(ImageBackingStore *file)
+{
+    flacDetach();
+
+    if (!file->isOpen())
+    {
+        return false;
+    }
+
+    g_flac_source.file = file;
+    g_flac_source.pos = 0;
+    if (!g_flac_decoder.open(&g_flac_source))
+    {
+        g_flac_source.file = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+void flacCloseImage(ImageBackingStore *file)
+{
+    if (g_flac_source.file == file)
+    {
+        flacDetach();
+    }
+}
+
+FLACDecoder *flacGetDecoder(ImageBackingStore *file)
+{
+    FLACDecoder *decoder = flacAttachedDecoder(file);
+    if (decoder)
+    {
+        return decoder;
+    }
+
+    dbgmsg("---- Reattaching FLAC decoder to another image");
+    return flacOpenImage(file) ? &g_flac_decoder : NULL;
+}
+
+FLACDecoder *flacAttachedDecoder(ImageBackingStore *file)
+{
+    if (g_flac_source.file == file && g_flac_decoder.isOpen())
+    {
+        return &g_flac_decoder;
+    }
+    else
+    {
+        return NULL;
+    }
+}
+
+#endif
@@ -0,0 +1,48 @@
+/**
+ * ZuluSCSI™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluSCSI™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// Access to CD audio images compressed with FLAC.
+// The decoder needs a lot of RAM, so there is only one instance that is
+// shared by all targets. It is attached to one image file at a time.
+
+#pragma once
+
+#ifdef ENABLE_AUDIO_OUTPUT
+
+#include <FLACDecoder.h>
+#include "ImageBackingStore.h"
+
+// Attach the decoder to image file and check the stream format.
+// Returns false if the file is not a supported FLAC stream.
+bool flacOpenImage(ImageBackingStore *file);
+
+// Detach the decoder if it is attached to the image file
+void flacCloseImage(ImageBackingStore *file);
+
+// Get decoder for image file. If it was last used with another image, it is
+// reattached, which stops any audio playback that is using it.
+// Returns NULL if the file cannot be decoded.
+FLACDecoder *flacGetDecoder(ImageBackingStore *file);
+
+// Get decoder if it is currently attached to the image file, otherwise NULL
+FLACDecoder *flacAttachedDecoder(ImageBackingStore *file);
+
+#endif
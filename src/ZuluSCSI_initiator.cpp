@@ -28,7 +28,9 @@
 #include "ZuluSCSI_log.h"
 #include "ZuluSCSI_log_trace.h"
 #include "ZuluSCSI_initiator.h"
+#include "ImageBackingStore.h"
 #include <ZuluSCSI_platform.h>
+#include <minIni.h>
 #include "SdFat.h"
 
 #include <scsi2sd.h>
@@ -60,6 +62,31 @@ bool scsiInitiatorReadCapacity(int target_id, uint32_t *sectorcount, uint32_t *s
 
 #else
 
+// How often to record the imaging progress to SD card
+#ifndef INITIATOR_CHECKPOINT_INTERVAL_MS
+#define INITIATOR_CHECKPOINT_INTERVAL_MS 5000
+#endif
+
+// Default selection timeout used when sweeping the bus for devices
+#ifndef INITIATOR_DISCOVERY_SELECT_TIMEOUT_MS
+#define INITIATOR_DISCOVERY_SELECT_TIMEOUT_MS 5
+#endif
+
+// How often to sweep the bus for new devices when nothing is being imaged
+#ifndef INITIATOR_DISCOVERY_INTERVAL_MS
+#define INITIATOR_DISCOVERY_INTERVAL_MS 1000
+#endif
+
+// How often to poll devices that are still spinning up
+#ifndef INITIATOR_SPINUP_POLL_MS
+#define INITIATOR_SPINUP_POLL_MS 250
+#endif
+
+// How long to wait for a started device to become ready before starting it again
+#ifndef INITIATOR_SPINUP_TIMEOUT_MS
+#define INITIATOR_SPINUP_TIMEOUT_MS 30000
+#endif
+
 /*************************************
  * High level initiator mode logic   *
  *************************************/
@@ -68,6 +95,18 @@ static struct {
     // Bitmap of all drives that have been imaged
     uint32_t drives_imaged;
 
+    // Device table from bus discovery.
+    // Devices that were not ready are started with IMMED bit set,
+    // so that several drives spin up in parallel while being polled.
+    uint32_t devices_present;
+    uint32_t devices_ready;
+    uint32_t devices_started;
+    uint32_t spinup_start[8];
+    uint32_t last_discovery;
+    uint32_t last_spinup_poll;
+    uint32_t discovery_timeout_us;
+    uint32_t select_timeout_us;
+
     // Is imaging a drive in progress, or are we scanning?
     bool imaging;
 
@@ -84,11 +123,101 @@ static struct {
     int retrycount;
     uint32_t failposition;
 
+    // Preallocated image files have their final size from the start,
+    // so the amount of valid data is tracked in a separate progress file.
+    char filename[32];
+    uint32_t last_checkpoint;
+    FsFile progress_file;
+
+    // First SD card sector of a contiguous preallocated image file, or 0 to
+    // write through the filesystem.
+    uint32_t raw_sector_begin;
+
     FsFile target_file;
+
+    // Tape imaging state, used instead of sector counts for sequential access devices
+    bool tape;
+    bool tape_fixed; // Drive only supports fixed block size
+    uint32_t tape_blocksize; // Block size in fixed mode
+    uint32_t tape_maxlen; // Maximum record length in variable mode
+    uint64_t tape_bytes; // Bytes of valid data in image file
+    uint32_t tape_records;
+    uint32_t tape_filemarks;
+    uint32_t tape_errors;
+    uint32_t tape_last_log;
 } g_initiator_state;
 
 extern SdFs SD;
 
+// Check if imaging was interrupted by power loss or reset.
+// The preallocated image is truncated to the amount of data that was
+// recorded as valid, so that a usable partial image remains.
+static void scsiInitiatorRecoverPartialImage()
+{
+    FsFile progress = SD.open(PROGRESSFILE, O_RDONLY);
+    if (!progress.isOpen())
+    {
+        return;
+    }
+
+    char buf[64] = {0};
+    progress.read(buf, sizeof(buf) - 1);
+    progress.close();
+
+    char *separator = strchr(buf, '\n');
+    if (separator)
+    {
+        *separator = '\0';
+        uint64_t valid_bytes = strtoull(separator + 1, NULL, 10);
+
+        FsFile image = SD.open(buf, O_RDWR);
+        if (image.isOpen() && image.size() > valid_bytes)
+        {
+            logmsg("Imaging of ", buf, " was interrupted, truncating to ", (int)(valid_bytes / 1024), " kB of valid data");
+            if (!image.truncate(valid_bytes))
+            {
+                logmsg("Failed to truncate ", buf);
+            }
+        }
+        image.close();
+    }
+
+    SD.remove(PROGRESSFILE);
+}
+
+// Flush image file and record the amount of valid data to the progress file.
+// The record has fixed length so that it is always rewritten in place.
+static void scsiInitiatorCheckpoint()
+{
+    g_initiator_state.target_file.flush();
+
+    uint64_t valid_bytes = (uint64_t)g_initiator_state.sectors_done * g_initiator_state.sectorsize;
+    if (g_initiator_state.tape)
+    {
+        valid_bytes = g_initiator_state.tape_bytes;
+    }
+
+    char number[21];
+    for (int i = 19; i >= 0; i--)
+    {
+        number[i] = '0' + (valid_bytes % 10);
+        valid_bytes /= 10;
+    }
+    number[20] = '\n';
+
+    FsFile &progress = g_initiator_state.progress_file;
+    if (progress.isOpen())
+    {
+        progress.seek(0);
+        progress.write(g_initiator_state.filename, strlen(g_initiator_state.filename));
+        progress.write("\n", 1);
+        progress.write(number, sizeof(number));
+        progress.flush();
+    }
+
+    g_initiator_state.last_checkpoint = millis();
+}
+
 // Initialization of initiator mode
 void scsiInitiatorInit()
 {
@@ -103,6 +232,18 @@ void scsiInitiatorInit()
     g_initiator_state.retrycount = 0;
     g_initiator_state.failposition = 0;
     g_initiator_state.max_sector_per_transfer = 512;
+    g_initiator_state.tape = false;
+
+    g_initiator_state.devices_present = 0;
+    g_initiator_state.devices_ready = 0;
+    g_initiator_state.devices_started = 0;
+    g_initiator_state.last_discovery = millis() - INITIATOR_DISCOVERY_INTERVAL_MS;
+    g_initiator_state.last_spinup_poll = millis();
+    g_initiator_state.discovery_timeout_us = 1000 *
+        ini_getl("SCSI", "InitiatorSelectTimeout", INITIATOR_DISCOVERY_SELECT_TIMEOUT_MS, CONFIGFILE);
+    g_initiator_state.select_timeout_us = 250000;
+
+    scsiInitiatorRecoverPartialImage();
 }
 
 // Update progress bar LED during transfers
@@ -111,7 +252,11 @@ static void scsiInitiatorUpdateLed()
     // Update status indicator, the led blinks every 5 seconds and is on the longer the more data has been transferred
     const int period = 256;
     int phase = (millis() % period);
-    int duty = g_initiator_state.sectors_done * period / g_initiator_state.sectorcount;
+    int duty = period / 2;
+    if (g_initiator_state.sectorcount > 0)
+    {
+        duty = g_initiator_state.sectors_done * period / g_initiator_state.sectorcount;
+    }
 
     // Minimum and maximum time to verify that the blink is visible
     if (duty < 50) duty = 50;
@@ -137,6 +282,130 @@ void delay_with_poll(uint32_t ms)
     }
 }
 
+// Check device state with a single TEST UNIT READY command.
+// Devices that report NOT READY are started once without waiting for completion,
+// and then only polled until they become ready or the spin up timeout expires.
+// Returns false if the device did not respond to selection.
+static bool scsiInitiatorPollDevice(int target_id, bool *ready)
+{
+    uint8_t command[6] = {0x00, 0, 0, 0, 0, 0};
+    int status = scsiInitiatorRunCommand(target_id,
+                                         command, sizeof(command),
+                                         NULL, 0,
+                                         NULL, 0);
+    *ready = (status == 0);
+
+    if (status == 2)
+    {
+        uint8_t sense_key = 0;
+        scsiRequestSense(target_id, &sense_key);
+
+        bool started = g_initiator_state.devices_started & (1 << target_id);
+        uint32_t elapsed = millis() - g_initiator_state.spinup_start[target_id];
+        if (sense_key == 2 && started && elapsed >= INITIATOR_SPINUP_TIMEOUT_MS)
+        {
+            logmsg("SCSI id ", target_id, " did not become ready in ", (int)(elapsed / 1000), " s, starting it again");
+            started = false;
+        }
+
+        if (sense_key == 2 && !started)
+        {
+            // START STOP UNIT with IMMED bit returns as soon as the command is accepted
+            uint8_t startcmd[6] = {0x1B, 0x01, 0, 0, 0x01, 0};
+            scsiInitiatorRunCommand(target_id,
+                                    startcmd, sizeof(startcmd),
+                                    NULL, 0,
+                                    NULL, 0);
+            g_initiator_state.devices_started |= (1 << target_id);
+            g_initiator_state.spinup_start[target_id] = millis();
+        }
+    }
+    else
+    {
+        g_initiator_state.devices_started &= ~(1 << target_id);
+    }
+
+    return status != -1;
+}
+
+// Sweep all IDs with a short selection timeout and poll devices that are spinning up.
+static void scsiInitiatorDiscovery()
+{
+    uint32_t now = millis();
+    uint32_t pending = g_initiator_state.devices_present & ~g_initiator_state.devices_ready;
+
+    if ((uint32_t)(now - g_initiator_state.last_discovery) >= INITIATOR_DISCOVERY_INTERVAL_MS)
+    {
+        g_initiator_state.last_discovery = now;
+        g_initiator_state.last_spinup_poll = now;
+        g_initiator_state.select_timeout_us = g_initiator_state.discovery_timeout_us;
+
+        uint32_t found = 0, ready = 0;
+        for (int id = 0; id < 8; id++)
+        {
+            bool is_ready;
+            if (g_initiator_state.drives_imaged & (1 << id)) continue;
+            if (!scsiInitiatorPollDevice(id, &is_ready)) continue;
+
+            found |= (1 << id);
+            if (is_ready) ready |= (1 << id);
+        }
+
+        g_initiator_state.select_timeout_us = 250000;
+
+        if (found != g_initiator_state.devices_present)
+        {
+            for (int id = 0; id < 8; id++)
+            {
+                if (found & ~g_initiator_state.devices_present & (1 << id))
+                {
+                    logmsg("Found SCSI id ", id, (ready & (1 << id)) ? ", ready" : ", waiting for spin up");
+                }
+            }
+        }
+
+        g_initiator_state.devices_present = found;
+        g_initiator_state.devices_ready = ready;
+    }
+    else if (pending && (uint32_t)(now - g_initiator_state.last_spinup_poll) >= INITIATOR_SPINUP_POLL_MS)
+    {
+        g_initiator_state.last_spinup_poll = now;
+
+        for (int id = 0; id < 8; id++)
+        {
+            bool is_ready;
+            if (!(pending & (1 << id))) continue;
+
+            if (!scsiInitiatorPollDevice(id, &is_ready))
+            {
+                g_initiator_state.devices_present &= ~(1 << id);
+            }
+            else if (is_ready)
+            {
+                dbgmsg("SCSI id ", id, " is ready");
+                g_initiator_state.devices_ready |= (1 << id);
+            }
+        }
+    }
+}
+
+// Pick the next device from discovery table that is ready and not yet imaged.
+// Returns -1 if no device is ready.
+static int scsiInitiatorNextReadyDevice()
+{
+    uint32_t candidates = g_initiator_state.devices_ready & ~g_initiator_state.drives_imaged;
+    for (int i = 1; i <= 8; i++)
+    {
+        int id = (g_initiator_state.target_id + i) % 8;
+        if (candidates & (1 << id)) return id;
+    }
+    return -1;
+}
+
+// Tape imaging is implemented below
+static void scsiInitiatorStartTapeImaging();
+static void scsiInitiatorTapeStep();
+
 // High level logic of the initiator mode
 void scsiInitiatorMainLoop()
 {
@@ -144,20 +413,29 @@ void scsiInitiatorMainLoop()
     {
         logmsg("Executing BUS RESET after aborted command");
         scsiHostPhyReset();
+
+        // Bus reset may leave devices in unit attention state, rediscover them
+        g_initiator_state.devices_ready = 0;
+        g_initiator_state.last_discovery = millis() - INITIATOR_DISCOVERY_INTERVAL_MS;
     }
 
     if (!g_initiator_state.imaging)
     {
-        // Scan for SCSI drives one at a time
-        g_initiator_state.target_id = (g_initiator_state.target_id + 1) % 8;
+        // Find drives on the bus and start imaging the first one that is ready
+        scsiInitiatorDiscovery();
+        int next_id = scsiInitiatorNextReadyDevice();
+        if (next_id < 0)
+        {
+            delay_with_poll(10);
+            return;
+        }
+
+        g_initiator_state.target_id = next_id;
         g_initiator_state.sectors_done = 0;
         g_initiator_state.retrycount = 0;
         g_initiator_state.max_sector_per_transfer = 512;
 
-        if (!(g_initiator_state.drives_imaged & (1 << g_initiator_state.target_id)))
         {
-            delay_with_poll(1000);
-
             uint8_t inquiry_data[36];
 
             LED_ON();
@@ -165,16 +443,25 @@ void scsiInitiatorMainLoop()
                 scsiTestUnitReady(g_initiator_state.target_id) &&
                 scsiStartStopUnit(g_initiator_state.target_id, true);
 
-            bool readcapok = startstopok &&
+            bool inquiryok = startstopok &&
+                scsiInquiry(g_initiator_state.target_id, inquiry_data);
+
+            // Sequential access devices don't have a capacity
+            g_initiator_state.tape = inquiryok && (inquiry_data[0] & 0x1F) == 1;
+
+            bool readcapok = startstopok && !g_initiator_state.tape &&
                 scsiInitiatorReadCapacity(g_initiator_state.target_id,
                                           &g_initiator_state.sectorcount,
                                           &g_initiator_state.sectorsize);
-
-            bool inquiryok = startstopok &&
-                scsiInquiry(g_initiator_state.target_id, inquiry_data);
             LED_OFF();
 
-            if (readcapok)
+            if (g_initiator_state.tape)
+            {
+                logmsg("SCSI id ", g_initiator_state.target_id, " is a tape drive");
+                scsiInitiatorStartTapeImaging();
+                return;
+            }
+            else if (readcapok)
             {
                 logmsg("SCSI id ", g_initiator_state.target_id,
                     " capacity ", (int)g_initiator_state.sectorcount,
@@ -205,6 +492,7 @@ void scsiInitiatorMainLoop()
             else
             {
                 dbgmsg("Failed to connect to SCSI id ", g_initiator_state.target_id);
+                g_initiator_state.devices_ready &= ~(1 << g_initiator_state.target_id);
                 g_initiator_state.sectorsize = 0;
                 g_initiator_state.sectorcount = g_initiator_state.sectorcount_all = 0;
             }
@@ -220,8 +508,9 @@ void scsiInitiatorMainLoop()
 
             if (g_initiator_state.sectorcount > 0)
             {
-                char filename[32] = {0};
-                strncpy(filename, filename_format, sizeof(filename) - 1);
+                char *filename = g_initiator_state.filename;
+                memset(filename, 0, sizeof(g_initiator_state.filename));
+                strncpy(filename, filename_format, sizeof(g_initiator_state.filename) - 1);
                 filename[2] += g_initiator_state.target_id;
 
                 SD.remove(filename);
@@ -232,12 +521,34 @@ void scsiInitiatorMainLoop()
                     return;
                 }
 
-                if (SD.fatType() == FAT_TYPE_EXFAT)
+                g_initiator_state.progress_file = SD.open(PROGRESSFILE, O_RDWR | O_CREAT | O_TRUNC);
+                scsiInitiatorCheckpoint();
+
+                if (ini_getbool("SCSI", "InitiatorPreallocate", 1, CONFIGFILE))
                 {
-                    // Only preallocate on exFAT, on FAT32 preallocating can result in false garbage data in the
-                    // file if write is interrupted.
+                    // Reserving a contiguous cluster chain avoids FAT updates during imaging.
+                    // If imaging is interrupted, the progress file is used on next boot to
+                    // truncate the file to the valid data.
                     logmsg("Preallocating image file");
-                    g_initiator_state.target_file.preAllocate((uint64_t)g_initiator_state.sectorcount * g_initiator_state.sectorsize);
+                    if (!g_initiator_state.target_file.preAllocate((uint64_t)g_initiator_state.sectorcount * g_initiator_state.sectorsize))
+                    {
+                        logmsg("Preallocation didn't find contiguous set of clusters, continuing anyway");
+                    }
+                }
+
+                // On FAT32 a preallocated file already has its final size in the directory entry,
+                // so data can be written directly to the SD card sectors without going through SdFat.
+                // On exFAT the valid data length must be updated by the filesystem layer.
+                g_initiator_state.raw_sector_begin = 0;
+                uint32_t sector_begin = 0, sector_end = 0;
+                uint64_t image_bytes = (uint64_t)g_initiator_state.sectorcount * g_initiator_state.sectorsize;
+                if (SD.fatType() != FAT_TYPE_EXFAT &&
+                    g_initiator_state.target_file.size() >= image_bytes &&
+                    g_initiator_state.target_file.contiguousRange(&sector_begin, &sector_end) &&
+                    (uint64_t)(sector_end - sector_begin + 1) * SD_SECTOR_SIZE >= image_bytes)
+                {
+                    dbgmsg("Image file is contiguous, writing directly to SD card sectors ", (int)sector_begin, " to ", (int)sector_end);
+                    g_initiator_state.raw_sector_begin = sector_begin;
                 }
 
                 logmsg("Starting to copy drive data to ", filename);
@@ -245,6 +556,10 @@ void scsiInitiatorMainLoop()
             }
         }
     }
+    else if (g_initiator_state.tape)
+    {
+        scsiInitiatorTapeStep();
+    }
     else
     {
         // Copy sectors from SCSI drive to file
@@ -263,6 +578,8 @@ void scsiInitiatorMainLoop()
             g_initiator_state.drives_imaged |= (1 << g_initiator_state.target_id);
             g_initiator_state.imaging = false;
             g_initiator_state.target_file.close();
+            g_initiator_state.progress_file.close();
+            SD.remove(PROGRESSFILE);
             return;
         }
 
@@ -278,9 +595,20 @@ void scsiInitiatorMainLoop()
             numtoread = 1;
 
         uint32_t time_start = millis();
+        uint32_t raw_sector = 0;
+        if (g_initiator_state.raw_sector_begin != 0 &&
+            g_initiator_state.sectorsize % SD_SECTOR_SIZE == 0)
+        {
+            uint64_t offset = (uint64_t)g_initiator_state.sectors_done * g_initiator_state.sectorsize;
+            if (offset % SD_SECTOR_SIZE == 0)
+            {
+                raw_sector = g_initiator_state.raw_sector_begin + (uint32_t)(offset / SD_SECTOR_SIZE);
+            }
+        }
+
         bool status = scsiInitiatorReadDataToFile(g_initiator_state.target_id,
             g_initiator_state.sectors_done, numtoread, g_initiator_state.sectorsize,
-            g_initiator_state.target_file);
+            g_initiator_state.target_file, raw_sector);
 
         if (!status)
         {
@@ -314,7 +642,11 @@ void scsiInitiatorMainLoop()
         {
             g_initiator_state.retrycount = 0;
             g_initiator_state.sectors_done += numtoread;
-            g_initiator_state.target_file.flush();
+
+            if ((uint32_t)(millis() - g_initiator_state.last_checkpoint) >= INITIATOR_CHECKPOINT_INTERVAL_MS)
+            {
+                scsiInitiatorCheckpoint();
+            }
 
             int speed_kbps = numtoread * g_initiator_state.sectorsize / (millis() - time_start);
             logmsg("SCSI read succeeded, sectors done: ",
@@ -334,7 +666,7 @@ int scsiInitiatorRunCommand(int target_id,
                             const uint8_t *bufOut, size_t bufOutLen,
                             bool returnDataPhase)
 {
-    if (!scsiHostPhySelect(target_id))
+    if (!scsiHostPhySelect(target_id, g_initiator_state.select_timeout_us))
     {
         dbgmsg("------ Target ", target_id, " did not respond");
         scsiHostPhyRelease();
@@ -545,6 +877,97 @@ bool scsiTestUnitReady(int target_id)
     return false;
 }
 
+// Execute REQUEST SENSE command and return the full sense data
+bool scsiRequestSenseData(int target_id, uint8_t sense[18])
+{
+    uint8_t command[6] = {0x03, 0, 0, 0, 18, 0};
+    memset(sense, 0, 18);
+
+    int status = scsiInitiatorRunCommand(target_id,
+                                         command, sizeof(command),
+                                         sense, 18,
+                                         NULL, 0);
+
+    dbgmsg("RequestSense response: ", bytearray(sense, 18));
+    return status == 0;
+}
+
+// Execute REWIND command on tape drive and wait for it to complete
+bool scsiTapeRewind(int target_id)
+{
+    // Immediate bit is used so that bus is not held during rewind
+    uint8_t command[6] = {0x01, 0x01, 0, 0, 0, 0};
+    int status = scsiInitiatorRunCommand(target_id,
+                                         command, sizeof(command),
+                                         NULL, 0,
+                                         NULL, 0);
+    if (status != 0)
+    {
+        return false;
+    }
+
+    // Rewinding a long tape can take several minutes
+    uint32_t start = millis();
+    while ((uint32_t)(millis() - start) < 600000)
+    {
+        platform_reset_watchdog();
+        delay_with_poll(500);
+
+        uint8_t tur[6] = {0x00, 0, 0, 0, 0, 0};
+        if (scsiInitiatorRunCommand(target_id, tur, sizeof(tur), NULL, 0, NULL, 0) == 0)
+        {
+            return true;
+        }
+
+        uint8_t sense_key;
+        scsiRequestSense(target_id, &sense_key);
+    }
+
+    return false;
+}
+
+// Execute READ BLOCK LIMITS command on tape drive
+bool scsiTapeReadBlockLimits(int target_id, uint32_t *maxlen, uint16_t *minlen)
+{
+    uint8_t command[6] = {0x05, 0, 0, 0, 0, 0};
+    uint8_t response[6] = {0};
+    int status = scsiInitiatorRunCommand(target_id,
+                                         command, sizeof(command),
+                                         response, sizeof(response),
+                                         NULL, 0);
+    if (status == 2)
+    {
+        uint8_t sense_key;
+        scsiRequestSense(target_id, &sense_key);
+    }
+
+    *maxlen = ((uint32_t)response[1] << 16) | ((uint32_t)response[2] << 8) | response[3];
+    *minlen = ((uint16_t)response[4] << 8) | response[5];
+    return status == 0;
+}
+
+// Set tape block size using MODE SELECT block descriptor, 0 selects variable block mode
+bool scsiTapeSetBlockSize(int target_id, uint32_t blocksize)
+{
+    uint8_t params[12] = {
+        0, 0, 0x10, 8, // Header: buffered mode, block descriptor length
+        0, 0, 0, 0, // Density code, number of blocks
+        0, (uint8_t)(blocksize >> 16), (uint8_t)(blocksize >> 8), (uint8_t)blocksize
+    };
+    uint8_t command[6] = {0x15, 0x10, 0, 0, sizeof(params), 0};
+    int status = scsiInitiatorRunCommand(target_id,
+                                         command, sizeof(command),
+                                         NULL, 0,
+                                         params, sizeof(params));
+    if (status == 2)
+    {
+        uint8_t sense_key;
+        scsiRequestSense(target_id, &sense_key);
+    }
+
+    return status == 0;
+}
+
 // This uses callbacks to run SD and SCSI transfers in parallel
 static struct {
     uint32_t bytes_sd; // Number of bytes that have been transferred on SD card side
@@ -554,8 +977,15 @@ static struct {
     
     uint32_t bytes_per_sector;
     bool all_ok;
+    bool allow_short; // Target may end the data phase early, e.g. variable length tape records
+
+    uint32_t raw_sector; // SD card sector to write to, or 0 to write through file
+    bool raw_fallback; // Transfer started with raw_sector but continued through file
 } g_initiator_transfer;
 
+static int scsiInitiatorReceiveDataToFile(uint32_t bytes, uint32_t sectorsize, FsFile &file,
+                                          uint32_t raw_sector, bool allow_short, uint32_t *bytes_received);
+
 static void initiatorReadSDCallback(uint32_t bytes_complete)
 {
     if (g_initiator_transfer.bytes_scsi_done < g_initiator_transfer.bytes_scsi)
@@ -609,7 +1039,14 @@ static void initiatorReadSDCallback(uint32_t bytes_complete)
             return;
 
         // dbgmsg("SCSI read ", (int)start, " + ", (int)len, ", sd ready cnt ", (int)sd_ready_cnt, " ", (int)bytes_complete, ", scsi done ", (int)g_initiator_transfer.bytes_scsi_done);
-        if (scsiHostRead(&scsiDev.data[start], len) != len)
+        uint32_t count = scsiHostRead(&scsiDev.data[start], len);
+        if (count != len && g_initiator_transfer.allow_short && count > 0 && !g_scsiHostPhyReset)
+        {
+            // Record was shorter than the requested length
+            g_initiator_transfer.bytes_scsi = g_initiator_transfer.bytes_scsi_done + count;
+            len = count;
+        }
+        else if (count != len)
         {
             logmsg("Read failed at byte ", (int)g_initiator_transfer.bytes_scsi_done);
             g_initiator_transfer.all_ok = false;
@@ -639,18 +1076,41 @@ static void scsiInitiatorWriteDataToSd(FsFile &file, bool use_callback)
         platform_set_sd_callback(&initiatorReadSDCallback, buf);
     }
 
+    if (g_initiator_transfer.raw_sector != 0 &&
+        (g_initiator_transfer.bytes_sd % SD_SECTOR_SIZE != 0 || len % SD_SECTOR_SIZE != 0))
+    {
+        // Partial sector, e.g. a short read. Continue rest of the transfer through
+        // the filesystem, starting from the correct position.
+        file.seek(file.curPosition() + g_initiator_transfer.bytes_sd);
+        g_initiator_transfer.raw_sector = 0;
+        g_initiator_transfer.raw_fallback = true;
+    }
+
     g_initiator_transfer.bytes_sd_scheduled = g_initiator_transfer.bytes_sd + len;
-    if (file.write(buf, len) != len)
+    if (g_initiator_transfer.raw_sector != 0)
     {
-        logmsg("scsiInitiatorReadDataToFile: SD card write failed");
-        g_initiator_transfer.all_ok = false;
+        // Write directly to the sectors of a contiguous file
+        uint32_t sector = g_initiator_transfer.raw_sector + g_initiator_transfer.bytes_sd / SD_SECTOR_SIZE;
+        if (!SD.card()->writeSectors(sector, buf, len / SD_SECTOR_SIZE))
+        {
+            logmsg("scsiInitiatorReadDataToFile: SD card write failed at sector ", (int)sector);
+            g_initiator_transfer.all_ok = false;
+        }
+    }
+    else
+    {
+        if (file.write(buf, len) != len)
+        {
+            logmsg("scsiInitiatorReadDataToFile: SD card write failed");
+            g_initiator_transfer.all_ok = false;
+        }
     }
     platform_set_sd_callback(NULL, NULL);
     g_initiator_transfer.bytes_sd += len;
 }
 
 bool scsiInitiatorReadDataToFile(int target_id, uint32_t start_sector, uint32_t sectorcount, uint32_t sectorsize,
-                                 FsFile &file)
+                                 FsFile &file, uint32_t raw_sector)
 {
     int status = -1;
 
@@ -694,14 +1154,37 @@ bool scsiInitiatorReadDataToFile(int target_id, uint32_t start_sector, uint32_t
         return false;
     }
 
+    uint32_t bytes_received;
+    status = scsiInitiatorReceiveDataToFile(sectorcount * sectorsize, sectorsize, file, raw_sector,
+                                            false, &bytes_received);
+    if (bytes_received != sectorcount * sectorsize)
+    {
+        logmsg("SCSI read from sector ", (int)start_sector, " was incomplete: expected ",
+             (int)(sectorcount * sectorsize), " got ", (int)bytes_received, " bytes");
+        return false;
+    }
+
+    return status == 0 && g_initiator_transfer.all_ok;
+}
+
+// Receive DATA IN phase of a command started with scsiInitiatorRunCommand(returnDataPhase = true).
+// SCSI bus reads and SD card writes are done in parallel using the SD callback.
+// Returns the status byte, bus is released on return.
+static int scsiInitiatorReceiveDataToFile(uint32_t bytes, uint32_t sectorsize, FsFile &file,
+                                          uint32_t raw_sector, bool allow_short, uint32_t *bytes_received)
+{
+    int status = -1;
     SCSI_PHASE phase;
 
-    g_initiator_transfer.bytes_scsi = sectorcount * sectorsize;
+    g_initiator_transfer.bytes_scsi = bytes;
     g_initiator_transfer.bytes_per_sector = sectorsize;
     g_initiator_transfer.bytes_sd = 0;
     g_initiator_transfer.bytes_sd_scheduled = 0;
     g_initiator_transfer.bytes_scsi_done = 0;
     g_initiator_transfer.all_ok = true;
+    g_initiator_transfer.allow_short = allow_short;
+    g_initiator_transfer.raw_sector = raw_sector;
+    g_initiator_transfer.raw_fallback = false;
 
     while (true)
     {
@@ -733,10 +1216,20 @@ bool scsiInitiatorReadDataToFile(int target_id, uint32_t start_sector, uint32_t
         scsiInitiatorWriteDataToSd(file, false);
     }
 
+    if (g_initiator_transfer.raw_sector != 0)
+    {
+        // Keep file position in sync with the data written directly to SD card
+        file.seek(file.curPosition() + g_initiator_transfer.bytes_sd);
+    }
+    else if (g_initiator_transfer.raw_fallback)
+    {
+        // Later transfers write directly again, don't leave dirty sectors in the cache
+        file.flush();
+    }
+
+    *bytes_received = g_initiator_transfer.bytes_sd;
     if (g_initiator_transfer.bytes_sd != g_initiator_transfer.bytes_scsi)
     {
-        logmsg("SCSI read from sector ", (int)start_sector, " was incomplete: expected ",
-             (int)g_initiator_transfer.bytes_scsi, " got ", (int)g_initiator_transfer.bytes_sd, " bytes");
         g_initiator_transfer.all_ok = false;
     }
 
@@ -765,7 +1258,285 @@ bool scsiInitiatorReadDataToFile(int target_id, uint32_t start_sector, uint32_t
 
     scsiHostPhyRelease();
 
-    return status == 0 && g_initiator_transfer.all_ok;
+    return status;
+}
+
+/*************************************
+ * Tape imaging                      *
+ *************************************/
+
+// Tapes are stored in the SIMH .tap container format. Each record is stored
+// as 32-bit little endian length, data padded to even length, and the length
+// again. A filemark is stored as zero length and end of medium as 0xFFFFFFFF.
+// Records read with errors have the top bit of the length set.
+#define TAPE_MARK_FILEMARK 0x00000000
+#define TAPE_MARK_END_OF_MEDIUM 0xFFFFFFFF
+#define TAPE_RECORD_ERROR_FLAG 0x80000000
+
+#ifndef TAPE_MAX_ERRORS
+#define TAPE_MAX_ERRORS 10
+#endif
+
+#define TAPE_PROGRESS_LOG_INTERVAL_MS 5000
+
+static bool writeTapeMarker(FsFile &file, uint32_t marker)
+{
+    uint8_t buf[4] = {(uint8_t)marker, (uint8_t)(marker >> 8), (uint8_t)(marker >> 16), (uint8_t)(marker >> 24)};
+    return file.write(buf, 4) == 4;
+}
+
+// Complete a record whose data has been written after a placeholder length at header_pos
+static bool finishTapeRecord(FsFile &file, uint64_t header_pos, uint32_t length, bool bad)
+{
+    uint32_t marker = bad ? (length | TAPE_RECORD_ERROR_FLAG) : length;
+    uint64_t end_pos = file.curPosition();
+    bool ok = file.seek(header_pos) && writeTapeMarker(file, marker) && file.seek(end_pos);
+
+    if (length & 1)
+    {
+        uint8_t pad = 0;
+        ok = ok && file.write(&pad, 1) == 1;
+    }
+
+    ok = ok && writeTapeMarker(file, marker);
+    g_initiator_state.tape_records++;
+    return ok;
+}
+
+static void scsiInitiatorStartTapeImaging()
+{
+    int target_id = g_initiator_state.target_id;
+
+    char *filename = g_initiator_state.filename;
+    memset(filename, 0, sizeof(g_initiator_state.filename));
+    strncpy(filename, "TP00_imaged.tap", sizeof(g_initiator_state.filename) - 1);
+    filename[2] += target_id;
+
+    SD.remove(filename);
+    g_initiator_state.target_file = SD.open(filename, O_RDWR | O_CREAT | O_TRUNC);
+    if (!g_initiator_state.target_file.isOpen())
+    {
+        logmsg("Failed to open file for writing: ", filename);
+        g_initiator_state.tape = false;
+        return;
+    }
+
+    g_initiator_state.sectorsize = 0;
+    g_initiator_state.sectorcount = g_initiator_state.sectorcount_all = 0;
+    g_initiator_state.tape_bytes = 0;
+    g_initiator_state.tape_records = 0;
+    g_initiator_state.tape_filemarks = 0;
+    g_initiator_state.tape_errors = 0;
+    g_initiator_state.tape_last_log = millis();
+    g_initiator_state.progress_file = SD.open(PROGRESSFILE, O_RDWR | O_CREAT | O_TRUNC);
+    scsiInitiatorCheckpoint();
+
+    if (!scsiTapeRewind(target_id))
+    {
+        logmsg("REWIND failed, imaging from current tape position");
+    }
+
+    uint32_t maxlen = 0;
+    uint16_t minlen = 0;
+    if (scsiTapeReadBlockLimits(target_id, &maxlen, &minlen) && maxlen > 0 && maxlen == minlen)
+    {
+        // Drive supports only one block size
+        g_initiator_state.tape_fixed = true;
+        g_initiator_state.tape_blocksize = maxlen;
+        logmsg("Tape uses fixed block size of ", (int)maxlen, " bytes");
+    }
+    else
+    {
+        if (maxlen == 0 || maxlen > 0xFFFFFE) maxlen = 0xFFFFFE;
+        g_initiator_state.tape_fixed = false;
+        g_initiator_state.tape_maxlen = maxlen & ~1;
+
+        if (!scsiTapeSetBlockSize(target_id, 0))
+        {
+            logmsg("Failed to select variable block mode, continuing anyway");
+        }
+        logmsg("Tape uses variable block size, maximum ", (int)g_initiator_state.tape_maxlen, " bytes");
+    }
+
+    if (g_initiator_state.tape_fixed &&
+        (g_initiator_state.tape_blocksize > sizeof(scsiDev.data) || (g_initiator_state.tape_blocksize & 1)))
+    {
+        logmsg("Unsupported fixed block size ", (int)g_initiator_state.tape_blocksize);
+        g_initiator_state.target_file.close();
+        g_initiator_state.progress_file.close();
+        SD.remove(PROGRESSFILE);
+        g_initiator_state.drives_imaged |= (1 << target_id);
+        g_initiator_state.tape = false;
+        return;
+    }
+
+    logmsg("Starting to copy tape data to ", filename);
+    g_initiator_state.imaging = true;
+}
+
+static void scsiInitiatorFinishTapeImaging()
+{
+    FsFile &file = g_initiator_state.target_file;
+    writeTapeMarker(file, TAPE_MARK_END_OF_MEDIUM);
+    file.truncate(file.curPosition());
+    file.close();
+
+    logmsg("Finished imaging tape with id ", g_initiator_state.target_id, ": ",
+           (int)g_initiator_state.tape_records, " records, ",
+           (int)g_initiator_state.tape_filemarks, " filemarks, ",
+           (int)(g_initiator_state.tape_bytes / 1024), " kB, ",
+           (int)g_initiator_state.tape_errors, " errors");
+
+    scsiTapeRewind(g_initiator_state.target_id);
+    LED_OFF();
+
+    g_initiator_state.drives_imaged |= (1 << g_initiator_state.target_id);
+    g_initiator_state.imaging = false;
+    g_initiator_state.tape = false;
+    g_initiator_state.progress_file.close();
+    SD.remove(PROGRESSFILE);
+}
+
+// Read one READ command worth of data from tape and store it to the image file.
+// Variable length records are received directly to SD card in parallel with the
+// SCSI transfer, so that the tape drive can keep streaming.
+static void scsiInitiatorTapeStep()
+{
+    int target_id = g_initiator_state.target_id;
+    FsFile &file = g_initiator_state.target_file;
+    uint64_t header_pos = file.curPosition();
+    uint32_t blocksize = g_initiator_state.tape_blocksize;
+    uint32_t received = 0;
+    bool transfer_ok = true;
+    int status;
+
+    scsiInitiatorUpdateLed();
+
+    uint8_t sense[18] = {0};
+
+    if (g_initiator_state.tape_fixed)
+    {
+        // Fixed mode: read multiple blocks to RAM, then store each as a record
+        uint32_t blocks = sizeof(scsiDev.data) / blocksize;
+        uint8_t command[6] = {0x08, 0x01,
+            (uint8_t)(blocks >> 16), (uint8_t)(blocks >> 8), (uint8_t)blocks, 0};
+
+        status = scsiInitiatorRunCommand(target_id, command, sizeof(command),
+                                         scsiDev.data, blocks * blocksize, NULL, 0);
+        if (status == 0)
+        {
+            received = blocks * blocksize;
+        }
+        else if (status == 2)
+        {
+            // Information field tells how many blocks were not transferred
+            scsiRequestSenseData(target_id, sense);
+            if (sense[0] & 0x80)
+            {
+                uint32_t residue = ((uint32_t)sense[3] << 24) | ((uint32_t)sense[4] << 16) |
+                                   ((uint32_t)sense[5] << 8) | sense[6];
+                if (residue < blocks) received = (blocks - residue) * blocksize;
+            }
+        }
+
+        for (uint32_t pos = 0; pos < received && transfer_ok; pos += blocksize)
+        {
+            transfer_ok = writeTapeMarker(file, blocksize) &&
+                          file.write(&scsiDev.data[pos], blocksize) == blocksize &&
+                          writeTapeMarker(file, blocksize);
+            g_initiator_state.tape_records++;
+        }
+    }
+    else
+    {
+        // Variable mode: one record per command, SILI bit suppresses errors for short records
+        uint32_t maxlen = g_initiator_state.tape_maxlen;
+        uint8_t command[6] = {0x08, 0x02,
+            (uint8_t)(maxlen >> 16), (uint8_t)(maxlen >> 8), (uint8_t)maxlen, 0};
+
+        transfer_ok = writeTapeMarker(file, 0);
+        status = scsiInitiatorRunCommand(target_id, command, sizeof(command),
+                                         NULL, 0, NULL, 0, true);
+        if (status == 0)
+        {
+            status = scsiInitiatorReceiveDataToFile(maxlen, SD_SECTOR_SIZE, file, 0, true, &received);
+            transfer_ok = transfer_ok && g_initiator_transfer.all_ok;
+        }
+
+        if (status == 2)
+        {
+            scsiRequestSenseData(target_id, sense);
+        }
+
+        if (received > 0)
+        {
+            // Keep partially read records, but flag them as bad in the image
+            uint8_t key = sense[2] & 0x0F;
+            bool bad = !transfer_ok || status < 0 || (status == 2 && key != 0 && key != 8);
+            transfer_ok = finishTapeRecord(file, header_pos, received, bad) && transfer_ok;
+        }
+        else
+        {
+            // Remove placeholder length
+            file.seek(header_pos);
+        }
+    }
+
+    uint8_t sense_key = sense[2] & 0x0F;
+    bool filemark = sense[2] & 0x80;
+    bool eom = sense[2] & 0x40;
+    bool ili = sense[2] & 0x20;
+
+    if (ili && !g_initiator_state.tape_fixed)
+    {
+        logmsg("WARNING: Tape record ", (int)g_initiator_state.tape_records,
+               " was longer than maximum length ", (int)g_initiator_state.tape_maxlen, " and was truncated");
+    }
+
+    if (filemark)
+    {
+        writeTapeMarker(file, TAPE_MARK_FILEMARK);
+        g_initiator_state.tape_filemarks++;
+        logmsg("Tape filemark ", (int)g_initiator_state.tape_filemarks, " after ",
+               (int)g_initiator_state.tape_records, " records");
+    }
+
+    if (!transfer_ok || status < 0 || (status == 2 && sense_key != 0 && sense_key != 8))
+    {
+        g_initiator_state.tape_errors++;
+        logmsg("Tape read failed after record ", (int)g_initiator_state.tape_records,
+               ", status ", status, " sense key ", sense_key,
+               " asc ", sense[12], " ascq ", sense[13]);
+    }
+    else
+    {
+        g_initiator_state.tape_bytes = file.curPosition();
+    }
+
+    if (sense_key == 8 || eom || g_initiator_state.tape_errors > TAPE_MAX_ERRORS)
+    {
+        // BLANK CHECK: end of recorded data
+        if (g_initiator_state.tape_errors > TAPE_MAX_ERRORS)
+        {
+            logmsg("Too many tape read errors, stopping");
+        }
+
+        file.seek(g_initiator_state.tape_bytes);
+        scsiInitiatorFinishTapeImaging();
+        return;
+    }
+
+    if ((uint32_t)(millis() - g_initiator_state.last_checkpoint) >= INITIATOR_CHECKPOINT_INTERVAL_MS)
+    {
+        scsiInitiatorCheckpoint();
+    }
+
+    if ((uint32_t)(millis() - g_initiator_state.tape_last_log) >= TAPE_PROGRESS_LOG_INTERVAL_MS)
+    {
+        g_initiator_state.tape_last_log = millis();
+        logmsg("Tape imaging: ", (int)g_initiator_state.tape_records, " records, ",
+               (int)(g_initiator_state.tape_bytes / 1024), " kB done");
+    }
 }
 
 
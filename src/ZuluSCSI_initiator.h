@@ -52,7 +52,21 @@ bool scsiInquiry(int target_id, uint8_t inquiry_data[36]);
 // Execute TEST UNIT READY command and handle unit attention state
 bool scsiTestUnitReady(int target_id);
 
-// Read a block of data from SCSI device and write to file on SD card
+// Execute REQUEST SENSE command and return the full sense data
+bool scsiRequestSenseData(int target_id, uint8_t sense[18]);
+
+// Execute REWIND command on tape drive and wait for it to complete
+bool scsiTapeRewind(int target_id);
+
+// Execute READ BLOCK LIMITS command on tape drive
+bool scsiTapeReadBlockLimits(int target_id, uint32_t *maxlen, uint16_t *minlen);
+
+// Set tape block size using MODE SELECT block descriptor, 0 selects variable block mode
+bool scsiTapeSetBlockSize(int target_id, uint32_t blocksize);
+
+// Read a block of data from SCSI device and write to file on SD card.
+// If raw_sector is nonzero, the file must be contiguous and preallocated and the data is
+// written directly to SD card starting at that sector. File position is advanced in either case.
 class FsFile;
 bool scsiInitiatorReadDataToFile(int target_id, uint32_t start_sector, uint32_t sectorcount, uint32_t sectorsize,
-                                 FsFile &file);
+                                 FsFile &file, uint32_t raw_sector = 0);
@@ -0,0 +1,134 @@
+/**
+ * ZuluSCSI™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluSCSI™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#include "ZuluSCSI_msc.h"
+#include "ZuluSCSI_config.h"
+#include "ZuluSCSI_log.h"
+#include <ZuluSCSI_platform.h>
+#include <minIni.h>
+#include <SdFat.h>
+
+#ifndef PLATFORM_HAS_USB_MSC
+
+bool zuluscsi_msc_run()
+{
+    return false;
+}
+
+#else
+
+#include "usb_msc.h"
+#include <USBMassStorage.h>
+
+extern "C" {
+#include <scsi.h>
+}
+
+extern SdFs SD;
+
+// Raw access to the whole SD card, bypassing the filesystem
+class SDCardStorage: public MSCStorage
+{
+public:
+    bool ready()
+    {
+        return SD.card() != NULL && SD.sdErrorCode() == 0;
+    }
+
+    uint32_t sectorCount()
+    {
+        return SD.card()->sectorCount();
+    }
+
+    bool readSectors(uint32_t lba, uint8_t *dst, uint32_t count)
+    {
+        return SD.card()->readSectors(lba, dst, count);
+    }
+
+    bool writeSectors(uint32_t lba, const uint8_t *src, uint32_t count)
+    {
+        return SD.card()->writeSectors(lba, src, count);
+    }
+
+    bool sync()
+    {
+        return SD.card()->syncDevice();
+    }
+};
+
+bool zuluscsi_msc_run()
+{
+    if (!ini_getbool("SCSI", "USBMassStorage", false, CONFIGFILE))
+    {
+        return false;
+    }
+
+    // Give host time to enumerate the device with the added interface
+    usb_msc_enable();
+    int wait_ms = ini_getl("SCSI", "USBMassStorageWait", 2000, CONFIGFILE);
+    uint32_t start = millis();
+    while (!usb_msc_host_connected() && (uint32_t)(millis() - start) < (uint32_t)wait_ms)
+    {
+        platform_reset_watchdog();
+        platform_poll();
+    }
+
+    if (!usb_msc_host_connected())
+    {
+        logmsg("USB mass storage mode enabled but no USB host connected, continuing to SCSI mode");
+        return false;
+    }
+
+    logmsg("USB mass storage mode: SD card is accessible over USB, eject it on the host to start SCSI mode");
+
+    // SCSI is not active, so its transfer buffer is free for use
+    SDCardStorage storage;
+    uint64_t start_read = usb_msc_bytes_read();
+    uint64_t start_written = usb_msc_bytes_written();
+    usb_msc_start(&storage, scsiDev.data, sizeof(scsiDev.data));
+
+    while (usb_msc_host_connected() && !usb_msc_ejected())
+    {
+        platform_reset_watchdog();
+        platform_poll();
+
+        if (usb_msc_busy())
+        {
+            LED_ON();
+        }
+        else
+        {
+            LED_OFF();
+        }
+    }
+
+    bool ejected = usb_msc_ejected();
+    usb_msc_stop();
+    storage.sync();
+    LED_OFF();
+
+    logmsg("USB mass storage mode ended by ", ejected ? "eject" : "disconnect",
+           ", read ", (int)((usb_msc_bytes_read() - start_read) / 1024), " kB",
+           ", written ", (int)((usb_msc_bytes_written() - start_written) / 1024), " kB");
+    return true;
+}
+
+#endif
@@ -29,6 +29,7 @@ import os
 import mmap
 import random
 import time
+from speed_tester import percentile
 
 class BlockDevice:
     def __init__(self, path, sectorsize = 512):
@@ -41,22 +42,23 @@ class BlockDevice:
         buffer = mmap.mmap(-1, sector_count * self.sectorsize)
         buffer.write(rnd.randbytes(sector_count * self.sectorsize))
         
-        start = time.time()
+        start = time.perf_counter()
         self.dev.seek(first_sector * self.sectorsize)
         self.dev.write(buffer)
-        elapsed = time.time() - start
+        elapsed = time.perf_counter() - start
         speed = sector_count * self.sectorsize / elapsed / 1e6
 
         print("Wrote  %16s, %8d, %8d, %8d, %8.3f MB/s" % (self.path, first_sector, sector_count, seed, speed))
+        return elapsed
 
     def verify_block(self, first_sector, sector_count, seed):
         rnd = random.Random(seed)
         buffer = mmap.mmap(-1, sector_count * self.sectorsize)
 
-        start = time.time()
+        start = time.perf_counter()
         self.dev.seek(first_sector * self.sectorsize)
         self.dev.readinto(buffer)
-        elapsed = time.time() - start
+        elapsed = time.perf_counter() - start
         speed = sector_count * self.sectorsize / elapsed / 1e6
 
         print("Verify %16s, %8d, %8d, %8d, %8.3f MB/s" % (self.path, first_sector, sector_count, seed, speed))
@@ -73,6 +75,13 @@ class BlockDevice:
             print("Saved data to %s.expected/actual" % fname)
             raise Exception("Compare error")
 
+        return elapsed
+
+def print_latency(name, latencies):
+    print("%s latency: p50 %.3f ms, p99 %.3f ms, p99.9 %.3f ms, max %.3f ms" % (name,
+        percentile(latencies, 50) * 1000, percentile(latencies, 99) * 1000,
+        percentile(latencies, 99.9) * 1000, max(latencies) * 1000))
+
 if __name__ == "__main__":
     blockdevs = []
     for path in sys.argv[1:]:
@@ -98,11 +107,16 @@ if __name__ == "__main__":
         print("Write / verify set size: %d" % len(blocks))
 
         random.shuffle(blocks)
+        write_latencies = []
         for dev, start, count, seed in blocks:
-            dev.write_block(start, count, seed)
+            write_latencies.append(dev.write_block(start, count, seed))
         
         random.shuffle(blocks)
+        read_latencies = []
         for dev, start, count, seed in blocks:
-            dev.verify_block(start, count, seed)
+            read_latencies.append(dev.verify_block(start, count, seed))
+
+        print_latency("Write", write_latencies)
+        print_latency("Verify", read_latencies)
 
 
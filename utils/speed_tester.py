@@ -21,52 +21,101 @@
   along with this program.  If not, see <https://www.gnu.org/licenses/>.
 '''
 
-'''This script executes random-sized reads and writes to one or more block devices to test them.
-It will destroy the contents of the block device.'''
+'''Storage benchmark for ZuluSCSI and other block devices.
 
+Runs block size and access pattern sweeps and reports throughput together
+with p50 / p99 / p99.9 latency of individual requests. Results can be saved
+as JSON or CSV and compared against an earlier saved JSON baseline.
 
+Write tests will destroy the contents of the block device.
+
+Examples:
+    utils/speed_tester.py /dev/sdX
+    utils/speed_tester.py /dev/sdX --patterns seqread,randread --json result.json
+    utils/speed_tester.py /dev/sdX --baseline previous.json --tolerance 10
+    utils/speed_tester.py --selftest   # Run against a Linux loop device
+'''
 
 import sys
 import os
 import mmap
 import random
 import time
+import json
+import csv
+import argparse
+import tempfile
+import subprocess
+import threading
+
+PATTERNS = {
+    # name: (sequential, write fraction)
+    'seqread': (True, 0.0),
+    'seqwrite': (True, 1.0),
+    'randread': (False, 0.0),
+    'randwrite': (False, 1.0),
+    'mixed': (False, 0.3),
+}
+
+DEFAULT_BLOCK_SIZES = [512 * 2**i for i in range(12)]
+
+def percentile(values, pct):
+    '''Nearest-rank percentile of a list of values'''
+    if not values:
+        return 0.0
+    values = sorted(values)
+    rank = max(0, min(len(values) - 1, int(len(values) * pct / 100.0 + 0.5) - 1))
+    return values[rank]
 
 class BlockDevice:
     def __init__(self, path, sectorsize = 512):
         self.path = path
         self.dev = os.fdopen(os.open(path, os.O_RDWR | os.O_DIRECT | os.O_SYNC), "rb+", 0)
         self.sectorsize = sectorsize
+        self.dev.seek(0, os.SEEK_END)
+        self.sectorcount = self.dev.tell() // sectorsize
+
+    def reopen(self):
+        '''Separate file handle for each worker thread'''
+        return BlockDevice(self.path, self.sectorsize)
+
+    def pattern(self, first_sector, sector_count, seed):
+        '''Test data depends only on seed and sector number, so overlapping requests agree'''
+        return b''.join(random.Random(seed * 2**32 + first_sector + i).randbytes(self.sectorsize)
+                        for i in range(sector_count))
 
-    def write_block(self, first_sector, sector_count, seed):
-        rnd = random.Random(seed)
+    def write_block(self, first_sector, sector_count, seed, quiet = False):
         buffer = mmap.mmap(-1, sector_count * self.sectorsize)
-        buffer.write(rnd.randbytes(sector_count * self.sectorsize))
+        buffer.write(self.pattern(first_sector, sector_count, seed))
         
-        start = time.time()
+        start = time.perf_counter()
         self.dev.seek(first_sector * self.sectorsize)
         self.dev.write(buffer)
-        elapsed = time.time() - start
+        elapsed = time.perf_counter() - start
         speed = sector_count * self.sectorsize / elapsed / 1e6
 
-        print("Wrote  %16s, %8d, %8d, %8d, %8.3f MB/s" % (self.path, first_sector, sector_count, seed, speed))
-        return speed
+        if not quiet:
+            print("Wrote  %16s, %8d, %8d, %8d, %8.3f MB/s" % (self.path, first_sector, sector_count, seed, speed))
+        return elapsed
 
-    def verify_block(self, first_sector, sector_count, seed):
-        rnd = random.Random(seed)
+    def verify_block(self, first_sector, sector_count, seed, quiet = False, verify = True):
         buffer = mmap.mmap(-1, sector_count * self.sectorsize)
 
-        start = time.time()
+        start = time.perf_counter()
         self.dev.seek(first_sector * self.sectorsize)
         self.dev.readinto(buffer)
-        elapsed = time.time() - start
+        elapsed = time.perf_counter() - start
         speed = sector_count * self.sectorsize / elapsed / 1e6
 
-        print("Verify %16s, %8d, %8d, %8d, %8.3f MB/s" % (self.path, first_sector, sector_count, seed, speed))
+        if not quiet:
+            print("Verify %16s, %8d, %8d, %8d, %8.3f MB/s" % (self.path, first_sector, sector_count, seed, speed))
+
+        if not verify:
+            return elapsed
 
         buffer.seek(0)
         actual = buffer.read(sector_count * self.sectorsize)
-        expected = rnd.randbytes(sector_count * self.sectorsize)
+        expected = self.pattern(first_sector, sector_count, seed)
         if expected != actual:
             print("Compare error, device = %s, sectorsize = %d, first_sector = %d, sector_count = %d, seed = %d"
                 % (self.path, self.sectorsize, first_sector, sector_count, seed))
@@ -76,33 +125,175 @@ class BlockDevice:
             print("Saved data to %s.expected/actual" % fname)
             raise Exception("Compare error")
         
-        return speed
+        return elapsed
 
-if __name__ == "__main__":
-    blockdev = BlockDevice(sys.argv[1])
-    
-    seed = 1
-    
-    results = '# ReqSize(B)  RdSpeed(MB/s)  WrSpeed(MB/s)\n'
-    for i in range(12):
-        seed += 1
-        seccount = 2**i
-        wr_speeds = []
-        rd_speeds = []
-        samplecount = 8
-        for i in range(samplecount):
-            wr_speeds.append(blockdev.write_block(0, seccount, seed))
-            time.sleep(0.2)
-            rd_speeds.append(blockdev.verify_block(0, seccount, seed))
-            time.sleep(0.2)
-
-        # Get median
-        wr_speeds.sort()
-        rd_speeds.sort()
-        wr_speed = wr_speeds[samplecount//2]
-        rd_speed = rd_speeds[samplecount//2]
-        
-        results += '%8d %8.3f %8.3f\n' % (seccount * 512, rd_speed, wr_speed)
-    
-    print(results)
+def run_test(blockdev, pattern, blocksize, queue_depth, args):
+    '''Run one pattern / block size / queue depth combination, returns result dictionary'''
+    sequential, write_fraction = PATTERNS[pattern]
+    seccount = blocksize // blockdev.sectorsize
+    span = min(args.span, blockdev.sectorcount) - seccount
+    if span < 0:
+        raise Exception("Device is too small for block size %d" % blocksize)
+
+    # Random requests start at any sector in the span, sequential ones wrap around at its end.
+    nblocks = min(args.count, span // seccount + 1)
+    ops = []
+    rnd = random.Random(args.seed)
+    for i in range(args.count):
+        pos = (i % nblocks) * seccount if sequential else rnd.randint(0, span)
+        is_write = rnd.random() < write_fraction
+        ops.append((pos, is_write))
+
+    # Reads are verified against known data, so fill the areas they access first.
+    for pos in sorted(set(pos for pos, is_write in ops if not is_write)):
+        blockdev.write_block(pos, seccount, args.seed, quiet = True)
+
+    latencies = []
+    lock = threading.Lock()
 
+    def worker(dev, my_ops):
+        local = []
+        for pos, is_write in my_ops:
+            if is_write:
+                local.append(dev.write_block(pos, seccount, args.seed, quiet = True))
+            else:
+                local.append(dev.verify_block(pos, seccount, args.seed, quiet = True, verify = args.verify))
+        with lock:
+            latencies.extend(local)
+
+    # Queue depth is emulated with parallel threads, each with its own handle.
+    # Sequential patterns give each thread a contiguous slice to keep the order.
+    depth = max(1, queue_depth)
+    if sequential:
+        chunk = (len(ops) + depth - 1) // depth
+        slices = [ops[i * chunk:(i + 1) * chunk] for i in range(depth)]
+    else:
+        slices = [ops[i::depth] for i in range(depth)]
+
+    devs = [blockdev] + [blockdev.reopen() for i in range(depth - 1)]
+    threads = [threading.Thread(target = worker, args = (devs[i], slices[i])) for i in range(depth)]
+    start = time.perf_counter()
+    for t in threads: t.start()
+    for t in threads: t.join()
+    elapsed = time.perf_counter() - start
+
+    return {
+        'pattern': pattern,
+        'blocksize': blocksize,
+        'queue_depth': depth,
+        'ops': len(latencies),
+        'mbps': len(latencies) * blocksize / elapsed / 1e6,
+        'iops': len(latencies) / elapsed,
+        'lat_avg_ms': sum(latencies) / len(latencies) * 1000,
+        'lat_p50_ms': percentile(latencies, 50) * 1000,
+        'lat_p99_ms': percentile(latencies, 99) * 1000,
+        'lat_p999_ms': percentile(latencies, 99.9) * 1000,
+        'lat_max_ms': max(latencies) * 1000,
+    }
+
+def compare_baseline(results, baseline, tolerance):
+    '''Compare throughput and p99 latency against baseline, returns number of regressions and compared rows'''
+    old = {(r['pattern'], r['blocksize'], r['queue_depth']): r for r in baseline['results']}
+    regressions = 0
+    compared = 0
+    print('# Comparison against baseline, tolerance %.1f %%' % tolerance)
+    for r in results:
+        b = old.get((r['pattern'], r['blocksize'], r['queue_depth']))
+        if b is None:
+            print('%-10s %8d %4d  no baseline' % (r['pattern'], r['blocksize'], r['queue_depth']))
+            continue
+        compared += 1
+        mbps_change = (r['mbps'] / b['mbps'] - 1) * 100 if b['mbps'] else 0
+        p99_change = (r['lat_p99_ms'] / b['lat_p99_ms'] - 1) * 100 if b['lat_p99_ms'] else 0
+        status = 'ok'
+        if mbps_change < -tolerance or p99_change > tolerance:
+            status = 'REGRESSION'
+            regressions += 1
+        print('%-10s %8d %4d  %+7.1f %% MB/s  %+7.1f %% p99  %s' % (r['pattern'], r['blocksize'], r['queue_depth'],
+              mbps_change, p99_change, status))
+    return regressions, compared
+
+def create_loop_device(size_mb):
+    '''Create a temporary image file and attach it as loop device if possible'''
+    fd, path = tempfile.mkstemp(prefix = 'zulu_bench_', suffix = '.img', dir = '/var/tmp')
+    os.ftruncate(fd, size_mb * 1024 * 1024)
+    os.close(fd)
+    try:
+        loopdev = subprocess.check_output(['losetup', '--find', '--show', path],
+                                          stderr = subprocess.DEVNULL).decode().strip()
+        return loopdev, path
+    except (OSError, subprocess.CalledProcessError):
+        print("losetup not available, using image file directly")
+        return None, path
+
+def main():
+    parser = argparse.ArgumentParser(description = "Block device benchmark, write tests destroy device contents")
+    parser.add_argument('device', nargs = '?', help = "Block device, e.g. /dev/sdX")
+    parser.add_argument('--sectorsize', type = int, default = 512)
+    parser.add_argument('--blocksizes', default = ','.join(str(x) for x in DEFAULT_BLOCK_SIZES),
+                        help = "Comma separated list of request sizes in bytes")
+    parser.add_argument('--patterns', default = 'seqwrite,seqread',
+                        help = "Comma separated list of: " + ', '.join(PATTERNS.keys()))
+    parser.add_argument('--queue-depth', default = '1',
+                        help = "Comma separated list of parallel request counts")
+    parser.add_argument('--count', type = int, default = 32, help = "Number of requests per test")
+    parser.add_argument('--span', type = int, default = 1 << 21, help = "Range of sectors to use for random access")
+    parser.add_argument('--seed', type = int, default = 1)
+    parser.add_argument('--no-verify', dest = 'verify', action = 'store_false', help = "Don't compare read data")
+    parser.add_argument('--json', help = "Save results as JSON")
+    parser.add_argument('--csv', help = "Save results as CSV")
+    parser.add_argument('--baseline', help = "Compare against results saved earlier with --json")
+    parser.add_argument('--tolerance', type = float, default = 10.0, help = "Allowed regression in percent")
+    parser.add_argument('--selftest', action = 'store_true', help = "Run against a temporary loop device")
+    args = parser.parse_args()
+
+    loopdev = imagefile = None
+    if args.selftest:
+        loopdev, imagefile = create_loop_device(64)
+        args.device = loopdev or imagefile
+        args.count = min(args.count, 16)
+    elif not args.device:
+        parser.error("device is required")
+
+    try:
+        blockdev = BlockDevice(args.device, args.sectorsize)
+        results = []
+        print('# Pattern     ReqSize(B)   QD    MB/s     IOPS   p50(ms)   p99(ms) p99.9(ms)')
+        for pattern in args.patterns.split(','):
+            if pattern not in PATTERNS:
+                parser.error("Unknown pattern: " + pattern)
+            for blocksize in [int(x) for x in args.blocksizes.split(',')]:
+                for depth in [int(x) for x in args.queue_depth.split(',')]:
+                    r = run_test(blockdev, pattern, blocksize, depth, args)
+                    results.append(r)
+                    print('%-10s %12d %4d %8.3f %8.1f %9.3f %9.3f %9.3f' % (r['pattern'], r['blocksize'],
+                          r['queue_depth'], r['mbps'], r['iops'], r['lat_p50_ms'], r['lat_p99_ms'], r['lat_p999_ms']))
+    finally:
+        if loopdev:
+            subprocess.call(['losetup', '--detach', loopdev])
+        if imagefile:
+            os.remove(imagefile)
+
+    output = {'device': args.device, 'time': time.strftime('%Y-%m-%dT%H:%M:%S'), 'results': results}
+    if args.json:
+        with open(args.json, 'w') as f:
+            json.dump(output, f, indent = 2)
+
+    if args.csv:
+        with open(args.csv, 'w', newline = '') as f:
+            writer = csv.DictWriter(f, fieldnames = list(results[0].keys()))
+            writer.writeheader()
+            writer.writerows(results)
+
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+        regressions, compared = compare_baseline(results, baseline, args.tolerance)
+        if compared == 0:
+            print("No results matched the baseline, check patterns, block sizes and queue depths")
+            sys.exit(1)
+        if regressions > 0:
+            sys.exit(1)
+
+if __name__ == "__main__":
+    main()
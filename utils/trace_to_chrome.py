@@ -0,0 +1,142 @@
+#!/usr/bin/python3
+
+'''
+  ZuluSCSI™ - Copyright (c) 2023 Rabbit Hole Computing™
+  
+  ZuluSCSI™ file is licensed under the GPL version 3 or any later version. 
+  
+  https://www.gnu.org/licenses/gpl-3.0.html
+  ----
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version. 
+  
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details. 
+  
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+'''
+
+'''This script converts the zulutrc.bin file written by the cycle tracer
+to Chrome trace JSON format. The result can be opened in chrome://tracing
+or https://ui.perfetto.dev/
+
+Usage: utils/trace_to_chrome.py zulutrc.bin > trace.json
+
+The firmware must be built with -DCYCLE_TRACE_EVENTS=1024 or similar.
+'''
+
+import sys
+import struct
+import json
+
+# Must match cycletrace_event_t in src/ZuluSCSI_cycletrace.h
+TRACE_PHASE = 1
+TRACE_SD_READ_START = 2
+TRACE_SD_READ_END = 3
+TRACE_SD_WRITE_START = 4
+TRACE_SD_WRITE_END = 5
+TRACE_SCSI_WRITE_DONE = 6
+TRACE_SCSI_READ_DONE = 7
+TRACE_SD_CALLBACK = 8
+TRACE_LOST = 9
+
+# Must match SCSI_PHASE in lib/SCSI2SD/src/firmware/scsi.h
+PHASE_NAMES = {
+    -1: "BUS_FREE",
+    -2: "BUS_BUSY",
+    -3: "ARBITRATION",
+    -4: "SELECTION",
+    -5: "RESELECTION",
+    0: "DATA_OUT",
+    2: "COMMAND",
+    4: "DATA_IN",
+    6: "STATUS",
+    7: "MESSAGE_IN",
+    3: "MESSAGE_OUT",
+}
+
+# Thread ids used to separate the tracks in viewer
+TID_SCSI = 1
+TID_SD = 2
+TID_EVENTS = 3
+
+def read_records(f):
+    header = f.read(16)
+    magic, version, cycles_per_us, record_size = struct.unpack("<4sIII", header)
+    if magic != b"ZTRC" or version != 1:
+        raise ValueError("Not a ZuluSCSI trace file")
+
+    while True:
+        data = f.read(record_size)
+        if len(data) < record_size:
+            break
+        yield cycles_per_us, struct.unpack("<IBbHI", data[:12])
+
+def convert(f):
+    events = [
+        {"name": "thread_name", "ph": "M", "pid": 0, "tid": TID_SCSI, "args": {"name": "SCSI bus"}},
+        {"name": "thread_name", "ph": "M", "pid": 0, "tid": TID_SD, "args": {"name": "SD card"}},
+        {"name": "thread_name", "ph": "M", "pid": 0, "tid": TID_EVENTS, "args": {"name": "Events"}},
+    ]
+
+    # Extend 32-bit counter to 64 bits
+    prev_stamp = None
+    time = 0
+    phase_start = None
+    phase_name = None
+    phase_cmd = 0
+    sd_start = {}
+
+    for cycles_per_us, (stamp, type, arg8, reserved, arg) in read_records(f):
+        if prev_stamp is not None and type != TRACE_LOST:
+            # Time across lost events is unknown, so it is left out
+            time += (stamp - prev_stamp) & 0xFFFFFFFF
+        prev_stamp = stamp
+        us = time / cycles_per_us
+
+        if type == TRACE_PHASE:
+            if phase_start is not None:
+                events.append({"name": phase_name, "ph": "X", "pid": 0, "tid": TID_SCSI,
+                               "ts": phase_start, "dur": us - phase_start,
+                               "args": {"opcode": "0x%02X" % phase_cmd}})
+            phase_start = us
+            phase_name = PHASE_NAMES.get(arg8, "PHASE %d" % arg8)
+            phase_cmd = arg
+        elif type in (TRACE_SD_READ_START, TRACE_SD_WRITE_START):
+            sd_start[type] = (us, arg)
+        elif type in (TRACE_SD_READ_END, TRACE_SD_WRITE_END):
+            start = sd_start.pop(type - 1, None)
+            if start is not None:
+                name = "SD read" if type == TRACE_SD_READ_END else "SD write"
+                events.append({"name": name, "ph": "X", "pid": 0, "tid": TID_SD,
+                               "ts": start[0], "dur": us - start[0],
+                               "args": {"bytes": start[1]}})
+        elif type == TRACE_SCSI_WRITE_DONE:
+            events.append({"name": "SCSI write done", "ph": "i", "s": "t", "pid": 0,
+                           "tid": TID_EVENTS, "ts": us})
+        elif type == TRACE_SCSI_READ_DONE:
+            events.append({"name": "SCSI read done", "ph": "i", "s": "t", "pid": 0,
+                           "tid": TID_EVENTS, "ts": us, "args": {"bytes": arg}})
+        elif type == TRACE_SD_CALLBACK:
+            events.append({"name": "SD callback " + ("write" if arg8 else "read"), "ph": "i", "s": "t",
+                           "pid": 0, "tid": TID_EVENTS, "ts": us, "args": {"bytes_complete": arg}})
+        elif type == TRACE_LOST:
+            events.append({"name": "%d events lost" % arg, "ph": "i", "s": "g", "pid": 0,
+                           "tid": TID_EVENTS, "ts": us})
+            phase_start = None
+            sd_start = {}
+
+    return {"traceEvents": events, "displayTimeUnit": "ns"}
+
+if __name__ == '__main__':
+    if len(sys.argv) != 2:
+        print("Usage: " + sys.argv[0] + " zulutrc.bin > trace.json", file=sys.stderr)
+        sys.exit(1)
+
+    with open(sys.argv[1], "rb") as f:
+        json.dump(convert(f), sys.stdout)